@@ -0,0 +1,24 @@
+# - Try to find libdeflate
+#
+# Defines the following variables:
+#
+# LIBDEFLATE_FOUND - system has libdeflate
+# LIBDEFLATE_INCLUDE_DIR - the libdeflate include directory
+# LIBDEFLATE_LIBRARIES - Link these to use libdeflate
+
+# Find the header and library
+FIND_PATH(LIBDEFLATE_INCLUDE_DIR NAMES libdeflate.h)
+FIND_LIBRARY(LIBDEFLATE_LIBRARY NAMES deflate libdeflate)
+
+# Handle the QUIETLY and REQUIRED arguments and set LIBDEFLATE_FOUND
+# to TRUE if all listed variables are TRUE
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Libdeflate REQUIRED_VARS LIBDEFLATE_INCLUDE_DIR LIBDEFLATE_LIBRARY)
+
+# Hide advanced variables
+MARK_AS_ADVANCED(LIBDEFLATE_INCLUDE_DIR LIBDEFLATE_LIBRARY)
+
+# Set standard variables
+IF (LIBDEFLATE_FOUND)
+	SET(LIBDEFLATE_LIBRARIES ${LIBDEFLATE_LIBRARY})
+ENDIF()
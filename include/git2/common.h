@@ -136,9 +136,29 @@ typedef enum {
 	GIT_OPT_ENABLE_CACHING,
 	GIT_OPT_GET_CACHED_MEMORY,
 	GIT_OPT_GET_TEMPLATE_PATH,
-	GIT_OPT_SET_TEMPLATE_PATH
+	GIT_OPT_SET_TEMPLATE_PATH,
+	GIT_OPT_SET_CACHE_EVICTION,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_GET_DELTA_BASE_CACHE_LIMIT,
+	GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT,
+	GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+	GIT_OPT_ENABLE_INDEXER_PIPELINE,
+	GIT_OPT_ENABLE_WHOLE_PACK_MMAP
 } git_libgit2_opt_t;
 
+/**
+ * How objects are picked for eviction once the object cache is full
+ *
+ * - GIT_CACHE_EVICT_RANDOM evicts objects at random.
+ * - GIT_CACHE_EVICT_CLOCK gives a second chance to the objects that have
+ *   been looked up again since they were cached, so that objects that are
+ *   used only once are evicted first.  This is the default.
+ */
+typedef enum {
+	GIT_CACHE_EVICT_RANDOM = 0,
+	GIT_CACHE_EVICT_CLOCK = 1
+} git_cache_eviction_t;
+
 /**
  * Set or query a library global option
  *
@@ -221,6 +241,57 @@ typedef enum {
  *		>
  *		> - `path` directory of template.
  *
+ *	* opts(GIT_OPT_SET_CACHE_EVICTION, git_cache_eviction_t policy)
+ *
+ *		> Set how objects are picked for eviction when the cache is over
+ *		> its maximum size.  Defaults to GIT_CACHE_EVICT_CLOCK.
+ *
+ *	* opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of cache lookups that found an object, the
+ *		> number of them that did not, and the number of objects that
+ *		> have been evicted, across all repositories since the library
+ *		> was loaded.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_BASE_CACHE_LIMIT, size_t *):
+ *
+ *		> Get the maximum memory used to cache the bases of deltas
+ *
+ *	* opts(GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT, size_t):
+ *
+ *		> Set the maximum memory used to cache the bases of deltas that
+ *		> were read from packfiles.  The cache is shared by all the packs
+ *		> that are open, and the least recently used bases are evicted
+ *		> first.  The default is 96MB.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, size_t *memory_used,
+ *		size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the memory currently used by the delta base cache, the
+ *		> number of delta bases that were found in it and that were not,
+ *		> and the number of bases that have been evicted from it.
+ *
+ *	* opts(GIT_OPT_ENABLE_INDEXER_PIPELINE, int enabled)
+ *
+ *		> Enable or disable pipelined indexing of packfiles.  When it is
+ *		> enabled, the indexers created afterwards (including the ones
+ *		> used to fetch) only write the data to disk when it is appended,
+ *		> and the objects are hashed and inflated on a thread of their
+ *		> own, so that receiving the pack is not held back by it.  This
+ *		> requires libgit2 to be built with threads; enabling it fails
+ *		> otherwise.  It is disabled by default.
+ *
+ *	* opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, int enabled)
+ *
+ *		> Enable or disable mapping packfiles whole.  When it is enabled,
+ *		> each packfile is mapped in its entirety the first time it is
+ *		> read and stays mapped until it is closed, instead of going
+ *		> through windows of `GIT_OPT_SET_MWINDOW_SIZE` bytes, so that
+ *		> reading from it needs no locking.  These mappings don't count
+ *		> towards `GIT_OPT_SET_MWINDOW_MAPPED_LIMIT`.  This is only
+ *		> available on 64-bit platforms, where address space is
+ *		> plentiful, and is disabled by default.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
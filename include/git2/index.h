@@ -123,6 +123,10 @@ typedef struct git_index_entry {
 #define GIT_IDXENTRY_UNPACKED          (1 << 8)
 #define GIT_IDXENTRY_NEW_SKIP_WORKTREE (1 << 9)
 
+/* unchanged in the working directory since the filesystem monitor's
+ * last report, so it needs no `stat` */
+#define GIT_IDXENTRY_FSMONITOR_VALID   (1 << 10)
+
 /** Capabilities of system that affect index actions. */
 typedef enum {
 	GIT_INDEXCAP_IGNORE_CASE = 1,
@@ -226,6 +230,53 @@ GIT_EXTERN(int) git_index_caps(const git_index *index);
  */
 GIT_EXTERN(int) git_index_set_caps(git_index *index, int caps);
 
+/**
+ * Get the on-disk version of the index.
+ *
+ * This is the version of the index file which was read, or the one set
+ * with `git_index_set_version`.  Valid return values are 2, 3 and 4.  If
+ * 2 or 3 is returned, the index will be written with version 3 if there
+ * are entries with extended flags and version 2 otherwise.
+ *
+ * @param index An existing index object
+ * @return the index version
+ */
+GIT_EXTERN(unsigned int) git_index_version(git_index *index);
+
+/**
+ * Set the on-disk version of the index.
+ *
+ * Valid values are 2, 3 and 4.  Version 4 prefix-compresses the paths of
+ * the entries against the previous entry, which makes the index file
+ * much smaller when there are many files in deep directories, but it is
+ * not understood by git before 1.8.0.  The version is used the next
+ * time the index is written.
+ *
+ * @param index An existing index object
+ * @param version The new version number
+ * @return 0 on success, -1 on failure
+ */
+GIT_EXTERN(int) git_index_set_version(git_index *index, unsigned int version);
+
+/**
+ * Set the number of threads used to read the index.
+ *
+ * Indexes with a large number of entries are written with a table of
+ * the offsets of blocks of entries (the IEOT and EOIE extensions, which
+ * git writes as well when `index.threads` is set).  When such an index
+ * is read, the blocks are parsed on several threads while another one
+ * verifies the checksum.
+ *
+ * By default, one thread per CPU is used.  Passing 0 goes back to this.
+ * When libgit2 is built without threads, the index is always read on
+ * the calling thread.
+ *
+ * @param index An existing index object
+ * @param n The number of threads to use, or 0 for one per CPU
+ * @return the number of threads set, 0 meaning one per CPU
+ */
+GIT_EXTERN(unsigned int) git_index_set_threads(git_index *index, unsigned int n);
+
 /**
  * Update the contents of an existing index object in memory by reading
  * from the hard disk.
@@ -35,6 +35,25 @@ GIT_EXTERN(int) git_indexer_new(
 		git_transfer_progress_cb progress_cb,
 		void *progress_cb_payload);
 
+/**
+ * Set the number of threads used to resolve the deltas
+ *
+ * The deltas are resolved in `git_indexer_commit`, where each tree of
+ * deltas that share a base can be resolved independently of the others.
+ * The default is 0, which uses one thread per CPU. 1 resolves them in
+ * the calling thread, and any other value is the number of threads to
+ * use. Without thread support, they are always resolved in the calling
+ * thread.
+ *
+ * The progress callback is always called from the thread that called
+ * `git_indexer_commit`.
+ *
+ * @param idx the indexer
+ * @param n Number of threads to use, or 0 for one per CPU
+ * @return the setting in effect: `n`, or 1 without thread support
+ */
+GIT_EXTERN(unsigned int) git_indexer_set_threads(git_indexer *idx, unsigned int n);
+
 /**
  * Add data to the indexer
  *
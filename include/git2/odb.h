@@ -147,6 +147,45 @@ GIT_EXTERN(int) git_odb_read_prefix(git_odb_object **out, git_odb *db, const git
  */
 GIT_EXTERN(int) git_odb_read_header(size_t *len_out, git_otype *type_out, git_odb *db, const git_oid *id);
 
+/**
+ * Read several objects from the database at once.
+ *
+ * This is equivalent to calling `git_odb_read()` for each of the ids,
+ * but the backends that support it (like the packfile one) read the
+ * objects in the order in which they are stored rather than in the
+ * order of `ids`, which is much cheaper for a large number of objects.
+ *
+ * Either all of the objects are read or none are: if any of them is
+ * missing, `out` is left with NULLs and GIT_ENOTFOUND is returned.
+ *
+ * @param out array of `n` elements where to store the read objects,
+ *            in the order of `ids`; each one must be freed by the user
+ * @param db database to search for the objects in.
+ * @param ids array of `n` ids of the objects to read.
+ * @param n the number of objects to read
+ * @return
+ * - 0 if all of the objects were read;
+ * - GIT_ENOTFOUND if any of the objects is not in the database.
+ */
+GIT_EXTERN(int) git_odb_read_many(git_odb_object **out, git_odb *db, const git_oid *ids, size_t n);
+
+/**
+ * Read the headers of several objects from the database at once.
+ *
+ * Like `git_odb_read_many()`, but only the lengths and types of the
+ * objects are read, as with `git_odb_read_header()`.
+ *
+ * @param len_out array of `n` elements where to store the lengths
+ * @param type_out array of `n` elements where to store the types
+ * @param db database to search for the objects in.
+ * @param ids array of `n` ids of the objects to read.
+ * @param n the number of objects to read
+ * @return
+ * - 0 if all of the headers were read;
+ * - GIT_ENOTFOUND if any of the objects is not in the database.
+ */
+GIT_EXTERN(int) git_odb_read_header_many(size_t *len_out, git_otype *type_out, git_odb *db, const git_oid *ids, size_t n);
+
 /**
  * Determine if the given object can be found in the object database.
  *
@@ -341,6 +380,21 @@ GIT_EXTERN(int) git_odb_write_pack(
 	git_transfer_progress_cb progress_cb,
 	void *progress_payload);
 
+/**
+ * Write a `multi-pack-index` file from all the `.pack` files in the ODB.
+ *
+ * If the ODB layer understands pack files, then this will create a file
+ * called `multi-pack-index` next to the `.pack` and `.idx` files, which
+ * will contain an index of all objects stored in `.pack` files. This will
+ * allow for O(log n) lookup for n objects (regardless of how many packfiles
+ * there exist).
+ *
+ * @param db object database where the `multi-pack-index` file will be written.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_write_multi_pack_index(
+	git_odb *db);
+
 /**
  * Determine the object-ID (sha1 hash) of a data buffer
  *
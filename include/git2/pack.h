@@ -76,6 +76,57 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(unsigned int) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Set whether to spill the deltas that don't fit in the delta cache to disk
+ *
+ * The deltas that are found while searching are kept in memory, up to
+ * the `pack.deltaCacheSize` configuration value; the others are
+ * computed again when the pack is written. When this is enabled, they
+ * are compressed and written to a temporary file in the objects
+ * directory of the repository instead, and read back from it as the
+ * pack is written, so that packing a large repository neither exceeds
+ * the budget nor computes its deltas twice.
+ *
+ * This is disabled by default.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to spill deltas to disk
+ */
+GIT_EXTERN(void) git_packbuilder_set_spill_deltas(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether to reuse the data of the objects that are already packed
+ *
+ * When enabled, the objects that are stored in a pack of the repository
+ * are copied as-is into the new pack, after checking them against the
+ * CRC32 of the pack index, instead of being compressed again. The ones
+ * stored as a delta keep that delta when its base is also part of the
+ * new pack, and are not searched for another one. This makes packing a
+ * repository that was recently repacked much cheaper.
+ *
+ * This is enabled by default. It must be set before inserting objects.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to reuse packed objects
+ */
+GIT_EXTERN(void) git_packbuilder_set_reuse_objects(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether to write a reachability bitmap along with the pack
+ *
+ * When enabled, `git_packbuilder_write` also writes a `.bitmap` file
+ * for the pack, which lets later walks count the objects reachable from
+ * a set of commits without parsing them. A bitmap is only written when
+ * the pack has every object reachable from its commits, as is the case
+ * when repacking the whole repository.
+ *
+ * This defaults to the `repack.writeBitmaps` configuration value.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write bitmaps
+ */
+GIT_EXTERN(void) git_packbuilder_set_write_bitmaps(git_packbuilder *pb, int enabled);
+
 /**
  * Insert a single object
  *
@@ -114,6 +165,32 @@ GIT_EXTERN(int) git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *
  */
 GIT_EXTERN(int) git_packbuilder_insert_commit(git_packbuilder *pb, const git_oid *id);
 
+/**
+ * Insert the objects reachable from some tips but not from others
+ *
+ * This adds every object that is reachable from one of the `wants`
+ * (commits, annotated tags, trees or blobs) and is not reachable from any
+ * of the `haves`, as needed for a fetch or a clone.
+ *
+ * When one of the repository's packs has a reachability bitmap, the
+ * objects are counted from the bitmaps instead of walking every tree;
+ * only the history that the bitmaps do not cover is walked.
+ *
+ * @param pb The packbuilder
+ * @param wants The tips to include
+ * @param wants_len The number of tips to include
+ * @param haves The tips whose objects are to be left out; might be NULL
+ * @param haves_len The number of tips to leave out
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_insert_reachable(
+	git_packbuilder *pb,
+	const git_oid *wants,
+	size_t wants_len,
+	const git_oid *haves,
+	size_t haves_len);
+
 /**
  * Write the contents of the packfile to an in-memory buffer
  *
@@ -188,13 +265,50 @@ typedef int (*git_packbuilder_progress)(
 	unsigned int total,
 	void *payload);
 
+/**
+ * What one of the threads of the packbuilder did while searching for
+ * deltas.
+ */
+typedef struct {
+	/** The number of objects it searched a delta for */
+	unsigned int objects;
+
+	/** The number of times it took over work from another thread */
+	unsigned int steals;
+
+	/** The time it spent searching, in seconds */
+	double search_time;
+} git_packbuilder_thread_stats;
+
+/**
+ * Get what one of the threads did while searching for deltas
+ *
+ * The objects are spread over the threads, and the ones that are done
+ * with their share take over half of what remains for the busiest one.
+ * This can be called from the progress callback while the search is in
+ * progress (the GIT_PACKBUILDER_DELTAFICATION stage), or after the pack
+ * has been written.
+ *
+ * @param out where to store the stats
+ * @param pb the packbuilder
+ * @param n the index of the thread
+ * @return 0 or GIT_ENOTFOUND if there is no such thread
+ */
+GIT_EXTERN(int) git_packbuilder_get_thread_stats(
+	git_packbuilder_thread_stats *out,
+	git_packbuilder *pb,
+	unsigned int n);
+
 /**
  * Set the callbacks for a packbuilder
  *
  * @param pb The packbuilder object
  * @param progress_cb Function to call with progress information during
  * pack building. Be aware that this is called inline with pack building
- * operations, so performance may be affected.
+ * operations, so performance may be affected. While deltas are being
+ * searched for, it gets the number of objects searched so far; it is
+ * always called from the thread that builds the pack, even when the
+ * search is spread over several threads.
  * @param progress_cb_payload Payload for progress callback.
  * @return 0 or an error code
  */
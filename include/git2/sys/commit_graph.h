@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_commit_graph_h__
+#define INCLUDE_sys_git_commit_graph_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/commit_graph.h
+ * @brief Git commit-graph routines
+ * @defgroup git_commit_graph Git commit-graph routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * A writer for `commit-graph` files.
+ */
+typedef struct git_commit_graph_writer git_commit_graph_writer;
+
+/**
+ * The strategy to use when writing a commit-graph.
+ */
+typedef enum {
+	/**
+	 * Write a single `info/commit-graph` file with all the commits.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE = 0,
+
+	/**
+	 * Add a layer with the commits that are not in the graph yet to the
+	 * `info/commit-graphs/commit-graph-chain`. Layers below it that are
+	 * not much bigger than the new one are merged into it.
+	 */
+	GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SPLIT,
+} git_commit_graph_split_strategy_t;
+
+/**
+ * Options for writing a commit-graph.
+ */
+typedef struct {
+	unsigned int version;
+
+	/** The strategy to use when adding the new commits. */
+	git_commit_graph_split_strategy_t split_strategy;
+
+	/**
+	 * When splitting, a layer of the chain is merged into the new one
+	 * unless it has more than `size_multiple` times its commits.
+	 * Defaults to 2.
+	 */
+	float size_multiple;
+} git_commit_graph_writer_options;
+
+#define GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION 1
+#define GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT { \
+		GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION, \
+		GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SINGLE_FILE, 2.0f \
+	}
+
+/**
+ * Create a new writer for `commit-graph` files.
+ *
+ * @param out location to store the writer pointer.
+ * @param objects_info_dir the `objects/info` directory. The `commit-graph`
+ * file (or the `commit-graphs` chain) will be written in this directory.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir);
+
+/**
+ * Free the commit-graph writer and its resources.
+ *
+ * @param w the writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_commit_graph_writer_free(git_commit_graph_writer *w);
+
+/**
+ * Add all the commits that a revision walk produces to the writer, along
+ * with all their ancestors.
+ *
+ * The walk is consumed (and reset) in the process.
+ *
+ * @param w the writer
+ * @param walk the revision walk, with its tips already pushed
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk);
+
+/**
+ * Write the commit-graph to the `objects/info` directory.
+ *
+ * @param w the writer
+ * @param opts the options for the write, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_commit(
+		git_commit_graph_writer *w,
+		const git_commit_graph_writer_options *opts);
+
+/**
+ * Dump the file that `git_commit_graph_writer_commit` would write to an
+ * in-memory buffer. When splitting, this is the new layer of the chain.
+ *
+ * @param cgraph Buffer where to store the contents of the `commit-graph`.
+ * @param w the writer
+ * @param opts the options for the write, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w,
+		const git_commit_graph_writer_options *opts);
+
+/**
+ * Write a commit-graph for all the commits reachable from a revision walk
+ * into the `objects/info` directory of the walk's repository.
+ *
+ * @param walk the revision walk, with its tips already pushed
+ * @param opts the options for the write, or NULL for the defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_write(
+		git_revwalk *walk,
+		const git_commit_graph_writer_options *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
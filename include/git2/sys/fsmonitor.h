@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_fsmonitor_h__
+#define INCLUDE_sys_git_fsmonitor_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/fsmonitor.h
+ * @brief Git filesystem monitor backends
+ * @defgroup git_backend Git custom backend APIs
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Callback for each path a filesystem monitor reports
+ *
+ * The path is relative to the working directory; the empty path stands
+ * for all of it.  Return non-zero to stop the query.
+ */
+typedef int (*git_fsmonitor_changed_cb)(const char *path, void *payload);
+
+/**
+ * A filesystem monitor knows which paths of a working directory changed
+ * since an earlier point in time, so that a diff between the index and
+ * the working directory only needs to look at those.
+ *
+ * The points in time are tokens of the monitor's own making, which are
+ * kept in the index (as its "FSMN" extension) between queries.
+ */
+struct git_fsmonitor {
+	unsigned int version;
+
+	/**
+	 * Report through `changed_cb` each path which may have changed
+	 * since `token`, and put a token for now in `out`.  A directory
+	 * stands for everything below it.  When `token` is NULL, or is not
+	 * one the monitor can answer for, it must report the empty path.
+	 */
+	int (*query)(
+		git_buf *out,
+		git_fsmonitor *fsmonitor,
+		const char *token,
+		git_fsmonitor_changed_cb changed_cb,
+		void *payload);
+
+	/** Free the monitor */
+	void (*free)(git_fsmonitor *fsmonitor);
+};
+
+#define GIT_FSMONITOR_VERSION 1
+#define GIT_FSMONITOR_INIT {GIT_FSMONITOR_VERSION}
+
+/**
+ * Initializes a `git_fsmonitor` with default values. Equivalent to
+ * creating an instance with GIT_FSMONITOR_INIT.
+ *
+ * @param fsmonitor the `git_fsmonitor` struct to initialize.
+ * @param version Version of struct; pass `GIT_FSMONITOR_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fsmonitor_init_backend(
+	git_fsmonitor *fsmonitor,
+	unsigned int version);
+
+/**
+ * Create a filesystem monitor which watches a directory with inotify
+ *
+ * Every directory below `path` gets a watch right away, and new ones as
+ * they are reported, so the monitor only knows about the changes made
+ * while it exists: its first query in a process reports everything.
+ * It is meant for long-lived processes, and only available on Linux.
+ *
+ * @param out pointer to the new monitor
+ * @param path the working directory to watch
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_fsmonitor_inotify(git_fsmonitor **out, const char *path);
+
+/**
+ * Set the filesystem monitor of the working directory of a repository
+ *
+ * Diffs between the index and the working directory then trust the
+ * index for what the monitor doesn't report.  The repository takes
+ * ownership of the monitor and frees it along with itself, or when
+ * another one (or NULL) is set.
+ *
+ * @param repo A repository object
+ * @param fsmonitor The monitor, or NULL to do without one
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo,
+	git_fsmonitor *fsmonitor);
+
+/** @} */
+GIT_END_DECL
+#endif
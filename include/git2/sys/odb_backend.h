@@ -84,6 +84,36 @@ struct git_odb_backend {
 		git_transfer_progress_cb progress_cb, void *progress_payload);
 
 	void (* free)(git_odb_backend *);
+
+	/**
+	 * If the backend supports pack files, this will create a
+	 * `multi-pack-index` file which will contain an index of all objects
+	 * across all the `.pack` files.
+	 */
+	int (* writemidx)(git_odb_backend *);
+
+	/**
+	 * Read several objects at once, in whatever order is the cheapest for
+	 * the backend (e.g. the order in which they are stored).
+	 *
+	 * The arrays have one element per id. The objects that are found get
+	 * their buffer, size and type filled in; the elements of the ones that
+	 * are not found must be left untouched. On error, the backend must
+	 * free any buffer that it has filled in.
+	 *
+	 * Optional; `git_odb_read_many()` reads the objects one by one when
+	 * a backend does not implement it.
+	 */
+	int (* read_many)(
+		void **, size_t *, git_otype *, git_odb_backend *,
+		const git_oid *, size_t);
+
+	/**
+	 * Like `read_many`, but only reads the sizes and types of the objects.
+	 */
+	int (* read_header_many)(
+		size_t *, git_otype *, git_odb_backend *,
+		const git_oid *, size_t);
 };
 
 #define GIT_ODB_BACKEND_VERSION 1
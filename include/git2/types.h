@@ -134,6 +134,9 @@ typedef struct git_index git_index;
 /** An iterator for conflicts in the index. */
 typedef struct git_index_conflict_iterator git_index_conflict_iterator;
 
+/** A monitor of what changes in a working directory */
+typedef struct git_fsmonitor git_fsmonitor;
+
 /** Memory representation of a set of config files */
 typedef struct git_config git_config;
 
@@ -66,6 +66,93 @@ GIT_INLINE(void) git_bitvec_clear(git_bitvec *bv)
 		memset(bv->u.words, 0x0, bv->length * sizeof(uint64_t));
 }
 
+#define GIT_BITVEC_WORDS(BV) ((BV)->length ? (BV)->u.words : &(BV)->u.bits)
+#define GIT_BITVEC_LENGTH(BV) ((BV)->length ? (BV)->length : 1)
+
+/* Make room for at least `capacity` bits, keeping the ones already set */
+GIT_INLINE(int) git_bitvec_grow(git_bitvec *bv, size_t capacity)
+{
+	size_t length = (capacity / 64) + 1;
+	uint64_t *words;
+
+	if (capacity < 64 || length <= bv->length)
+		return 0;
+
+	words = git__calloc(length, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(words);
+
+	if (bv->length) {
+		memcpy(words, bv->u.words, bv->length * sizeof(uint64_t));
+		git__free(bv->u.words);
+	} else
+		words[0] = bv->u.bits;
+
+	bv->length = length;
+	bv->u.words = words;
+	return 0;
+}
+
+/* Set in `bv` all the bits that are set in `other`, growing `bv` as needed */
+GIT_INLINE(int) git_bitvec_or(git_bitvec *bv, const git_bitvec *other)
+{
+	const uint64_t *src = GIT_BITVEC_WORDS(other);
+	size_t i, len = GIT_BITVEC_LENGTH(other);
+	uint64_t *dst;
+
+	if (git_bitvec_grow(bv, len * 64 - 1) < 0)
+		return -1;
+
+	dst = GIT_BITVEC_WORDS(bv);
+	for (i = 0; i < len; ++i)
+		dst[i] |= src[i];
+
+	return 0;
+}
+
+/* Clear in `bv` all the bits that are set in `other` */
+GIT_INLINE(void) git_bitvec_and_not(git_bitvec *bv, const git_bitvec *other)
+{
+	const uint64_t *src = GIT_BITVEC_WORDS(other);
+	uint64_t *dst = GIT_BITVEC_WORDS(bv);
+	size_t i, len = min(GIT_BITVEC_LENGTH(bv), GIT_BITVEC_LENGTH(other));
+
+	for (i = 0; i < len; ++i)
+		dst[i] &= ~src[i];
+}
+
+/* Flip in `bv` all the bits that are set in `other`, growing `bv` as needed */
+GIT_INLINE(int) git_bitvec_xor(git_bitvec *bv, const git_bitvec *other)
+{
+	const uint64_t *src = GIT_BITVEC_WORDS(other);
+	size_t i, len = GIT_BITVEC_LENGTH(other);
+	uint64_t *dst;
+
+	if (git_bitvec_grow(bv, len * 64 - 1) < 0)
+		return -1;
+
+	dst = GIT_BITVEC_WORDS(bv);
+	for (i = 0; i < len; ++i)
+		dst[i] ^= src[i];
+
+	return 0;
+}
+
+/* Count the bits that are set */
+GIT_INLINE(size_t) git_bitvec_count(git_bitvec *bv)
+{
+	const uint64_t *words = GIT_BITVEC_WORDS(bv);
+	size_t i, count = 0, len = GIT_BITVEC_LENGTH(bv);
+
+	for (i = 0; i < len; ++i) {
+		uint64_t word = words[i];
+
+		for (; word; count++)
+			word &= word - 1;
+	}
+
+	return count;
+}
+
 GIT_INLINE(void) git_bitvec_free(git_bitvec *bv)
 {
 	if (bv->length)
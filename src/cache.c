@@ -13,6 +13,7 @@
 #include "cache.h"
 #include "odb.h"
 #include "object.h"
+#include "global.h"
 #include "git2/oid.h"
 
 GIT__USE_OIDMAP
@@ -20,6 +21,11 @@ GIT__USE_OIDMAP
 bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
+git_cache_eviction_t git_cache__eviction = GIT_CACHE_EVICT_CLOCK;
+
+/* Whenever you want to read or modify these, grab git__cache_mutex */
+static git_cache *live_caches;
+static size_t freed_hits, freed_misses, freed_evictions;
 
 static size_t git_cache__max_object_size[8] = {
 	0,     /* GIT_OBJ__EXT1 */
@@ -43,102 +49,310 @@ int git_cache_set_max_object_size(git_otype type, size_t size)
 	return 0;
 }
 
+int git_cache_set_eviction(git_cache_eviction_t policy)
+{
+	if (policy != GIT_CACHE_EVICT_RANDOM && policy != GIT_CACHE_EVICT_CLOCK) {
+		giterr_set(GITERR_INVALID, "unknown cache eviction policy");
+		return -1;
+	}
+
+	git_cache__eviction = policy;
+	return 0;
+}
+
+GIT_INLINE(git_cache_shard *) cache_shard(git_cache *cache, const git_oid *oid)
+{
+	return &cache->shards[oid->id[0] % GIT_CACHE_SHARDS];
+}
+
+static ssize_t cache_used_memory(git_cache *cache)
+{
+	ssize_t used_memory = 0;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		used_memory += shard->used_memory;
+		git_mutex_unlock(&shard->lock);
+	}
+
+	return used_memory;
+}
+
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
+	size_t i;
 
-	if (kh_size(cache->map) == 0)
+	if (git_cache_size(cache) == 0)
 		return;
 
 	printf("Cache %p: %d items cached, %d bytes\n",
-		cache, kh_size(cache->map), (int)cache->used_memory);
-
-	kh_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%d)\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			(int)object->size
-		);
-	});
+		cache, (int)git_cache_size(cache), (int)cache_used_memory(cache));
+
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+		kh_foreach_value(cache->shards[i].map, object, {
+			char oid_str[9];
+			printf(" %s%c %s (%d)\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				(int)object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
-	cache->map = git_oidmap_alloc();
-	if (git_mutex_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize cache mutex");
+
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		shard->map = git_oidmap_alloc();
+		GITERR_CHECK_ALLOC(shard->map);
+
+		if (git_mutex_init(&shard->lock)) {
+			giterr_set(GITERR_OS, "Failed to initialize cache mutex");
+			return -1;
+		}
+	}
+
+	if (git_mutex_lock(&git__cache_mutex) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock cache statistics");
+		return -1;
+	}
+
+	if ((cache->next = live_caches) != NULL)
+		live_caches->prev = cache;
+	live_caches = cache;
+
+	git_mutex_unlock(&git__cache_mutex);
+	return 0;
+}
+
+int git_cache_stats(size_t *hits, size_t *misses, size_t *evictions)
+{
+	git_cache *cache;
+	size_t i;
+
+	if (git_mutex_lock(&git__cache_mutex) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock cache statistics");
 		return -1;
 	}
+
+	*hits = freed_hits;
+	*misses = freed_misses;
+	*evictions = freed_evictions;
+
+	for (cache = live_caches; cache != NULL; cache = cache->next) {
+		for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+			git_cache_shard *shard = &cache->shards[i];
+
+			if (git_mutex_lock(&shard->lock) < 0)
+				continue;
+
+			*hits += shard->hits;
+			*misses += shard->misses;
+			*evictions += shard->evictions;
+
+			git_mutex_unlock(&shard->lock);
+		}
+	}
+
+	git_mutex_unlock(&git__cache_mutex);
 	return 0;
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
 
-	if (kh_size(cache->map) == 0)
+	if (kh_size(shard->map) == 0)
 		return;
 
-	kh_foreach_value(cache->map, evict, {
+	kh_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	kh_clear(oid, cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	kh_clear(oid, shard->map);
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
+	shard->clock_hand = 0;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_mutex_lock(&cache->lock) < 0)
-		return;
+	size_t i;
 
-	clear_cache(cache);
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	git_mutex_unlock(&cache->lock);
+		if (!shard->map || git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		clear_shard(shard);
+
+		git_mutex_unlock(&shard->lock);
+	}
 }
 
 void git_cache_free(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_mutex_free(&cache->lock);
+
+	/* its counts go on being part of the statistics */
+	if (git_mutex_lock(&git__cache_mutex) == 0) {
+		if (cache->prev != NULL || live_caches == cache) {
+			for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+				freed_hits += cache->shards[i].hits;
+				freed_misses += cache->shards[i].misses;
+				freed_evictions += cache->shards[i].evictions;
+			}
+
+			if (cache->prev)
+				cache->prev->next = cache->next;
+			else
+				live_caches = cache->next;
+			if (cache->next)
+				cache->next->prev = cache->prev;
+		}
+
+		git_mutex_unlock(&git__cache_mutex);
+	}
+
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i) {
+		if (cache->shards[i].map)
+			git_oidmap_free(cache->shards[i].map);
+		git_mutex_free(&cache->shards[i].lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
 /* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+static void cache_evict_entry(git_cache_shard *shard, khiter_t pos)
+{
+	git_cached_obj *evict = kh_val(shard->map, pos);
+
+	shard->used_memory -= evict->size;
+	git_atomic_ssize_add(&git_cache__current_storage, -(ssize_t)evict->size);
+	shard->evictions++;
+	git_cached_obj_decref(evict);
+
+	kh_del(oid, shard->map, pos);
+}
+
+/* Called with lock; returns the number of evicted entries */
+static size_t cache_evict_random(git_cache_shard *shard, size_t evict_count)
 {
 	uint32_t seed = rand();
-	size_t evict_count = 8;
-	ssize_t evicted_memory = 0;
+	size_t evicted = 0;
 
 	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > kh_size(cache->map)) {
-		clear_cache(cache);
-		return;
+	if (evict_count >= kh_size(shard->map)) {
+		evicted = kh_size(shard->map);
+		shard->evictions += evicted;
+		clear_shard(shard);
+		return evicted;
+	}
+
+	while (evicted < evict_count) {
+		khiter_t pos = seed++ % kh_end(shard->map);
+
+		if (kh_exist(shard->map, pos)) {
+			cache_evict_entry(shard, pos);
+			evicted++;
+		}
 	}
 
-	while (evict_count > 0) {
-		khiter_t pos = seed++ % kh_end(cache->map);
+	return evicted;
+}
+
+/*
+ * Called with lock; returns the number of evicted entries and whether
+ * the hand went past the last slot of the shard.
+ *
+ * The clock hand sweeps over the slots of the maps, giving a second chance
+ * to the entries that were hit since it last passed over them. Objects
+ * that are only ever loaded once (say, while scanning a large diff) are
+ * evicted before the ones that are used over and over.
+ */
+static size_t cache_evict_clock(git_cache_shard *shard, size_t evict_count, bool *wrapped)
+{
+	khiter_t pos = shard->clock_hand;
+	size_t evicted = 0;
+
+	*wrapped = false;
+
+	while (evicted < evict_count) {
+		git_cached_obj *entry;
 
-		if (kh_exist(cache->map, pos)) {
-			git_cached_obj *evict = kh_val(cache->map, pos);
+		if (pos >= kh_end(shard->map)) {
+			pos = kh_begin(shard->map);
+			*wrapped = true;
+			break;
+		}
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+		if (kh_exist(shard->map, pos)) {
+			entry = kh_val(shard->map, pos);
 
-			kh_del(oid, cache->map, pos);
+			if (entry->referenced) {
+				entry->referenced = 0;
+			} else {
+				cache_evict_entry(shard, pos);
+				evicted++;
+			}
 		}
+
+		pos++;
 	}
 
-	cache->used_memory -= evicted_memory;
-	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+	shard->clock_hand = pos;
+	return evicted;
+}
+
+/*
+ * Evict a few entries, one shard at a time. The clock moves through the
+ * shards in turn, as if their maps made up a single one; two rounds are
+ * enough to clear the referenced bits of every entry and then evict.
+ */
+static void cache_evict_entries(git_cache *cache)
+{
+	size_t evict_count = 8, tries;
+	bool wrapped;
+
+	for (tries = 0; evict_count > 0 && tries < 2 * GIT_CACHE_SHARDS + 1; ++tries) {
+		size_t idx = (size_t)git_atomic_get(&cache->clock_shard) % GIT_CACHE_SHARDS;
+		git_cache_shard *shard = &cache->shards[idx];
+		size_t evicted;
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			return;
+
+		if (git_cache__eviction == GIT_CACHE_EVICT_RANDOM) {
+			evicted = cache_evict_random(shard, evict_count);
+			wrapped = true;
+		} else
+			evicted = cache_evict_clock(shard, evict_count, &wrapped);
+
+		git_mutex_unlock(&shard->lock);
+
+		evict_count -= evicted;
+
+		if (wrapped)
+			git_atomic_inc(&cache->clock_shard);
+	}
 }
 
 static bool cache_should_store(git_otype object_type, size_t object_size)
@@ -149,35 +363,43 @@ static bool cache_should_store(git_otype object_type, size_t object_size)
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
+	git_cache_shard *shard = cache_shard(cache, oid);
 	khiter_t pos;
 	git_cached_obj *entry = NULL;
 
-	if (!git_cache__enabled || git_mutex_lock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_mutex_lock(&shard->lock) < 0)
 		return NULL;
 
-	pos = kh_get(oid, cache->map, oid);
-	if (pos != kh_end(cache->map)) {
-		entry = kh_val(cache->map, pos);
+	pos = kh_get(oid, shard->map, oid);
+	if (pos != kh_end(shard->map)) {
+		entry = kh_val(shard->map, pos);
 
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+			entry->referenced = 1;
 		}
 	}
 
-	git_mutex_unlock(&cache->lock);
+	if (entry)
+		shard->hits++;
+	else
+		shard->misses++;
+
+	git_mutex_unlock(&shard->lock);
 
 	return entry;
 }
 
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
+	git_cache_shard *shard = cache_shard(cache, &entry->oid);
 	khiter_t pos;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && cache_used_memory(cache) > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -185,31 +407,31 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_mutex_lock(&cache->lock) < 0)
-		return entry;
-
 	/* soften the load on the cache */
 	if (git_cache__current_storage.val > git_cache__max_storage)
 		cache_evict_entries(cache);
 
-	pos = kh_get(oid, cache->map, &entry->oid);
+	if (git_mutex_lock(&shard->lock) < 0)
+		return entry;
+
+	pos = kh_get(oid, shard->map, &entry->oid);
 
 	/* not found */
-	if (pos == kh_end(cache->map)) {
+	if (pos == kh_end(shard->map)) {
 		int rval;
 
-		pos = kh_put(oid, cache->map, &entry->oid, &rval);
+		pos = kh_put(oid, shard->map, &entry->oid, &rval);
 		if (rval >= 0) {
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
+			shard->used_memory += entry->size;
 			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
 		}
 	}
 	/* found */
 	else {
-		git_cached_obj *stored_entry = kh_val(cache->map, pos);
+		git_cached_obj *stored_entry = kh_val(shard->map, pos);
 
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
@@ -217,17 +439,18 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			entry->flags == GIT_CACHE_STORE_PARSED) {
+			entry->referenced = stored_entry->referenced;
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_mutex_unlock(&cache->lock);
+	git_mutex_unlock(&shard->lock);
 	return entry;
 }
 
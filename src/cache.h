@@ -26,19 +26,44 @@ typedef struct {
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+	uint8_t    referenced; /* hit since the clock hand last passed */
 } git_cached_obj;
 
+/*
+ * The cache is split by the first byte of the object ids into shards that
+ * are locked independently, so that threads that share a repository do
+ * not all wait on the same lock.
+ */
+#define GIT_CACHE_SHARDS 32
+
 typedef struct {
 	git_oidmap *map;
 	git_mutex   lock;
 	ssize_t     used_memory;
+	khiter_t    clock_hand; /* next slot of `map` to consider for eviction */
+
+	/* counted under `lock`, and only added up when they are asked for */
+	size_t      hits, misses, evictions;
+} git_cache_shard;
+
+typedef struct git_cache {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
+	git_atomic      clock_shard; /* the shard the clock hand is in */
+
+	/* in the list of live caches, for the statistics */
+	struct git_cache *prev, *next;
 } git_cache;
 
 extern bool git_cache__enabled;
 extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
+extern git_cache_eviction_t git_cache__eviction;
 
 int git_cache_set_max_object_size(git_otype type, size_t size);
+int git_cache_set_eviction(git_cache_eviction_t policy);
+
+/* The hits, misses and evictions of all caches, freed ones included */
+int git_cache_stats(size_t *hits, size_t *misses, size_t *evictions);
 
 int git_cache_init(git_cache *cache);
 void git_cache_free(git_cache *cache);
@@ -53,7 +78,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)kh_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; ++i)
+		size += (size_t)kh_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
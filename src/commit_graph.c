@@ -0,0 +1,1505 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "git2/commit.h"
+#include "git2/sys/commit_graph.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "odb.h"
+#include "oid.h"
+#include "path.h"
+#include "repository.h"
+#include "revwalk.h"
+#include "sha1_lookup.h"
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+#define COMMIT_GRAPH_BASE_GRAPHS_LIST_ID 0x42415345 /* "BASE" */
+
+#define COMMIT_GRAPH_CHUNK_HEADER_SIZE 12
+#define COMMIT_GRAPH_COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 16)
+#define COMMIT_GRAPH_EXTRA_EDGE_NEEDED 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid, zero_oid = {{0}};
+	size_t len;
+
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (git__multiply_sizet_overflow(
+			&len, file->num_commits, GIT_OID_RAWSZ) ||
+		chunk_oid_lookup->length != len)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = &zero_oid;
+	for (i = 0; i < file->num_commits; ++i, ++oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	size_t len;
+
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length == 0)
+		return commit_graph_error("empty Commit Data chunk");
+	if (git__multiply_sizet_overflow(
+			&len, file->num_commits, COMMIT_GRAPH_COMMIT_DATA_SIZE) ||
+		chunk_commit_data->length != len)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = data + chunk_extra_edge_list->offset;
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+
+	return 0;
+}
+
+static int commit_graph_parse_base_graphs_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_base_graphs_list)
+{
+	if (file->num_base_graphs == 0) {
+		if (chunk_base_graphs_list->offset != 0)
+			return commit_graph_error("unexpected Base Graphs List chunk");
+		return 0;
+	}
+
+	if (chunk_base_graphs_list->offset == 0)
+		return commit_graph_error("missing Base Graphs List chunk");
+	if (chunk_base_graphs_list->length != file->num_base_graphs * GIT_OID_RAWSZ)
+		return commit_graph_error("Base Graphs List chunk has wrong length");
+
+	file->base_graphs = (const git_oid *)(data + chunk_base_graphs_list->offset);
+
+	return 0;
+}
+
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+				      chunk_base_graphs_list = {0}, chunk_unsupported = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+		hdr->version != COMMIT_GRAPH_VERSION ||
+		hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION) {
+		return commit_graph_error("unsupported commit-graph version");
+	}
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+	file->num_base_graphs = hdr->base_graph_files;
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_commit_graph_header) +
+			(1 + hdr->chunks) * COMMIT_GRAPH_CHUNK_HEADER_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+
+	/*
+	 * As with the multi-pack-index, the trailing checksum is only recorded
+	 * here: hashing the whole file on every open would defeat its purpose.
+	 */
+	git_oid_fromraw(&file->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_HEADER_SIZE) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32 |
+				((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		case COMMIT_GRAPH_BASE_GRAPHS_LIST_ID:
+			chunk_base_graphs_list.offset = last_chunk_offset;
+			last_chunk = &chunk_base_graphs_list;
+			break;
+
+		default:
+			/* Generation data, bloom filters etc. are not used (yet) */
+			chunk_unsupported.offset = last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout)) < 0)
+		return error;
+	if ((error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup)) < 0)
+		return error;
+	if ((error = commit_graph_parse_commit_data(file, data, &chunk_commit_data)) < 0)
+		return error;
+	if ((error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list)) < 0)
+		return error;
+	if ((error = commit_graph_parse_base_graphs_list(file, data, &chunk_base_graphs_list)) < 0)
+		return error;
+
+	return 0;
+}
+
+
+int git_commit_graph_file_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	/* TODO: properly open the file without access time using O_NOATIME */
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid commit-graph file '%s'", path);
+		return -1;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	git_futils_filestamp_set_from_stat(&file->stamp, &st);
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_file_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_chain_open(git_commit_graph_file **file_out, const char *chain_path)
+{
+	git_buf chain = GIT_BUF_INIT, dir = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_commit_graph_file *file = NULL, *layer;
+	const char *line, *eol;
+	size_t num_layers = 0;
+	git_oid id;
+	int error;
+
+	assert(file_out && chain_path);
+
+	if ((error = git_futils_readbuffer(&chain, chain_path)) < 0 ||
+		(error = git_path_dirname_r(&dir, chain_path)) < 0)
+		goto cleanup;
+
+	/* The chain lists one layer per line, starting from the bottom one */
+	for (line = git_buf_cstr(&chain); *line; line = eol) {
+		if ((eol = strchr(line, '\n')) == NULL)
+			eol = line + strlen(line);
+		else
+			eol++;
+
+		if ((eol - line != GIT_OID_HEXSZ &&
+			 (eol - line != GIT_OID_HEXSZ + 1 || line[GIT_OID_HEXSZ] != '\n')) ||
+			git_oid_fromstrn(&id, line, GIT_OID_HEXSZ) < 0) {
+			error = commit_graph_error("malformed commit-graph chain");
+			goto cleanup;
+		}
+
+		git_buf_clear(&path);
+		if ((error = git_buf_printf(&path, "%s/graph-%.*s.graph",
+				git_buf_cstr(&dir), GIT_OID_HEXSZ, line)) < 0 ||
+			(error = git_commit_graph_file_open(&layer, git_buf_cstr(&path))) < 0)
+			goto cleanup;
+
+		layer->base = file;
+		file = layer;
+
+		if (file->num_base_graphs != num_layers ||
+			!git_oid_equal(&file->checksum, &id) ||
+			(num_layers > 0 &&
+			 !git_oid_equal(&file->base_graphs[num_layers - 1], &file->base->checksum))) {
+			error = commit_graph_error("commit-graph chain does not match its layers");
+			goto cleanup;
+		}
+
+		if (file->base)
+			file->num_commits_in_base =
+				file->base->num_commits_in_base + file->base->num_commits;
+		num_layers++;
+	}
+
+	if (num_layers == 0) {
+		error = commit_graph_error("empty commit-graph chain");
+		goto cleanup;
+	}
+
+	*file_out = file;
+	file = NULL;
+
+cleanup:
+	git_commit_graph_file_free(file);
+	git_buf_free(&chain);
+	git_buf_free(&dir);
+	git_buf_free(&path);
+	return error;
+}
+
+static int commit_graph_load(git_commit_graph *cgraph)
+{
+	struct stat st;
+	int error;
+
+	cgraph->checked = 1;
+	cgraph->split = 0;
+
+	/* As git does, a single commit-graph file wins over a chain */
+	if (git_path_exists(git_buf_cstr(&cgraph->filename))) {
+		if ((error = git_commit_graph_file_open(
+				&cgraph->file, git_buf_cstr(&cgraph->filename))) < 0)
+			return error;
+
+		if (cgraph->file->num_base_graphs != 0) {
+			git_commit_graph_file_free(cgraph->file);
+			cgraph->file = NULL;
+			return commit_graph_error("commit-graph has base graphs but no chain");
+		}
+
+		GIT_REFCOUNT_INC(cgraph->file);
+		return 0;
+	}
+
+	if (p_stat(git_buf_cstr(&cgraph->chain_filename), &st) < 0)
+		return 0;
+
+	git_futils_filestamp_set_from_stat(&cgraph->chain_stamp, &st);
+	cgraph->split = 1;
+
+	if ((error = git_commit_graph_chain_open(
+			&cgraph->file, git_buf_cstr(&cgraph->chain_filename))) < 0)
+		return error;
+
+	GIT_REFCOUNT_INC(cgraph->file);
+	return 0;
+}
+
+int git_commit_graph_get_file(git_commit_graph_file **file_out, git_commit_graph *cgraph)
+{
+	int error = 0;
+
+	if (!cgraph)
+		return GIT_ENOTFOUND;
+
+	if (git_mutex_lock(&cgraph->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock commit-graph");
+		return -1;
+	}
+
+	/* A broken or missing commit-graph is not an error: just don't use it */
+	if (!cgraph->checked && commit_graph_load(cgraph) < 0) {
+		giterr_clear();
+		cgraph->file = NULL;
+	}
+
+	if (cgraph->file) {
+		GIT_REFCOUNT_INC(cgraph->file);
+		*file_out = cgraph->file;
+	} else
+		error = GIT_ENOTFOUND;
+
+	git_mutex_unlock(&cgraph->lock);
+	return error;
+}
+
+int git_commit_graph_new(git_commit_graph **cgraph_out, const char *objects_dir, bool open_file)
+{
+	git_commit_graph *cgraph = NULL;
+	git_commit_graph_file *file;
+	int error = 0;
+
+	assert(cgraph_out && objects_dir);
+
+	cgraph = git__calloc(1, sizeof(git_commit_graph));
+	GITERR_CHECK_ALLOC(cgraph);
+
+	if (git_mutex_init(&cgraph->lock)) {
+		giterr_set(GITERR_OS, "Failed to initialize commit-graph mutex");
+		git__free(cgraph);
+		return -1;
+	}
+
+	if ((error = git_buf_joinpath(&cgraph->filename, objects_dir, GIT_COMMIT_GRAPH_FILE)) < 0 ||
+		(error = git_buf_joinpath(&cgraph->chain_filename, objects_dir, GIT_COMMIT_GRAPH_CHAIN_FILE)) < 0)
+		goto error;
+
+	if (open_file) {
+		if ((error = commit_graph_load(cgraph)) < 0)
+			goto error;
+		if ((error = git_commit_graph_get_file(&file, cgraph)) < 0) {
+			giterr_set(GITERR_ODB, "commit-graph file not found - '%s'",
+				git_buf_cstr(&cgraph->filename));
+			goto error;
+		}
+		git_commit_graph_file_free(file);
+	}
+
+	*cgraph_out = cgraph;
+	return 0;
+
+error:
+	git_commit_graph_free(cgraph);
+	return error;
+}
+
+void git_commit_graph_refresh(git_commit_graph *cgraph)
+{
+	git_commit_graph_file *retired = NULL;
+
+	if (!cgraph)
+		return;
+
+	if (git_mutex_lock(&cgraph->lock) < 0)
+		return;
+
+	if (!cgraph->checked)
+		goto done;
+
+	if (cgraph->file && !cgraph->split &&
+		!git_commit_graph_file_needs_refresh(cgraph->file, git_buf_cstr(&cgraph->filename)))
+		goto done;
+
+	if (cgraph->file && cgraph->split &&
+		!git_path_exists(git_buf_cstr(&cgraph->filename)) &&
+		git_futils_filestamp_check(
+			&cgraph->chain_stamp, git_buf_cstr(&cgraph->chain_filename)) == 0)
+		goto done;
+
+	/* readers which got the file before keep their own reference */
+	retired = cgraph->file;
+	cgraph->file = NULL;
+	cgraph->checked = 0;
+
+done:
+	git_mutex_unlock(&cgraph->lock);
+	git_commit_graph_file_free(retired);
+}
+
+/* Find the layer of a split commit-graph that holds the commit at `pos`. */
+static const git_commit_graph_file *commit_graph_layer(
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	while (file && pos < file->num_commits_in_base)
+		file = file->base;
+
+	return file;
+}
+
+static int git_commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	const unsigned char *commit_data;
+	size_t local_pos;
+
+	assert(e && file);
+
+	file = commit_graph_layer(file, pos);
+	if (!file || pos - file->num_commits_in_base >= file->num_commits) {
+		giterr_set(GITERR_INVALID, "commit index %u does not exist", (unsigned int)pos);
+		return GIT_ENOTFOUND;
+	}
+	local_pos = pos - file->num_commits_in_base;
+
+	commit_data = file->commit_data + local_pos * COMMIT_GRAPH_COMMIT_DATA_SIZE;
+	git_oid_cpy(&e->tree_oid, (const git_oid *)commit_data);
+	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ)));
+	e->parent_indices[1] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t))));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+	e->generation = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t))));
+	e->commit_time = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t))));
+
+	e->commit_time |= (git_time_t)(e->generation & 0x3) << 32;
+	e->generation >>= 2u;
+	if (e->parent_indices[1] & COMMIT_GRAPH_EXTRA_EDGE_NEEDED) {
+		const unsigned char *extra_edge_list;
+		size_t extra_edge_list_pos;
+
+		extra_edge_list_pos = e->parent_indices[1] & ~COMMIT_GRAPH_EXTRA_EDGE_NEEDED;
+		e->extra_parents_index = extra_edge_list_pos;
+
+		/* Count all the parents of an octopus merge */
+		while (1) {
+			uint32_t parent;
+
+			if (extra_edge_list_pos >= file->num_extra_edge_list) {
+				giterr_set(GITERR_INVALID,
+					"commit %u does not exist", (unsigned int)extra_edge_list_pos);
+				return GIT_ENOTFOUND;
+			}
+
+			extra_edge_list = file->extra_edge_list + extra_edge_list_pos * sizeof(uint32_t);
+			parent = ntohl(*((uint32_t *)extra_edge_list));
+
+			/* the second parent was already counted: it's the first edge */
+			if (parent & COMMIT_GRAPH_LAST_EDGE)
+				break;
+
+			e->parent_count++;
+			extra_edge_list_pos++;
+		}
+	}
+
+	git_oid_cpy(&e->sha1, &file->oid_lookup[local_pos]);
+	e->position = pos;
+	return 0;
+}
+
+bool git_commit_graph_file_needs_refresh(
+		git_commit_graph_file *file, const char *path)
+{
+	/* Refresh if the file disappeared, or if it was rewritten in place. */
+	return git_futils_filestamp_check(&file->stamp, path) != 0;
+}
+
+/*
+ * Look for a commit in a single layer. Returns 1 when found, 2 when the short
+ * oid is ambiguous and 0 otherwise.
+ */
+static int commit_graph_layer_find(
+		size_t *out,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	hi = ntohl(file->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = file->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)file->num_commits) {
+			current = file->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)file->num_commits) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len))
+			found = 2;
+	}
+
+	*out = file->num_commits_in_base + (size_t)pos;
+	return found;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	const git_commit_graph_file *layer;
+	size_t pos = 0;
+	int found = 0;
+
+	assert(e && file && short_oid);
+
+	for (layer = file; layer; layer = layer->base) {
+		if ((found = commit_graph_layer_find(&pos, layer, short_oid, len)) != 0)
+			break;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for commit-graph index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for commit-graph index entry");
+
+	return git_commit_graph_entry_get_byindex(e, file, pos);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	const git_commit_graph_file *layer;
+
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "parent index %u does not exist", (unsigned int)n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	/* The extra edges live in the layer of the octopus merge itself */
+	layer = commit_graph_layer(file, entry->position);
+	assert(layer);
+
+	return git_commit_graph_entry_get_byindex(
+			parent,
+			file,
+			ntohl(
+				*(uint32_t *)(layer->extra_edge_list
+					      + (entry->extra_parents_index + n - 1)
+							* sizeof(uint32_t)))
+				& ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+static void commit_graph_file_free(git_commit_graph_file *file)
+{
+	git_commit_graph_file *base;
+
+	/* the base layers belong to the file above them */
+	while (file) {
+		base = file->base;
+
+		if (file->graph_map.data)
+			git_futils_mmap_free(&file->graph_map);
+		git__free(file);
+
+		file = base;
+	}
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	GIT_REFCOUNT_DEC(file, commit_graph_file_free);
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	if (!cgraph)
+		return;
+
+	git_buf_free(&cgraph->filename);
+	git_buf_free(&cgraph->chain_filename);
+	git_commit_graph_file_free(cgraph->file);
+	git_mutex_free(&cgraph->lock);
+	git__free(cgraph);
+}
+
+/***********************************************************
+ *
+ * COMMIT-GRAPH WRITER
+ *
+ ***********************************************************/
+
+typedef git_array_t(git_oid) packed_commit_oid_array_t;
+
+typedef struct {
+	git_oid sha1;
+	git_oid tree_oid;
+	git_time_t commit_time;
+	packed_commit_oid_array_t parents;
+
+	/* Filled in while writing the graph */
+	bool in_base;
+	size_t index;
+	uint32_t generation;
+} packed_commit;
+
+struct git_commit_graph_writer {
+	git_buf objects_info_dir;
+
+	/* The commits to write, and a map from their ids to them */
+	git_vector commits;
+	git_oidmap *commit_map;
+};
+
+static void packed_commit_free(packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git__free(p);
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const packed_commit *a = a_;
+	const packed_commit *b = b_;
+
+	return git_oid__cmp(&a->sha1, &b->sha1);
+}
+
+int git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir)
+{
+	git_commit_graph_writer *w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0 ||
+		git_vector_init(&w->commits, 0, packed_commit__cmp) < 0 ||
+		(w->commit_map = git_oidmap_alloc()) == NULL) {
+		git_commit_graph_writer_free(w);
+		giterr_set_oom();
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	packed_commit *p;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->commits, i, p)
+		packed_commit_free(p);
+	git_vector_free(&w->commits);
+	if (w->commit_map)
+		git_oidmap_free(w->commit_map);
+	git_buf_free(&w->objects_info_dir);
+	git__free(w);
+}
+
+static int packed_commit_from_graph(
+		packed_commit *p,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	git_oid *parent_id;
+	size_t i;
+
+	git_oid_cpy(&p->sha1, &e->sha1);
+	git_oid_cpy(&p->tree_oid, &e->tree_oid);
+	p->commit_time = e->commit_time;
+
+	for (i = 0; i < e->parent_count; ++i) {
+		if (git_commit_graph_entry_parent(&parent, file, e, i) < 0)
+			return -1;
+
+		parent_id = git_array_alloc(p->parents);
+		GITERR_CHECK_ALLOC(parent_id);
+		git_oid_cpy(parent_id, &parent.sha1);
+	}
+
+	return 0;
+}
+
+static int packed_commit_from_odb(
+		packed_commit *p,
+		git_repository *repo,
+		const git_oid *id)
+{
+	git_commit *commit;
+	git_oid *parent_id;
+	unsigned int i;
+
+	if (git_commit_lookup(&commit, repo, id) < 0)
+		return -1;
+
+	git_oid_cpy(&p->sha1, id);
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = git_commit_time(commit);
+
+	for (i = 0; i < git_commit_parentcount(commit); ++i) {
+		if ((parent_id = git_array_alloc(p->parents)) == NULL) {
+			git_commit_free(commit);
+			giterr_set_oom();
+			return -1;
+		}
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	git_commit_free(commit);
+	return 0;
+}
+
+static int packed_commit_insert(git_commit_graph_writer *w, packed_commit *p)
+{
+	khiter_t pos;
+	int ret;
+
+	if (git_vector_insert(&w->commits, p) < 0)
+		return -1;
+
+	pos = kh_put(oid, w->commit_map, &p->sha1, &ret);
+	if (ret < 0) {
+		git_vector_pop(&w->commits);
+		giterr_set_oom();
+		return -1;
+	}
+	kh_value(w->commit_map, pos) = p;
+
+	return 0;
+}
+
+static packed_commit *packed_commit_lookup(git_commit_graph_writer *w, const git_oid *id)
+{
+	khiter_t pos = kh_get(oid, w->commit_map, id);
+
+	if (pos == kh_end(w->commit_map))
+		return NULL;
+
+	return kh_value(w->commit_map, pos);
+}
+
+/*
+ * Add a commit to the writer, reading it from the current commit-graph
+ * when possible, and queue its parents that the writer does not have yet.
+ */
+static int packed_commit_add(
+		git_commit_graph_writer *w,
+		git_repository *repo,
+		const git_commit_graph_file *file,
+		const git_oid *id,
+		packed_commit_oid_array_t *pending)
+{
+	packed_commit *p;
+	git_commit_graph_entry e;
+	git_oid *parent_id;
+	size_t i;
+	int error;
+
+	if (packed_commit_lookup(w, id) != NULL)
+		return 0;
+
+	p = git__calloc(1, sizeof(packed_commit));
+	GITERR_CHECK_ALLOC(p);
+
+	if (file && git_commit_graph_entry_find(&e, file, id, GIT_OID_HEXSZ) == 0) {
+		error = packed_commit_from_graph(p, file, &e);
+	} else {
+		giterr_clear();
+		error = packed_commit_from_odb(p, repo, id);
+	}
+
+	if (error < 0 || (error = packed_commit_insert(w, p)) < 0) {
+		packed_commit_free(p);
+		return error;
+	}
+
+	for (i = 0; i < git_array_size(p->parents); ++i) {
+		if (packed_commit_lookup(w, git_array_get(p->parents, i)) != NULL)
+			continue;
+
+		parent_id = git_array_alloc(*pending);
+		GITERR_CHECK_ALLOC(parent_id);
+		git_oid_cpy(parent_id, git_array_get(p->parents, i));
+	}
+
+	return 0;
+}
+
+int git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk)
+{
+	git_commit_graph_file *file = NULL;
+	packed_commit_oid_array_t pending = GIT_ARRAY_INIT;
+	git_oid id, *pending_id;
+	int error;
+
+	assert(w && walk);
+
+	/* What the current commit-graph knows does not need to be inflated */
+	if (git_odb__get_commit_graph_file(&file, walk->odb) < 0)
+		file = NULL;
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = packed_commit_add(w, walk->repo, file, &id, &pending)) < 0)
+			goto cleanup;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto cleanup;
+
+	/* The graph must be closed under reachability: add hidden ancestors */
+	while ((pending_id = git_array_pop(pending)) != NULL) {
+		git_oid_cpy(&id, pending_id);
+
+		if ((error = packed_commit_add(w, walk->repo, file, &id, &pending)) < 0)
+			goto cleanup;
+	}
+
+	error = 0;
+
+cleanup:
+	git_commit_graph_file_free(file);
+	git_array_clear(pending);
+	return error;
+}
+
+/*
+ * Decide which layers of the chain are kept below the new one, and add the
+ * commits of the others to the writer, so that they are merged into it.
+ */
+static int commit_graph_split_base(
+		git_commit_graph_file **base_out,
+		git_commit_graph_writer *w,
+		git_commit_graph_file *chain,
+		const git_commit_graph_writer_options *opts)
+{
+	packed_commit_oid_array_t pending = GIT_ARRAY_INIT;
+	git_commit_graph_file *base = chain;
+	git_commit_graph_entry e;
+	float size_multiple = opts->size_multiple > 0 ? opts->size_multiple : 2.0f;
+	size_t num_commits = 0, i;
+	packed_commit *p;
+	int error = 0;
+
+	git_vector_foreach(&w->commits, i, p) {
+		if (git_commit_graph_entry_find(&e, chain, &p->sha1, GIT_OID_HEXSZ) < 0)
+			num_commits++;
+	}
+	giterr_clear();
+
+	while (num_commits > 0 && base &&
+		(float)base->num_commits <= size_multiple * num_commits) {
+		for (i = 0; i < base->num_commits; ++i) {
+			if ((error = git_commit_graph_entry_get_byindex(
+					&e, base, base->num_commits_in_base + i)) < 0 ||
+				(error = packed_commit_add(w, NULL, base, &e.sha1, &pending)) < 0)
+				goto cleanup;
+		}
+
+		num_commits += base->num_commits;
+		base = base->base;
+	}
+
+	*base_out = base;
+
+cleanup:
+	git_array_clear(pending);
+	return error;
+}
+
+/* Sort the commits of the new graph, and compute their generation numbers. */
+static int commit_graph_prepare(
+		git_vector *commits,
+		git_commit_graph_writer *w,
+		const git_commit_graph_file *base)
+{
+	git_array_t(packed_commit *) stack = GIT_ARRAY_INIT;
+	git_commit_graph_entry e;
+	packed_commit *p, *parent, **top;
+	size_t i, j;
+	int error = 0;
+
+	git_vector_foreach(&w->commits, i, p) {
+		p->in_base = (base &&
+			git_commit_graph_entry_find(&e, base, &p->sha1, GIT_OID_HEXSZ) == 0);
+		p->generation = 0;
+
+		if (!p->in_base && git_vector_insert(commits, p) < 0)
+			return -1;
+	}
+	giterr_clear();
+
+	git_vector_sort(commits);
+	git_vector_foreach(commits, i, p)
+		p->index = (base ? base->num_commits_in_base + base->num_commits : 0) + i;
+
+	/* A commit's generation is one more than the highest of its parents' */
+	git_vector_foreach(commits, i, p) {
+		if (p->generation)
+			continue;
+
+		if ((top = git_array_alloc(stack)) == NULL)
+			goto on_oom;
+		*top = p;
+
+		while ((top = git_array_last(stack)) != NULL) {
+			uint32_t generation = 1;
+			bool ready = true;
+
+			p = *top;
+
+			for (j = 0; j < git_array_size(p->parents); ++j) {
+				const git_oid *parent_id = git_array_get(p->parents, j);
+
+				if ((parent = packed_commit_lookup(w, parent_id)) != NULL && !parent->in_base) {
+					if (!parent->generation) {
+						if ((top = git_array_alloc(stack)) == NULL)
+							goto on_oom;
+						*top = parent;
+						ready = false;
+					} else if (parent->generation >= generation) {
+						generation = parent->generation + 1;
+					}
+				} else if (base &&
+					git_commit_graph_entry_find(&e, base, parent_id, GIT_OID_HEXSZ) == 0) {
+					if (e.generation >= generation)
+						generation = (uint32_t)e.generation + 1;
+				} else {
+					error = git_odb__error_notfound(
+						"commit-graph is missing a parent", parent_id);
+					goto cleanup;
+				}
+			}
+
+			if (ready) {
+				p->generation = generation > GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX ?
+					GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX : generation;
+				git_array_pop(stack);
+			}
+		}
+	}
+
+cleanup:
+	git_array_clear(stack);
+	return error;
+
+on_oom:
+	git_array_clear(stack);
+	giterr_set_oom();
+	return -1;
+}
+
+static int commit_graph_parent_index(
+		uint32_t *out,
+		git_commit_graph_writer *w,
+		const git_commit_graph_file *base,
+		const git_oid *parent_id)
+{
+	git_commit_graph_entry e;
+	packed_commit *parent;
+
+	if ((parent = packed_commit_lookup(w, parent_id)) != NULL && !parent->in_base) {
+		*out = (uint32_t)parent->index;
+		return 0;
+	}
+
+	if (git_commit_graph_entry_find(&e, base, parent_id, GIT_OID_HEXSZ) < 0)
+		return -1;
+
+	*out = (uint32_t)e.position;
+	return 0;
+}
+
+static int commit_graph_put_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int commit_graph_write_chunk_header(git_buf *buf, uint32_t id, uint64_t offset)
+{
+	if (commit_graph_put_be32(buf, id) < 0 ||
+		commit_graph_put_be32(buf, (uint32_t)(offset >> 32)) < 0)
+		return -1;
+	return commit_graph_put_be32(buf, (uint32_t)(offset & 0xffffffff));
+}
+
+static int commit_graph_write_buf(
+		git_buf *cgraph,
+		git_commit_graph_writer *w,
+		git_vector *commits,
+		const git_commit_graph_file *base)
+{
+	struct git_commit_graph_header hdr = {0};
+	git_buf oid_lookup = GIT_BUF_INIT,
+		commit_data = GIT_BUF_INIT,
+		extra_edge_list = GIT_BUF_INIT,
+		base_graphs = GIT_BUF_INIT;
+	uint32_t fanout[256] = {0}, parent_index;
+	uint64_t offset, time;
+	packed_commit *p;
+	git_oid checksum;
+	size_t i, j, num_extra_edges = 0;
+	int error = 0;
+
+	git_vector_foreach(commits, i, p) {
+		size_t parent_count = git_array_size(p->parents);
+		uint32_t parents[2] = {
+			GIT_COMMIT_GRAPH_MISSING_PARENT, GIT_COMMIT_GRAPH_MISSING_PARENT
+		};
+
+		fanout[p->sha1.id[0]]++;
+
+		for (j = 0; j < parent_count; ++j) {
+			if ((error = commit_graph_parent_index(&parent_index, w, base,
+					git_array_get(p->parents, j))) < 0)
+				goto cleanup;
+
+			if (j == 0 || parent_count == 2) {
+				parents[j] = parent_index;
+				continue;
+			}
+
+			/* An octopus merge lists all but its first parent in EDGE */
+			if (j == 1)
+				parents[1] = COMMIT_GRAPH_EXTRA_EDGE_NEEDED | (uint32_t)num_extra_edges;
+			if (j == parent_count - 1)
+				parent_index |= COMMIT_GRAPH_LAST_EDGE;
+
+			if ((error = commit_graph_put_be32(&extra_edge_list, parent_index)) < 0)
+				goto cleanup;
+			num_extra_edges++;
+		}
+
+		time = (uint64_t)p->commit_time;
+		if ((error = git_buf_put(&oid_lookup, (const char *)p->sha1.id, GIT_OID_RAWSZ)) < 0 ||
+			(error = git_buf_put(&commit_data, (const char *)p->tree_oid.id, GIT_OID_RAWSZ)) < 0 ||
+			(error = commit_graph_put_be32(&commit_data, parents[0])) < 0 ||
+			(error = commit_graph_put_be32(&commit_data, parents[1])) < 0 ||
+			(error = commit_graph_put_be32(&commit_data,
+				(p->generation << 2) | (uint32_t)((time >> 32) & 0x3))) < 0 ||
+			(error = commit_graph_put_be32(&commit_data, (uint32_t)(time & 0xffffffff))) < 0)
+			goto cleanup;
+	}
+
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	/* A layer lists all the ones below it, from the bottom up */
+	if (base) {
+		if ((error = git_buf_put(&base_graphs, (const char *)base->base_graphs,
+				base->num_base_graphs * GIT_OID_RAWSZ)) < 0 ||
+			(error = git_buf_put(&base_graphs,
+				(const char *)base->checksum.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+	}
+
+	/* Write the header */
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = 3 + (num_extra_edges ? 1 : 0) + (base ? 1 : 0);
+	hdr.base_graph_files = (uint8_t)(base ? base->num_base_graphs + 1 : 0);
+
+	git_buf_clear(cgraph);
+	if ((error = git_buf_put(cgraph, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk headers, followed by the terminating one */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_HEADER_SIZE;
+
+	if ((error = commit_graph_write_chunk_header(cgraph, COMMIT_GRAPH_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += sizeof(fanout);
+	if ((error = commit_graph_write_chunk_header(cgraph, COMMIT_GRAPH_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = commit_graph_write_chunk_header(cgraph, COMMIT_GRAPH_COMMIT_DATA_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&commit_data);
+	if (num_extra_edges) {
+		if ((error = commit_graph_write_chunk_header(cgraph, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&extra_edge_list);
+	}
+	if (base) {
+		if ((error = commit_graph_write_chunk_header(cgraph, COMMIT_GRAPH_BASE_GRAPHS_LIST_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&base_graphs);
+	}
+	if ((error = commit_graph_write_chunk_header(cgraph, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write the chunks themselves */
+	for (i = 0; i < 256; ++i) {
+		if ((error = commit_graph_put_be32(cgraph, fanout[i])) < 0)
+			goto cleanup;
+	}
+	if ((error = git_buf_put(cgraph,
+			git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup))) < 0 ||
+		(error = git_buf_put(cgraph,
+			git_buf_cstr(&commit_data), git_buf_len(&commit_data))) < 0 ||
+		(error = git_buf_put(cgraph,
+			git_buf_cstr(&extra_edge_list), git_buf_len(&extra_edge_list))) < 0 ||
+		(error = git_buf_put(cgraph,
+			git_buf_cstr(&base_graphs), git_buf_len(&base_graphs))) < 0)
+		goto cleanup;
+
+	/* And the trailer: a checksum of everything that precedes it */
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(cgraph), git_buf_len(cgraph))) < 0)
+		goto cleanup;
+	error = git_buf_put(cgraph, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_buf_free(&oid_lookup);
+	git_buf_free(&commit_data);
+	git_buf_free(&extra_edge_list);
+	git_buf_free(&base_graphs);
+	return error;
+}
+
+/*
+ * Build the file to write. When splitting, `chain_out` gets the current
+ * chain (if any) and `base_out` the layer the new one goes on top of.
+ */
+static int commit_graph_writer_build(
+		git_buf *cgraph,
+		git_commit_graph_file **chain_out,
+		git_commit_graph_file **base_out,
+		git_commit_graph_writer *w,
+		const git_commit_graph_writer_options *given_opts)
+{
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_commit_graph_file *chain = NULL, *base = NULL;
+	git_buf chain_path = GIT_BUF_INIT;
+	git_vector commits = GIT_VECTOR_INIT;
+	int error = 0;
+
+	if (given_opts) {
+		GITERR_CHECK_VERSION(given_opts,
+			GIT_COMMIT_GRAPH_WRITER_OPTIONS_VERSION, "git_commit_graph_writer_options");
+		memcpy(&opts, given_opts, sizeof(opts));
+	}
+
+	if (opts.split_strategy == GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SPLIT) {
+		if ((error = git_buf_joinpath(&chain_path, git_buf_cstr(&w->objects_info_dir),
+				GIT_COMMIT_GRAPH_INFO_CHAIN_FILE)) < 0)
+			goto cleanup;
+
+		if (git_path_exists(git_buf_cstr(&chain_path)) &&
+			((error = git_commit_graph_chain_open(&chain, git_buf_cstr(&chain_path))) < 0 ||
+			 (error = commit_graph_split_base(&base, w, chain, &opts)) < 0))
+			goto cleanup;
+	}
+
+	if ((error = git_vector_init(&commits, git_vector_length(&w->commits), packed_commit__cmp)) < 0 ||
+		(error = commit_graph_prepare(&commits, w, base)) < 0)
+		goto cleanup;
+
+	/* Nothing new to add to the chain */
+	if (opts.split_strategy == GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SPLIT &&
+		git_vector_length(&commits) == 0) {
+		git_buf_clear(cgraph);
+		goto cleanup;
+	}
+
+	error = commit_graph_write_buf(cgraph, w, &commits, base);
+
+cleanup:
+	git_vector_free(&commits);
+	git_buf_free(&chain_path);
+
+	if (error < 0 || !chain_out) {
+		git_commit_graph_file_free(chain);
+	} else {
+		*chain_out = chain;
+		*base_out = base;
+	}
+
+	return error;
+}
+
+int git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w,
+		const git_commit_graph_writer_options *opts)
+{
+	assert(cgraph && w);
+
+	return commit_graph_writer_build(cgraph, NULL, NULL, w, opts);
+}
+
+static int commit_graph_write_file(const char *path, const git_buf *contents)
+{
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	if ((error = git_futils_mkpath2file(path, GIT_OBJECT_DIR_MODE)) < 0 ||
+		(error = git_filebuf_open(&output, path, 0, GIT_OBJECT_FILE_MODE)) < 0)
+		return error;
+
+	if ((error = git_filebuf_write(&output,
+			git_buf_cstr(contents), git_buf_len(contents))) < 0) {
+		git_filebuf_cleanup(&output);
+		return error;
+	}
+
+	return git_filebuf_commit(&output);
+}
+
+static int commit_graph_layer_path(git_buf *path, const char *dir, const git_oid *id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(hex, sizeof(hex), id);
+
+	git_buf_clear(path);
+	return git_buf_printf(path, "%s/graph-%s.graph", dir, hex);
+}
+
+int git_commit_graph_writer_commit(
+		git_commit_graph_writer *w,
+		const git_commit_graph_writer_options *opts)
+{
+	git_buf cgraph = GIT_BUF_INIT, path = GIT_BUF_INIT,
+		chain_dir = GIT_BUF_INIT, chain = GIT_BUF_INIT;
+	git_commit_graph_file *chain_file = NULL, *base = NULL, *layer;
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid checksum;
+	size_t i;
+	int error;
+
+	assert(w);
+
+	if ((error = commit_graph_writer_build(&cgraph, &chain_file, &base, w, opts)) < 0 ||
+		(error = git_buf_joinpath(&path, git_buf_cstr(&w->objects_info_dir),
+			GIT_COMMIT_GRAPH_INFO_FILE)) < 0)
+		goto cleanup;
+
+	if (!opts || opts->split_strategy != GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SPLIT) {
+		error = commit_graph_write_file(git_buf_cstr(&path), &cgraph);
+		goto cleanup;
+	}
+
+	/* The chain is already up to date */
+	if (git_buf_len(&cgraph) == 0)
+		goto cleanup;
+
+	/* Write the new layer, named after its checksum... */
+	if ((error = git_buf_joinpath(&chain_dir, git_buf_cstr(&w->objects_info_dir),
+			GIT_COMMIT_GRAPH_INFO_CHAIN_DIR)) < 0)
+		goto cleanup;
+
+	git_oid_fromraw(&checksum, (const unsigned char *)git_buf_cstr(&cgraph) +
+		git_buf_len(&cgraph) - GIT_OID_RAWSZ);
+	if ((error = commit_graph_layer_path(&path, git_buf_cstr(&chain_dir), &checksum)) < 0 ||
+		(error = commit_graph_write_file(git_buf_cstr(&path), &cgraph)) < 0)
+		goto cleanup;
+
+	/* ...then the chain that ends with it... */
+	for (i = 0; base && i < base->num_base_graphs; ++i) {
+		git_oid_tostr(hex, sizeof(hex), &base->base_graphs[i]);
+		git_buf_printf(&chain, "%s\n", hex);
+	}
+	if (base) {
+		git_oid_tostr(hex, sizeof(hex), &base->checksum);
+		git_buf_printf(&chain, "%s\n", hex);
+	}
+	git_oid_tostr(hex, sizeof(hex), &checksum);
+	git_buf_printf(&chain, "%s\n", hex);
+
+	if (git_buf_oom(&chain) ||
+		(error = git_buf_joinpath(&path, git_buf_cstr(&w->objects_info_dir),
+			GIT_COMMIT_GRAPH_INFO_CHAIN_FILE)) < 0 ||
+		(error = commit_graph_write_file(git_buf_cstr(&path), &chain)) < 0) {
+		error = -1;
+		goto cleanup;
+	}
+
+	/* ...and drop the layers that were merged into it. */
+	for (layer = chain_file; layer != base; layer = layer->base) {
+		if (commit_graph_layer_path(&path, git_buf_cstr(&chain_dir), &layer->checksum) < 0 ||
+			p_unlink(git_buf_cstr(&path)) < 0)
+			giterr_clear();
+	}
+
+	/* A single commit-graph file would hide the chain */
+	if (git_buf_joinpath(&path, git_buf_cstr(&w->objects_info_dir),
+			GIT_COMMIT_GRAPH_INFO_FILE) == 0 &&
+		git_path_exists(git_buf_cstr(&path)) &&
+		(error = p_unlink(git_buf_cstr(&path))) < 0)
+		giterr_set(GITERR_OS, "Failed to remove '%s'", git_buf_cstr(&path));
+
+cleanup:
+	git_commit_graph_file_free(chain_file);
+	git_buf_free(&cgraph);
+	git_buf_free(&path);
+	git_buf_free(&chain_dir);
+	git_buf_free(&chain);
+	return error;
+}
+
+int git_commit_graph_write(
+		git_revwalk *walk,
+		const git_commit_graph_writer_options *opts)
+{
+	git_commit_graph_writer *w = NULL;
+	git_buf objects_info_dir = GIT_BUF_INIT;
+	int error;
+
+	assert(walk);
+
+	if ((error = git_buf_joinpath(&objects_info_dir,
+			walk->repo->path_repository, GIT_OBJECTS_DIR "info")) < 0 ||
+		(error = git_commit_graph_writer_new(&w, git_buf_cstr(&objects_info_dir))) < 0 ||
+		(error = git_commit_graph_writer_add_revwalk(w, walk)) < 0 ||
+		(error = git_commit_graph_writer_commit(w, opts)) < 0)
+		goto cleanup;
+
+	/* Have the repository pick up the new graph */
+	git_commit_graph_refresh(walk->odb->cgraph);
+
+cleanup:
+	git_commit_graph_writer_free(w);
+	git_buf_free(&objects_info_dir);
+	return error;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "git2/oid.h"
+
+#include "common.h"
+#include "buffer.h"
+#include "fileops.h"
+#include "map.h"
+#include "thread-utils.h"
+
+/* Paths relative to the `objects/info` directory */
+#define GIT_COMMIT_GRAPH_INFO_FILE "commit-graph"
+#define GIT_COMMIT_GRAPH_INFO_CHAIN_DIR "commit-graphs"
+#define GIT_COMMIT_GRAPH_INFO_CHAIN_FILE GIT_COMMIT_GRAPH_INFO_CHAIN_DIR "/commit-graph-chain"
+
+/* Paths relative to the `objects` directory */
+#define GIT_COMMIT_GRAPH_FILE "info/" GIT_COMMIT_GRAPH_INFO_FILE
+#define GIT_COMMIT_GRAPH_CHAIN_FILE "info/" GIT_COMMIT_GRAPH_INFO_CHAIN_FILE
+
+#define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX 0x3FFFFFFF
+
+/*
+ * A commit-graph file.
+ *
+ * This file contains metadata about commits, particularly the generation
+ * number for each one. This can help speed up graph operations without
+ * requiring a full graph traversal.
+ *
+ * The on-disk format is documented in git's
+ * Documentation/technical/commit-graph-format.txt: a header, a chunk table,
+ * an oid fanout (OIDF), the sorted oids (OIDL), the per-commit data (CDAT),
+ * the optional octopus parent list (EDGE) and a trailing SHA-1 of all that
+ * precedes it.
+ *
+ * A split commit-graph is a chain of such files (layers), listed from the
+ * bottom up in `info/commit-graphs/commit-graph-chain`. Each layer only
+ * holds the commits that are not in the layers below it, which are listed
+ * in its BASE chunk; commit positions (including the parent indices in the
+ * Commit Data) are global, and count the commits of all the lower layers
+ * first.
+ */
+typedef struct git_commit_graph_file {
+	/* Held by the git_commit_graph it was loaded for, and by its users. */
+	git_refcount rc;
+
+	git_map graph_map;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of commits in the graph. */
+	uint32_t num_commits;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/*
+	 * The Commit Data table. Each entry contains the OID of the commit followed
+	 * by two 8-byte fields in network byte order:
+	 * - The indices of the first two parents (32 bits each).
+	 * - The generation number (first 30 bits) and commit time in seconds since
+	 *   UNIX epoch (34 bits).
+	 */
+	const unsigned char *commit_data;
+
+	/*
+	 * The Extra Edge List table. Each 4-byte entry is a network byte order index
+	 * of one of the i-th (i > 0) parents of commits in the `commit_data` table,
+	 * when the commit has more than 2 parents.
+	 */
+	const unsigned char *extra_edge_list;
+	/* The number of entries in the Extra Edge List table. Each entry is 4 bytes wide. */
+	size_t num_extra_edge_list;
+
+	/* The number of layers below this one, as recorded in the header. */
+	size_t num_base_graphs;
+
+	/* The BASE chunk: the checksums of the layers below this one. */
+	const git_oid *base_graphs;
+
+	/* The layer below this one in a split commit-graph; owned by this file. */
+	struct git_commit_graph_file *base;
+
+	/* The number of commits in all the layers below this one. */
+	size_t num_commits_in_base;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/* Stat data of the file when it was loaded, used to detect rewrites. */
+	git_futils_filestamp stamp;
+} git_commit_graph_file;
+
+/*
+ * An entry in the commit-graph file. Provides a subset of the information that
+ * can be obtained from the commit header.
+ */
+typedef struct git_commit_graph_entry {
+	/* The generation number of the commit within the graph */
+	size_t generation;
+
+	/* Time in seconds from UNIX epoch. */
+	git_time_t commit_time;
+
+	/* The number of parents of the commit. */
+	size_t parent_count;
+
+	/*
+	 * The indices of the parent commits within the Commit Data table. The value
+	 * of `GIT_COMMIT_GRAPH_MISSING_PARENT` indicates that no parent is in that
+	 * position.
+	 */
+	size_t parent_indices[2];
+
+	/* The index within the Extra Edge List of any parent after the first two. */
+	size_t extra_parents_index;
+
+	/* The SHA-1 hash of the root tree of the commit. */
+	git_oid tree_oid;
+
+	/* The SHA-1 hash of the requested commit. */
+	git_oid sha1;
+
+	/* The global position of the commit in the (possibly split) graph. */
+	size_t position;
+} git_commit_graph_entry;
+
+/* A wrapper for git_commit_graph_file to enable lazy loading in the ODB. */
+typedef struct git_commit_graph {
+	/* The path to the commit-graph file. Something like ".git/objects/info/commit-graph". */
+	git_buf filename;
+
+	/* The path to the chain of a split commit-graph, used when `filename` is missing. */
+	git_buf chain_filename;
+
+	/* The underlying commit-graph file, or the top layer of the chain. */
+	git_commit_graph_file *file;
+
+	/* Whether `file` was loaded from the chain, and the chain's stat data. */
+	bool split;
+	git_futils_filestamp chain_stamp;
+
+	/* Whether the commit-graph file was already checked for validity. */
+	bool checked;
+
+	/* Protects the lazy loading of `file`. */
+	git_mutex lock;
+} git_commit_graph;
+
+/* Create a new commit-graph, optionally opening the underlying file. */
+int git_commit_graph_new(git_commit_graph **cgraph_out, const char *objects_dir, bool open_file);
+
+/*
+ * Get the underlying commit-graph file; returns GIT_ENOTFOUND if the
+ * repository has none (or it is unusable).  The file stays valid across
+ * refreshes until the caller releases it with git_commit_graph_file_free.
+ */
+int git_commit_graph_get_file(git_commit_graph_file **file_out, git_commit_graph *cgraph);
+
+/*
+ * Make the commit-graph be checked again on its next use, in case the file
+ * was written or removed in the meantime.
+ */
+void git_commit_graph_refresh(git_commit_graph *cgraph);
+void git_commit_graph_free(git_commit_graph *cgraph);
+
+/* Open and validate a commit-graph file. */
+int git_commit_graph_file_open(git_commit_graph_file **file_out, const char *path);
+
+/*
+ * Open all the layers of a split commit-graph, returning the topmost one.
+ * The layers are looked up next to the chain file.
+ */
+int git_commit_graph_chain_open(git_commit_graph_file **file_out, const char *chain_path);
+
+/*
+ * Returns whether the git_commit_graph_file needs to be reloaded since the
+ * contents of the commit-graph file have changed on disk.
+ */
+bool git_commit_graph_file_needs_refresh(
+		git_commit_graph_file *file, const char *path);
+
+/*
+ * Find a commit in the graph, looking in the lower layers of a split graph
+ * when it is not in the given one.
+ */
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len);
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n);
+
+/* Release a reference to a file, freeing it (and its base layers) with the last one. */
+void git_commit_graph_file_free(git_commit_graph_file *file);
+
+/* Parse an in-memory commit-graph; exposed for the tests. */
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size);
+
+#endif
@@ -19,6 +19,17 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return (commit_a->time < commit_b->time);
 }
 
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	uint32_t generation_a = git_commit_list_generation((const git_commit_list_node *)a);
+	uint32_t generation_b = git_commit_list_generation((const git_commit_list_node *)b);
+
+	if (generation_a != generation_b)
+		return (generation_a < generation_b);
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -174,14 +185,54 @@ static int commit_quick_parse(
 	return 0;
 }
 
+static int commit_quick_parse_graph(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *cgraph_file,
+	git_commit_graph_entry *e)
+{
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, e->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e->parent_count; ++i) {
+		git_commit_graph_entry parent;
+
+		if (git_commit_graph_entry_parent(&parent, cgraph_file, e, i) < 0)
+			return commit_error(commit, "commit-graph is corrupted");
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)e->parent_count;
+	commit->generation = (uint32_t)e->generation;
+	commit->time = (uint32_t)e->commit_time;
+	commit->parsed = 1;
+	return 0;
+}
+
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	/* The commit-graph has all we need, without inflating the commit */
+	if (git_revwalk__commit_graph_file(&cgraph_file, walk) == 0) {
+		if (git_commit_graph_entry_find(&e, cgraph_file, &commit->oid, GIT_OID_HEXSZ) == 0 &&
+			e.parent_count <= USHRT_MAX)
+			return commit_quick_parse_graph(walk, commit, cgraph_file, &e);
+
+		giterr_clear();
+	}
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
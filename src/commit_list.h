@@ -14,6 +14,14 @@
 #define RESULT   (1 << 2)
 #define STALE    (1 << 3)
 
+/*
+ * Commits that are not in the commit-graph have no generation number (0);
+ * they are newer than all the commits that are, so count them as infinite.
+ */
+#define GIT_COMMIT_LIST_GENERATION_INFINITY 0xFFFFFFFF
+#define git_commit_list_generation(c) \
+	((c)->generation ? (c)->generation : GIT_COMMIT_LIST_GENERATION_INFINITY)
+
 #define PARENTS_PER_COMMIT	2
 #define COMMIT_ALLOC \
 	(sizeof(git_commit_list_node) + PARENTS_PER_COMMIT * sizeof(git_commit_list_node *))
@@ -21,6 +29,7 @@
 typedef struct git_commit_list_node {
 	git_oid oid;
 	uint32_t time;
+	uint32_t generation;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -40,6 +49,7 @@ typedef struct git_commit_list {
 
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk);
 int git_commit_list_time_cmp(const void *a, const void *b);
+int git_commit_list_generation_cmp(const void *a, const void *b);
 void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
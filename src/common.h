@@ -67,6 +67,13 @@
  */
 #define GITERR_CHECK_ALLOC(ptr) if (ptr == NULL) { return -1; }
 
+/**
+ * Compute the size of `nelem` elements of `elsize` bytes into `out`, and
+ * fail as if out of memory when it would overflow.
+ */
+#define GITERR_CHECK_ALLOC_MULTIPLY(out, nelem, elsize) \
+	if (git__multiply_sizet_overflow(out, nelem, elsize)) { giterr_set_oom(); return -1; }
+
 /**
  * Check a return value and propogate result if non-zero.
  */
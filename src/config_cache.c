@@ -51,6 +51,18 @@ static git_cvar_map _cvar_map_autocrlf[] = {
 	{GIT_CVAR_STRING, "input", GIT_AUTO_CRLF_INPUT}
 };
 
+/*
+ *	core.untrackedCache
+ *		Whether the index should remember the untracked files of each
+ *	directory: true adds the cache to the index, false removes it, and
+ *	keep (the default) uses it only when the index already has one.
+ */
+static git_cvar_map _cvar_map_untrackedcache[] = {
+	{GIT_CVAR_FALSE, NULL, GIT_UNTRACKEDCACHE_FALSE},
+	{GIT_CVAR_TRUE, NULL, GIT_UNTRACKEDCACHE_TRUE},
+	{GIT_CVAR_STRING, "keep", GIT_UNTRACKEDCACHE_KEEP}
+};
+
 /*
  * Generic map for integer values
  */
@@ -69,6 +81,7 @@ static struct map_data _cvar_maps[] = {
 	{"core.abbrev", _cvar_map_int, 1, GIT_ABBREV_DEFAULT },
 	{"core.precomposeunicode", NULL, 0, GIT_PRECOMPOSE_DEFAULT },
 	{"core.safecrlf", NULL, 0, GIT_SAFE_CRLF_DEFAULT},
+	{"core.untrackedcache", _cvar_map_untrackedcache, ARRAY_SIZE(_cvar_map_untrackedcache), GIT_UNTRACKEDCACHE_DEFAULT},
 };
 
 int git_repository__cvar(int *out, git_repository *repo, git_cvar_cached cvar)
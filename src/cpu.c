@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "cpu.h"
+
+#ifdef GIT_CPU_X86_TARGETS
+# include <cpuid.h>
+#endif
+
+#ifdef GIT_CPU_ARM_TARGETS
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+
+unsigned int git_cpu__features;
+
+#ifdef GIT_CPU_X86_TARGETS
+
+/* Whether the OS saves the AVX state (the YMM registers) on context switches */
+static bool x86_os_saves_ymm(void)
+{
+	unsigned int eax, edx;
+
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+	return (eax & 0x6) == 0x6;
+}
+
+static unsigned int x86_features(void)
+{
+	unsigned int eax, ebx, ecx, edx, features = 0;
+	bool sse41, avx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	if (edx & bit_SSE2)
+		features |= GIT_CPU_SSE2;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return features;
+
+	sse41 = (ecx & bit_SSSE3) && (ecx & bit_SSE4_1);
+	avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX) && x86_os_saves_ymm();
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	if (sse41 && (ebx & bit_SHA))
+		features |= GIT_CPU_SHA;
+	if (avx && (ebx & bit_AVX2))
+		features |= GIT_CPU_AVX2;
+
+	return features;
+}
+
+#endif
+
+#ifdef GIT_CPU_ARM_TARGETS
+
+static unsigned int arm_features(void)
+{
+	unsigned int features = 0;
+
+	if (getauxval(AT_HWCAP) & HWCAP_SHA1)
+		features |= GIT_CPU_ARM_SHA1;
+
+	return features;
+}
+
+#endif
+
+int git_cpu_global_init(void)
+{
+#ifdef GIT_CPU_X86_TARGETS
+	git_cpu__features = x86_features();
+#elif defined(GIT_CPU_ARM_TARGETS)
+	git_cpu__features = arm_features();
+#endif
+
+	return 0;
+}
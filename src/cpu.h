@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_cpu_h__
+#define INCLUDE_cpu_h__
+
+#include "common.h"
+
+/*
+ * Instruction set extensions that some of our routines have faster
+ * implementations for. They are detected once, when the library is
+ * initialized, and the implementation is picked at runtime, so that a
+ * single build runs everywhere.
+ */
+#define GIT_CPU_SSE2 (1u << 0)
+#define GIT_CPU_AVX2 (1u << 1)
+#define GIT_CPU_SHA  (1u << 2) /* x86 SHA extensions, with SSSE3 and SSE4.1 */
+#define GIT_CPU_ARM_SHA1 (1u << 3) /* ARMv8 SHA1 crypto extension */
+
+/* Compilers that let us build single functions for these extensions */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && \
+	 (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+# define GIT_CPU_X86_TARGETS 1
+#endif
+
+/* The ARMv8 code has not been run on hardware yet, so it is opt-in */
+#if defined(GIT_ARM_SHA1) && defined(__aarch64__) && defined(__linux__) && \
+	defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6
+# define GIT_CPU_ARM_TARGETS 1
+#endif
+
+/*
+ * The extensions that are available, both on the CPU and for this build.
+ * This is zero until `git_threads_init()` has been called.
+ */
+extern unsigned int git_cpu__features;
+
+int git_cpu_global_init(void);
+
+GIT_INLINE(unsigned int) git_cpu_features(void)
+{
+	return git_cpu__features;
+}
+
+#endif
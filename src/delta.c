@@ -6,6 +6,11 @@
  */
 
 #include "delta.h"
+#include "cpu.h"
+
+#ifdef GIT_CPU_X86_TARGETS
+# include <immintrin.h>
+#endif
 
 /* maximum hash entry list for the same hash bucket */
 #define HASH_LIMIT 64
@@ -105,6 +110,224 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * The fingerprints of the blocks of the source that go into its index:
+ * `vals[n]` is the one of the RABIN_WINDOW bytes after `buffer + n *
+ * RABIN_WINDOW` (the first byte is skipped, see below).
+ */
+static void fingerprint_blocks(
+	unsigned int *vals, const unsigned char *buffer,
+	unsigned long bufsize, unsigned int from, unsigned int entries)
+{
+	unsigned int n, i;
+
+	GIT_UNUSED(bufsize);
+
+	for (n = from; n < entries; n++) {
+		const unsigned char *data = buffer + n * RABIN_WINDOW;
+		unsigned int val = 0;
+
+		for (i = 1; i <= RABIN_WINDOW; i++)
+			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+
+		vals[n] = val;
+	}
+}
+
+/* How many bytes are the same at the start of `a` and `b`, up to `max` */
+static size_t match_forward(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0, x, y;
+
+	while (n + sizeof(size_t) <= max) {
+		memcpy(&x, a + n, sizeof(size_t));
+		memcpy(&y, b + n, sizeof(size_t));
+		if (x != y)
+			break;
+		n += sizeof(size_t);
+	}
+
+	while (n < max && a[n] == b[n])
+		n++;
+
+	return n;
+}
+
+/* How many bytes are the same right before `a` and `b`, up to `max` */
+static size_t match_backward(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+
+	while (n < max && a[-1 - (ptrdiff_t)n] == b[-1 - (ptrdiff_t)n])
+		n++;
+
+	return n;
+}
+
+#ifdef GIT_CPU_X86_TARGETS
+
+__attribute__((target("sse2")))
+static size_t match_forward_sse2(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+	unsigned int diff;
+
+	while (n + 16 <= max) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + n));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + n));
+
+		diff = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return n + __builtin_ctz(diff);
+
+		n += 16;
+	}
+
+	return n + match_forward(a + n, b + n, max - n);
+}
+
+__attribute__((target("sse2")))
+static size_t match_backward_sse2(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+	unsigned int diff;
+
+	while (n + 16 <= max) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a - n - 16));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b - n - 16));
+
+		diff = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (diff)
+			return n + __builtin_clz(diff) - 16;
+
+		n += 16;
+	}
+
+	return n + match_backward(a - n, b - n, max - n);
+}
+
+__attribute__((target("avx2")))
+static size_t match_forward_avx2(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+	unsigned int diff;
+
+	while (n + 32 <= max) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + n));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + n));
+
+		diff = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (diff)
+			return n + __builtin_ctz(diff);
+
+		n += 32;
+	}
+
+	return n + match_forward_sse2(a + n, b + n, max - n);
+}
+
+__attribute__((target("avx2")))
+static size_t match_backward_avx2(
+	const unsigned char *a, const unsigned char *b, size_t max)
+{
+	size_t n = 0;
+	unsigned int diff;
+
+	while (n + 32 <= max) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a - n - 32));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b - n - 32));
+
+		diff = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (diff)
+			return n + __builtin_clz(diff);
+
+		n += 32;
+	}
+
+	return n + match_backward_sse2(a - n, b - n, max - n);
+}
+
+/*
+ * Eight blocks at a time, one per lane: their bytes and the lookups in T
+ * are gathered. The gathers read 32 bits, so the last blocks, whose
+ * last bytes are too close to the end of the buffer, are left to the
+ * scalar code.
+ */
+__attribute__((target("avx2")))
+static void fingerprint_blocks_avx2(
+	unsigned int *vals, const unsigned char *buffer,
+	unsigned long bufsize, unsigned int from, unsigned int entries)
+{
+	const __m256i offsets = _mm256_setr_epi32(
+		0, RABIN_WINDOW, 2 * RABIN_WINDOW, 3 * RABIN_WINDOW,
+		4 * RABIN_WINDOW, 5 * RABIN_WINDOW, 6 * RABIN_WINDOW, 7 * RABIN_WINDOW);
+	const __m256i low_byte = _mm256_set1_epi32(0xff);
+	unsigned int n = from, i;
+
+	while (n + 8 <= entries &&
+		(unsigned long)(n + 8) * RABIN_WINDOW + 3 < bufsize) {
+		const unsigned char *data = buffer + n * RABIN_WINDOW;
+		__m256i val = _mm256_setzero_si256();
+
+		for (i = 1; i <= RABIN_WINDOW; i++) {
+			__m256i bytes = _mm256_and_si256(low_byte,
+				_mm256_i32gather_epi32((const int *)(data + i), offsets, 1));
+			__m256i t = _mm256_i32gather_epi32(
+				(const int *)T, _mm256_srli_epi32(val, RABIN_SHIFT), 4);
+
+			val = _mm256_xor_si256(
+				_mm256_or_si256(_mm256_slli_epi32(val, 8), bytes), t);
+		}
+
+		_mm256_storeu_si256((__m256i *)(vals + n), val);
+		n += 8;
+	}
+
+	fingerprint_blocks(vals, buffer, bufsize, n, entries);
+}
+
+#endif
+
+struct delta_kernels {
+	void (*fingerprint_blocks)(unsigned int *, const unsigned char *,
+		unsigned long, unsigned int, unsigned int);
+	size_t (*match_forward)(const unsigned char *, const unsigned char *, size_t);
+	size_t (*match_backward)(const unsigned char *, const unsigned char *, size_t);
+};
+
+static const struct delta_kernels scalar_kernels = {
+	fingerprint_blocks, match_forward, match_backward
+};
+
+#ifdef GIT_CPU_X86_TARGETS
+static const struct delta_kernels sse2_kernels = {
+	fingerprint_blocks, match_forward_sse2, match_backward_sse2
+};
+
+static const struct delta_kernels avx2_kernels = {
+	fingerprint_blocks_avx2, match_forward_avx2, match_backward_avx2
+};
+#endif
+
+static const struct delta_kernels *delta_kernels(void)
+{
+#ifdef GIT_CPU_X86_TARGETS
+	unsigned int features = git_cpu_features();
+
+	if (features & GIT_CPU_AVX2)
+		return &avx2_kernels;
+	if (features & GIT_CPU_SSE2)
+		return &sse2_kernels;
+#endif
+
+	return &scalar_kernels;
+}
+
 struct index_entry {
 	const unsigned char *ptr;
 	unsigned int val;
@@ -122,7 +345,7 @@ struct git_delta_index {
 struct git_delta_index *
 git_delta_create_index(const void *buf, unsigned long bufsize)
 {
-	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
+	unsigned int i, n, hsize, hmask, entries, prev_val, *hash_count, *vals;
 	const unsigned char *data, *buffer = buf;
 	struct git_delta_index *index;
 	struct index_entry *entry, **hash;
@@ -174,14 +397,21 @@ git_delta_create_index(const void *buf, unsigned long bufsize)
 		return NULL;
 	}
 
+	/* fingerprint the blocks */
+	vals = git__malloc(entries * sizeof(*vals));
+	if (!vals) {
+		git__free(hash_count);
+		git__free(index);
+		return NULL;
+	}
+
+	delta_kernels()->fingerprint_blocks(vals, buffer, bufsize, 0, entries);
+
 	/* then populate the index */
 	prev_val = ~0;
-	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
-	     data >= buffer;
-	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+	for (n = entries; n-- > 0; ) {
+		unsigned int val = vals[n];
+		data = buffer + n * RABIN_WINDOW;
 		if (val == prev_val) {
 			/* keep the lowest of consecutive identical blocks */
 			entry[-1].ptr = data + RABIN_WINDOW;
@@ -223,6 +453,7 @@ git_delta_create_index(const void *buf, unsigned long bufsize)
 		} while (entry);
 	}
 	git__free(hash_count);
+	git__free(vals);
 
 	return index;
 }
@@ -254,6 +485,7 @@ git_delta_create(
 	unsigned long *delta_size,
 	unsigned long max_size)
 {
+	const struct delta_kernels *kernels = delta_kernels();
 	unsigned int i, outpos, outsize, moff, msize, val;
 	int inscnt;
 	const unsigned char *ref_data, *ref_top, *data, *top;
@@ -317,8 +549,7 @@ git_delta_create(
 					ref_size = (unsigned int)(top - src);
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
+				ref += kernels->match_forward(ref, src, ref_size);
 				if (msize < (unsigned int)(ref - entry->ptr)) {
 					/* this is our best match so far */
 					msize = (unsigned int)(ref - entry->ptr);
@@ -344,17 +575,20 @@ git_delta_create(
 			unsigned char *op;
 
 			if (inscnt) {
-				while (moff && ref_data[moff-1] == data[-1]) {
-					/* we can match one byte back */
-					msize++;
-					moff--;
-					data--;
-					outpos--;
-					if (--inscnt)
-						continue;
+				/* we can match some bytes back */
+				unsigned int back = (unsigned int)kernels->match_backward(
+					ref_data + moff, data,
+					min(moff, (unsigned int)inscnt));
+
+				msize += back;
+				moff -= back;
+				data -= back;
+				outpos -= back;
+				inscnt -= back;
+
+				if (!inscnt) {
 					outpos--;  /* remove count slot */
 					inscnt--;  /* make it -1 */
-					break;
 				}
 				out[outpos - inscnt - 1] = inscnt;
 				inscnt = 0;
@@ -14,6 +14,7 @@
 #include "index.h"
 #include "odb.h"
 #include "submodule.h"
+#include "array.h"
 
 #define DIFF_FLAG_IS_SET(DIFF,FLAG) (((DIFF)->opts.flags & (FLAG)) != 0)
 #define DIFF_FLAG_ISNT_SET(DIFF,FLAG) (((DIFF)->opts.flags & (FLAG)) == 0)
@@ -626,6 +627,12 @@ static bool diff_time_eq(
 		(!use_nanos || a->nanoseconds == b->nanoseconds);
 }
 
+/* A MODIFIED record whose workdir OID still has to be calculated */
+typedef struct {
+	git_diff_delta *delta;
+	git_index_entry entry;
+} diff_uncertain;
+
 typedef struct {
 	git_repository *repo;
 	git_iterator *old_iter;
@@ -633,10 +640,117 @@ typedef struct {
 	const git_index_entry *oitem;
 	const git_index_entry *nitem;
 	git_buf ignore_prefix;
+	git_array_t(diff_uncertain) uncertain;
 } diff_in_progress;
 
 #define MODE_BITS_MASK 0000777
 
+#define DIFF_HASH_BATCH 32
+#define DIFF_HASH_BATCH_FILE_SIZE (256 * 1024)
+
+typedef struct {
+	git_diff_file *files[DIFF_HASH_BATCH];
+	git_buf bufs[DIFF_HASH_BATCH];
+	git_rawobj objs[DIFF_HASH_BATCH];
+	git_oid ids[DIFF_HASH_BATCH];
+	size_t count;
+} diff_hash_batch;
+
+static int diff_hash_batch_flush(git_diff *diff, diff_hash_batch *batch)
+{
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < batch->count; i++) {
+		batch->objs[i].data = batch->bufs[i].ptr;
+		batch->objs[i].len = batch->bufs[i].size;
+		batch->objs[i].type = GIT_OBJ_BLOB;
+	}
+
+	if (batch->count &&
+		!(error = git_odb__hashobj_many(batch->ids, batch->objs, batch->count))) {
+		for (i = 0; i < batch->count; i++) {
+			git_oid_cpy(&batch->files[i]->id, &batch->ids[i]);
+			batch->files[i]->flags |= GIT_DIFF_FLAG_VALID_ID;
+		}
+
+		diff->perf.oid_calculations += batch->count;
+	}
+
+	for (i = 0; i < batch->count; i++)
+		git_buf_clear(&batch->bufs[i]);
+	batch->count = 0;
+
+	return error;
+}
+
+/* Whether the file can go in a batch, and its contents if so */
+static bool diff_hash_batch_read(
+	git_buf *out, git_diff *diff, git_diff_file *file)
+{
+	git_buf full_path = GIT_BUF_INIT;
+	git_filter_list *fl = NULL;
+	bool batched = false;
+
+	if (!S_ISREG(file->mode) || file->size > DIFF_HASH_BATCH_FILE_SIZE)
+		return false;
+
+	if (git_filter_list_load(
+			&fl, diff->repo, NULL, file->path, GIT_FILTER_TO_ODB) < 0) {
+		giterr_clear();
+		return false;
+	}
+
+	if (!fl &&
+		!git_buf_joinpath(
+			&full_path, git_repository_workdir(diff->repo), file->path) &&
+		!git_futils_readbuffer(out, full_path.ptr))
+		batched = true;
+
+	if (!batched)
+		giterr_clear();
+
+	git_filter_list_free(fl);
+	git_buf_free(&full_path);
+
+	return batched;
+}
+
+int git_diff__oid_for_files(git_diff *diff, git_diff_file **files, size_t n)
+{
+	diff_hash_batch batch;
+	size_t i;
+	int error = 0;
+
+	memset(&batch, 0, sizeof(batch));
+
+	for (i = 0; i < n && !error; i++) {
+		git_diff_file *file = files[i];
+
+		if (!git_oid_iszero(&file->id))
+			continue;
+
+		if (diff_hash_batch_read(&batch.bufs[batch.count], diff, file)) {
+			batch.files[batch.count++] = file;
+
+			if (batch.count == DIFF_HASH_BATCH)
+				error = diff_hash_batch_flush(diff, &batch);
+		} else if (!git_diff__oid_for_file(
+				&file->id, diff, file->path, file->mode, file->size))
+			file->flags |= GIT_DIFF_FLAG_VALID_ID;
+		else
+			giterr_clear();
+	}
+
+	if (!error)
+		error = diff_hash_batch_flush(diff, &batch);
+
+	for (i = 0; i < DIFF_HASH_BATCH; i++)
+		git_buf_free(&batch.bufs[i]);
+
+	return error;
+}
+
 static int maybe_modified_submodule(
 	git_delta_t *status,
 	git_oid *found_oid,
@@ -686,6 +800,111 @@ static int maybe_modified_submodule(
 	return error;
 }
 
+static int maybe_modified_defer(
+	git_diff *diff,
+	diff_in_progress *info,
+	uint32_t omode,
+	uint32_t nmode,
+	const char *matched_pathspec)
+{
+	diff_uncertain *uncertain;
+	size_t ndeltas = diff->deltas.length;
+	int error;
+
+	if ((error = diff_delta__from_two(
+			diff, GIT_DELTA_MODIFIED, info->oitem, omode,
+			info->nitem, nmode, NULL, matched_pathspec)) < 0 ||
+		diff->deltas.length == ndeltas)
+		return error;
+
+	uncertain = git_array_alloc(info->uncertain);
+	GITERR_CHECK_ALLOC(uncertain);
+
+	uncertain->delta = git_vector_last(&diff->deltas);
+	uncertain->entry = *info->nitem;
+	uncertain->entry.path = (char *)uncertain->delta->new_file.path;
+
+	return 0;
+}
+
+static int diff_delta__is_unmodified(
+	const git_vector *v, size_t idx, void *payload)
+{
+	git_diff_delta *delta = git_vector_get(v, idx);
+	GIT_UNUSED(payload);
+	return (delta->status == GIT_DELTA_UNMODIFIED);
+}
+
+/* Hash the workdir side of the deferred records in batches and mark the
+ * ones that turn out to match the old side as unmodified
+ */
+static int diff_hash_uncertain(git_diff *diff, diff_in_progress *info)
+{
+	size_t i, count = git_array_size(info->uncertain);
+	bool reverse = DIFF_FLAG_IS_SET(diff, GIT_DIFF_REVERSE);
+	git_diff_file **files;
+	git_index *index = NULL;
+	diff_uncertain *uncertain;
+	int error;
+
+	if (!count)
+		return 0;
+
+	files = git__calloc(count, sizeof(git_diff_file *));
+	GITERR_CHECK_ALLOC(files);
+
+	for (i = 0; i < count; i++) {
+		uncertain = git_array_get(info->uncertain, i);
+		files[i] = reverse ?
+			&uncertain->delta->old_file : &uncertain->delta->new_file;
+	}
+
+	error = git_diff__oid_for_files(diff, files, count);
+
+	for (i = 0; i < count && !error; i++) {
+		const git_diff_file *other;
+
+		uncertain = git_array_get(info->uncertain, i);
+		other = reverse ?
+			&uncertain->delta->new_file : &uncertain->delta->old_file;
+
+		if ((files[i]->flags & GIT_DIFF_FLAG_VALID_ID) == 0 ||
+			!git_oid_equal(&files[i]->id, &other->id))
+			continue;
+
+		/* update index for entry if requested */
+		if (DIFF_FLAG_IS_SET(diff, GIT_DIFF_UPDATE_INDEX)) {
+			if (!index &&
+				(error = git_repository_index(&index, diff->repo)) < 0)
+				break;
+
+			git_oid_cpy(&uncertain->entry.id, &files[i]->id);
+			if ((error = git_index_add(index, &uncertain->entry)) < 0)
+				break;
+		}
+
+		if (files[i]->mode == other->mode)
+			uncertain->delta->status = GIT_DELTA_UNMODIFIED;
+	}
+
+	/* drop the records that turned out to be unmodified */
+	if (!error && DIFF_FLAG_ISNT_SET(diff, GIT_DIFF_INCLUDE_UNMODIFIED)) {
+		git_vector_remove_matching(
+			&diff->deltas, diff_delta__is_unmodified, NULL);
+
+		for (i = 0; i < count; i++) {
+			uncertain = git_array_get(info->uncertain, i);
+			if (uncertain->delta->status == GIT_DELTA_UNMODIFIED)
+				git__free(uncertain->delta);
+		}
+	}
+
+	git_index_free(index);
+	git__free(files);
+
+	return error;
+}
+
 static int maybe_modified(
 	git_diff *diff,
 	diff_in_progress *info)
@@ -697,7 +916,7 @@ static int maybe_modified(
 	unsigned int omode = oitem->mode;
 	unsigned int nmode = nitem->mode;
 	bool new_is_workdir = (info->new_iter->type == GIT_ITERATOR_TYPE_WORKDIR);
-	bool modified_uncertain = false;
+	bool modified_uncertain = false, stat_matched = false;
 	const char *matched_pathspec;
 	int error = 0;
 
@@ -780,6 +999,8 @@ static int maybe_modified(
 			status = GIT_DELTA_MODIFIED;
 			modified_uncertain = true;
 		}
+		else
+			stat_matched = true;
 	}
 
 	/* if mode is GITLINK and submodules are ignored, then skip */
@@ -791,6 +1012,14 @@ static int maybe_modified(
 	 * haven't calculated the OID of the new item, then calculate it now
 	 */
 	if (modified_uncertain && git_oid_iszero(&nitem->id)) {
+		/* leave it to be hashed with the others once iteration is done
+		 * (a notify callback has to see the final status, though)
+		 */
+		if (git_oid_iszero(&noid) && S_ISREG(nmode) &&
+			!diff->opts.notify_cb)
+			return maybe_modified_defer(
+				diff, info, omode, nmode, matched_pathspec);
+
 		if (git_oid_iszero(&noid)) {
 			const git_oid *update_check =
 				DIFF_FLAG_IS_SET(diff, GIT_DIFF_UPDATE_INDEX) ?
@@ -810,6 +1039,15 @@ static int maybe_modified(
 			status = GIT_DELTA_UNMODIFIED;
 	}
 
+	/* until the filesystem monitor reports it, the file stays as it is */
+	if (stat_matched && status == GIT_DELTA_UNMODIFIED &&
+		(info->new_iter->flags & GIT_ITERATOR_USE_FSMONITOR) != 0) {
+		git_index *index = git_iterator_get_index(info->old_iter);
+
+		if (index != NULL)
+			git_index__fsmonitor_mark_valid(index, oitem);
+	}
+
 	return diff_delta__from_two(
 		diff, status, oitem, omode, nitem, nmode,
 		git_oid_iszero(&noid) ? NULL : &noid, matched_pathspec);
@@ -1068,6 +1306,7 @@ int git_diff__from_iterators(
 	info.old_iter = old_iter;
 	info.new_iter = new_iter;
 	git_buf_init(&info.ignore_prefix, 0);
+	git_array_init(info.uncertain);
 
 	/* make iterators have matching icase behavior */
 	if (DIFF_FLAG_IS_SET(diff, GIT_DIFF_IGNORE_CASE)) {
@@ -1114,6 +1353,9 @@ int git_diff__from_iterators(
 			error = 0;
 	}
 
+	if (!error)
+		error = diff_hash_uncertain(diff, &info);
+
 	diff->perf.stat_calls += old_iter->stat_calls + new_iter->stat_calls;
 
 cleanup:
@@ -1123,6 +1365,7 @@ cleanup:
 		git_diff_free(diff);
 
 	git_buf_free(&info.ignore_prefix);
+	git_array_clear(info.uncertain);
 
 	return error;
 }
@@ -1212,16 +1455,27 @@ int git_diff_index_to_workdir(
 	const git_diff_options *opts)
 {
 	int error = 0;
+	git_iterator_flag_t iflag = GIT_ITERATOR_DONT_AUTOEXPAND;
 
 	assert(diff && repo);
 
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	/* the untracked cache leaves out what is ignored */
+	if (!opts || (opts->flags & GIT_DIFF_INCLUDE_IGNORED) == 0)
+		iflag |= GIT_ITERATOR_USE_UNTRACKED_CACHE;
+
+	/* without an answer from the monitor everything is stat'ed */
+	if (git_index__fsmonitor_refresh(index, repo) < 0)
+		giterr_clear();
+	else
+		iflag |= GIT_ITERATOR_USE_FSMONITOR;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index(&a, index, 0, pfx, pfx),
-		git_iterator_for_workdir(
-			&b, repo, GIT_ITERATOR_DONT_AUTOEXPAND, pfx, pfx)
+		git_iterator_for_workdir_ext(
+			&b, repo, NULL, index, iflag, pfx, pfx)
 	);
 
 	if (!error && DIFF_FLAG_IS_SET(*diff, GIT_DIFF_UPDATE_INDEX))
@@ -96,6 +96,14 @@ extern int git_diff__oid_for_file(
 extern int git_diff__oid_for_entry(
 	git_oid *out, git_diff *, const git_index_entry *, const git_oid *update);
 
+/*
+ * Calculate the missing OIDs of `n` workdir files, hashing the small ones
+ * that need no filtering together. Files whose OID cannot be calculated
+ * are left without GIT_DIFF_FLAG_VALID_ID.
+ */
+extern int git_diff__oid_for_files(
+	git_diff *diff, git_diff_file **files, size_t n);
+
 extern int git_diff__from_iterators(
 	git_diff **diff_ptr,
 	git_repository *repo,
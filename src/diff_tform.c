@@ -804,6 +804,40 @@ typedef struct {
 	uint16_t similarity;
 } diff_find_match;
 
+/*
+ * For exact matching, the OIDs of all the workdir files among the rename
+ * sources and targets are needed; calculate them all at once rather than
+ * one by one as the pairs are compared.
+ */
+static int calc_workdir_oids(git_diff *diff)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	git_diff_delta *delta;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(&diff->deltas, i, delta) {
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) != 0 &&
+			diff->old_src == GIT_ITERATOR_TYPE_WORKDIR &&
+			git_oid_iszero(&delta->old_file.id) &&
+			(error = git_vector_insert(&files, &delta->old_file)) < 0)
+			break;
+
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_TARGET) != 0 &&
+			diff->new_src == GIT_ITERATOR_TYPE_WORKDIR &&
+			git_oid_iszero(&delta->new_file.id) &&
+			(error = git_vector_insert(&files, &delta->new_file)) < 0)
+			break;
+	}
+
+	if (!error && files.length > 0)
+		error = git_diff__oid_for_files(
+			diff, (git_diff_file **)files.contents, files.length);
+
+	git_vector_free(&files);
+	return error;
+}
+
 int git_diff_find_similar(
 	git_diff *diff,
 	const git_diff_find_options *given_opts)
@@ -859,6 +893,10 @@ int git_diff_find_similar(
 	if (!num_srcs || !num_tgts)
 		goto cleanup;
 
+	if (FLAG_SET(&opts, GIT_DIFF_FIND_EXACT_MATCH_ONLY) &&
+		(error = calc_workdir_oids(diff)) < 0)
+		goto cleanup;
+
 	src2tgt = git__calloc(num_deltas, sizeof(diff_find_match));
 	GITERR_CHECK_ALLOC(src2tgt);
 	tgt2src = git__calloc(num_deltas, sizeof(diff_find_match));
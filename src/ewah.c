@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+#define EWAH_RUNNING_BITS 32
+
+GIT_INLINE(uint64_t) ewah_word(const git_ewah *ewah, size_t i)
+{
+	const unsigned char *p = ewah->words + i * 8;
+
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+		((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+		((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+		((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+GIT_INLINE(uint32_t) ewah_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static int ewah_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid EWAH bitmap - %s", message);
+	return -1;
+}
+
+int git_ewah_parse(
+		git_ewah *ewah, size_t *out_len, const unsigned char *data, size_t len)
+{
+	size_t word_count;
+
+	if (len < 12)
+		return ewah_error("bitmap is truncated");
+
+	ewah->bit_size = ewah_get_be32(data);
+	word_count = ewah_get_be32(data + 4);
+
+	if (word_count > (len - 12) / 8)
+		return ewah_error("bitmap is truncated");
+
+	ewah->words = data + 8;
+	ewah->word_count = word_count;
+
+	*out_len = 8 + word_count * 8 + 4;
+	return 0;
+}
+
+typedef enum {
+	EWAH_OR,
+	EWAH_XOR,
+} ewah_op;
+
+static int ewah_apply(git_bitvec *bv, const git_ewah *ewah, ewah_op op)
+{
+	size_t i = 0, pos = 0, max_words = (ewah->bit_size + 63) / 64, n;
+	uint64_t *words;
+
+	if (ewah->bit_size && git_bitvec_grow(bv, ewah->bit_size - 1) < 0)
+		return -1;
+
+	words = GIT_BITVEC_WORDS(bv);
+
+	while (i < ewah->word_count) {
+		uint64_t rlw = ewah_word(ewah, i++);
+		size_t running_len = (size_t)((rlw >> 1) & 0xFFFFFFFF);
+		size_t literal_words = (size_t)(rlw >> (1 + EWAH_RUNNING_BITS));
+
+		if (running_len > max_words - pos ||
+			literal_words > max_words - pos - running_len ||
+			literal_words > ewah->word_count - i)
+			return ewah_error("words overflow the bitmap");
+
+		/* A run of zeroes changes nothing, a run of ones flips or sets */
+		if (rlw & 1) {
+			for (n = 0; n < running_len; ++n) {
+				if (op == EWAH_OR)
+					words[pos + n] = ~(uint64_t)0;
+				else
+					words[pos + n] = ~words[pos + n];
+			}
+		}
+
+		pos += running_len;
+
+		for (n = 0; n < literal_words; ++n, ++pos) {
+			uint64_t literal = ewah_word(ewah, i++);
+
+			if (op == EWAH_OR)
+				words[pos] |= literal;
+			else
+				words[pos] ^= literal;
+		}
+	}
+
+	return 0;
+}
+
+int git_ewah_or(git_bitvec *bv, const git_ewah *ewah)
+{
+	return ewah_apply(bv, ewah, EWAH_OR);
+}
+
+int git_ewah_xor(git_bitvec *bv, const git_ewah *ewah)
+{
+	return ewah_apply(bv, ewah, EWAH_XOR);
+}
+
+static int ewah_put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int ewah_put_word(git_buf *out, uint64_t word)
+{
+	if (ewah_put_be32(out, (uint32_t)(word >> 32)) < 0)
+		return -1;
+	return ewah_put_be32(out, (uint32_t)(word & 0xFFFFFFFF));
+}
+
+int git_ewah_write(git_buf *out, const git_bitvec *bv)
+{
+	const uint64_t *words = GIT_BITVEC_WORDS(bv);
+	size_t num_words = GIT_BITVEC_LENGTH(bv), i = 0, bit_size;
+	size_t header_pos, rlw_pos = 0, word_count = 0;
+	uint32_t value;
+
+	/* Trailing zeroes are implied by the size of the bitmap */
+	while (num_words > 0 && !words[num_words - 1])
+		num_words--;
+
+	bit_size = 0;
+	if (num_words) {
+		uint64_t last = words[num_words - 1];
+
+		for (bit_size = (num_words - 1) * 64; last; last >>= 1)
+			bit_size++;
+	}
+
+	if ((size_t)(uint32_t)bit_size != bit_size) {
+		giterr_set(GITERR_INVALID, "bitmap is too large");
+		return -1;
+	}
+
+	header_pos = git_buf_len(out);
+	if (ewah_put_be32(out, (uint32_t)bit_size) < 0 ||
+		ewah_put_be32(out, 0) < 0)
+		return -1;
+
+	i = 0;
+	while (i < num_words) {
+		uint64_t running_bit = (words[i] == ~(uint64_t)0);
+		uint64_t run_word = running_bit ? ~(uint64_t)0 : 0;
+		size_t running_len = 0, literal_words = 0, literal_start;
+
+		while (i < num_words && words[i] == run_word && running_len < 0xFFFFFFFF) {
+			running_len++;
+			i++;
+		}
+
+		literal_start = i;
+		while (i < num_words && words[i] != 0 && words[i] != ~(uint64_t)0 &&
+			literal_words < 0x7FFFFFFF) {
+			literal_words++;
+			i++;
+		}
+
+		rlw_pos = word_count;
+		if (ewah_put_word(out, running_bit |
+				((uint64_t)running_len << 1) |
+				((uint64_t)literal_words << (1 + EWAH_RUNNING_BITS))) < 0)
+			return -1;
+
+		for (; literal_start < i; ++literal_start)
+			if (ewah_put_word(out, words[literal_start]) < 0)
+				return -1;
+
+		word_count += 1 + literal_words;
+	}
+
+	if (ewah_put_be32(out, (uint32_t)rlw_pos) < 0)
+		return -1;
+
+	value = htonl((uint32_t)word_count);
+	memcpy(out->ptr + header_pos + 4, &value, sizeof(value));
+	return 0;
+}
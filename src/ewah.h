@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+#include "bitvec.h"
+#include "buffer.h"
+
+/*
+ * An EWAH-compressed bitmap, as stored in `.bitmap` files.
+ *
+ * The serialized form is the number of bits (32 bits), the number of
+ * 64-bit words that follow (32 bits), the words themselves and the
+ * position of the last run-length word (32 bits), all in network byte
+ * order. The words are a sequence of run-length words, each followed by
+ * the literal words it announces: bit 0 of a run-length word is the value
+ * of the run, bits 1-32 the number of words in the run and bits 33-63 the
+ * number of literal words after it.
+ */
+typedef struct {
+	/* The number of bits in the bitmap. */
+	size_t bit_size;
+
+	/* The compressed words, in network byte order; points into the file. */
+	const unsigned char *words;
+	size_t word_count;
+} git_ewah;
+
+/*
+ * Parse the serialized bitmap at `data`; `out_len` is set to the number of
+ * bytes it takes. The bitmap still points into `data`.
+ */
+int git_ewah_parse(
+		git_ewah *ewah, size_t *out_len, const unsigned char *data, size_t len);
+
+/* Set in `bv` all the bits that are set in `ewah`, growing `bv` as needed. */
+int git_ewah_or(git_bitvec *bv, const git_ewah *ewah);
+
+/* Flip in `bv` all the bits that are set in `ewah`, growing `bv` as needed. */
+int git_ewah_xor(git_bitvec *bv, const git_ewah *ewah);
+
+/* Compress `bv` and append its serialized form to `out`. */
+int git_ewah_write(git_buf *out, const git_bitvec *bv);
+
+#endif
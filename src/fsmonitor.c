@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "buffer.h"
+#include "vector.h"
+#include "strmap.h"
+#include "path.h"
+#include "posix.h"
+#include "repository.h"
+#include "git2/sys/fsmonitor.h"
+
+int git_fsmonitor_init_backend(git_fsmonitor *fsmonitor, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		fsmonitor, version, git_fsmonitor, GIT_FSMONITOR_INIT);
+	return 0;
+}
+
+#ifdef GIT_USE_INOTIFY
+
+#include <sys/inotify.h>
+
+GIT__USE_STRMAP
+
+/*
+ * The inotify monitor keeps a watch on every directory of the working
+ * directory, and drains the events they queued up when it is queried.
+ * The paths these name are kept with the number of the query which
+ * drained them; its tokens are the number of the next query.
+ */
+
+#define INOTIFY_WATCH_MASK \
+	(IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MODIFY | \
+	 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | \
+	 IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+typedef struct {
+	int wd;
+	char path[GIT_FLEX_ARRAY]; /* "" for the root, else with a slash */
+} inotify_watch;
+
+typedef struct {
+	size_t query;
+	char path[GIT_FLEX_ARRAY];
+} inotify_change;
+
+typedef struct {
+	git_fsmonitor parent;
+	int fd;
+	git_buf workdir;
+	git_buf token_prefix;
+	git_vector watches;
+	git_strmap *changes;
+
+	/* the number of the next query, and the last one we can't answer
+	 * for: the events before it were lost
+	 */
+	size_t query;
+	size_t lost;
+} inotify_fsmonitor;
+
+static git_atomic inotify_instances;
+
+static int inotify_watch_cmp(const void *a, const void *b)
+{
+	const inotify_watch *wa = a, *wb = b;
+	return (wa->wd > wb->wd) - (wa->wd < wb->wd);
+}
+
+static int inotify_watch_srch(const void *key, const void *array_member)
+{
+	int wd = *(const int *)key;
+	const inotify_watch *w = array_member;
+	return (wd > w->wd) - (wd < w->wd);
+}
+
+static int inotify_watch_set(inotify_fsmonitor *fsm, int wd, const char *path)
+{
+	size_t path_len = strlen(path), pos;
+	inotify_watch *w = git__malloc(sizeof(inotify_watch) + path_len + 1);
+
+	GITERR_CHECK_ALLOC(w);
+	w->wd = wd;
+	memcpy(w->path, path, path_len + 1);
+
+	/* the same directory may be watched again under a new name */
+	if (!git_vector_bsearch2(&pos, &fsm->watches, inotify_watch_srch, &wd)) {
+		git__free(git_vector_get(&fsm->watches, pos));
+		fsm->watches.contents[pos] = w;
+		return 0;
+	}
+
+	if (git_vector_insert_sorted(&fsm->watches, w, NULL) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Watch the directory `path` ("" or relative with a trailing slash) and
+ * the ones below it, leaving out .git directories
+ */
+static int inotify_watch_tree(inotify_fsmonitor *fsm, const char *path)
+{
+	git_buf full = GIT_BUF_INIT;
+	git_vector contents = GIT_VECTOR_INIT;
+	struct stat st;
+	char *name;
+	const char *base;
+	size_t i;
+	int wd, error;
+
+	if (git_buf_join(&full, '\0', fsm->workdir.ptr, path) < 0)
+		return -1;
+
+	if ((wd = inotify_add_watch(fsm->fd, full.ptr, INOTIFY_WATCH_MASK)) < 0) {
+		/* it went away again, which its parent reports */
+		if (path[0] && (errno == ENOENT || errno == ENOTDIR)) {
+			error = 0;
+			goto done;
+		}
+
+		giterr_set(GITERR_OS, "Failed to watch '%s'", full.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = inotify_watch_set(fsm, wd, path)) < 0)
+		goto done;
+
+	if ((error = git_path_dirload(
+			full.ptr, fsm->workdir.size, 1, 0, &contents)) < 0) {
+		if (path[0] && !git_path_isdir(full.ptr)) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	git_vector_foreach(&contents, i, name) {
+		base = strrchr(name, '/');
+		base = base ? base + 1 : name;
+
+		if (!strcmp(base, DOT_GIT))
+			continue;
+
+		git_buf_truncate(&full, fsm->workdir.size);
+		if ((error = git_buf_puts(&full, name)) < 0)
+			break;
+
+		if (p_lstat(full.ptr, &st) < 0 || !S_ISDIR(st.st_mode))
+			continue;
+
+		/* the names were allocated with a byte to spare */
+		strcat(name, "/");
+
+		if ((error = inotify_watch_tree(fsm, name)) < 0)
+			break;
+	}
+
+done:
+	git_vector_free_deep(&contents);
+	git_buf_free(&full);
+	return error;
+}
+
+static void inotify_unwatch_tree(inotify_fsmonitor *fsm, const char *path)
+{
+	inotify_watch *w;
+	size_t i;
+
+	git_vector_rforeach(&fsm->watches, i, w) {
+		if (git__prefixcmp(w->path, path) != 0)
+			continue;
+
+		(void)inotify_rm_watch(fsm->fd, w->wd);
+		git_vector_remove(&fsm->watches, i);
+		git__free(w);
+	}
+}
+
+static int inotify_record(inotify_fsmonitor *fsm, const char *path)
+{
+	inotify_change *change;
+	khiter_t pos;
+	size_t path_len;
+	int error;
+
+	pos = git_strmap_lookup_index(fsm->changes, path);
+
+	if (git_strmap_valid_index(fsm->changes, pos)) {
+		change = git_strmap_value_at(fsm->changes, pos);
+		change->query = fsm->query;
+		return 0;
+	}
+
+	path_len = strlen(path);
+	change = git__malloc(sizeof(inotify_change) + path_len + 1);
+	GITERR_CHECK_ALLOC(change);
+
+	change->query = fsm->query;
+	memcpy(change->path, path, path_len + 1);
+
+	git_strmap_insert(fsm->changes, change->path, change, error);
+	if (error < 0) {
+		git__free(change);
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Take in an event: record the path it is about, and have the watches
+ * follow the directories which come and go
+ */
+static int inotify_event(
+	inotify_fsmonitor *fsm, git_buf *path, const struct inotify_event *ev)
+{
+	inotify_watch *w;
+	size_t pos;
+
+	if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+		fsm->lost = fsm->query;
+		return 0;
+	}
+
+	if (git_vector_bsearch2(
+			&pos, &fsm->watches, inotify_watch_srch, &ev->wd) < 0)
+		return 0;
+
+	w = git_vector_get(&fsm->watches, pos);
+
+	if ((ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) != 0) {
+		/* nothing can be told about the working directory anymore */
+		if (!w->path[0])
+			fsm->lost = SIZE_MAX;
+
+		if ((ev->mask & IN_IGNORED) != 0) {
+			git_vector_remove(&fsm->watches, pos);
+			git__free(w);
+		}
+
+		return 0;
+	}
+
+	/* what happens to a directory itself is reported by its parent */
+	if (!ev->len || !strcmp(ev->name, DOT_GIT))
+		return 0;
+
+	if (git_buf_join(path, '\0', w->path, ev->name) < 0)
+		return -1;
+
+	if ((ev->mask & IN_ISDIR) != 0) {
+		if (git_buf_putc(path, '/') < 0)
+			return -1;
+
+		if ((ev->mask & (IN_MOVED_FROM | IN_DELETE)) != 0)
+			inotify_unwatch_tree(fsm, path->ptr);
+
+		if ((ev->mask & (IN_MOVED_TO | IN_CREATE)) != 0 &&
+			inotify_watch_tree(fsm, path->ptr) < 0) {
+			/* changes below it would go unnoticed */
+			giterr_clear();
+			fsm->lost = SIZE_MAX;
+		}
+
+		git_buf_truncate(path, path->size - 1);
+	}
+
+	return inotify_record(fsm, path->ptr);
+}
+
+static int inotify_drain(inotify_fsmonitor *fsm)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} events;
+	const struct inotify_event *ev;
+	git_buf path = GIT_BUF_INIT;
+	ssize_t len, pos;
+	int error = 0;
+
+	while (!error) {
+		if ((len = read(fsm->fd, events.buf, sizeof(events.buf))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				giterr_set(GITERR_OS, "Failed to read inotify events");
+				error = -1;
+			}
+			break;
+		}
+
+		for (pos = 0; !error && pos < len;
+			pos += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)(events.buf + pos);
+			error = inotify_event(fsm, &path, ev);
+		}
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+static int inotify_query(
+	git_buf *out,
+	git_fsmonitor *fsmonitor,
+	const char *token,
+	git_fsmonitor_changed_cb changed_cb,
+	void *payload)
+{
+	inotify_fsmonitor *fsm = (inotify_fsmonitor *)fsmonitor;
+	inotify_change *change;
+	const char *end;
+	int64_t since = 0;
+	khiter_t pos;
+	int error;
+
+	if ((error = inotify_drain(fsm)) < 0)
+		return error;
+
+	/* tokens of other monitors (or processes) are no good to us */
+	if (token && !git__prefixcmp(token, fsm->token_prefix.ptr) &&
+		(git__strtol64(&since,
+			token + fsm->token_prefix.size, &end, 10) < 0 || *end))
+		since = 0;
+
+	giterr_clear();
+
+	if (since <= 0 || (size_t)since <= fsm->lost ||
+		(size_t)since > fsm->query)
+		error = changed_cb("", payload);
+	else {
+		for (pos = git_strmap_begin(fsm->changes);
+			pos != git_strmap_end(fsm->changes) && !error; ++pos) {
+			if (!git_strmap_has_data(fsm->changes, pos))
+				continue;
+
+			change = git_strmap_value_at(fsm->changes, pos);
+			if (change->query >= (size_t)since)
+				error = changed_cb(change->path, payload);
+		}
+	}
+
+	if (error)
+		return giterr_set_after_callback(error);
+
+	fsm->query++;
+
+	git_buf_clear(out);
+	return git_buf_printf(out, "%s%"PRIuZ, fsm->token_prefix.ptr, fsm->query);
+}
+
+static void inotify_free(git_fsmonitor *fsmonitor)
+{
+	inotify_fsmonitor *fsm = (inotify_fsmonitor *)fsmonitor;
+	inotify_change *change;
+
+	if (fsm->fd >= 0)
+		p_close(fsm->fd);
+
+	git_vector_free_deep(&fsm->watches);
+
+	if (fsm->changes) {
+		git_strmap_foreach_value(fsm->changes, change, {
+			git__free(change);
+		});
+		git_strmap_free(fsm->changes);
+	}
+
+	git_buf_free(&fsm->workdir);
+	git_buf_free(&fsm->token_prefix);
+	git__free(fsm);
+}
+
+int git_fsmonitor_inotify(git_fsmonitor **out, const char *path)
+{
+	inotify_fsmonitor *fsm;
+	int error;
+
+	assert(out && path);
+
+	*out = NULL;
+
+	fsm = git__calloc(1, sizeof(inotify_fsmonitor));
+	GITERR_CHECK_ALLOC(fsm);
+
+	fsm->parent.version = GIT_FSMONITOR_VERSION;
+	fsm->parent.query = inotify_query;
+	fsm->parent.free = inotify_free;
+	fsm->fd = -1;
+	fsm->query = 1;
+
+	if ((error = git_path_prettify_dir(&fsm->workdir, path, NULL)) < 0 ||
+		(error = git_vector_init(&fsm->watches, 0, inotify_watch_cmp)) < 0 ||
+		(error = git_strmap_alloc(&fsm->changes)) < 0 ||
+		(error = git_buf_printf(&fsm->token_prefix, "libgit2-inotify:%d.%ld.%d:",
+			(int)getpid(), (long)time(NULL),
+			git_atomic_inc(&inotify_instances))) < 0)
+		goto on_error;
+
+	if ((fsm->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize inotify");
+		error = -1;
+		goto on_error;
+	}
+
+	if ((error = inotify_watch_tree(fsm, "")) < 0)
+		goto on_error;
+
+	*out = &fsm->parent;
+	return 0;
+
+on_error:
+	inotify_free(&fsm->parent);
+	return error;
+}
+
+#else
+
+int git_fsmonitor_inotify(git_fsmonitor **out, const char *path)
+{
+	GIT_UNUSED(path);
+
+	*out = NULL;
+	giterr_set(GITERR_INVALID, "inotify is not available on this platform");
+	return -1;
+}
+
+#endif
@@ -6,6 +6,7 @@
  */
 #include "common.h"
 #include "global.h"
+#include "cpu.h"
 #include "hash.h"
 #include "sysdir.h"
 #include "git2/threads.h"
@@ -13,6 +14,8 @@
 
 
 git_mutex git__mwindow_mutex;
+git_mutex git__pack_cache_mutex;
+git_mutex git__cache_mutex;
 
 #define MAX_SHUTDOWN_CB 8
 
@@ -81,11 +84,14 @@ static int synchronized_threads_init()
 	int error;
 
 	_tls_index = TlsAlloc();
-	if (git_mutex_init(&git__mwindow_mutex))
+	if (git_mutex_init(&git__mwindow_mutex) ||
+		git_mutex_init(&git__pack_cache_mutex) ||
+		git_mutex_init(&git__cache_mutex))
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
-	if ((error = git_hash_global_init()) >= 0)
+	if ((error = git_cpu_global_init()) >= 0 &&
+		(error = git_hash_global_init()) >= 0)
 		error = git_sysdir_global_init();
 
 	win32_pthread_initialize();
@@ -116,6 +122,8 @@ static void synchronized_threads_shutdown()
 	git__shutdown();
 	TlsFree(_tls_index);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__pack_cache_mutex);
+	git_mutex_free(&git__cache_mutex);
 }
 
 void git_threads_shutdown(void)
@@ -162,12 +170,15 @@ static void cb__free_status(void *st)
 
 static void init_once(void)
 {
-	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0)
+	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0 ||
+		(init_error = git_mutex_init(&git__pack_cache_mutex)) != 0 ||
+		(init_error = git_mutex_init(&git__cache_mutex)) != 0)
 		return;
 	pthread_key_create(&_tls_key, &cb__free_status);
 
 	/* Initialize any other subsystems that have global state */
-	if ((init_error = git_hash_global_init()) >= 0)
+	if ((init_error = git_cpu_global_init()) >= 0 &&
+		(init_error = git_hash_global_init()) >= 0)
 		init_error = git_sysdir_global_init();
 
 	GIT_MEMORY_BARRIER;
@@ -196,6 +207,8 @@ void git_threads_shutdown(void)
 
 	pthread_key_delete(_tls_key);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__pack_cache_mutex);
+	git_mutex_free(&git__cache_mutex);
 	_once_init = new_once;
 }
 
@@ -223,8 +236,13 @@ static git_global_st __state;
 
 int git_threads_init(void)
 {
-	git_atomic_inc(&git__n_inits);
-	return 0;
+	int error = 0;
+
+	if (1 == git_atomic_inc(&git__n_inits) &&
+		(error = git_cpu_global_init()) >= 0)
+		error = git_hash_global_init();
+
+	return error;
 }
 
 void git_threads_shutdown(void)
@@ -174,19 +174,60 @@ on_error:
 
 int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
 {
-	git_oid merge_base;
+	git_revwalk *walk;
+	git_vector list;
+	git_commit_list *result = NULL;
+	git_commit_list_node *node_commit, *node_ancestor;
+	void *contents[1];
 	int error;
 
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
-	error = git_merge_base(&merge_base, repo, commit, ancestor);
-	/* No merge-base found, it's not a descendant */
-	if (error == GIT_ENOTFOUND)
-		return 0;
-
-	if (error < 0)
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
 		return error;
 
-	return git_oid_equal(&merge_base, ancestor);
+	if ((node_commit = git_revwalk__commit_lookup(walk, commit)) == NULL ||
+		(node_ancestor = git_revwalk__commit_lookup(walk, ancestor)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_commit_list_parse(walk, node_commit)) < 0)
+		goto done;
+
+	/* A missing ancestor can't be reached */
+	if ((error = git_commit_list_parse(walk, node_ancestor)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	/* A commit's ancestors all have a lower generation number */
+	if (node_commit->generation &&
+		node_commit->generation <= git_commit_list_generation(node_ancestor))
+		goto done;
+
+	/* This is just one value, so we can do it on the stack */
+	memset(&list, 0x0, sizeof(git_vector));
+	contents[0] = node_ancestor;
+	list.length = 1;
+	list.contents = contents;
+
+	/*
+	 * There is no need to look any further than the ancestor's generation:
+	 * it is a descendant if the walk from the commit reached the ancestor.
+	 */
+	if ((error = git_merge__bases_many(&result, walk, node_commit, &list,
+			node_ancestor->generation)) < 0)
+		goto done;
+
+	error = (node_ancestor->flags & PARENT1) != 0;
+
+done:
+	git_commit_list_free(&result);
+	git_revwalk_free(walk);
+	return error;
 }
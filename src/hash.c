@@ -7,6 +7,11 @@
 
 #include "common.h"
 #include "hash.h"
+#include "cpu.h"
+
+#ifdef GIT_CPU_X86_TARGETS
+# include <immintrin.h>
+#endif
 
 int git_hash_buf(git_oid *out, const void *data, size_t len)
 {
@@ -45,3 +50,231 @@ done:
 
 	return error;
 }
+
+#ifdef GIT_CPU_X86_TARGETS
+
+/*
+ * Multi-buffer hashing: each of the eight 32-bit lanes of the AVX2
+ * registers runs the compression function for a different input, so
+ * that hashing many small buffers is not bound by the latency of the
+ * rounds of a single one.
+ */
+
+#define HASH_LANES 8
+
+struct hash_lane {
+	git_oid *out;
+	git_buf_vec *vec;
+	size_t vec_n;
+	size_t piece;
+	size_t offset;
+	unsigned long long len;
+	size_t blocks;
+	bool padded;
+};
+
+static void hash_lane_start(
+	struct hash_lane *lane, unsigned int H[5][HASH_LANES], size_t i,
+	git_oid *out, git_buf_vec *vec, size_t vec_n)
+{
+	size_t j;
+
+	lane->out = out;
+	lane->vec = vec;
+	lane->vec_n = vec_n;
+	lane->piece = 0;
+	lane->offset = 0;
+	lane->len = 0;
+	lane->padded = false;
+
+	for (j = 0; j < vec_n; j++)
+		lane->len += vec[j].len;
+
+	/* the data, the 0x80 byte and the 64-bit length, in whole blocks */
+	lane->blocks = (size_t)((lane->len + 9 + 63) / 64);
+
+	H[0][i] = 0x67452301;
+	H[1][i] = 0xefcdab89;
+	H[2][i] = 0x98badcfe;
+	H[3][i] = 0x10325476;
+	H[4][i] = 0xc3d2e1f0;
+}
+
+static void hash_lane_fill(struct hash_lane *lane, unsigned char *block)
+{
+	size_t filled = 0, n;
+
+	while (filled < 64 && lane->piece < lane->vec_n) {
+		const git_buf_vec *vec = &lane->vec[lane->piece];
+
+		n = min(64 - filled, vec->len - lane->offset);
+		memcpy(block + filled, (const char *)vec->data + lane->offset, n);
+		filled += n;
+		lane->offset += n;
+
+		if (lane->offset == vec->len) {
+			lane->piece++;
+			lane->offset = 0;
+		}
+	}
+
+	if (filled == 64)
+		return;
+
+	if (!lane->padded) {
+		block[filled++] = 0x80;
+		lane->padded = true;
+	}
+
+	memset(block + filled, 0, 64 - filled);
+
+	if (lane->blocks == 1) {
+		unsigned long long bits = lane->len << 3;
+		int i;
+
+		for (i = 0; i < 8; i++)
+			block[63 - i] = (unsigned char)(bits >> (i * 8));
+	}
+}
+
+#define ROL(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+#define ROUND(i, f, k) do { \
+	if (i >= 16) { \
+		tmp = _mm256_xor_si256( \
+			_mm256_xor_si256(W[(i + 13) & 15], W[(i + 8) & 15]), \
+			_mm256_xor_si256(W[(i + 2) & 15], W[i & 15])); \
+		W[i & 15] = ROL(tmp, 1); \
+	} \
+	tmp = _mm256_add_epi32( \
+		_mm256_add_epi32(ROL(a, 5), f), \
+		_mm256_add_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(k)), W[i & 15])); \
+	e = d; d = c; c = ROL(b, 30); b = a; a = tmp; } while (0)
+
+#define F_CHOOSE _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(c, d), b), d)
+#define F_PARITY _mm256_xor_si256(_mm256_xor_si256(b, c), d)
+#define F_MAJORITY _mm256_or_si256(_mm256_and_si256(b, c), \
+	_mm256_and_si256(d, _mm256_or_si256(b, c)))
+
+__attribute__((target("avx2")))
+static void hash_lanes_avx2(
+	unsigned int H[5][HASH_LANES],
+	unsigned char blocks[HASH_LANES][64])
+{
+	const __m256i offsets = _mm256_setr_epi32(
+		0, 64, 128, 192, 256, 320, 384, 448);
+	const __m256i bswap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i W[16], a, b, c, d, e, tmp;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		W[i] = _mm256_shuffle_epi8(_mm256_i32gather_epi32(
+			(const int *)(blocks[0] + i * 4), offsets, 1), bswap);
+
+	a = _mm256_loadu_si256((const __m256i *)H[0]);
+	b = _mm256_loadu_si256((const __m256i *)H[1]);
+	c = _mm256_loadu_si256((const __m256i *)H[2]);
+	d = _mm256_loadu_si256((const __m256i *)H[3]);
+	e = _mm256_loadu_si256((const __m256i *)H[4]);
+
+	for (i = 0; i < 20; i++)
+		ROUND(i, F_CHOOSE, 0x5a827999);
+	for (; i < 40; i++)
+		ROUND(i, F_PARITY, 0x6ed9eba1);
+	for (; i < 60; i++)
+		ROUND(i, F_MAJORITY, (int)0x8f1bbcdc);
+	for (; i < 80; i++)
+		ROUND(i, F_PARITY, (int)0xca62c1d6);
+
+	a = _mm256_add_epi32(a, _mm256_loadu_si256((const __m256i *)H[0]));
+	b = _mm256_add_epi32(b, _mm256_loadu_si256((const __m256i *)H[1]));
+	c = _mm256_add_epi32(c, _mm256_loadu_si256((const __m256i *)H[2]));
+	d = _mm256_add_epi32(d, _mm256_loadu_si256((const __m256i *)H[3]));
+	e = _mm256_add_epi32(e, _mm256_loadu_si256((const __m256i *)H[4]));
+
+	_mm256_storeu_si256((__m256i *)H[0], a);
+	_mm256_storeu_si256((__m256i *)H[1], b);
+	_mm256_storeu_si256((__m256i *)H[2], c);
+	_mm256_storeu_si256((__m256i *)H[3], d);
+	_mm256_storeu_si256((__m256i *)H[4], e);
+}
+
+#undef ROL
+#undef ROUND
+#undef F_CHOOSE
+#undef F_PARITY
+#undef F_MAJORITY
+
+static void hash_many_avx2(
+	git_oid *out, git_buf_vec *vec, size_t vec_n, size_t n)
+{
+	struct hash_lane lanes[HASH_LANES];
+	unsigned int H[5][HASH_LANES];
+	unsigned char blocks[HASH_LANES][64];
+	size_t next = 0, i, j, active;
+
+	/* idle lanes still go through the kernel, on this state */
+	memset(lanes, 0, sizeof(lanes));
+	memset(H, 0, sizeof(H));
+	memset(blocks, 0, sizeof(blocks));
+
+	while (1) {
+		active = 0;
+
+		/* lanes whose input is done take the next one */
+		for (i = 0; i < HASH_LANES; i++) {
+			if (!lanes[i].blocks && next < n) {
+				hash_lane_start(&lanes[i], H, i,
+					&out[next], &vec[next * vec_n], vec_n);
+				next++;
+			}
+
+			if (lanes[i].blocks) {
+				hash_lane_fill(&lanes[i], blocks[i]);
+				active++;
+			}
+		}
+
+		if (!active)
+			break;
+
+		hash_lanes_avx2(H, blocks);
+
+		for (i = 0; i < HASH_LANES; i++) {
+			if (!lanes[i].blocks || --lanes[i].blocks)
+				continue;
+
+			for (j = 0; j < 5; j++) {
+				lanes[i].out->id[j * 4 + 0] = (unsigned char)(H[j][i] >> 24);
+				lanes[i].out->id[j * 4 + 1] = (unsigned char)(H[j][i] >> 16);
+				lanes[i].out->id[j * 4 + 2] = (unsigned char)(H[j][i] >> 8);
+				lanes[i].out->id[j * 4 + 3] = (unsigned char)(H[j][i]);
+			}
+		}
+	}
+}
+
+#endif
+
+int git_hash_many(git_oid *out, git_buf_vec *vec, size_t vec_n, size_t n)
+{
+	size_t i;
+	int error;
+
+#ifdef GIT_CPU_X86_TARGETS
+	if (n > 1 && (git_cpu_features() & GIT_CPU_AVX2)) {
+		hash_many_avx2(out, vec, vec_n, n);
+		return 0;
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		if ((error = git_hash_vec(&out[i], &vec[i * vec_n], vec_n)) < 0)
+			return error;
+	}
+
+	return 0;
+}
@@ -36,4 +36,12 @@ int git_hash_final(git_oid *out, git_hash_ctx *c);
 int git_hash_buf(git_oid *out, const void *data, size_t len);
 int git_hash_vec(git_oid *out, git_buf_vec *vec, size_t n);
 
+/*
+ * Hash `n` independent inputs at once, into `out[0..n-1]`. Each input is
+ * made of `vec_n` pieces; the ones of input `i` are `vec[i * vec_n]` to
+ * `vec[i * vec_n + vec_n - 1]`. On CPUs where it is faster, the inputs
+ * are hashed side by side in the lanes of vector registers.
+ */
+int git_hash_many(git_oid *out, git_buf_vec *vec, size_t vec_n, size_t n);
+
 #endif /* INCLUDE_hash_h__ */
@@ -8,6 +8,15 @@
 #include "common.h"
 #include "hash.h"
 #include "hash/hash_generic.h"
+#include "cpu.h"
+
+#ifdef GIT_CPU_X86_TARGETS
+# include <immintrin.h>
+#endif
+
+#ifdef GIT_CPU_ARM_TARGETS
+# include <arm_neon.h>
+#endif
 
 #if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
@@ -221,6 +230,214 @@ static void hash__block(git_hash_ctx *ctx, const unsigned int *data)
 	ctx->H[4] += E;
 }
 
+static void hash__blocks_generic(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	for (; blocks; blocks--, data += 64)
+		hash__block(ctx, (const unsigned int *)data);
+}
+
+#ifdef GIT_CPU_X86_TARGETS
+
+/*
+ * Four rounds with the SHA extensions, the message schedule for the
+ * following ones interleaved: `m0` is the schedule for these rounds,
+ * `m1`, `m2` and `m3` are the ones for the next, the one after and the
+ * one before, and `e` and `next_e` alternate between the calls.
+ */
+#define SHANI_ROUNDS(e, next_e, m0, m1, m2, m3, fn) do { \
+	e = _mm_sha1nexte_epu32(e, m0); \
+	next_e = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, fn); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0); } while (0)
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void hash__blocks_shani(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(
+		0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, e0, e1, abcd_save, e0_save, m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(
+		_mm_loadu_si128((const __m128i *)ctx->H), 0x1b);
+	e0 = _mm_set_epi32((int)ctx->H[4], 0, 0, 0);
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(data + 0)), bswap);
+		m1 = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(data + 16)), bswap);
+		m2 = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(data + 32)), bswap);
+		m3 = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(data + 48)), bswap);
+
+		/* Rounds 0-11, while the message is still being loaded */
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		/* Rounds 12-79 */
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 0);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 3);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 3);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)ctx->H, _mm_shuffle_epi32(abcd, 0x1b));
+	ctx->H[4] = (unsigned int)_mm_extract_epi32(e0, 3);
+}
+
+#undef SHANI_ROUNDS
+
+#endif
+
+#ifdef GIT_CPU_ARM_TARGETS
+
+/*
+ * Four rounds with the ARMv8 crypto extension, the message schedule for
+ * the following ones interleaved: `tmp` holds this round's message
+ * words with the constant added, and is refilled from `m2` for the
+ * rounds after next.
+ */
+#define ARM_ROUNDS(op, e, next_e, tmp, m0, m1, m2, m3, k) do { \
+	next_e = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+	abcd = op(abcd, e, tmp); \
+	tmp = vaddq_u32(m2, vdupq_n_u32(k)); \
+	m3 = vsha1su1q_u32(m3, m2); \
+	m0 = vsha1su0q_u32(m0, m1, m2); } while (0)
+
+#define K0 0x5a827999
+#define K1 0x6ed9eba1
+#define K2 0x8f1bbcdc
+#define K3 0xca62c1d6
+
+__attribute__((target("+crypto")))
+static void hash__blocks_arm(
+	git_hash_ctx *ctx, const unsigned char *data, size_t blocks)
+{
+	uint32x4_t abcd, abcd_save, tmp0, tmp1, m0, m1, m2, m3;
+	uint32_t e0, e0_save, e1;
+
+	abcd = vld1q_u32(ctx->H);
+	e0 = ctx->H[4];
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+		m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+		tmp0 = vaddq_u32(m0, vdupq_n_u32(K0));
+		tmp1 = vaddq_u32(m1, vdupq_n_u32(K0));
+
+		/* Rounds 0-3, before the schedule can be finished */
+		e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+		abcd = vsha1cq_u32(abcd, e0, tmp0);
+		tmp0 = vaddq_u32(m2, vdupq_n_u32(K0));
+		m0 = vsha1su0q_u32(m0, m1, m2);
+
+		/* Rounds 4-79 */
+		ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp1, m1, m2, m3, m0, K0);
+		ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp0, m2, m3, m0, m1, K0);
+		ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp1, m3, m0, m1, m2, K1);
+		ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp0, m0, m1, m2, m3, K1);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m1, m2, m3, m0, K1);
+		ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0, m2, m3, m0, m1, K1);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m3, m0, m1, m2, K1);
+		ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0, m0, m1, m2, m3, K2);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m1, m2, m3, m0, K2);
+		ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0, m2, m3, m0, m1, K2);
+		ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp1, m3, m0, m1, m2, K2);
+		ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0, m0, m1, m2, m3, K2);
+		ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp1, m1, m2, m3, m0, K3);
+		ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp0, m2, m3, m0, m1, K3);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m3, m0, m1, m2, K3);
+		ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0, m0, m1, m2, m3, K3);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m1, m2, m3, m0, K3);
+		ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp0, m2, m3, m0, m1, K3);
+		ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp1, m3, m0, m1, m2, K3);
+
+		e0 += e0_save;
+		abcd = vaddq_u32(abcd, abcd_save);
+	}
+
+	vst1q_u32(ctx->H, abcd);
+	ctx->H[4] = e0;
+}
+
+#undef ARM_ROUNDS
+#undef K0
+#undef K1
+#undef K2
+#undef K3
+
+#endif
+
+/*
+ * The block function for this CPU; the portable one until
+ * `git_hash_global_init()` has looked at what is available.
+ */
+static void (*hash__blocks)(git_hash_ctx *, const unsigned char *, size_t) =
+	hash__blocks_generic;
+
+int git_hash_global_init(void)
+{
+	unsigned int features = git_cpu_features();
+
+	GIT_UNUSED(features);
+
+	hash__blocks = hash__blocks_generic;
+
+#ifdef GIT_CPU_X86_TARGETS
+	if (features & GIT_CPU_SHA)
+		hash__blocks = hash__blocks_shani;
+#endif
+
+#ifdef GIT_CPU_ARM_TARGETS
+	if (features & GIT_CPU_ARM_SHA1)
+		hash__blocks = hash__blocks_arm;
+#endif
+
+	return 0;
+}
+
 int git_hash_init(git_hash_ctx *ctx)
 {
 	ctx->size = 0;
@@ -252,12 +469,12 @@ int git_hash_update(git_hash_ctx *ctx, const void *data, size_t len)
 		data = ((const char *)data + left);
 		if (lenW)
 			return 0;
-		hash__block(ctx, ctx->W);
+		hash__blocks(ctx, (const unsigned char *)ctx->W, 1);
 	}
-	while (len >= 64) {
-		hash__block(ctx, data);
-		data = ((const char *)data + 64);
-		len -= 64;
+	if (len >= 64) {
+		hash__blocks(ctx, data, len / 64);
+		data = ((const char *)data + (len & ~(size_t)63));
+		len &= 63;
 	}
 	if (len)
 		memcpy(ctx->W, data, len);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_idxmap_h__
+#define INCLUDE_idxmap_h__
+
+#include <ctype.h>
+#include "common.h"
+#include "git2/index.h"
+
+#define kmalloc git__malloc
+#define kcalloc git__calloc
+#define krealloc git__realloc
+#define kfree git__free
+#include "khash.h"
+
+__KHASH_TYPE(idx, const git_index_entry *, git_index_entry *);
+typedef khash_t(idx) git_idxmap;
+
+__KHASH_TYPE(idxicase, const git_index_entry *, git_index_entry *);
+typedef khash_t(idxicase) git_idxmap_icase;
+
+typedef khiter_t git_idxmap_iter;
+
+/* These are __ac_X31_hash_string (folded to lower case for the other
+ * map) plus the stage, so the sides of a conflict don't collide.
+ */
+GIT_INLINE(khint_t) git_idxmap_hash(const git_index_entry *e)
+{
+	const unsigned char *s = (const unsigned char *)e->path;
+	khint_t h = 0;
+
+	while (*s)
+		h = (h << 5) - h + (khint_t)*s++;
+
+	return h + GIT_IDXENTRY_STAGE(e);
+}
+
+GIT_INLINE(khint_t) git_idxmap_icase_hash(const git_index_entry *e)
+{
+	const unsigned char *s = (const unsigned char *)e->path;
+	khint_t h = 0;
+
+	while (*s)
+		h = (h << 5) - h + (khint_t)tolower(*s++);
+
+	return h + GIT_IDXENTRY_STAGE(e);
+}
+
+#define git_idxmap_equal(a, b) \
+	(GIT_IDXENTRY_STAGE(a) == GIT_IDXENTRY_STAGE(b) && \
+	 strcmp((a)->path, (b)->path) == 0)
+
+#define git_idxmap_icase_equal(a, b) \
+	(GIT_IDXENTRY_STAGE(a) == GIT_IDXENTRY_STAGE(b) && \
+	 strcasecmp((a)->path, (b)->path) == 0)
+
+#define GIT__USE_IDXMAP \
+	__KHASH_IMPL(idx, static kh_inline, const git_index_entry *, git_index_entry *, 1, git_idxmap_hash, git_idxmap_equal)
+
+#define GIT__USE_IDXMAP_ICASE \
+	__KHASH_IMPL(idxicase, static kh_inline, const git_index_entry *, git_index_entry *, 1, git_idxmap_icase_hash, git_idxmap_icase_equal)
+
+/* A directory of the index, keyed on its path without trailing slash.
+ * `entries` counts, per stage, the files right inside it and the
+ * subdirectories which have entries at that stage.
+ */
+typedef struct {
+	const char *path;
+	size_t pathlen;
+	size_t entries[4];
+} git_idxmap_dir_entry;
+
+__KHASH_TYPE(idxdir, const git_idxmap_dir_entry *, git_idxmap_dir_entry *);
+typedef khash_t(idxdir) git_idxmap_dir;
+
+GIT_INLINE(khint_t) git_idxmap_dir_hash(const git_idxmap_dir_entry *d)
+{
+	const char *s = d->path, *end = d->path + d->pathlen;
+	khint_t h = 0;
+
+	while (s < end)
+		h = (h << 5) - h + (khint_t)*s++;
+
+	return h;
+}
+
+#define git_idxmap_dir_equal(a, b) \
+	((a)->pathlen == (b)->pathlen && \
+	 memcmp((a)->path, (b)->path, (a)->pathlen) == 0)
+
+#define GIT__USE_IDXMAP_DIR \
+	__KHASH_IMPL(idxdir, static kh_inline, const git_idxmap_dir_entry *, git_idxmap_dir_entry *, 1, git_idxmap_dir_hash, git_idxmap_dir_equal)
+
+#define git_idxmap_alloc(hp) \
+	((*(hp) = kh_init(idx)) == NULL) ? giterr_set_oom(), -1 : 0
+#define git_idxmap_icase_alloc(hp) \
+	((*(hp) = kh_init(idxicase)) == NULL) ? giterr_set_oom(), -1 : 0
+#define git_idxmap_dir_alloc(hp) \
+	((*(hp) = kh_init(idxdir)) == NULL) ? giterr_set_oom(), -1 : 0
+
+#define git_idxmap_free(h)       kh_destroy(idx, h), h = NULL
+#define git_idxmap_icase_free(h) kh_destroy(idxicase, h), h = NULL
+#define git_idxmap_dir_free(h)   kh_destroy(idxdir, h), h = NULL
+
+#define git_idxmap_resize(h, s)       kh_resize(idx, h, s)
+#define git_idxmap_icase_resize(h, s) kh_resize(idxicase, h, s)
+
+#define git_idxmap_lookup_index(h, k)       kh_get(idx, h, k)
+#define git_idxmap_icase_lookup_index(h, k) kh_get(idxicase, h, k)
+#define git_idxmap_dir_lookup_index(h, k)   kh_get(idxdir, h, k)
+#define git_idxmap_valid_index(h, pos)      (pos != kh_end(h))
+
+#define git_idxmap_value_at(h, pos)         kh_val(h, pos)
+#define git_idxmap_delete_at(h, pos)        kh_del(idx, h, pos)
+#define git_idxmap_icase_delete_at(h, pos)  kh_del(idxicase, h, pos)
+#define git_idxmap_dir_delete_at(h, pos)    kh_del(idxdir, h, pos)
+
+/* Insert `e` unless an equal entry is there already; rval is 0 then */
+#define git_idxmap_insert(h, e, rval) do { \
+	khiter_t __pos = kh_put(idx, h, e, &rval); \
+	if (rval > 0) kh_val(h, __pos) = e; } while (0)
+
+#define git_idxmap_icase_insert(h, e, rval) do { \
+	khiter_t __pos = kh_put(idxicase, h, e, &rval); \
+	if (rval > 0) kh_val(h, __pos) = e; } while (0)
+
+#define git_idxmap_dir_insert(h, d, rval) do { \
+	khiter_t __pos = kh_put(idxdir, h, d, &rval); \
+	if (rval > 0) kh_val(h, __pos) = d; } while (0)
+
+#define git_idxmap_dir_foreach_value kh_foreach_value
+
+#endif
@@ -8,6 +8,7 @@
 #define GIT_IGNORE_INTERNAL		"[internal]exclude"
 
 #define GIT_IGNORE_DEFAULT_RULES ".\n..\n.git\n"
+#define GIT_IGNORE_DEFAULT_RULE_COUNT 3 /* in GIT_IGNORE_DEFAULT_RULES */
 
 static int parse_ignore_file(
 	git_repository *repo, git_attr_file *attrs, const char *data)
@@ -297,6 +298,13 @@ cleanup:
 	return 0;
 }
 
+bool git_ignore__has_internal_rules(git_ignores *ignores)
+{
+	/* rules are only ever added to the defaults, or reset to them */
+	return ignores->ign_internal != NULL &&
+		ignores->ign_internal->rules.length > GIT_IGNORE_DEFAULT_RULE_COUNT;
+}
+
 int git_ignore_add_rule(git_repository *repo, const char *rules)
 {
 	int error;
@@ -44,6 +44,9 @@ extern void git_ignore__free(git_ignores *ign);
 
 extern int git_ignore__lookup(git_ignores *ign, const char *path, int *ignored);
 
+/* Whether rules were added with `git_ignore_add_rule` (and not cleared) */
+extern bool git_ignore__has_internal_rules(git_ignores *ign);
+
 /* command line Git sometimes generates an error message if given a
  * pathspec that contains an exact match to an ignored file (provided
  * --force isn't also given).  This makes it easy to check it that has
@@ -17,12 +17,22 @@
 #include "pathspec.h"
 #include "ignore.h"
 #include "blob.h"
+#include "varint.h"
+#include "idxmap.h"
+#include "ewah.h"
+#include "filter.h"
+#include "odb.h"
 
 #include "git2/odb.h"
 #include "git2/oid.h"
 #include "git2/blob.h"
 #include "git2/config.h"
 #include "git2/sys/index.h"
+#include "git2/sys/fsmonitor.h"
+
+GIT__USE_IDXMAP
+GIT__USE_IDXMAP_ICASE
+GIT__USE_IDXMAP_DIR
 
 #define entry_size(type,len) ((offsetof(type, path) + (len) + 8) & ~7)
 #define short_entry_size(len) entry_size(struct entry_short, len)
@@ -35,11 +45,28 @@ static const size_t INDEX_HEADER_SIZE = 12;
 
 static const unsigned int INDEX_VERSION_NUMBER = 2;
 static const unsigned int INDEX_VERSION_NUMBER_EXT = 3;
+static const unsigned int INDEX_VERSION_NUMBER_COMP = 4;
 
 static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_END_OF_ENTRIES_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_ENTRY_OFFSETS_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+
+/* The EOIE extension: where the entries end and a hash of the extensions */
+#define INDEX_EOIE_SIZE (4 + GIT_OID_RAWSZ)
+
+#define INDEX_IEOT_VERSION 1
+
+/*
+ * Entries worth a thread of their own when loading, like git. Indexes
+ * with at least two blocks of this many are written with an offset table.
+ */
+#define INDEX_THREAD_COST 10000
+#define INDEX_MAX_BLOCKS 64
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -88,6 +115,14 @@ struct entry_long {
 	char path[1]; /* arbitrary length */
 };
 
+/* A block of entries, as listed in the IEOT extension */
+struct index_block {
+	size_t offset; /* where its first entry is in the file */
+	size_t end;    /* where its last entry ends */
+	size_t first;  /* position of its first entry in the index */
+	uint32_t count;
+};
+
 struct entry_srch_key {
 	const char *path;
 	size_t pathlen;
@@ -107,7 +142,9 @@ struct reuc_entry_internal {
 };
 
 /* local declarations */
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size);
+static size_t read_extension(
+	git_index *index, const char *buffer, size_t buffer_size,
+	size_t entry_count);
 static int read_header(struct index_header *dest, const void *buffer);
 
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size);
@@ -365,8 +402,275 @@ GIT_INLINE(int) index_find(
 		out, &index->entries, index->entries_search, path, path_len, stage);
 }
 
+static void index_map_free(git_index *index)
+{
+	git_idxmap_dir_entry *dir;
+
+	if (index->entries_map)
+		git_idxmap_free(index->entries_map);
+	if (index->entries_map_icase)
+		git_idxmap_icase_free(index->entries_map_icase);
+
+	if (index->entries_dirs) {
+		git_idxmap_dir_foreach_value(index->entries_dirs, dir, {
+			git__free(dir);
+		});
+		git_idxmap_dir_free(index->entries_dirs);
+	}
+}
+
+GIT_INLINE(bool) index_map_exists(git_index *index)
+{
+	return index->ignore_case ?
+		(index->entries_map_icase != NULL) : (index->entries_map != NULL);
+}
+
+static git_index_entry *index_map_get(
+	git_index *index, const char *path, int stage)
+{
+	git_index_entry key = {{ 0 }};
+	git_idxmap_iter pos;
+
+	if (stage == GIT_INDEX_STAGE_ANY) {
+		git_index_entry *found = NULL;
+
+		for (stage = 0; stage < 4 && !found; stage++)
+			found = index_map_get(index, path, stage);
+
+		return found;
+	}
+
+	key.path = path;
+	GIT_IDXENTRY_STAGE_SET(&key, stage);
+
+	if (index->ignore_case) {
+		pos = git_idxmap_icase_lookup_index(index->entries_map_icase, &key);
+		return git_idxmap_valid_index(index->entries_map_icase, pos) ?
+			git_idxmap_value_at(index->entries_map_icase, pos) : NULL;
+	}
+
+	pos = git_idxmap_lookup_index(index->entries_map, &key);
+	return git_idxmap_valid_index(index->entries_map, pos) ?
+		git_idxmap_value_at(index->entries_map, pos) : NULL;
+}
+
+static int index_map_insert(git_index *index, git_index_entry *entry)
+{
+	int error;
+
+	/* an entry which only differs in case from one already there (read
+	 * from an index written case-sensitively) stays out of the map
+	 */
+	if (index->ignore_case)
+		git_idxmap_icase_insert(index->entries_map_icase, entry, error);
+	else
+		git_idxmap_insert(index->entries_map, entry, error);
+
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static git_idxmap_dir_entry *index_dir_get(
+	git_index *index, const char *path, size_t len)
+{
+	git_idxmap_dir_entry key = { 0 };
+	git_idxmap_iter pos;
+
+	key.path = path;
+	key.pathlen = len;
+
+	pos = git_idxmap_dir_lookup_index(index->entries_dirs, &key);
+	return git_idxmap_valid_index(index->entries_dirs, pos) ?
+		git_idxmap_value_at(index->entries_dirs, pos) : NULL;
+}
+
+/* Count `entry` in (or out of) its directory, and that directory in its
+ * parent whenever it gains its first or loses its last entry at a stage.
+ */
+static int index_dirs_update(
+	git_index *index, const git_index_entry *entry, bool add)
+{
+	int stage = GIT_IDXENTRY_STAGE(entry), error;
+	const char *slash = entry->path + strlen(entry->path);
+	git_idxmap_dir_entry *dir;
+	size_t len;
+
+	for (;;) {
+		do {
+			if (slash == entry->path)
+				return 0;
+		} while (*--slash != '/');
+
+		len = slash - entry->path;
+
+		if ((dir = index_dir_get(index, entry->path, len)) == NULL) {
+			if (!add)
+				return 0;
+
+			dir = git__calloc(1, sizeof(git_idxmap_dir_entry) + len + 1);
+			GITERR_CHECK_ALLOC(dir);
+
+			dir->path = memcpy(dir + 1, entry->path, len);
+			dir->pathlen = len;
+
+			git_idxmap_dir_insert(index->entries_dirs, dir, error);
+			if (error < 0) {
+				git__free(dir);
+				giterr_set_oom();
+				return -1;
+			}
+		}
+
+		if (add) {
+			if (dir->entries[stage]++ > 0)
+				return 0;
+		} else {
+			if (!dir->entries[stage] || --dir->entries[stage] > 0)
+				return 0;
+
+			if (!dir->entries[0] && !dir->entries[1] &&
+				!dir->entries[2] && !dir->entries[3]) {
+				git_idxmap_dir_delete_at(index->entries_dirs,
+					git_idxmap_dir_lookup_index(index->entries_dirs, dir));
+				git__free(dir);
+			}
+		}
+	}
+}
+
+/* call with locked index */
+static int index_map_build(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+	int error;
+
+	if (index_map_exists(index))
+		return 0;
+
+	/* leave enough room that filling it never needs to grow it */
+	if (index->ignore_case) {
+		if ((error = git_idxmap_icase_alloc(&index->entries_map_icase)) == 0)
+			error = git_idxmap_icase_resize(index->entries_map_icase,
+				(khint_t)(index->entries.length * 4 / 3 + 1));
+	} else {
+		if ((error = git_idxmap_alloc(&index->entries_map)) == 0)
+			error = git_idxmap_resize(index->entries_map,
+				(khint_t)(index->entries.length * 4 / 3 + 1));
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (error < 0)
+			break;
+		error = index_map_insert(index, entry);
+	}
+
+	if (error < 0)
+		index_map_free(index);
+
+	return error;
+}
+
+/* call with locked index */
+static int index_dirs_build(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+	int error;
+
+	if (index->entries_dirs)
+		return 0;
+
+	error = git_idxmap_dir_alloc(&index->entries_dirs);
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (error < 0)
+			break;
+		error = index_dirs_update(index, entry, true);
+	}
+
+	if (error < 0)
+		index_map_free(index);
+
+	return error;
+}
+
+static int index_map_if_needed(git_index *index, bool need_lock)
+{
+	int error;
+
+	if (index_map_exists(index))
+		return 0;
+
+	if (need_lock && git_mutex_lock(&index->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock index");
+		return -1;
+	}
+
+	error = index_map_build(index);
+
+	if (need_lock)
+		git_mutex_unlock(&index->lock);
+
+	return error;
+}
+
+/* Keep the maps in step with a new entry.  The entries themselves have
+ * changed already, so if that fails drop the maps to be rebuilt later.
+ */
+static void index_map_add(git_index *index, git_index_entry *entry)
+{
+	if ((index_map_exists(index) && index_map_insert(index, entry) < 0) ||
+		(index->entries_dirs && index_dirs_update(index, entry, true) < 0)) {
+		index_map_free(index);
+		giterr_clear();
+	}
+}
+
+/* call after `entry` was removed from position `pos` */
+static void index_map_remove(
+	git_index *index, git_index_entry *entry, size_t pos)
+{
+	git_index_entry *dup;
+	size_t i;
+
+	if (index->entries_dirs)
+		index_dirs_update(index, entry, false);
+
+	if (!index_map_exists(index) ||
+		index_map_get(index, entry->path, GIT_IDXENTRY_STAGE(entry)) != entry)
+		return;
+
+	if (index->ignore_case)
+		git_idxmap_icase_delete_at(index->entries_map_icase,
+			git_idxmap_icase_lookup_index(index->entries_map_icase, entry));
+	else
+		git_idxmap_delete_at(index->entries_map,
+			git_idxmap_lookup_index(index->entries_map, entry));
+
+	/* an equal entry (from a damaged index, or one differing in case)
+	 * sorts right next to it and takes over its place in the map
+	 */
+	for (i = pos > 0 ? pos - 1 : 0; i <= pos; i++) {
+		if ((dup = git_vector_get(&index->entries, i)) != NULL &&
+			GIT_IDXENTRY_STAGE(dup) == GIT_IDXENTRY_STAGE(entry) &&
+			index->entries_cmp_path(dup->path, entry->path) == 0) {
+			if (index_map_insert(index, dup) < 0) {
+				index_map_free(index);
+				giterr_clear();
+			}
+			break;
+		}
+	}
+}
+
 void git_index__set_ignore_case(git_index *index, bool ignore_case)
 {
+	index_map_free(index);
 	index->ignore_case = ignore_case;
 
 	if (ignore_case) {
@@ -421,6 +725,7 @@ int git_index_open(git_index **index_out, const char *index_path)
 		git_vector_init(&index->deleted, 8, git_index_entry_cmp) < 0)
 		goto fail;
 
+	index->version = INDEX_VERSION_NUMBER;
 	index->entries_cmp_path = git__strcmp_cb;
 	index->entries_search = git_index_entry_srch;
 	index->entries_search_path = index_entry_srch_path;
@@ -452,6 +757,7 @@ static void index_free(git_index *index)
 	assert(!git_atomic_get(&index->readers));
 
 	git_index_clear(index);
+	index_map_free(index);
 	git_vector_free(&index->entries);
 	git_vector_free(&index->names);
 	git_vector_free(&index->reuc);
@@ -495,12 +801,16 @@ static int index_remove_entry(git_index *index, size_t pos)
 	int error = 0;
 	git_index_entry *entry = git_vector_get(&index->entries, pos);
 
-	if (entry != NULL)
+	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
+	}
 
 	error = git_vector_remove(&index->entries, pos);
 
 	if (!error) {
+		index_map_remove(index, entry, pos);
+
 		if (git_atomic_get(&index->readers) > 0) {
 			error = git_vector_insert(&index->deleted, entry);
 		} else {
@@ -520,11 +830,25 @@ int git_index_clear(git_index *index)
 	git_tree_cache_free(index->tree);
 	index->tree = NULL;
 
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+	index->fsmonitor_fresh = 0;
+	index->fsmonitor_dirs = 0;
+
+	git_bitvec_free(&index->fsmonitor_dirty);
+	git_bitvec_init(&index->fsmonitor_dirty, 0);
+	index->fsmonitor_dirty_bits = 0;
+
 	if (git_mutex_lock(&index->lock) < 0) {
 		giterr_set(GITERR_OS, "Failed to lock index");
 		return -1;
 	}
 
+	index_map_free(index);
+
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
 	index_free_deleted(index);
@@ -588,6 +912,42 @@ int git_index_caps(const git_index *index)
 			(index->no_symlinks ? GIT_INDEXCAP_NO_SYMLINKS : 0));
 }
 
+unsigned int git_index_version(git_index *index)
+{
+	assert(index);
+
+	return index->version;
+}
+
+int git_index_set_version(git_index *index, unsigned int version)
+{
+	assert(index);
+
+	if (version < INDEX_VERSION_NUMBER ||
+		version > INDEX_VERSION_NUMBER_COMP) {
+		giterr_set(GITERR_INDEX, "Invalid version number");
+		return -1;
+	}
+
+	index->version = version;
+
+	return 0;
+}
+
+unsigned int git_index_set_threads(git_index *index, unsigned int n)
+{
+	assert(index);
+
+#ifdef GIT_THREADS
+	index->nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	index->nr_threads = 1;
+#endif
+
+	return index->nr_threads;
+}
+
 int git_index_read(git_index *index, int force)
 {
 	int error = 0, updated;
@@ -645,63 +1005,278 @@ int git_index__changed_relative_to(
 			index->stamp.ino != fs->ino);
 }
 
-int git_index_write(git_index *index)
+bool git_index__has_dir(git_index *index, const char *dir, size_t dir_len)
 {
-	git_filebuf file = GIT_FILEBUF_INIT;
-	int error;
+	const git_index_entry *entry;
+	size_t pos;
 
-	if (!index->index_file_path)
-		return create_index_error(-1,
-			"Failed to read index: The index is in-memory only");
+	if (index_find(&pos, index, dir, dir_len, 0, true) == -1) {
+		giterr_clear();
+		return false;
+	}
 
-	if (index_sort_if_needed(index, true) < 0)
-		return -1;
-	git_vector_sort(&index->reuc);
+	return ((entry = git_vector_get(&index->entries, pos)) != NULL &&
+		(index->ignore_case ? git__strncasecmp : git__strncmp)(
+			entry->path, dir, dir_len) == 0);
+}
 
-	if ((error = git_filebuf_open(
-		&file, index->index_file_path, GIT_FILEBUF_HASH_CONTENTS, GIT_INDEX_FILE_MODE)) < 0) {
-		if (error == GIT_ELOCKED)
-			giterr_set(GITERR_INDEX, "The index is locked. This might be due to a concurrent or crashed process");
+int git_index__foreach_in_dir(
+	git_index *index, const char *dir, size_t dir_len,
+	int (*cb)(const char *path, size_t path_len, void *payload),
+	void *payload)
+{
+	int (*strncomp)(const char *a, const char *b, size_t sz) =
+		index->ignore_case ? git__strncasecmp : git__strncmp;
+	const git_index_entry *entry, *prev = NULL;
+	git_buf next = GIT_BUF_INIT;
+	const char *slash;
+	size_t pos, len;
+	int error;
 
+	if ((error = index_find(&pos, index, dir, dir_len, 0, true)) == -1)
 		return error;
+	error = 0;
+
+	while ((entry = git_vector_get(&index->entries, pos)) != NULL &&
+		strncomp(entry->path, dir, dir_len) == 0) {
+
+		if ((slash = strchr(entry->path + dir_len, '/')) != NULL) {
+			len = slash - entry->path + 1;
+
+			if ((error = cb(entry->path, len, payload)) != 0)
+				break;
+
+			/* skip to the first entry after the directory: '0'
+			 * comes right after '/'
+			 */
+			git_buf_set(&next, entry->path, len - 1);
+			git_buf_putc(&next, '0');
+			if (git_buf_oom(&next) ||
+				(error = index_find(&pos, index,
+					next.ptr, next.size, 0, true)) == -1) {
+				error = -1;
+				break;
+			}
+			error = 0;
+
+			prev = NULL;
+			continue;
+		}
+
+		/* the stages of a conflict are next to each other */
+		if (!prev || index->entries_cmp_path(prev->path, entry->path) != 0) {
+			if ((error = cb(entry->path, strlen(entry->path), payload)) != 0)
+				break;
+		}
+
+		prev = entry;
+		pos++;
 	}
 
-	if ((error = write_index(index, &file)) < 0) {
-		git_filebuf_cleanup(&file);
+	git_buf_free(&next);
+	return error;
+}
+
+int git_index__untracked_cache(
+	git_untracked_cache **out, git_index *index, git_repository *repo)
+{
+	int use, error;
+
+	*out = NULL;
+
+	if ((error = git_repository__cvar(
+			&use, repo, GIT_CVAR_UNTRACKEDCACHE)) < 0)
 		return error;
+
+	if (use == GIT_UNTRACKEDCACHE_FALSE) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		return 0;
 	}
 
-	if ((error = git_filebuf_commit(&file)) < 0)
-		return error;
+	if (!index->untracked) {
+		if (use != GIT_UNTRACKEDCACHE_TRUE)
+			return 0;
+		if ((error = git_untracked_cache_new(&index->untracked)) < 0)
+			return error;
+	}
 
-	if (git_futils_filestamp_check(&index->stamp, index->index_file_path) < 0)
-		/* index could not be read from disk! */;
-	else
-		index->on_disk = 1;
+	if ((error = git_untracked_cache_validate(index->untracked, repo)) < 0)
+		return error;
 
+	*out = index->untracked;
 	return 0;
 }
 
-const char * git_index_path(const git_index *index)
+typedef struct {
+	git_index *index;
+	git_buf dir;
+	bool everything;
+} fsmonitor_refresh_data;
+
+static void fsmonitor_invalidate_all(git_index *index)
 {
-	assert(index);
-	return index->index_file_path;
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
 }
 
-int git_index_write_tree(git_oid *oid, git_index *index)
+static int fsmonitor_changed(const char *path, void *payload)
 {
-	git_repository *repo;
+	fsmonitor_refresh_data *data = payload;
+	git_index *index = data->index;
+	int (*strncomp)(const char *a, const char *b, size_t sz) =
+		index->ignore_case ? git__strncasecmp : git__strncmp;
+	git_index_entry *entry;
+	git_untracked_dir *dir;
+	const char *name, *slash;
+	size_t path_len = strlen(path), pos;
 
-	assert(oid && index);
+	if (!path_len) {
+		data->everything = true;
+		return 0;
+	}
 
-	repo = INDEX_OWNER(index);
+	/* the path may be a file, or a directory and all that is below it */
+	if (index_find(&pos, index, path, path_len, 0, true) == -1)
+		return -1;
 
-	if (repo == NULL)
-		return create_index_error(-1, "Failed to write tree. "
-		  "The index file is not backed up by an existing repository");
+	while ((entry = git_vector_get(&index->entries, pos++)) != NULL &&
+		strncomp(entry->path, path, path_len) == 0) {
+		if (entry->path[path_len] == '\0' || entry->path[path_len] == '/')
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
 
-	return git_tree__write_index(oid, index, repo);
-}
+	if (index->untracked && (dir = index->untracked->root) != NULL) {
+		/* the directory's own block too, if it is one */
+		if (git_buf_sets(&data->dir, path) < 0 ||
+			git_buf_putc(&data->dir, '/') < 0)
+			return -1;
+
+		git_untracked_cache_invalidate_path(index->untracked, data->dir.ptr);
+
+		/* and everything below it, which may have been replaced whole */
+		for (name = data->dir.ptr; dir != NULL && *name; name = slash + 1) {
+			slash = strchr(name, '/');
+
+			if (git_untracked_dir_child(
+					&dir, dir, name, slash - name, false) < 0)
+				return -1;
+		}
+
+		if (dir != NULL)
+			git_untracked_dir_invalidate(dir, true);
+	}
+
+	return 0;
+}
+
+int git_index__fsmonitor_refresh(git_index *index, git_repository *repo)
+{
+	git_fsmonitor *fsmonitor = repo->_fsmonitor;
+	fsmonitor_refresh_data data;
+	git_buf token = GIT_BUF_INIT;
+	int error = 0;
+
+	index->fsmonitor_fresh = 0;
+	index->fsmonitor_dirs = 0;
+
+	memset(&data, 0, sizeof(data));
+	data.index = index;
+	data.everything = (index->fsmonitor_token == NULL);
+
+	if (fsmonitor)
+		error = fsmonitor->query(&token, fsmonitor,
+			index->fsmonitor_token, fsmonitor_changed, &data);
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+
+	/* without a monitor (that works) the bits can't be kept up to date */
+	if (!fsmonitor || error < 0 || data.everything)
+		fsmonitor_invalidate_all(index);
+
+	if (fsmonitor && !error) {
+		index->fsmonitor_token = git_buf_detach(&token);
+		index->fsmonitor_fresh = 1;
+		index->fsmonitor_dirs = !data.everything;
+	}
+
+	git_buf_free(&data.dir);
+	git_buf_free(&token);
+	return error;
+}
+
+void git_index__fsmonitor_mark_valid(
+	git_index *index, const git_index_entry *entry)
+{
+	/* racily clean entries have to be looked at again */
+	if (index->fsmonitor_fresh &&
+		!GIT_IDXENTRY_STAGE(entry) && !S_ISGITLINK(entry->mode) &&
+		entry->mtime.seconds < (git_time_t)index->stamp.mtime)
+		((git_index_entry *)entry)->flags_extended |=
+			GIT_IDXENTRY_FSMONITOR_VALID;
+}
+
+int git_index_write(git_index *index)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	int error;
+
+	if (!index->index_file_path)
+		return create_index_error(-1,
+			"Failed to read index: The index is in-memory only");
+
+	if (index_sort_if_needed(index, true) < 0)
+		return -1;
+	git_vector_sort(&index->reuc);
+
+	if ((error = git_filebuf_open(
+		&file, index->index_file_path, GIT_FILEBUF_HASH_CONTENTS, GIT_INDEX_FILE_MODE)) < 0) {
+		if (error == GIT_ELOCKED)
+			giterr_set(GITERR_INDEX, "The index is locked. This might be due to a concurrent or crashed process");
+
+		return error;
+	}
+
+	if ((error = write_index(index, &file)) < 0) {
+		git_filebuf_cleanup(&file);
+		return error;
+	}
+
+	if ((error = git_filebuf_commit(&file)) < 0)
+		return error;
+
+	if (git_futils_filestamp_check(&index->stamp, index->index_file_path) < 0)
+		/* index could not be read from disk! */;
+	else
+		index->on_disk = 1;
+
+	return 0;
+}
+
+const char * git_index_path(const git_index *index)
+{
+	assert(index);
+	return index->index_file_path;
+}
+
+int git_index_write_tree(git_oid *oid, git_index *index)
+{
+	git_repository *repo;
+
+	assert(oid && index);
+
+	repo = INDEX_OWNER(index);
+
+	if (repo == NULL)
+		return create_index_error(-1, "Failed to write tree. "
+		  "The index file is not backed up by an existing repository");
+
+	return git_tree__write_index(oid, index, repo);
+}
 
 int git_index_write_tree_to(
 	git_oid *oid, git_index *index, git_repository *repo)
@@ -728,16 +1303,17 @@ const git_index_entry *git_index_get_byindex(
 const git_index_entry *git_index_get_bypath(
 	git_index *index, const char *path, int stage)
 {
-	size_t pos;
+	git_index_entry *entry;
 
 	assert(index);
 
-	if (index_find(&pos, index, path, 0, stage, true) < 0) {
-		giterr_set(GITERR_INDEX, "Index does not contain %s", path);
+	if (index_map_if_needed(index, true) < 0)
 		return NULL;
-	}
 
-	return git_index_get_byindex(index, pos);
+	if ((entry = index_map_get(index, path, stage)) == NULL)
+		giterr_set(GITERR_INDEX, "Index does not contain %s", path);
+
+	return entry;
 }
 
 void git_index_entry__init_from_stat(
@@ -756,21 +1332,29 @@ void git_index_entry__init_from_stat(
 	entry->file_size = st->st_size;
 }
 
-static git_index_entry *index_entry_alloc(const char *path)
+static git_index_entry *index_entry_alloc_joined(
+	const char *prefix, size_t prefix_len,
+	const char *suffix, size_t suffix_len)
 {
-	size_t pathlen = strlen(path);
+	size_t pathlen = prefix_len + suffix_len;
 	struct entry_internal *entry =
 		git__calloc(sizeof(struct entry_internal) + pathlen + 1, 1);
 	if (!entry)
 		return NULL;
 
 	entry->pathlen = pathlen;
-	memcpy(entry->path, path, pathlen);
+	memcpy(entry->path, prefix, prefix_len);
+	memcpy(entry->path + prefix_len, suffix, suffix_len);
 	entry->entry.path = entry->path;
 
 	return (git_index_entry *)entry;
 }
 
+static git_index_entry *index_entry_alloc(const char *path)
+{
+	return index_entry_alloc_joined(path, strlen(path), "", 0);
+}
+
 static int index_entry_init(
 	git_index_entry **entry_out, git_index *index, const char *rel_path)
 {
@@ -865,12 +1449,18 @@ static int index_entry_dup(git_index_entry **out, const git_index_entry *src)
 }
 
 static int has_file_name(git_index *index,
-	 const git_index_entry *entry, size_t pos, int ok_to_replace)
+	 const git_index_entry *entry, int ok_to_replace)
 {
 	int retval = 0;
-	size_t len = strlen(entry->path);
+	size_t len = strlen(entry->path), pos;
 	int stage = GIT_IDXENTRY_STAGE(entry);
 	const char *name = entry->path;
+	git_idxmap_dir_entry *dir = index_dir_get(index, name, len);
+
+	if (!dir || !dir->entries[stage])
+		return 0;
+
+	index_find(&pos, index, name, len, stage, false);
 
 	while (pos < index->entries.length) {
 		struct entry_internal *p = index->entries.contents[pos++];
@@ -904,6 +1494,7 @@ static int has_dir_name(git_index *index,
 	int stage = GIT_IDXENTRY_STAGE(entry);
 	const char *name = entry->path;
 	const char *slash = name + strlen(name);
+	git_idxmap_dir_entry *dir;
 
 	for (;;) {
 		size_t len, pos;
@@ -916,6 +1507,15 @@ static int has_dir_name(git_index *index,
 		}
 		len = slash - name;
 
+		/*
+		 * Trivial optimization: if we find an entry that
+		 * already matches the sub-directory, then we know
+		 * we're ok, and we can exit.
+		 */
+		if ((dir = index_dir_get(index, name, len)) != NULL &&
+			dir->entries[stage] > 0)
+			return retval;
+
 		if (!index_find(&pos, index, name, len, stage, false)) {
 			retval = -1;
 			if (!ok_to_replace)
@@ -925,32 +1525,15 @@ static int has_dir_name(git_index *index,
 				break;
 			continue;
 		}
-
-		/*
-		 * Trivial optimization: if we find an entry that
-		 * already matches the sub-directory, then we know
-		 * we're ok, and we can exit.
-		 */
-		for (; pos < index->entries.length; ++pos) {
-			struct entry_internal *p = index->entries.contents[pos];
-
-			if (p->pathlen <= len ||
-			    p->path[len] != '/' ||
-			    memcmp(p->path, name, len))
-				break; /* not our subdirectory */
-
-			if (GIT_IDXENTRY_STAGE(&p->entry) == stage)
-				return retval;
-		}
 	}
 
 	return retval;
 }
 
 static int check_file_directory_collision(git_index *index,
-		git_index_entry *entry, size_t pos, int ok_to_replace)
+		git_index_entry *entry, int ok_to_replace)
 {
-	int retval = has_file_name(index, entry, pos, ok_to_replace);
+	int retval = has_file_name(index, entry, ok_to_replace);
 	retval = retval + has_dir_name(index, entry, ok_to_replace);
 
 	if (retval) {
@@ -981,7 +1564,7 @@ static int index_insert(
 {
 	int error = 0;
 	size_t path_length, position;
-	git_index_entry *existing = NULL, *entry;
+	git_index_entry *existing, *entry, *last;
 
 	assert(index && entry_ptr);
 
@@ -997,6 +1580,9 @@ static int index_insert(
 	else
 		entry->flags |= GIT_IDXENTRY_NAMEMASK;
 
+	/* the working directory may not match what is added */
+	entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+
 	if (git_mutex_lock(&index->lock) < 0) {
 		giterr_set(GITERR_OS, "Unable to acquire index lock");
 		return -1;
@@ -1004,16 +1590,35 @@ static int index_insert(
 
 	git_vector_sort(&index->entries);
 
-	/* look if an entry with this path already exists */
-	if (!index_find(
-			&position, index, entry->path, 0, GIT_IDXENTRY_STAGE(entry), false)) {
+	if ((error = index_dirs_build(index)) < 0) {
+		git_mutex_unlock(&index->lock);
+		index_entry_free(*entry_ptr);
+		*entry_ptr = NULL;
+		return error;
+	}
+
+	/* look if an entry with this path already exists, unless it's going
+	 * to the end, as it does when adding in order
+	 */
+	last = git_vector_last(&index->entries);
+
+	if (last && index->entries._cmp(last, entry) < 0)
+		existing = NULL;
+	else if (index_map_exists(index))
+		existing = index_map_get(
+			index, entry->path, GIT_IDXENTRY_STAGE(entry));
+	else if (!index_find(&position, index,
+			entry->path, 0, GIT_IDXENTRY_STAGE(entry), false))
 		existing = index->entries.contents[position];
-		/* update filemode to existing values if stat is not trusted */
+	else
+		existing = NULL;
+
+	/* update filemode to existing values if stat is not trusted */
+	if (existing)
 		entry->mode = index_merge_mode(index, existing, entry->mode);
-	}
 
 	/* look for tree / blob name collisions, removing conflicts if requested */
-	error = check_file_directory_collision(index, entry, position, replace);
+	error = check_file_directory_collision(index, entry, replace);
 	if (error < 0)
 		/* skip changes */;
 
@@ -1032,6 +1637,11 @@ static int index_insert(
 		 * check for dups, this is actually cheaper in the long run.)
 		 */
 		error = git_vector_insert_sorted(&index->entries, entry, index_no_dups);
+
+		if (!error) {
+			index_map_add(index, entry);
+			git_untracked_cache_invalidate_path(index->untracked, entry->path);
+		}
 	}
 
 	if (error < 0) {
@@ -1182,6 +1792,14 @@ int git_index__find_pos(
 	size_t *out, git_index *index, const char *path, size_t path_len, int stage)
 {
 	assert(index && path);
+
+	/* without a position to report, the hash map can answer alone */
+	if (!out && !path_len) {
+		if (index_map_if_needed(index, true) < 0)
+			return -1;
+		return index_map_get(index, path, stage) ? 0 : GIT_ENOTFOUND;
+	}
+
 	return index_find(out, index, path, path_len, stage, true);
 }
 
@@ -1749,10 +2367,63 @@ static int read_conflict_names(git_index *index, const char *buffer, size_t size
 	return 0;
 }
 
+/*
+ * Version 4 indexes don't store the whole path of an entry, but how many
+ * bytes to drop from the end of the previous entry's path, followed by
+ * the NUL-terminated bytes to append to what remains. The entries are
+ * not padded either.
+ */
+static size_t read_entry_compressed(
+	git_index_entry **out,
+	const git_index_entry *src,
+	const git_index_entry *last,
+	const char *path_ptr,
+	size_t path_avail)
+{
+	size_t varint_len, strip_len, last_len, suffix_len;
+	const char *suffix, *suffix_end;
+
+	last_len = last ? ((struct entry_internal *)last)->pathlen : 0;
+
+	strip_len = (size_t)git_decode_varint(
+		(const unsigned char *)path_ptr, path_avail, &varint_len);
+	if (varint_len == 0)
+		return 0;
+
+	/*
+	 * The first entry of a block of the IEOT extension has the whole
+	 * path, and whatever it says to strip is meant for a sequential reader.
+	 */
+	if (!last)
+		strip_len = 0;
+	else if (strip_len > last_len)
+		return 0;
+
+	suffix = path_ptr + varint_len;
+	suffix_end = memchr(suffix, '\0', path_avail - varint_len);
+	if (suffix_end == NULL)
+		return 0;
+
+	suffix_len = suffix_end - suffix;
+
+	*out = index_entry_alloc_joined(
+		last ? last->path : "", last_len - strip_len, suffix, suffix_len);
+	if (*out == NULL)
+		return 0;
+
+	index_entry_cpy(*out, src);
+
+	return varint_len + suffix_len + 1;
+}
+
 static size_t read_entry(
-	git_index_entry **out, const void *buffer, size_t buffer_size)
+	git_index_entry **out,
+	git_index *index,
+	const void *buffer,
+	size_t buffer_size,
+	const git_index_entry *last)
 {
-	size_t path_length, entry_size;
+	size_t path_length, path_offset, entry_size;
 	uint16_t flags_raw;
 	const char *path_ptr;
 	const struct entry_short *source = buffer;
@@ -1783,6 +2454,20 @@ static size_t read_entry(
 	} else
 		path_ptr = source->path;
 
+	path_offset = path_ptr - (const char *)buffer;
+
+	if (index->version >= INDEX_VERSION_NUMBER_COMP) {
+		size_t path_size;
+
+		if (INDEX_FOOTER_SIZE + path_offset >= buffer_size)
+			return 0;
+
+		path_size = read_entry_compressed(out, &entry, last, path_ptr,
+			buffer_size - INDEX_FOOTER_SIZE - path_offset);
+
+		return path_size ? path_offset + path_size : 0;
+	}
+
 	path_length = entry.flags & GIT_IDXENTRY_NAMEMASK;
 
 	/* if this is a very long string, we must find its
@@ -1822,15 +2507,101 @@ static int read_header(struct index_header *dest, const void *buffer)
 		return index_error_invalid("incorrect header signature");
 
 	dest->version = ntohl(source->version);
-	if (dest->version != INDEX_VERSION_NUMBER_EXT &&
-		dest->version != INDEX_VERSION_NUMBER)
+	if (dest->version < INDEX_VERSION_NUMBER ||
+		dest->version > INDEX_VERSION_NUMBER_COMP)
 		return index_error_invalid("incorrect header version");
 
 	dest->entry_count = ntohl(source->entry_count);
 	return 0;
 }
 
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size)
+/*
+ * The FSMN extension: a version (2, as version 1 has a timestamp for
+ * git's hooks instead of a token), the token and its NUL, and the size
+ * of an EWAH bitmap of the entries which were not valid, in on-disk order.
+ */
+static int read_fsmonitor(
+	git_index *index, const char *buffer, size_t size, size_t entry_count)
+{
+	const char *end = buffer + size, *token_end;
+	uint32_t version, ewah_size;
+	git_ewah dirty;
+	size_t len;
+
+	if (size < 4)
+		goto corrupt;
+
+	memcpy(&version, buffer, 4);
+	buffer += 4;
+
+	if (ntohl(version) != 2)
+		return 0;
+
+	if ((token_end = memchr(buffer, '\0', end - buffer)) == NULL ||
+		end - (token_end + 1) < 4)
+		goto corrupt;
+
+	memcpy(&ewah_size, token_end + 1, 4);
+	ewah_size = ntohl(ewah_size);
+
+	if (ewah_size > (size_t)(end - (token_end + 5)) ||
+		git_ewah_parse(&dirty, &len,
+			(const unsigned char *)token_end + 5, ewah_size) < 0 ||
+		len != ewah_size)
+		goto corrupt;
+
+	/* there is no entry past the end of the index to be dirty */
+	if (dirty.bit_size > entry_count)
+		goto corrupt;
+
+	git__free(index->fsmonitor_token);
+	git_bitvec_free(&index->fsmonitor_dirty);
+	index->fsmonitor_dirty_bits = dirty.bit_size;
+
+	index->fsmonitor_token = NULL;
+
+	if (git_bitvec_init(&index->fsmonitor_dirty, dirty.bit_size) < 0 ||
+		git_ewah_or(&index->fsmonitor_dirty, &dirty) < 0 ||
+		(index->fsmonitor_token = git__strdup(buffer)) == NULL)
+		return -1;
+
+	return 0;
+
+corrupt:
+	giterr_set(GITERR_INDEX, "Corrupted fsmonitor extension in index");
+	return -1;
+}
+
+/* Set the bits of the entries, read in on-disk order, from the FSMN
+ * extension
+ */
+static void apply_fsmonitor(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	if (index->fsmonitor_token &&
+		index->fsmonitor_dirty_bits > index->entries.length) {
+		git__free(index->fsmonitor_token);
+		index->fsmonitor_token = NULL;
+	}
+
+	if (index->fsmonitor_token) {
+		git_vector_foreach(&index->entries, i, entry) {
+			if (i >= index->fsmonitor_dirty_bits ||
+				!git_bitvec_get(&index->fsmonitor_dirty, i))
+				entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+		}
+	}
+
+	git_bitvec_free(&index->fsmonitor_dirty);
+	git_bitvec_init(&index->fsmonitor_dirty, 0);
+	index->fsmonitor_dirty_bits = 0;
+}
+
+static size_t read_extension(
+	git_index *index, const char *buffer, size_t buffer_size,
+	size_t entry_count)
 {
 	const struct index_extension *source;
 	struct index_extension dest;
@@ -1860,6 +2631,16 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
 			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
 				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			/* like git, do without a cache we can't make sense of */
+			git_untracked_cache_free(index->untracked);
+			if (git_untracked_cache_read(&index->untracked,
+					buffer + 8, dest.extension_size) < 0)
+				giterr_clear();
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			if (read_fsmonitor(index,
+					buffer + 8, dest.extension_size, entry_count) < 0)
+				giterr_clear();
 		}
 		/* else, unsupported extension. We cannot parse this, but we can skip
 		 * it by returning `total_size */
@@ -1872,116 +2653,453 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 	return total_size;
 }
 
-static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+static int read_entries(
+	git_index *index,
+	struct index_header *header,
+	const char *buffer,
+	size_t buffer_size)
 {
 	int error = 0;
 	unsigned int i;
-	struct index_header header = { 0 };
-	git_oid checksum_calculated, checksum_expected;
+	git_index_entry *last = NULL;
 
 #define seek_forward(_increase) { \
-	if (_increase >= buffer_size) { \
-		error = index_error_invalid("ran out of data while parsing"); \
-		goto done; } \
+	if (_increase >= buffer_size) \
+		return index_error_invalid("ran out of data while parsing"); \
 	buffer += _increase; \
 	buffer_size -= _increase;\
 }
 
-	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
-		return index_error_invalid("insufficient buffer space");
-
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
-
-	/* Parse header */
-	if ((error = read_header(&header, buffer)) < 0)
-		return error;
-
 	seek_forward(INDEX_HEADER_SIZE);
 
-	if (git_mutex_lock(&index->lock) < 0) {
-		giterr_set(GITERR_OS, "Unable to acquire index lock");
-		return -1;
-	}
-
-	assert(!index->entries.length);
-
 	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
+	for (i = 0; i < header->entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
 		git_index_entry *entry;
-		size_t entry_size = read_entry(&entry, buffer, buffer_size);
+		size_t entry_size = read_entry(&entry, index, buffer, buffer_size, last);
 
 		/* 0 bytes read means an object corruption */
-		if (entry_size == 0) {
-			error = index_error_invalid("invalid entry");
-			goto done;
-		}
+		if (entry_size == 0)
+			return index_error_invalid("invalid entry");
 
 		if ((error = git_vector_insert(&index->entries, entry)) < 0) {
 			index_entry_free(entry);
-			goto done;
+			return error;
 		}
 
+		last = entry;
 		seek_forward(entry_size);
 	}
 
-	if (i != header.entry_count) {
-		error = index_error_invalid("header entries changed while parsing");
-		goto done;
-	}
+	if (i != header->entry_count)
+		return index_error_invalid("header entries changed while parsing");
 
 	/* There's still space for some extensions! */
 	while (buffer_size > INDEX_FOOTER_SIZE) {
 		size_t extension_size;
 
-		extension_size = read_extension(index, buffer, buffer_size);
+		extension_size = read_extension(
+			index, buffer, buffer_size, header->entry_count);
 
 		/* see if we have read any bytes from the extension */
-		if (extension_size == 0) {
-			error = index_error_invalid("extension is truncated");
-			goto done;
-		}
+		if (extension_size == 0)
+			return index_error_invalid("extension is truncated");
 
 		seek_forward(extension_size);
 	}
 
-	if (buffer_size != INDEX_FOOTER_SIZE) {
-		error = index_error_invalid(
-			"buffer size does not match index footer size");
-		goto done;
-	}
-
-	/* 160-bit SHA-1 over the content of the index file before this checksum. */
-	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
-
-	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
-		error = index_error_invalid(
-			"calculated checksum does not match expected");
-		goto done;
-	}
-
 #undef seek_forward
 
-	/* Entries are stored case-sensitively on disk, so re-sort now if
-	 * in-memory index is supposed to be case-insensitive
-	 */
-	git_vector_set_sorted(&index->entries, !index->ignore_case);
-	error = index_sort_if_needed(index, false);
+	if (buffer_size != INDEX_FOOTER_SIZE)
+		return index_error_invalid(
+			"buffer size does not match index footer size");
 
-done:
-	git_mutex_unlock(&index->lock);
-	return error;
+	return 0;
 }
 
-static bool is_index_extended(git_index *index)
+#ifdef GIT_THREADS
+
+/*
+ * Find where the entries end from the EOIE extension, which is written
+ * last, right before the checksum. It carries a hash of the headers of
+ * the extensions in between, so that we don't mistake an index written
+ * by something that doesn't know about EOIE (and so hasn't kept it up to
+ * date) for one which does. Returns 0 if there's no usable EOIE.
+ */
+static size_t read_end_of_entries(const char *buffer, size_t buffer_size)
 {
-	size_t i, extended;
-	git_index_entry *entry;
+	const char *eoie;
+	size_t eoie_pos, offset, pos;
+	git_hash_ctx ctx;
+	git_oid expected, actual;
 
-	extended = 0;
+	if (buffer_size < INDEX_HEADER_SIZE + sizeof(struct index_extension) +
+		INDEX_EOIE_SIZE + INDEX_FOOTER_SIZE)
+		return 0;
 
-	git_vector_foreach(&index->entries, i, entry) {
+	eoie_pos = buffer_size - INDEX_FOOTER_SIZE - INDEX_EOIE_SIZE -
+		sizeof(struct index_extension);
+	eoie = buffer + eoie_pos;
+
+	if (memcmp(eoie, INDEX_EXT_END_OF_ENTRIES_SIG, 4) != 0 ||
+		ntohl(*(uint32_t *)(eoie + 4)) != INDEX_EOIE_SIZE)
+		return 0;
+
+	offset = ntohl(*(uint32_t *)(eoie + 8));
+	if (offset < INDEX_HEADER_SIZE || offset > eoie_pos)
+		return 0;
+
+	if (git_hash_ctx_init(&ctx) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	for (pos = offset; pos < eoie_pos; ) {
+		size_t extension_size;
+
+		if (eoie_pos - pos < sizeof(struct index_extension))
+			break;
+
+		extension_size = ntohl(*(uint32_t *)(buffer + pos + 4));
+		git_hash_update(&ctx, buffer + pos, sizeof(struct index_extension));
+
+		pos += sizeof(struct index_extension);
+		if (extension_size > eoie_pos - pos)
+			break;
+
+		pos += extension_size;
+	}
+
+	git_hash_final(&actual, &ctx);
+	git_hash_ctx_cleanup(&ctx);
+
+	git_oid_fromraw(&expected, (const unsigned char *)eoie + 12);
+
+	if (pos != eoie_pos || git_oid__cmp(&expected, &actual) != 0)
+		return 0;
+
+	return offset;
+}
+
+/*
+ * Read the blocks of entries from the IEOT extension, which is the first
+ * one after the entries. With no (usable) IEOT, all the entries are one
+ * block.
+ */
+static int read_entry_blocks(
+	struct index_block **out,
+	size_t *out_len,
+	struct index_header *header,
+	const char *buffer,
+	size_t buffer_size,
+	size_t entries_end)
+{
+	const char *ieot = buffer + entries_end;
+	struct index_block *blocks;
+	size_t ieot_size, nblocks = 0, first = 0, i;
+
+	if (buffer_size - entries_end >= sizeof(struct index_extension) + 4 &&
+		memcmp(ieot, INDEX_EXT_ENTRY_OFFSETS_SIG, 4) == 0) {
+		ieot_size = ntohl(*(uint32_t *)(ieot + 4));
+
+		if (ieot_size >= 4 && (ieot_size - 4) % 8 == 0 &&
+			ieot_size <= buffer_size - entries_end - sizeof(struct index_extension) &&
+			ntohl(*(uint32_t *)(ieot + 8)) == INDEX_IEOT_VERSION)
+			nblocks = (ieot_size - 4) / 8;
+	}
+
+	if (!nblocks)
+		ieot = NULL;
+
+	blocks = git__calloc(ieot ? nblocks : 1, sizeof(struct index_block));
+	GITERR_CHECK_ALLOC(blocks);
+
+	if (!ieot) {
+		nblocks = 1;
+		blocks[0].offset = INDEX_HEADER_SIZE;
+		blocks[0].count = header->entry_count;
+	}
+
+	for (i = 0; ieot && i < nblocks; i++) {
+		const char *entry = ieot + sizeof(struct index_extension) + 4 + i * 8;
+
+		blocks[i].offset = ntohl(*(uint32_t *)entry);
+		blocks[i].count = ntohl(*(uint32_t *)(entry + 4));
+	}
+
+	for (i = 0; i < nblocks; i++) {
+		blocks[i].first = first;
+		blocks[i].end = (i + 1 < nblocks) ? blocks[i + 1].offset : entries_end;
+		first += blocks[i].count;
+
+		if (blocks[i].offset > blocks[i].end)
+			break;
+	}
+
+	if (i < nblocks || blocks[0].offset != INDEX_HEADER_SIZE ||
+		first != header->entry_count) {
+		git__free(blocks);
+		return index_error_invalid("invalid entry offset table");
+	}
+
+	*out = blocks;
+	*out_len = nblocks;
+	return 0;
+}
+
+struct entries_worker {
+	git_thread thread;
+	git_index *index;
+	const char *buffer;
+	size_t buffer_size;
+	const struct index_block *blocks;
+	size_t nblocks;
+	bool spawned;
+	int error;
+};
+
+static void *read_entry_blocks_worker(void *payload)
+{
+	struct entries_worker *w = payload;
+	git_index_entry **entries = (git_index_entry **)w->index->entries.contents;
+	size_t i, j;
+
+	for (i = 0; i < w->nblocks; i++) {
+		const struct index_block *block = &w->blocks[i];
+		git_index_entry *last = NULL;
+		size_t pos = block->offset;
+
+		/* Blocks are encoded on their own: there's no previous path */
+		for (j = 0; j < block->count; j++) {
+			git_index_entry **entry = &entries[block->first + j];
+			size_t entry_size = read_entry(
+				entry, w->index, w->buffer + pos, w->buffer_size - pos, last);
+
+			if (entry_size == 0 || entry_size > block->end - pos) {
+				w->error = -1;
+				return NULL;
+			}
+
+			last = *entry;
+			pos += entry_size;
+		}
+
+		if (pos != block->end) {
+			w->error = -1;
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+struct checksum_worker {
+	git_thread thread;
+	const char *buffer;
+	size_t buffer_size;
+	git_oid checksum;
+};
+
+static void *checksum_worker(void *payload)
+{
+	struct checksum_worker *w = payload;
+
+	git_hash_buf(&w->checksum, w->buffer, w->buffer_size);
+	return NULL;
+}
+
+/*
+ * Load the entries in blocks on several threads, while another hashes
+ * the file and this one reads the extensions.
+ */
+static int read_entries_threaded(
+	git_oid *checksum,
+	git_index *index,
+	struct index_header *header,
+	const char *buffer,
+	size_t buffer_size,
+	size_t entries_end,
+	unsigned int nr_threads)
+{
+	struct index_block *blocks = NULL;
+	struct entries_worker *workers = NULL;
+	struct checksum_worker hasher;
+	bool hashing;
+	size_t nblocks, i, pos;
+	int error;
+
+	if ((error = read_entry_blocks(&blocks, &nblocks,
+			header, buffer, buffer_size, entries_end)) < 0)
+		return error;
+
+	if (nr_threads > nblocks)
+		nr_threads = (unsigned int)nblocks;
+
+	workers = git__calloc(nr_threads, sizeof(struct entries_worker));
+
+	if (!workers ||
+		(error = git_vector_resize_to(&index->entries, header->entry_count)) < 0) {
+		git__free(workers);
+		git__free(blocks);
+		return -1;
+	}
+
+	hasher.buffer = buffer;
+	hasher.buffer_size = buffer_size - INDEX_FOOTER_SIZE;
+	hashing = !git_thread_create(&hasher.thread, NULL, checksum_worker, &hasher);
+
+	/* The first blocks are ours, as are the others if we can't spawn */
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].index = index;
+		workers[i].buffer = buffer;
+		workers[i].buffer_size = buffer_size;
+		workers[i].blocks = blocks + nblocks * i / nr_threads;
+		workers[i].nblocks =
+			nblocks * (i + 1) / nr_threads - nblocks * i / nr_threads;
+
+		if (i > 0)
+			workers[i].spawned = !git_thread_create(&workers[i].thread,
+				NULL, read_entry_blocks_worker, &workers[i]);
+	}
+
+	/* The extensions don't depend on the entries */
+	for (pos = entries_end; pos < buffer_size - INDEX_FOOTER_SIZE; ) {
+		size_t extension_size =
+			read_extension(index, buffer + pos, buffer_size - pos,
+				header->entry_count);
+
+		if (extension_size == 0) {
+			error = index_error_invalid("extension is truncated");
+			break;
+		}
+
+		pos += extension_size;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		if (workers[i].spawned)
+			git_thread_join(workers[i].thread, NULL);
+		else
+			read_entry_blocks_worker(&workers[i]);
+
+		if (workers[i].error && !error)
+			error = index_error_invalid("invalid entry");
+	}
+
+	if (hashing)
+		git_thread_join(hasher.thread, NULL);
+	else
+		git_hash_buf(&hasher.checksum, hasher.buffer, hasher.buffer_size);
+
+	git_oid_cpy(checksum, &hasher.checksum);
+
+	if (error < 0) {
+		git_index_entry *entry;
+
+		git_vector_foreach(&index->entries, i, entry)
+			if (entry)
+				index_entry_free(entry);
+
+		git_vector_clear(&index->entries);
+	}
+
+	git__free(workers);
+	git__free(blocks);
+	return error;
+}
+
+static unsigned int index_load_threads(
+	git_index *index, const struct index_header *header)
+{
+	unsigned int nr_threads = index->nr_threads;
+
+	if (!nr_threads)
+		nr_threads = (unsigned int)git_online_cpus();
+
+	if (header->entry_count < 2 * INDEX_THREAD_COST)
+		return 1;
+
+	return nr_threads;
+}
+
+#endif
+
+static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+{
+	int error = 0;
+	struct index_header header = { 0 };
+	git_oid checksum_calculated, checksum_expected;
+#ifdef GIT_THREADS
+	unsigned int nr_threads;
+	size_t entries_end;
+#endif
+
+	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
+		return index_error_invalid("insufficient buffer space");
+
+	/* Parse header */
+	if ((error = read_header(&header, buffer)) < 0)
+		return error;
+
+	if (git_mutex_lock(&index->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to acquire index lock");
+		return -1;
+	}
+
+	assert(!index->entries.length);
+
+	index->version = header.version;
+
+	/*
+	 * Large indexes which say where their entries end are read on several
+	 * threads. Otherwise, precalculate the SHA1 of the file's contents
+	 * and read it in order.
+	 */
+#ifdef GIT_THREADS
+	if ((nr_threads = index_load_threads(index, &header)) > 1 &&
+		(entries_end = read_end_of_entries(buffer, buffer_size)) > 0)
+		error = read_entries_threaded(&checksum_calculated, index,
+			&header, buffer, buffer_size, entries_end, nr_threads);
+	else
+#endif
+	{
+		git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+		error = read_entries(index, &header, buffer, buffer_size);
+	}
+
+	if (error < 0)
+		goto done;
+
+	/* 160-bit SHA-1 over the content of the index file before this checksum. */
+	git_oid_fromraw(&checksum_expected,
+		(const unsigned char *)buffer + buffer_size - INDEX_FOOTER_SIZE);
+
+	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
+		error = index_error_invalid(
+			"calculated checksum does not match expected");
+		goto done;
+	}
+
+	apply_fsmonitor(index);
+
+	/* Entries are stored case-sensitively on disk, so re-sort now if
+	 * in-memory index is supposed to be case-insensitive
+	 */
+	git_vector_set_sorted(&index->entries, !index->ignore_case);
+	error = index_sort_if_needed(index, false);
+
+done:
+	git_mutex_unlock(&index->lock);
+	return error;
+}
+
+static bool is_index_extended(git_index *index)
+{
+	size_t i, extended;
+	git_index_entry *entry;
+
+	extended = 0;
+
+	git_vector_foreach(&index->entries, i, entry) {
 		entry->flags &= ~GIT_IDXENTRY_EXTENDED;
 		if (entry->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS) {
 			extended++;
@@ -1992,16 +3110,44 @@ static bool is_index_extended(git_index *index)
 	return (extended > 0);
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
+/*
+ * Write `entry`; when `last` is given, its path is prefix-compressed
+ * against `last` (the path of the previous entry) as version 4 does.
+ * The first entry of a block of the IEOT extension shares nothing with
+ * the previous one, so that the block can be read on its own.
+ */
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	const char *last,
+	bool block_start)
 {
 	void *mem = NULL;
 	struct entry_short *ondisk;
-	size_t path_len, disk_size;
+	size_t path_len, disk_size, same_len = 0, varint_len = 0;
+	uintmax_t strip_len = 0;
+	const char *path_src = entry->path;
 	char *path;
 
 	path_len = ((struct entry_internal *)entry)->pathlen;
 
-	if (entry->flags & GIT_IDXENTRY_EXTENDED)
+	if (last) {
+		while (!block_start &&
+			last[same_len] && last[same_len] == path_src[same_len])
+			same_len++;
+
+		strip_len = strlen(last + same_len);
+		varint_len = git_encode_varint(NULL, 0, strip_len);
+
+		path_src += same_len;
+		path_len -= same_len;
+
+		disk_size = (entry->flags & GIT_IDXENTRY_EXTENDED) ?
+			offsetof(struct entry_long, path) :
+			offsetof(struct entry_short, path);
+		disk_size += varint_len + path_len + 1;
+	} else if (entry->flags & GIT_IDXENTRY_EXTENDED)
 		disk_size = long_entry_size(path_len);
 	else
 		disk_size = short_entry_size(path_len);
@@ -2047,17 +3193,33 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 	else
 		path = ondisk->path;
 
-	memcpy(path, entry->path, path_len);
+	if (last) {
+		git_encode_varint((unsigned char *)path, varint_len, strip_len);
+		path += varint_len;
+	}
+
+	memcpy(path, path_src, path_len);
 
+	*out_size = disk_size;
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/*
+ * Write the entries, in `nblocks` blocks whose offsets and counts go to
+ * `blocks` (when there's more than one), and where they end to `end`.
+ */
+static int write_entries(
+	size_t *end,
+	struct index_block *blocks,
+	size_t nblocks,
+	git_index *index,
+	git_filebuf *file)
 {
 	int error = 0;
-	size_t i;
+	size_t i, block_size, disk_size, offset = INDEX_HEADER_SIZE;
 	git_vector case_sorted, *entries;
 	git_index_entry *entry;
+	const char *last;
 
 	if (git_mutex_lock(&index->lock) < 0) {
 		giterr_set(GITERR_OS, "Failed to lock index");
@@ -2074,10 +3236,30 @@ static int write_entries(git_index *index, git_filebuf *file)
 		entries = &index->entries;
 	}
 
-	git_vector_foreach(entries, i, entry)
-		if ((error = write_disk_entry(file, entry)) < 0)
+	last = (index->version >= INDEX_VERSION_NUMBER_COMP) ? "" : NULL;
+	block_size = (entries->length + nblocks - 1) / nblocks;
+
+	git_vector_foreach(entries, i, entry) {
+		bool block_start = (nblocks > 1 && i % block_size == 0);
+
+		if (block_start) {
+			blocks[i / block_size].offset = offset;
+			blocks[i / block_size].count =
+				(uint32_t)min(block_size, entries->length - i);
+		}
+
+		if ((error = write_disk_entry(
+				&disk_size, file, entry, last, block_start)) < 0)
 			break;
 
+		offset += disk_size;
+
+		if (last)
+			last = entry->path;
+	}
+
+	*end = offset;
+
 	git_mutex_unlock(&index->lock);
 
 	if (index->ignore_case)
@@ -2086,7 +3268,12 @@ static int write_entries(git_index *index, git_filebuf *file)
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_buf *data)
+/* The header of every extension also goes into `eoie`, if given */
+static int write_extension(
+	git_filebuf *file,
+	struct index_extension *header,
+	git_buf *data,
+	git_hash_ctx *eoie)
 {
 	struct index_extension ondisk;
 	int error = 0;
@@ -2095,12 +3282,78 @@ static int write_extension(git_filebuf *file, struct index_extension *header, gi
 	memcpy(&ondisk, header, 4);
 	ondisk.extension_size = htonl(header->extension_size);
 
+	if (eoie)
+		git_hash_update(eoie, &ondisk, sizeof(struct index_extension));
+
 	if ((error = git_filebuf_write(file, &ondisk, sizeof(struct index_extension))) == 0)
 		error = git_filebuf_write(file, data->ptr, data->size);
 
 	return error;
 }
 
+static int write_entry_offsets_extension(
+	git_filebuf *file,
+	struct index_block *blocks,
+	size_t nblocks,
+	git_hash_ctx *eoie)
+{
+	git_buf ieot_buf = GIT_BUF_INIT;
+	struct index_extension extension;
+	uint32_t word;
+	size_t i;
+	int error;
+
+	word = htonl(INDEX_IEOT_VERSION);
+	git_buf_put(&ieot_buf, (char *)&word, 4);
+
+	for (i = 0; i < nblocks; i++) {
+		word = htonl((uint32_t)blocks[i].offset);
+		git_buf_put(&ieot_buf, (char *)&word, 4);
+		word = htonl(blocks[i].count);
+		git_buf_put(&ieot_buf, (char *)&word, 4);
+	}
+
+	if (git_buf_oom(&ieot_buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_ENTRY_OFFSETS_SIG, 4);
+	extension.extension_size = (uint32_t)ieot_buf.size;
+
+	error = write_extension(file, &extension, &ieot_buf, eoie);
+
+	git_buf_free(&ieot_buf);
+	return error;
+}
+
+/* Written last: where the entries end and the hash of what's in between */
+static int write_end_of_entries_extension(
+	git_filebuf *file, size_t entries_end, git_hash_ctx *eoie)
+{
+	git_buf eoie_buf = GIT_BUF_INIT;
+	struct index_extension extension;
+	uint32_t offset = htonl((uint32_t)entries_end);
+	git_oid hash;
+	int error;
+
+	git_hash_final(&hash, eoie);
+
+	git_buf_put(&eoie_buf, (char *)&offset, 4);
+	git_buf_put(&eoie_buf, (char *)hash.id, GIT_OID_RAWSZ);
+
+	if (git_buf_oom(&eoie_buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_END_OF_ENTRIES_SIG, 4);
+	extension.extension_size = (uint32_t)eoie_buf.size;
+
+	error = write_extension(file, &extension, &eoie_buf, NULL);
+
+	git_buf_free(&eoie_buf);
+	return error;
+}
+
 static int create_name_extension_data(git_buf *name_buf, git_index_name_entry *conflict_name)
 {
 	int error = 0;
@@ -2130,7 +3383,7 @@ on_error:
 	return error;
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+static int write_name_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf name_buf = GIT_BUF_INIT;
 	git_vector *out = &index->names;
@@ -2148,7 +3401,7 @@ static int write_name_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
 	extension.extension_size = (uint32_t)name_buf.size;
 
-	error = write_extension(file, &extension, &name_buf);
+	error = write_extension(file, &extension, &name_buf, eoie);
 
 	git_buf_free(&name_buf);
 
@@ -2178,7 +3431,7 @@ static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *r
 	return 0;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+static int write_reuc_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf reuc_buf = GIT_BUF_INIT;
 	git_vector *out = &index->reuc;
@@ -2196,7 +3449,7 @@ static int write_reuc_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
 	extension.extension_size = (uint32_t)reuc_buf.size;
 
-	error = write_extension(file, &extension, &reuc_buf);
+	error = write_extension(file, &extension, &reuc_buf, eoie);
 
 	git_buf_free(&reuc_buf);
 
@@ -2204,17 +3457,114 @@ done:
 	return error;
 }
 
+static int write_untracked_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	git_buf untracked_buf = GIT_BUF_INIT;
+	struct index_extension extension;
+	int error;
+
+	if ((error = git_untracked_cache_write(&untracked_buf, index->untracked)) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_SIG, 4);
+	extension.extension_size = (uint32_t)untracked_buf.size;
+
+	error = write_extension(file, &extension, &untracked_buf, eoie);
+
+done:
+	git_buf_free(&untracked_buf);
+	return error;
+}
+
+static int write_fsmonitor_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	git_buf fsmonitor_buf = GIT_BUF_INIT, ewah = GIT_BUF_INIT;
+	git_vector case_sorted = GIT_VECTOR_INIT, *entries = &index->entries;
+	struct index_extension extension;
+	git_index_entry *entry;
+	git_bitvec dirty;
+	uint32_t value;
+	size_t i;
+	int error = -1;
+
+	/* the bits go in the on-disk order of the entries */
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp) < 0)
+			return -1;
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	}
+
+	if (git_bitvec_init(&dirty, entries->length) < 0)
+		goto done;
+
+	git_vector_foreach(entries, i, entry) {
+		if (!(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID))
+			git_bitvec_set(&dirty, i, true);
+	}
+
+	if (git_ewah_write(&ewah, &dirty) < 0)
+		goto done;
+
+	value = htonl(2);
+	git_buf_put(&fsmonitor_buf, (const char *)&value, 4);
+	git_buf_put(&fsmonitor_buf,
+		index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+	value = htonl((uint32_t)ewah.size);
+	git_buf_put(&fsmonitor_buf, (const char *)&value, 4);
+	git_buf_put(&fsmonitor_buf, ewah.ptr, ewah.size);
+
+	if (git_buf_oom(&fsmonitor_buf))
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)fsmonitor_buf.size;
+
+	error = write_extension(file, &extension, &fsmonitor_buf, eoie);
+
+done:
+	git_bitvec_free(&dirty);
+	git_vector_free(&case_sorted);
+	git_buf_free(&ewah);
+	git_buf_free(&fsmonitor_buf);
+	return error;
+}
+
+/*
+ * Large indexes get an IEOT extension with the offsets of blocks of
+ * entries, and an EOIE one to find it, so they can be loaded on several
+ * threads. How many blocks depends only on the number of entries.
+ */
+static size_t index_write_blocks(git_index *index)
+{
+	size_t nblocks = index->entries.length / INDEX_THREAD_COST;
+
+	return nblocks > 1 ? min(nblocks, INDEX_MAX_BLOCKS) : 1;
+}
+
 static int write_index(git_index *index, git_filebuf *file)
 {
 	git_oid hash_final;
 	struct index_header header;
 	bool is_extended;
 	uint32_t index_version_number;
+	struct index_block *blocks = NULL;
+	size_t nblocks, entries_end;
+	git_hash_ctx eoie_ctx, *eoie = NULL;
+	int error = -1;
 
 	assert(index && file);
 
 	is_extended = is_index_extended(index);
-	index_version_number = is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER;
+
+	/* Version 3 is only needed (and only written) for the extended flags */
+	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+		index_version_number = index->version;
+	else
+		index_version_number = is_extended ?
+			INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER;
 
 	header.signature = htonl(INDEX_HEADER_SIG);
 	header.version = htonl(index_version_number);
@@ -2223,24 +3573,60 @@ static int write_index(git_index *index, git_filebuf *file)
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
 		return -1;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	if ((nblocks = index_write_blocks(index)) > 1) {
+		blocks = git__calloc(nblocks, sizeof(struct index_block));
+		GITERR_CHECK_ALLOC(blocks);
+	}
+
+	if (write_entries(&entries_end, blocks, nblocks, index, file) < 0)
+		goto done;
+
+	/* The offsets are 32-bit, give up on the extensions if they don't fit */
+	if (blocks && entries_end <= UINT32_MAX) {
+		if (git_hash_ctx_init(&eoie_ctx) < 0)
+			goto done;
+
+		eoie = &eoie_ctx;
+
+		if (write_entry_offsets_extension(file, blocks, nblocks, eoie) < 0)
+			goto done;
+	}
 
 	/* TODO: write tree cache extension */
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked && write_untracked_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (index->fsmonitor_token &&
+		write_fsmonitor_extension(index, file, eoie) < 0)
+		goto done;
+
+	if (eoie && write_end_of_entries_extension(file, entries_end, eoie) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
 
 	/* write it at the end of the file */
-	return git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ);
+	error = git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ);
+
+done:
+	if (eoie) {
+		git_hash_ctx_cleanup(eoie);
+	}
+
+	git__free(blocks);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -2342,6 +3728,105 @@ git_repository *git_index_owner(const git_index *index)
 	return INDEX_OWNER(index);
 }
 
+#define INDEX_ADD_BATCH 32
+#define INDEX_ADD_BATCH_FILE_SIZE (256 * 1024)
+
+/* Working directory files whose blobs are hashed together */
+typedef struct {
+	git_index_entry *entries[INDEX_ADD_BATCH];
+	git_buf bufs[INDEX_ADD_BATCH];
+	git_rawobj objs[INDEX_ADD_BATCH];
+	git_oid ids[INDEX_ADD_BATCH];
+	size_t count;
+} index_add_batch;
+
+static int index_add_entry(git_index *index, git_index_entry *entry)
+{
+	int error;
+
+	if ((error = index_insert(index, &entry, 1)) < 0)
+		return error;
+
+	git_tree_cache_invalidate_path(index->tree, entry->path);
+
+	/* add implies conflict resolved, move conflict entries to REUC */
+	if ((error = index_conflict_to_reuc(index, entry->path)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+/* Whether the file can go in a batch, and its contents if so */
+static bool index_add_batch_read(
+	git_buf *out, git_repository *repo, git_iterator *wditer,
+	const git_index_entry *wd)
+{
+	git_buf *full_path = NULL;
+	git_filter_list *fl = NULL;
+
+	if (!S_ISREG(wd->mode) || wd->file_size > INDEX_ADD_BATCH_FILE_SIZE)
+		return false;
+
+	if (git_filter_list_load(
+			&fl, repo, NULL, wd->path, GIT_FILTER_TO_ODB) < 0 || fl != NULL ||
+		git_iterator_current_workdir_path(&full_path, wditer) < 0 ||
+		!full_path ||
+		git_futils_readbuffer(out, full_path->ptr) < 0) {
+		git_filter_list_free(fl);
+		git_buf_clear(out);
+		giterr_clear();
+		return false;
+	}
+
+	return true;
+}
+
+static int index_add_batch_flush(git_index *index, index_add_batch *batch)
+{
+	git_odb *odb = NULL;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < batch->count; i++) {
+		batch->objs[i].data = batch->bufs[i].ptr;
+		batch->objs[i].len = batch->bufs[i].size;
+		batch->objs[i].type = GIT_OBJ_BLOB;
+	}
+
+	if (batch->count &&
+		!(error = git_repository_odb__weakptr(&odb, INDEX_OWNER(index))))
+		error = git_odb__hashobj_many(batch->ids, batch->objs, batch->count);
+
+	for (i = 0; i < batch->count; i++) {
+		git_index_entry *entry = batch->entries[i];
+
+		batch->entries[i] = NULL;
+
+		if (!error)
+			error = git_odb__write_hashed(odb, &batch->ids[i],
+				batch->objs[i].data, batch->objs[i].len, GIT_OBJ_BLOB);
+
+		/* the object points into the buffer until it is written */
+		git_buf_clear(&batch->bufs[i]);
+
+		if (error < 0) {
+			index_entry_free(entry);
+			continue;
+		}
+
+		entry->id = batch->ids[i];
+		error = index_add_entry(index, entry);
+	}
+
+	batch->count = 0;
+
+	return error;
+}
+
 int git_index_add_all(
 	git_index *index,
 	const git_strarray *paths,
@@ -2356,13 +3841,17 @@ int git_index_add_all(
 	git_index_entry *entry;
 	git_pathspec ps;
 	const char *match;
-	size_t existing;
+	size_t existing, i;
 	bool no_fnmatch = (flags & GIT_INDEX_ADD_DISABLE_PATHSPEC_MATCH) != 0;
+	bool aborted = false;
 	int ignorecase;
 	git_oid blobid;
+	index_add_batch batch;
 
 	assert(index);
 
+	memset(&batch, 0, sizeof(batch));
+
 	if (INDEX_OWNER(index) == NULL)
 		return create_index_error(-1,
 			"Could not add paths to index. "
@@ -2408,6 +3897,7 @@ int git_index_add_all(
 				continue;
 			if (error < 0) { /* return < 0 means abort */
 				giterr_set_after_callback(error);
+				aborted = true;
 				break;
 			}
 		}
@@ -2416,6 +3906,19 @@ int git_index_add_all(
 		 * match to the file in the index and skip this work if it is?
 		 */
 
+		/* small files are hashed together, the rest one at a time */
+		if (index_add_batch_read(&batch.bufs[batch.count], repo, wditer, wd)) {
+			if ((error = index_entry_dup(
+					&batch.entries[batch.count], wd)) < 0)
+				break;
+
+			if (++batch.count == INDEX_ADD_BATCH &&
+				(error = index_add_batch_flush(index, &batch)) < 0)
+				break;
+
+			continue;
+		}
+
 		/* write the blob to disk and get the oid */
 		if ((error = git_blob_create_fromworkdir(&blobid, repo, wd->path)) < 0)
 			break;
@@ -2427,23 +3930,26 @@ int git_index_add_all(
 		entry->id = blobid;
 
 		/* add working directory item to index */
-		if ((error = index_insert(index, &entry, 1)) < 0)
+		if ((error = index_add_entry(index, entry)) < 0)
 			break;
-
-		git_tree_cache_invalidate_path(index->tree, wd->path);
-
-		/* add implies conflict resolved, move conflict entries to REUC */
-		if ((error = index_conflict_to_reuc(index, wd->path)) < 0) {
-			if (error != GIT_ENOTFOUND)
-				break;
-			giterr_clear();
-		}
 	}
 
 	if (error == GIT_ITEROVER)
 		error = 0;
 
+	/* the files queued before an abort were accepted by the callback */
+	if (!error)
+		error = index_add_batch_flush(index, &batch);
+	else if (aborted)
+		index_add_batch_flush(index, &batch);
+
 cleanup:
+	for (i = 0; i < INDEX_ADD_BATCH; i++) {
+		if (batch.entries[i])
+			index_entry_free(batch.entries[i]);
+		git_buf_free(&batch.bufs[i]);
+	}
+
 	git_iterator_free(wditer);
 	git_pathspec__clear(&ps);
 
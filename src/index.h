@@ -11,6 +11,9 @@
 #include "filebuf.h"
 #include "vector.h"
 #include "tree-cache.h"
+#include "untracked-cache.h"
+#include "idxmap.h"
+#include "bitvec.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
@@ -25,6 +28,15 @@ struct git_index {
 
 	git_vector entries;
 
+	/* (path, stage) -> entry, built on the first lookup by path, and
+	 * path -> directory, built on the first insert; both are kept in step
+	 * with `entries` from then on.  Only the entry map matching
+	 * `ignore_case` is ever set.
+	 */
+	git_idxmap *entries_map;
+	git_idxmap_icase *entries_map_icase;
+	git_idxmap_dir *entries_dirs;
+
 	git_mutex  lock;    /* lock held while entries is being changed */
 	git_vector deleted; /* deleted entries if readers > 0 */
 	git_atomic readers; /* number of active iterators */
@@ -34,7 +46,22 @@ struct git_index {
 	unsigned int distrust_filemode:1;
 	unsigned int no_symlinks:1;
 
+	unsigned int version;
+	unsigned int nr_threads; /* to load it with, 0 for one per CPU */
+
 	git_tree_cache *tree;
+	git_untracked_cache *untracked;
+
+	/* The filesystem monitor's token (the FSMN extension); its bits are
+	 * on the entries, but wait in `fsmonitor_dirty` while they are read.
+	 * They are "fresh" once a query brought them up to date, and then
+	 * the untracked cache's directories may go without a `stat` too.
+	 */
+	char *fsmonitor_token;
+	git_bitvec fsmonitor_dirty;
+	size_t fsmonitor_dirty_bits;
+	unsigned int fsmonitor_fresh:1;
+	unsigned int fsmonitor_dirs:1;
 
 	git_vector names;
 	git_vector reuc;
@@ -81,6 +108,38 @@ GIT_INLINE(const git_futils_filestamp *) git_index__filestamp(git_index *index)
 
 extern int git_index__changed_relative_to(git_index *index, const git_futils_filestamp *fs);
 
+/* Whether any entry lives below `dir`, given with its trailing slash */
+extern bool git_index__has_dir(git_index *index, const char *dir, size_t dir_len);
+
+/* Call `cb` with each file and directory right inside `dir` ("" for the
+ * root, otherwise with its trailing slash).  The paths given point into
+ * the index entries and include the slash of directories, which are
+ * only reported once.
+ */
+extern int git_index__foreach_in_dir(
+	git_index *index, const char *dir, size_t dir_len,
+	int (*cb)(const char *path, size_t path_len, void *payload),
+	void *payload);
+
+/* Get the untracked cache of the index, set up for the working directory
+ * of `repo`, after creating or dropping it as core.untrackedCache says.
+ * `*out` is NULL when the index has none.
+ */
+extern int git_index__untracked_cache(
+	git_untracked_cache **out, git_index *index, git_repository *repo);
+
+/* Ask the filesystem monitor of `repo` what changed since the index's
+ * token, and clear the GIT_IDXENTRY_FSMONITOR_VALID bit of those entries
+ * (of all of them when it can't tell, or when there is no monitor).
+ */
+extern int git_index__fsmonitor_refresh(git_index *index, git_repository *repo);
+
+/* `entry` was found unchanged in the working directory after the last
+ * refresh, so it can be trusted until the monitor reports it
+ */
+extern void git_index__fsmonitor_mark_valid(
+	git_index *index, const git_index_entry *entry);
+
 /* Copy the current entries vector *and* increment the index refcount.
  * Call `git_index__release_snapshot` when done.
  */
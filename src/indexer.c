@@ -17,6 +17,9 @@
 #include "oid.h"
 #include "oidmap.h"
 #include "zstream.h"
+#include "array.h"
+#include "delta-apply.h"
+#include "odb.h"
 
 #define UINT31_MAX (0x7FFFFFFF)
 
@@ -27,11 +30,47 @@ struct entry {
 	uint64_t offset_long;
 };
 
+/* Whether new indexers parse the pack on a thread of their own */
+int git_indexer__pipeline = 0;
+
+#ifdef GIT_THREADS
+
+/*
+ * In pipelined mode, `git_indexer_append` only writes the data to the
+ * packfile, and a worker thread follows behind it, hashing the data and
+ * parsing the objects out of it. The pack can only be split into objects
+ * by inflating them in order, so there is one such worker per indexer.
+ */
+struct indexer_pipeline {
+	git_thread thread;
+	git_mutex lock;
+	git_cond cond;
+	unsigned int initialized :1,
+		started :1;
+
+	/* Protected by the lock */
+	git_off_t received;
+	int eof;
+	int abort;
+	int progressed;
+	git_transfer_progress stats;
+	int error;
+	int error_class;
+	git_buf error_msg;
+
+	/* Only used by the worker */
+	git_transfer_progress worker_stats;
+};
+
+#endif
+
 struct git_indexer {
 	unsigned int parsed_header :1,
-		opened_pack :1,
 		have_stream :1,
 		have_delta :1;
+	/* Apart from the bits the pipeline worker updates */
+	bool opened_pack;
+	bool pipelined;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	git_filebuf pack_file;
@@ -48,6 +87,7 @@ struct git_indexer {
 	git_transfer_progress_cb progress_cb;
 	void *progress_payload;
 	char objbuf[8*1024];
+	unsigned int nr_threads;
 
 	/* Needed to look up objects which we want to inject to fix a thin pack */
 	git_odb *odb;
@@ -56,10 +96,22 @@ struct git_indexer {
 	char inbuf[GIT_OID_RAWSZ];
 	size_t inbuf_len;
 	git_hash_ctx trailer;
+
+#ifdef GIT_THREADS
+	struct indexer_pipeline pipeline;
+#endif
 };
 
 struct delta_info {
 	git_off_t delta_off;
+
+	/* Filled in when the deltas are resolved */
+	git_off_t data_off;
+	size_t size;
+	git_otype type;
+	git_off_t base_off;
+	git_oid base_id;
+	unsigned int resolved :1;
 };
 
 const git_oid *git_indexer_hash(const git_indexer *idx)
@@ -134,6 +186,11 @@ int git_indexer_new(
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
+#ifdef GIT_THREADS
+	idx->pipelined = !!git_indexer__pipeline;
+#else
+	idx->nr_threads = 1;
+#endif
 	git_hash_ctx_init(&idx->trailer);
 
 	error = git_buf_joinpath(&path, prefix, suff);
@@ -157,6 +214,20 @@ cleanup:
 	return -1;
 }
 
+unsigned int git_indexer_set_threads(git_indexer *idx, unsigned int n)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	idx->nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	idx->nr_threads = 1;
+#endif
+
+	return idx->nr_threads;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -429,33 +500,57 @@ static void hash_partially(git_indexer *idx, const uint8_t *data, size_t size)
 	idx->inbuf_len += size - to_expell;
 }
 
-int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_transfer_progress *stats)
+#ifdef GIT_THREADS
+
+static void copy_indexer_stats(
+	git_transfer_progress *out, const git_transfer_progress *in)
 {
-	int error = -1;
-	size_t processed;
-	struct git_pack_header *hdr = &idx->hdr;
-	git_mwindow_file *mwf = &idx->pack->mwf;
+	/* The byte count belongs to whoever is feeding us the pack */
+	out->total_objects = in->total_objects;
+	out->indexed_objects = in->indexed_objects;
+	out->received_objects = in->received_objects;
+	out->local_objects = in->local_objects;
+	out->total_deltas = in->total_deltas;
+	out->indexed_deltas = in->indexed_deltas;
+}
 
-	assert(idx && data && stats);
+#endif
 
-	processed = stats->indexed_objects;
+/*
+ * Report the progress of parsing the pack; in pipelined mode, this hands
+ * the numbers over to the thread that appends the data, which is the one
+ * that calls the callback.
+ */
+static int index_progress(git_indexer *idx, git_transfer_progress *stats)
+{
+#ifdef GIT_THREADS
+	if (idx->pipelined) {
+		struct indexer_pipeline *pl = &idx->pipeline;
+		int error = 0;
+
+		git_mutex_lock(&pl->lock);
+		copy_indexer_stats(&pl->stats, stats);
+		pl->progressed = 1;
+		if (pl->abort)
+			error = GIT_EUSER;
+		git_mutex_unlock(&pl->lock);
 
-	if ((error = git_filebuf_write(&idx->pack_file, data, size)) < 0)
 		return error;
+	}
+#endif
 
-	hash_partially(idx, data, (int)size);
+	return do_progress_callback(idx, stats);
+}
 
-	/* Make sure we set the new size of the pack */
-	if (idx->opened_pack) {
-		idx->pack->mwf.size += size;
-	} else {
-		if ((error = open_pack(&idx->pack, idx->pack_file.path_lock)) < 0)
-			return error;
-		idx->opened_pack = 1;
-		mwf = &idx->pack->mwf;
-		if ((error = git_mwindow_file_register(&idx->pack->mwf)) < 0)
-			return error;
-	}
+/* Parse and hash the objects in the part of the pack that we have */
+static int index_objects(git_indexer *idx, git_transfer_progress *stats)
+{
+	int error = -1;
+	size_t processed;
+	struct git_pack_header *hdr = &idx->hdr;
+	git_mwindow_file *mwf = &idx->pack->mwf;
+
+	processed = stats->indexed_objects;
 
 	if (!idx->parsed_header) {
 		unsigned int total_objects;
@@ -494,7 +589,7 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		processed = stats->indexed_objects = 0;
 		stats->total_objects = total_objects;
 
-		if ((error = do_progress_callback(idx, stats)) != 0)
+		if ((error = index_progress(idx, stats)) != 0)
 			return error;
 	}
 
@@ -579,7 +674,7 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		}
 		stats->received_objects++;
 
-		if ((error = do_progress_callback(idx, stats)) != 0)
+		if ((error = index_progress(idx, stats)) != 0)
 			goto on_error;
 	}
 
@@ -590,6 +685,226 @@ on_error:
 	return error;
 }
 
+#ifdef GIT_THREADS
+
+/* Feed the trailer hash with the pack data in [from, to) */
+static int hash_written(git_indexer *idx, git_off_t from, git_off_t to)
+{
+	git_mwindow_file *mwf = &idx->pack->mwf;
+	git_mwindow *w = NULL;
+	unsigned int left;
+	void *ptr;
+
+	while (from < to) {
+		ptr = git_mwindow_open(mwf, &w, from, (size_t)(to - from), &left);
+		if (ptr == NULL)
+			return -1;
+
+		if ((git_off_t)left > to - from)
+			left = (unsigned int)(to - from);
+
+		hash_partially(idx, ptr, left);
+		from += left;
+
+		git_mwindow_close(&w);
+	}
+
+	return 0;
+}
+
+static void *pipeline_worker(void *arg)
+{
+	git_indexer *idx = arg;
+	struct indexer_pipeline *pl = &idx->pipeline;
+	git_off_t received, hashed = 0;
+	int eof, abort, error = 0;
+	const git_error *e;
+
+	while (1) {
+		git_mutex_lock(&pl->lock);
+		while (pl->received == hashed && !pl->eof && !pl->abort)
+			git_cond_wait(&pl->cond, &pl->lock);
+
+		received = pl->received;
+		eof = pl->eof;
+		abort = pl->abort;
+		git_mutex_unlock(&pl->lock);
+
+		if (abort)
+			break;
+
+		if (received == hashed) {
+			if (eof)
+				break;
+			continue;
+		}
+
+		/* The pack has grown; only this thread looks at it now */
+		idx->pack->mwf.size = received;
+		git_mwindow_free_all(&idx->pack->mwf);
+
+		if ((error = hash_written(idx, hashed, received)) < 0)
+			break;
+
+		hashed = received;
+
+		if ((error = index_objects(idx, &pl->worker_stats)) < 0)
+			break;
+	}
+
+	if (error < 0) {
+		e = giterr_last();
+
+		git_mutex_lock(&pl->lock);
+		pl->error = error;
+		pl->error_class = e ? e->klass : GITERR_INDEXER;
+		git_buf_sets(&pl->error_msg, e ? e->message : "failed to index the pack");
+		git_mutex_unlock(&pl->lock);
+	}
+
+	return NULL;
+}
+
+static int pipeline_start(git_indexer *idx, git_transfer_progress *stats)
+{
+	struct indexer_pipeline *pl = &idx->pipeline;
+
+	memcpy(&pl->worker_stats, stats, sizeof(git_transfer_progress));
+
+	git_mutex_init(&pl->lock);
+	git_cond_init(&pl->cond);
+
+	if (git_thread_create(&pl->thread, NULL, pipeline_worker, idx) != 0) {
+		git_cond_free(&pl->cond);
+		git_mutex_free(&pl->lock);
+		giterr_set(GITERR_THREAD, "unable to create thread");
+		return -1;
+	}
+
+	pl->initialized = 1;
+	pl->started = 1;
+	return 0;
+}
+
+/* Pick up the progress and the errors of the worker */
+static int pipeline_sync(git_indexer *idx, git_transfer_progress *stats, bool report)
+{
+	struct indexer_pipeline *pl = &idx->pipeline;
+	int error, progressed;
+
+	git_mutex_lock(&pl->lock);
+
+	if ((error = pl->error) != 0)
+		giterr_set(pl->error_class, "%s", pl->error_msg.ptr);
+
+	if ((progressed = pl->progressed) != 0)
+		copy_indexer_stats(stats, &pl->stats);
+
+	pl->progressed = 0;
+	git_mutex_unlock(&pl->lock);
+
+	if (error || !progressed || !report)
+		return error;
+
+	if ((error = do_progress_callback(idx, stats)) != 0) {
+		git_mutex_lock(&pl->lock);
+		pl->abort = 1;
+		git_cond_signal(&pl->cond);
+		git_mutex_unlock(&pl->lock);
+	}
+
+	return error;
+}
+
+/* Hand the data that was just written over to the worker */
+static int pipeline_append(git_indexer *idx, size_t size, git_transfer_progress *stats)
+{
+	struct indexer_pipeline *pl = &idx->pipeline;
+
+	if (!pl->started && pipeline_start(idx, stats) < 0)
+		return -1;
+
+	git_mutex_lock(&pl->lock);
+	pl->received += size;
+	git_cond_signal(&pl->cond);
+	git_mutex_unlock(&pl->lock);
+
+	return pipeline_sync(idx, stats, true);
+}
+
+/* Wait for the worker to go through all of the data */
+static int pipeline_finish(git_indexer *idx, git_transfer_progress *stats)
+{
+	struct indexer_pipeline *pl = &idx->pipeline;
+
+	if (!pl->started)
+		return 0;
+
+	git_mutex_lock(&pl->lock);
+	pl->eof = 1;
+	git_cond_signal(&pl->cond);
+	git_mutex_unlock(&pl->lock);
+
+	git_thread_join(pl->thread, NULL);
+	pl->started = 0;
+
+	return pipeline_sync(idx, stats, false);
+}
+
+static void pipeline_free(git_indexer *idx)
+{
+	struct indexer_pipeline *pl = &idx->pipeline;
+
+	if (pl->started) {
+		git_mutex_lock(&pl->lock);
+		pl->abort = 1;
+		git_cond_signal(&pl->cond);
+		git_mutex_unlock(&pl->lock);
+
+		git_thread_join(pl->thread, NULL);
+		pl->started = 0;
+	}
+
+	if (pl->initialized) {
+		git_cond_free(&pl->cond);
+		git_mutex_free(&pl->lock);
+	}
+
+	git_buf_free(&pl->error_msg);
+}
+
+#endif
+
+int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_transfer_progress *stats)
+{
+	int error;
+
+	assert(idx && data && stats);
+
+	if ((error = git_filebuf_write(&idx->pack_file, data, size)) < 0)
+		return error;
+
+	/* Make sure we set the new size of the pack */
+	if (!idx->opened_pack) {
+		if ((error = open_pack(&idx->pack, idx->pack_file.path_lock)) < 0)
+			return error;
+		idx->opened_pack = 1;
+		if ((error = git_mwindow_file_register(&idx->pack->mwf)) < 0)
+			return error;
+	} else if (!idx->pipelined) {
+		idx->pack->mwf.size += size;
+	}
+
+#ifdef GIT_THREADS
+	if (idx->pipelined)
+		return pipeline_append(idx, size, stats);
+#endif
+
+	hash_partially(idx, data, (int)size);
+
+	return index_objects(idx, stats);
+}
+
 static int index_path(git_buf *path, git_indexer *idx, const char *suffix)
 {
 	const char prefix[] = "pack-";
@@ -697,16 +1012,9 @@ cleanup:
 
 static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 {
-	int error, found_ref_delta = 0;
+	int found_ref_delta = 0;
 	unsigned int i;
 	struct delta_info *delta;
-	size_t size;
-	git_otype type;
-	git_mwindow *w = NULL;
-	git_off_t curpos;
-	unsigned char *base_info;
-	unsigned int left = 0;
-	git_oid base;
 
 	assert(git_vector_length(&idx->deltas) > 0);
 
@@ -715,15 +1023,9 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 		return -1;
 	}
 
-	/* Loop until we find the first REF delta */
+	/* Loop until we find the first unresolved REF delta */
 	git_vector_foreach(&idx->deltas, i, delta) {
-		curpos = delta->delta_off;
-		error = git_packfile_unpack_header(&size, &type, &idx->pack->mwf, &w, &curpos);
-		git_mwindow_close(&w);
-		if (error < 0)
-			return error;
-
-		if (type == GIT_OBJ_REF_DELTA) {
+		if (!delta->resolved && delta->type == GIT_OBJ_REF_DELTA) {
 			found_ref_delta = 1;
 			break;
 		}
@@ -734,66 +1036,671 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 		return -1;
 	}
 
-	/* curpos now points to the base information, which is an OID */
-	base_info = git_mwindow_open(&idx->pack->mwf, &w, curpos, GIT_OID_RAWSZ, &left);
-	if (base_info == NULL) {
-		giterr_set(GITERR_INDEXER, "failed to map delta information");
+	if (inject_object(idx, &delta->base_id) < 0)
 		return -1;
+
+	stats->local_objects++;
+
+	return 0;
+}
+
+/*
+ * Deltas are resolved the way git's index-pack does: each delta is a
+ * child of its base (by offset for OFS_DELTA, by id for REF_DELTA) and
+ * every tree of deltas is walked depth-first from its non-delta root,
+ * so each base is inflated once and kept only while its children are
+ * being resolved. The trees are independent of each other, so they are
+ * spread over a pool of threads.
+ */
+
+struct delta_frame {
+	git_rawobj obj;
+	git_off_t offset;
+	git_oid id;
+
+	/* The children that remain to be resolved */
+	size_t ofs_pos, ofs_end;
+	size_t ref_pos, ref_end;
+};
+
+typedef git_array_t(struct delta_frame) delta_frame_stack;
+
+struct delta_root {
+	git_off_t offset;
+	git_oid id;
+};
+
+typedef git_array_t(struct delta_root) delta_root_array;
+
+struct delta_resolver {
+	git_indexer *idx;
+	git_transfer_progress *stats;
+
+	/* The deltas by base offset and by base id */
+	struct delta_info **ofs_deltas;
+	size_t ofs_len;
+	struct delta_info **ref_deltas;
+	size_t ref_len;
+
+	delta_root_array roots;
+	size_t next_root;
+
+	int error;
+	int error_class;
+	git_buf error_msg;
+
+	int threaded;
+#ifdef GIT_THREADS
+	git_mutex lock;
+	git_cond progress_cond;
+	int progressed;
+#endif
+};
+
+static int delta_ofs_cmp(const void *a, const void *b)
+{
+	const struct delta_info *da = a, *db = b;
+
+	if (da->base_off != db->base_off)
+		return (da->base_off < db->base_off) ? -1 : 1;
+
+	return (da->delta_off < db->delta_off) ? -1 : (da->delta_off > db->delta_off);
+}
+
+static int delta_ref_cmp(const void *a, const void *b)
+{
+	const struct delta_info *da = a, *db = b;
+	int cmp = git_oid__cmp(&da->base_id, &db->base_id);
+
+	if (cmp)
+		return cmp;
+
+	return (da->delta_off < db->delta_off) ? -1 : (da->delta_off > db->delta_off);
+}
+
+/* Find the range of deltas whose base is at `offset` */
+static void find_ofs_children(
+	size_t *first, size_t *last, struct delta_resolver *r, git_off_t offset)
+{
+	size_t lo = 0, hi = r->ofs_len;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (r->ofs_deltas[mid]->base_off < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*first = *last = lo;
+	while (*last < r->ofs_len && r->ofs_deltas[*last]->base_off == offset)
+		(*last)++;
+}
+
+/* Find the range of deltas whose base is `id` */
+static void find_ref_children(
+	size_t *first, size_t *last, struct delta_resolver *r, const git_oid *id)
+{
+	size_t lo = 0, hi = r->ref_len;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (git_oid__cmp(&r->ref_deltas[mid]->base_id, id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	git_oid_fromraw(&base, base_info);
+	*first = *last = lo;
+	while (*last < r->ref_len && git_oid_equal(&r->ref_deltas[*last]->base_id, id))
+		(*last)++;
+}
+
+/* Read the type, size and base of a delta */
+static int delta_base_info(git_indexer *idx, struct delta_info *delta)
+{
+	git_mwindow *w = NULL;
+	git_off_t curpos = delta->delta_off;
+	unsigned char *base_info;
+	unsigned int left = 0;
+	int error;
+
+	error = git_packfile_unpack_header(
+		&delta->size, &delta->type, &idx->pack->mwf, &w, &curpos);
 	git_mwindow_close(&w);
+	if (error < 0)
+		return error;
 
-	if (inject_object(idx, &base) < 0)
+	if (delta->type == GIT_OBJ_OFS_DELTA) {
+		delta->base_off = get_delta_base(
+			idx->pack, &w, &curpos, delta->type, delta->delta_off);
+		git_mwindow_close(&w);
+
+		if (delta->base_off <= 0) {
+			giterr_set(GITERR_INDEXER, "invalid delta base offset");
+			return -1;
+		}
+	} else {
+		base_info = git_mwindow_open(
+			&idx->pack->mwf, &w, curpos, GIT_OID_RAWSZ, &left);
+		if (base_info == NULL || left < GIT_OID_RAWSZ) {
+			git_mwindow_close(&w);
+			giterr_set(GITERR_INDEXER, "failed to map delta information");
+			return -1;
+		}
+
+		git_oid_fromraw(&delta->base_id, base_info);
+		git_mwindow_close(&w);
+
+		curpos += GIT_OID_RAWSZ;
+	}
+
+	delta->data_off = curpos;
+	return 0;
+}
+
+static int delta_resolver_init(
+	struct delta_resolver *r, git_indexer *idx, git_transfer_progress *stats)
+{
+	struct delta_info *delta;
+	struct delta_root *root;
+	struct entry *entry;
+	unsigned int i;
+	int error;
+
+	memset(r, 0, sizeof(*r));
+	r->idx = idx;
+	r->stats = stats;
+
+	r->ofs_deltas = git__calloc(idx->deltas.length, sizeof(struct delta_info *));
+	GITERR_CHECK_ALLOC(r->ofs_deltas);
+	r->ref_deltas = git__calloc(idx->deltas.length, sizeof(struct delta_info *));
+	GITERR_CHECK_ALLOC(r->ref_deltas);
+
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if ((error = delta_base_info(idx, delta)) < 0)
+			return error;
+
+		if (delta->type == GIT_OBJ_OFS_DELTA)
+			r->ofs_deltas[r->ofs_len++] = delta;
+		else
+			r->ref_deltas[r->ref_len++] = delta;
+	}
+
+	git__tsort((void **)r->ofs_deltas, r->ofs_len, delta_ofs_cmp);
+	git__tsort((void **)r->ref_deltas, r->ref_len, delta_ref_cmp);
+
+	/* The objects we have so far are the roots of the delta trees */
+	git_vector_foreach(&idx->objects, i, entry) {
+		root = git_array_alloc(r->roots);
+		GITERR_CHECK_ALLOC(root);
+
+		root->offset = (entry->offset == UINT32_MAX) ?
+			(git_off_t)entry->offset_long : (git_off_t)entry->offset;
+		git_oid_cpy(&root->id, &entry->oid);
+	}
+
+	return 0;
+}
+
+static void delta_resolver_free(struct delta_resolver *r)
+{
+	git__free(r->ofs_deltas);
+	git__free(r->ref_deltas);
+	git_array_clear(r->roots);
+	git_buf_free(&r->error_msg);
+}
+
+static int resolver_lock(struct delta_resolver *r)
+{
+#ifdef GIT_THREADS
+	if (r->threaded && git_mutex_lock(&r->lock)) {
+		giterr_set(GITERR_THREAD, "unable to lock delta resolution mutex");
 		return -1;
+	}
+#else
+	GIT_UNUSED(r);
+#endif
+	return 0;
+}
 
-	stats->local_objects++;
+static void resolver_unlock(struct delta_resolver *r)
+{
+#ifdef GIT_THREADS
+	if (r->threaded)
+		git_mutex_unlock(&r->lock);
+#else
+	GIT_UNUSED(r);
+#endif
+}
+
+/* Record the first error of the workers, to be reported by the caller */
+static void resolver_fail(struct delta_resolver *r, int error)
+{
+	const git_error *e = giterr_last();
+
+	if (resolver_lock(r) < 0)
+		return;
+
+	if (!r->error) {
+		r->error = error;
+		r->error_class = e ? e->klass : GITERR_INDEXER;
+		git_buf_sets(&r->error_msg, e ? e->message : "failed to resolve deltas");
+	}
+
+	resolver_unlock(r);
+}
+
+/* Whether another worker has failed, or the progress callback aborted */
+static bool resolver_failed(struct delta_resolver *r)
+{
+	bool failed;
+
+	if (resolver_lock(r) < 0)
+		return true;
+
+	failed = (r->error != 0);
+	resolver_unlock(r);
+
+	return failed;
+}
+
+/* Resolve a delta against its base and add the resulting object */
+static int resolve_delta(
+	struct delta_frame *out,
+	struct delta_resolver *r,
+	struct delta_info *delta,
+	git_rawobj *base,
+	git_zstream *zs)
+{
+	git_indexer *idx = r->idx;
+	git_mwindow *w = NULL;
+	git_off_t curpos = delta->data_off;
+	git_rawobj diff;
+	struct entry *entry = NULL;
+	struct git_pack_entry *pentry = NULL;
+	int error;
+
+	if ((error = packfile_unpack_compressed(
+			&diff, idx->pack, &w, &curpos, delta->size, delta->type, zs)) < 0)
+		return error;
+
+	error = git__delta_apply(&out->obj,
+		base->data, base->len, diff.data, diff.len);
+	git__free(diff.data);
+
+	if (error < 0)
+		return error;
+
+	out->obj.type = base->type;
+	out->offset = delta->delta_off;
+
+	entry = git__calloc(1, sizeof(*entry));
+	pentry = git__calloc(1, sizeof(*pentry));
+	if (!entry || !pentry) {
+		error = -1;
+		goto on_error;
+	}
+
+	if (git_odb__hashobj(&out->id, &out->obj) < 0) {
+		giterr_set(GITERR_INDEXER, "Failed to hash object");
+		error = -1;
+		goto on_error;
+	}
+
+	git_oid_cpy(&entry->oid, &out->id);
+	git_oid_cpy(&pentry->sha1, &out->id);
+
+	if ((error = crc_object(&entry->crc, &idx->pack->mwf,
+			delta->delta_off, curpos - delta->delta_off)) < 0)
+		goto on_error;
+
+	if ((error = resolver_lock(r)) < 0)
+		goto on_error;
+
+	if (delta->resolved) {
+		/* Reached through a duplicate of its base */
+		resolver_unlock(r);
+		git__free(entry);
+		git__free(pentry);
+		git__free(out->obj.data);
+		out->obj.data = NULL;
+		return 0;
+	}
+
+	if ((error = save_entry(idx, entry, pentry, delta->delta_off)) < 0) {
+		resolver_unlock(r);
+		goto on_error;
+	}
+
+	delta->resolved = 1;
+	r->stats->indexed_objects++;
+	r->stats->indexed_deltas++;
+
+#ifdef GIT_THREADS
+	if (r->threaded) {
+		r->progressed = 1;
+		git_cond_signal(&r->progress_cond);
+	}
+#endif
+	resolver_unlock(r);
+
+	if (!r->threaded && (error = do_progress_callback(idx, r->stats)) != 0) {
+		git__free(out->obj.data);
+		out->obj.data = NULL;
+		return error;
+	}
+
+	return 0;
+
+on_error:
+	git__free(entry);
+	git__free(pentry);
+	git__free(out->obj.data);
+	out->obj.data = NULL;
+	return error;
+}
+
+static bool frame_has_children(struct delta_frame *frame)
+{
+	return frame->ofs_pos < frame->ofs_end || frame->ref_pos < frame->ref_end;
+}
+
+/* Resolve every delta in the tree that has its root at `root` */
+static int resolve_delta_tree(
+	struct delta_resolver *r, struct delta_root *root, git_zstream *zs)
+{
+	delta_frame_stack stack = GIT_ARRAY_INIT;
+	struct delta_frame *frame, *child;
+	struct delta_frame resolved;
+	struct delta_info *delta;
+	git_off_t curpos = root->offset;
+	int error = 0;
+
+	frame = git_array_alloc(stack);
+	GITERR_CHECK_ALLOC(frame);
+	memset(frame, 0, sizeof(*frame));
+
+	frame->offset = root->offset;
+	git_oid_cpy(&frame->id, &root->id);
+	find_ofs_children(&frame->ofs_pos, &frame->ofs_end, r, frame->offset);
+	find_ref_children(&frame->ref_pos, &frame->ref_end, r, &frame->id);
+
+	if (!frame_has_children(frame))
+		goto done;
+
+	if ((error = git_packfile_unpack(&frame->obj, r->idx->pack, &curpos)) < 0)
+		goto done;
+
+	while ((frame = git_array_last(stack)) != NULL) {
+		if (resolver_failed(r))
+			break;
+
+		if (frame->ofs_pos < frame->ofs_end)
+			delta = r->ofs_deltas[frame->ofs_pos++];
+		else if (frame->ref_pos < frame->ref_end)
+			delta = r->ref_deltas[frame->ref_pos++];
+		else {
+			git__free(frame->obj.data);
+			(void)git_array_pop(stack);
+			continue;
+		}
+
+		memset(&resolved, 0, sizeof(resolved));
+		if ((error = resolve_delta(&resolved, r, delta, &frame->obj, zs)) < 0)
+			goto done;
+
+		if (resolved.obj.data == NULL)
+			continue;
+
+		find_ofs_children(&resolved.ofs_pos, &resolved.ofs_end, r, resolved.offset);
+		find_ref_children(&resolved.ref_pos, &resolved.ref_end, r, &resolved.id);
+
+		/* Only keep the object around if it is a base itself */
+		if (!frame_has_children(&resolved)) {
+			git__free(resolved.obj.data);
+			continue;
+		}
+
+		if ((child = git_array_alloc(stack)) == NULL) {
+			git__free(resolved.obj.data);
+			error = -1;
+			goto done;
+		}
+
+		memcpy(child, &resolved, sizeof(resolved));
+	}
+
+done:
+	while ((frame = git_array_pop(stack)) != NULL)
+		git__free(frame->obj.data);
+
+	git_array_clear(stack);
+	return error;
+}
+
+/* Pick the next tree to resolve, or return NULL when there are none left */
+static struct delta_root *next_delta_root(struct delta_resolver *r)
+{
+	struct delta_root *root = NULL;
+
+	if (resolver_lock(r) < 0)
+		return NULL;
+
+	if (!r->error && r->next_root < git_array_size(r->roots)) {
+		root = git_array_get(r->roots, r->next_root);
+		r->next_root++;
+	}
+
+	resolver_unlock(r);
+	return root;
+}
+
+static void *resolve_delta_trees(void *arg)
+{
+	struct delta_resolver *r = arg;
+	struct delta_root *root;
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	int error;
+
+	while ((root = next_delta_root(r)) != NULL) {
+		if ((error = resolve_delta_tree(r, root, &zs)) < 0) {
+			resolver_fail(r, error);
+			break;
+		}
+	}
+
+	git_zstream_free(&zs);
+	return NULL;
+}
+
+#ifdef GIT_THREADS
+
+struct delta_worker {
+	git_thread thread;
+	struct delta_resolver *r;
+	int done;
+};
+
+static void *threaded_resolve_delta_trees(void *arg)
+{
+	struct delta_worker *worker = arg;
+	struct delta_resolver *r = worker->r;
+
+	resolve_delta_trees(r);
+
+	git_mutex_lock(&r->lock);
+	worker->done = 1;
+	git_cond_signal(&r->progress_cond);
+	git_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/*
+ * Run the workers, and report their progress from this thread, so the
+ * callback is always called from the thread that called the indexer.
+ */
+static int threaded_resolve(struct delta_resolver *r, unsigned int nr_threads)
+{
+	struct delta_worker *workers;
+	git_transfer_progress stats;
+	unsigned int i, started = 0, running;
+	int error = 0;
+
+	workers = git__calloc(nr_threads, sizeof(struct delta_worker));
+	GITERR_CHECK_ALLOC(workers);
+
+	git_mutex_init(&r->lock);
+	git_cond_init(&r->progress_cond);
+	r->threaded = 1;
+
+	for (i = 0; i < nr_threads; ++i) {
+		workers[i].r = r;
+
+		if (git_thread_create(&workers[i].thread, NULL,
+				threaded_resolve_delta_trees, &workers[i]) != 0) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			resolver_fail(r, -1);
+			break;
+		}
+
+		started++;
+	}
+
+	git_mutex_lock(&r->lock);
+
+	do {
+		for (i = 0, running = 0; i < started; ++i)
+			running += !workers[i].done;
+
+		if (r->progressed && !error) {
+			r->progressed = 0;
+			memcpy(&stats, r->stats, sizeof(stats));
+
+			git_mutex_unlock(&r->lock);
+			error = do_progress_callback(r->idx, &stats);
+			git_mutex_lock(&r->lock);
+
+			/* Stop the workers at the next tree */
+			if (error && !r->error)
+				r->error = error;
+
+			continue;
+		}
+
+		if (running)
+			git_cond_wait(&r->progress_cond, &r->lock);
+	} while (running);
+
+	git_mutex_unlock(&r->lock);
+
+	for (i = 0; i < started; ++i)
+		git_thread_join(workers[i].thread, NULL);
+
+	r->threaded = 0;
+	git_cond_free(&r->progress_cond);
+	git_mutex_free(&r->lock);
+	git__free(workers);
+
+	/* The callback's error is already set in this thread */
+	return error;
+}
+
+#endif
+
+static int resolve_delta_roots(struct delta_resolver *r, size_t first_root)
+{
+	unsigned int nr_threads = r->idx->nr_threads;
+	int error = 0;
+
+	r->next_root = first_root;
+
+#ifdef GIT_THREADS
+	if (!nr_threads)
+		nr_threads = git_online_cpus();
+
+	if (nr_threads > git_array_size(r->roots) - first_root)
+		nr_threads = (unsigned int)(git_array_size(r->roots) - first_root);
+
+	if (nr_threads > 1)
+		error = threaded_resolve(r, nr_threads);
+	else
+#endif
+	{
+		GIT_UNUSED(nr_threads);
+		resolve_delta_trees(r);
+	}
+
+	if (error)
+		return error;
+
+	if (r->error) {
+		giterr_set(r->error_class, "%s", r->error_msg.ptr);
+		return r->error;
+	}
 
 	return 0;
 }
 
 static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
 {
-	unsigned int i;
+	struct delta_resolver r;
 	struct delta_info *delta;
-	int progressed = 0, progress_cb_result;
+	struct delta_root *root;
+	struct entry *entry;
+	size_t first_root = 0;
+	unsigned int i;
+	int error;
+
+	if (!idx->deltas.length)
+		return 0;
+
+	if ((error = delta_resolver_init(&r, idx, stats)) < 0)
+		goto cleanup;
+
+	while (1) {
+		if ((error = resolve_delta_roots(&r, first_root)) < 0)
+			goto cleanup;
 
-	while (idx->deltas.length > 0) {
-		progressed = 0;
 		git_vector_foreach(&idx->deltas, i, delta) {
-			git_rawobj obj;
-
-			idx->off = delta->delta_off;
-			if (git_packfile_unpack(&obj, idx->pack, &idx->off) < 0)
-				continue;
-
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
-				continue;
-
-			git__free(obj.data);
-			stats->indexed_objects++;
-			stats->indexed_deltas++;
-			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
-				return progress_cb_result;
-
-			/*
-			 * Remove this delta from the list and
-			 * decrease i so we don't skip over the next
-			 * delta.
-			 */
-			git_vector_remove(&idx->deltas, i);
-			git__free(delta);
-			i--;
+			if (!delta->resolved)
+				break;
 		}
 
-		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
+		if (i == idx->deltas.length)
+			break;
+
+		/* The bases that are left must come from outside of a thin pack */
+		first_root = git_array_size(r.roots);
+
+		if (fix_thin_pack(idx, stats) < 0) {
 			giterr_set(GITERR_INDEXER, "missing delta bases");
-			return -1;
+			error = -1;
+			goto cleanup;
+		}
+
+		entry = git_vector_last(&idx->objects);
+		if ((root = git_array_alloc(r.roots)) == NULL) {
+			error = -1;
+			goto cleanup;
 		}
+
+		root->offset = (entry->offset == UINT32_MAX) ?
+			(git_off_t)entry->offset_long : (git_off_t)entry->offset;
+		git_oid_cpy(&root->id, &entry->oid);
 	}
 
-	return 0;
+cleanup:
+	delta_resolver_free(&r);
+
+	git_vector_foreach(&idx->deltas, i, delta)
+		git__free(delta);
+	git_vector_clear(&idx->deltas);
+
+	return error;
 }
 
 static int update_header_and_rehash(git_indexer *idx, git_transfer_progress *stats)
@@ -861,6 +1768,11 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	if (git_hash_ctx_init(&ctx) < 0)
 		return -1;
 
+#ifdef GIT_THREADS
+	if (idx->pipelined && (error = pipeline_finish(idx, stats)) < 0)
+		return error;
+#endif
+
 	/* Test for this before resolve_deltas(), as it plays with idx->off */
 	if (idx->off < idx->pack->mwf.size - 20) {
 		giterr_set(GITERR_INDEXER, "Unexpected data at the end of the pack");
@@ -1013,6 +1925,10 @@ void git_indexer_free(git_indexer *idx)
 	if (idx == NULL)
 		return;
 
+#ifdef GIT_THREADS
+	pipeline_free(idx);
+#endif
+
 	git_vector_free_deep(&idx->objects);
 
 	if (idx->pack) {
@@ -11,6 +11,7 @@
 #include "ignore.h"
 #include "buffer.h"
 #include "submodule.h"
+#include "untracked-cache.h"
 #include <ctype.h>
 
 #define ITERATOR_SET_CB(P,NAME_LC) do { \
@@ -897,6 +898,12 @@ struct fs_iterator_frame {
 	fs_iterator_frame *next;
 	git_vector entries;
 	size_t index;
+
+	/* the workdir iterator's untracked cache block for this directory */
+	git_untracked_dir *untracked;
+	struct stat untracked_st;
+	unsigned int untracked_refresh:1;
+	unsigned int untracked_ignored:1;
 };
 
 typedef struct fs_iterator fs_iterator;
@@ -910,6 +917,7 @@ struct fs_iterator {
 	uint32_t dirload_flags;
 	int depth;
 
+	int (*load_dir_cb)(fs_iterator *self, fs_iterator_frame *ff);
 	int (*enter_dir_cb)(fs_iterator *self);
 	int (*leave_dir_cb)(fs_iterator *self);
 	int (*update_entry_cb)(fs_iterator *self);
@@ -995,9 +1003,14 @@ static int fs_iterator__expand_dir(fs_iterator *fi)
 	ff = fs_iterator__alloc_frame(fi);
 	GITERR_CHECK_ALLOC(ff);
 
-	error = git_path_dirload_with_stat(
-		fi->path.ptr, fi->root_len, fi->dirload_flags,
-		fi->base.start, fi->base.end, &ff->entries);
+	if (fi->load_dir_cb)
+		error = fi->load_dir_cb(fi, ff);
+	else {
+		error = git_path_dirload_with_stat(
+			fi->path.ptr, fi->root_len, fi->dirload_flags,
+			fi->base.start, fi->base.end, &ff->entries);
+		fi->base.stat_calls += ff->entries.length;
+	}
 
 	if (error < 0) {
 		git_error_state last_error = { 0 };
@@ -1016,7 +1029,6 @@ static int fs_iterator__expand_dir(fs_iterator *fi)
 		fs_iterator__free_frame(ff);
 		return GIT_ENOTFOUND;
 	}
-	fi->base.stat_calls += ff->entries.length;
 
 	fs_iterator__seek_frame_start(fi, ff);
 
@@ -1267,6 +1279,11 @@ typedef struct {
 	fs_iterator fi;
 	git_ignores ignores;
 	int is_ignored;
+
+	git_index *index;
+	git_untracked_cache *untracked;
+	time_t untracked_now;
+	size_t stat_skipped;
 } workdir_iterator;
 
 GIT_INLINE(bool) workdir_path_is_dotgit(const git_buf *path)
@@ -1288,6 +1305,346 @@ GIT_INLINE(bool) workdir_path_is_dotgit(const git_buf *path)
 	return (len == 4 || path->ptr[len - 5] == '/');
 }
 
+static int workdir_iterator__exclude_oid(workdir_iterator *wi, git_oid *out)
+{
+	fs_iterator *fi = &wi->fi;
+	const git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+	int error = 0;
+
+	memset(out, 0, sizeof(*out));
+
+	if (git_buf_joinpath(&path, fi->path.ptr, GIT_IGNORE_FILE) < 0)
+		return -1;
+
+	if (p_lstat(path.ptr, &st) < 0)
+		goto done;
+
+	/* like git, trust the index when its entry is up to date */
+	entry = git_index_get_bypath(wi->index, path.ptr + fi->root_len, 0);
+
+	if (entry != NULL && S_ISREG(st.st_mode) &&
+		entry->file_size == (git_off_t)st.st_size &&
+		entry->mtime.seconds == (git_time_t)st.st_mtime &&
+		entry->mtime.seconds < (git_time_t)wi->index->stamp.mtime)
+		git_oid_cpy(out, &entry->id);
+	else
+		error = git_untracked_cache_hash_ignore_file(out, path.ptr);
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static int workdir_iterator__add_name(
+	fs_iterator_frame *ff, const char *dir, size_t dir_len,
+	const char *name, size_t name_len)
+{
+	char *entry;
+
+	/* the directory is found again by stat'ing it */
+	if (name_len && name[name_len - 1] == '/')
+		name_len--;
+
+	entry = git__calloc(
+		dir_len + name_len + 1 + sizeof(git_path_with_stat) + 1, 1);
+	GITERR_CHECK_ALLOC(entry);
+
+	memcpy(entry, dir, dir_len);
+	memcpy(entry + dir_len, name, name_len);
+
+	return git_vector_insert(&ff->entries, entry);
+}
+
+static int workdir_iterator__add_tracked(
+	const char *path, size_t path_len, void *payload)
+{
+	return workdir_iterator__add_name(payload, NULL, 0, path, path_len);
+}
+
+typedef struct {
+	workdir_iterator *wi;
+	fs_iterator_frame *ff;
+} workdir_stat_data;
+
+/* What the filesystem monitor didn't report is as the index (or, for a
+ * directory, its untracked cache block) last saw it
+ */
+static int workdir_iterator__fsmonitor_stat(git_path_with_stat *ps, void *payload)
+{
+	workdir_stat_data *data = payload;
+	workdir_iterator *wi = data->wi;
+	const git_index_entry *entry;
+	git_untracked_dir *child = NULL;
+	const char *name;
+
+	memset(&ps->st, 0, sizeof(ps->st));
+
+	if (wi->index->fsmonitor_dirs && data->ff->untracked != NULL) {
+		name = strrchr(ps->path, '/');
+		name = name ? name + 1 : ps->path;
+
+		if (git_untracked_dir_child(&child, data->ff->untracked,
+				name, ps->path + ps->path_len - name, false) < 0)
+			return -1;
+	}
+
+	if (child && child->valid && !child->check_only) {
+		ps->st.st_mode = S_IFDIR | 0755;
+		ps->st.st_ctime = child->st.ctime;
+		ps->st.st_mtime = child->st.mtime;
+		ps->st.st_dev = child->st.dev;
+		ps->st.st_ino = child->st.ino;
+		ps->st.st_uid = child->st.uid;
+		ps->st.st_gid = child->st.gid;
+		ps->st.st_size = child->st.size;
+	} else if ((entry = git_index_get_bypath(wi->index, ps->path, 0)) != NULL &&
+		(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0) {
+		ps->st.st_mode = entry->mode;
+		ps->st.st_ctime = (time_t)entry->ctime.seconds;
+		ps->st.st_mtime = (time_t)entry->mtime.seconds;
+		ps->st.st_rdev = entry->dev;
+		ps->st.st_ino = entry->ino;
+		ps->st.st_uid = entry->uid;
+		ps->st.st_gid = entry->gid;
+		ps->st.st_size = entry->file_size;
+	} else
+		return GIT_PASSTHROUGH;
+
+	wi->stat_skipped++;
+	return 0;
+}
+
+static int workdir_iterator__fill(workdir_iterator *wi, fs_iterator_frame *ff)
+{
+	fs_iterator *fi = &wi->fi;
+	workdir_stat_data data;
+	size_t skipped = wi->stat_skipped;
+	int error;
+
+	data.wi = wi;
+	data.ff = ff;
+
+	error = git_path_with_stat_fill(
+		fi->path.ptr, fi->root_len, fi->dirload_flags,
+		fi->base.start, fi->base.end, &ff->entries,
+		iterator__flag(fi, USE_FSMONITOR) ?
+			workdir_iterator__fsmonitor_stat : NULL, &data);
+
+	fi->base.stat_calls += ff->entries.length - (wi->stat_skipped - skipped);
+	return error;
+}
+
+/* List a directory from its untracked cache block: what the index has
+ * in it, and the untracked names and subdirectories the block knows.
+ */
+static int workdir_iterator__load_cached(
+	workdir_iterator *wi, fs_iterator_frame *ff, git_untracked_dir *dir)
+{
+	fs_iterator *fi = &wi->fi;
+	const char *rel = fi->path.ptr + fi->root_len, *name;
+	size_t rel_len = fi->path.size - fi->root_len, i;
+	git_untracked_dir *child;
+	int error;
+
+	if ((error = git_index__foreach_in_dir(wi->index, rel, rel_len,
+			workdir_iterator__add_tracked, ff)) < 0)
+		return error;
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if ((error = workdir_iterator__add_name(
+				ff, rel, rel_len, child->name, child->namelen)) < 0)
+			return error;
+	}
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		if ((error = workdir_iterator__add_name(
+				ff, rel, rel_len, name, strlen(name))) < 0)
+			return error;
+	}
+
+	git_vector_set_cmp(&ff->entries, CASESELECT(iterator__ignore_case(fi),
+		git__strcasecmp_cb, git__strcmp_cb));
+	git_vector_uniq(&ff->entries, git__free);
+	git_vector_set_cmp(&ff->entries, CASESELECT(iterator__ignore_case(fi),
+		git_path_with_stat_cmp_icase, git_path_with_stat_cmp));
+
+	return workdir_iterator__fill(wi, ff);
+}
+
+static int workdir_iterator__load_dir(fs_iterator *fi, fs_iterator_frame *ff)
+{
+	workdir_iterator *wi = (workdir_iterator *)fi;
+	fs_iterator_frame *parent = fi->stack;
+	git_untracked_dir *dir = NULL;
+	git_untracked_stat st;
+	git_oid exclude_oid;
+	int error, ignored;
+
+	if (!parent && wi->untracked) {
+		dir = wi->untracked->root;
+
+		/* what changes in it was reported to the filesystem monitor */
+		if (dir && dir->valid && wi->index->fsmonitor_dirs &&
+			iterator__flag(fi, USE_FSMONITOR)) {
+			memset(&ff->untracked_st, 0, sizeof(struct stat));
+			ff->untracked_st.st_ctime = dir->st.ctime;
+			ff->untracked_st.st_mtime = dir->st.mtime;
+			ff->untracked_st.st_ino = dir->st.ino;
+			ff->untracked_st.st_uid = dir->st.uid;
+			ff->untracked_st.st_gid = dir->st.gid;
+			ff->untracked_st.st_size = dir->st.size;
+		} else if (p_lstat(fi->path.ptr, &ff->untracked_st) < 0)
+			dir = NULL;
+	} else if (parent && parent->untracked != NULL) {
+		git_path_with_stat *ps =
+			git_vector_get(&parent->entries, parent->index);
+		const char *name = ps->path + ps->path_len - 1;
+
+		/* only directories with tracked files get a block: git keeps
+		 * partial ones for untracked directories, and submodules are
+		 * not part of the cache
+		 */
+		if (!S_ISDIR(ps->st.st_mode) ||
+			!git_index__has_dir(wi->index, ps->path, ps->path_len))
+			goto load;
+
+		while (name > ps->path && name[-1] != '/')
+			name--;
+
+		if ((error = git_untracked_dir_child(&dir, parent->untracked,
+				name, ps->path + ps->path_len - 1 - name, true)) < 0)
+			return error;
+
+		memcpy(&ff->untracked_st, &ps->st, sizeof(struct stat));
+
+		if (git_ignore__lookup(&wi->ignores, ps->path, &ignored) < 0)
+			return -1;
+		ff->untracked_ignored = (parent->untracked_ignored || ignored);
+	}
+
+	if (!dir)
+		goto load;
+
+	ff->untracked = dir;
+
+	/* everything below depends on the .gitignore files on the way */
+	if ((error = workdir_iterator__exclude_oid(wi, &exclude_oid)) < 0)
+		return error;
+
+	if (!git_oid_equal(&exclude_oid, &dir->exclude_oid)) {
+		git_untracked_dir_invalidate(dir, true);
+		git_oid_cpy(&dir->exclude_oid, &exclude_oid);
+	}
+
+	git_untracked_stat_from_stat(&st, &ff->untracked_st);
+
+	/* a directory changed in the second the index was written may have
+	 * changed after it was read, with the same mtime
+	 */
+	if (dir->valid && !dir->check_only &&
+		!git_untracked_stat_changed(&dir->st, &st) &&
+		(time_t)dir->st.mtime < wi->index->stamp.mtime)
+		return workdir_iterator__load_cached(wi, ff, dir);
+
+	ff->untracked_refresh = (!fi->base.start && !fi->base.end);
+
+load:
+	if ((error = git_path_dirload(fi->path.ptr, fi->root_len,
+			sizeof(git_path_with_stat) + 1, fi->dirload_flags,
+			&ff->entries)) < 0)
+		return error;
+
+	return workdir_iterator__fill(wi, ff);
+}
+
+static int workdir_iterator__is_tracked(
+	workdir_iterator *wi, const char *path, size_t path_len)
+{
+	size_t pos;
+
+	return (git_index__find_pos(
+		&pos, wi->index, path, path_len, GIT_INDEX_STAGE_ANY) == 0);
+}
+
+/* Record the untracked files of a directory which was just read.  The
+ * untracked directories in it are listed as well, even those git would
+ * leave out as empty, as they are read again every time.
+ */
+static int workdir_iterator__update_untracked(
+	workdir_iterator *wi, fs_iterator_frame *ff)
+{
+	fs_iterator *fi = &wi->fi;
+	git_untracked_dir *dir = ff->untracked, *child;
+	git_vector untracked = GIT_VECTOR_INIT, dirs = GIT_VECTOR_INIT;
+	git_path_with_stat *entry;
+	size_t rel_len = fi->path.size - fi->root_len, name_len, pos;
+	const char *name;
+	char *copy;
+	int error = 0, ignored = 0;
+
+	git_vector_foreach(&ff->entries, pos, entry) {
+		name = entry->path + rel_len;
+
+		/* the iterator skips these too */
+		if (!strcasecmp(name, GIT_DIR) || !strcasecmp(name, DOT_GIT))
+			continue;
+
+		if (S_ISDIR(entry->st.st_mode)) {
+			if (git_index__has_dir(wi->index, entry->path, entry->path_len)) {
+				if ((error = git_untracked_dir_child(&child, dir,
+						name, entry->path_len - rel_len - 1, true)) < 0 ||
+					(error = git_vector_insert(&dirs, child)) < 0)
+					goto done;
+				continue;
+			}
+
+			if (workdir_iterator__is_tracked(
+					wi, entry->path, entry->path_len - 1))
+				continue;
+		} else if (workdir_iterator__is_tracked(wi, entry->path, 0))
+			continue;
+
+		if (!ff->untracked_ignored) {
+			if ((error = git_ignore__lookup(
+					&wi->ignores, entry->path, &ignored)) < 0)
+				goto done;
+		}
+
+		if (ff->untracked_ignored || ignored)
+			continue;
+
+		name_len = strlen(name);
+		if ((copy = git__malloc(name_len + 2)) == NULL) {
+			error = -1;
+			goto done;
+		}
+		memcpy(copy, name, name_len + 1);
+
+		/* untracked directories (or submodules) end in a slash */
+		if (!S_ISREG(entry->st.st_mode) && !S_ISLNK(entry->st.st_mode) &&
+			name[name_len - 1] != '/') {
+			copy[name_len++] = '/';
+			copy[name_len] = '\0';
+		}
+
+		if ((error = git_vector_insert(&untracked, copy)) < 0) {
+			git__free(copy);
+			goto done;
+		}
+	}
+
+	git_untracked_dir_update(dir, &untracked, &dirs, &ff->untracked_st,
+		ff->untracked_st.st_mtime < wi->untracked_now);
+	return 0;
+
+done:
+	git_vector_free_deep(&untracked);
+	git_vector_free(&dirs);
+	return error;
+}
+
 static int workdir_iterator__enter_dir(fs_iterator *fi)
 {
 	fs_iterator_frame *ff = fi->stack;
@@ -1323,6 +1680,10 @@ static int workdir_iterator__enter_dir(fs_iterator *fi)
 		fs_iterator__seek_frame_start(fi, ff);
 	}
 
+	if (ff->untracked_refresh)
+		return workdir_iterator__update_untracked(
+			(workdir_iterator *)fi, ff);
+
 	return 0;
 }
 
@@ -1352,12 +1713,14 @@ static void workdir_iterator__free(git_iterator *self)
 	workdir_iterator *wi = (workdir_iterator *)self;
 	fs_iterator__free(self);
 	git_ignore__free(&wi->ignores);
+	git_index_free(wi->index);
 }
 
 int git_iterator_for_workdir_ext(
 	git_iterator **out,
 	git_repository *repo,
 	const char *repo_workdir,
+	git_index *index,
 	git_iterator_flag_t flags,
 	const char *start,
 	const char *end)
@@ -1365,6 +1728,14 @@ int git_iterator_for_workdir_ext(
 	int error, precompose = 0;
 	workdir_iterator *wi;
 
+	/* both are about the repository's own working directory */
+	if (repo_workdir || !index)
+		flags &= ~(GIT_ITERATOR_USE_UNTRACKED_CACHE |
+			GIT_ITERATOR_USE_FSMONITOR);
+
+	if (index && !index->fsmonitor_fresh)
+		flags &= ~GIT_ITERATOR_USE_FSMONITOR;
+
 	if (!repo_workdir) {
 		if (git_repository__ensure_not_bare(repo, "scan working directory") < 0)
 			return GIT_EBAREREPO;
@@ -1395,6 +1766,23 @@ int git_iterator_for_workdir_ext(
 	else if (precompose)
 		wi->fi.base.flags |= GIT_ITERATOR_PRECOMPOSE_UNICODE;
 
+	/* it's only a shortcut, so do without it when it can't be had; the
+	 * cache knows nothing of the rules added with git_ignore_add_rule
+	 */
+	if ((flags & GIT_ITERATOR_USE_UNTRACKED_CACHE) != 0 &&
+		!git_ignore__has_internal_rules(&wi->ignores)) {
+		if (git_index__untracked_cache(&wi->untracked, index, repo) < 0)
+			giterr_clear();
+
+		wi->untracked_now = time(NULL);
+	}
+
+	if (wi->untracked != NULL || (flags & GIT_ITERATOR_USE_FSMONITOR) != 0) {
+		GIT_REFCOUNT_INC(index);
+		wi->index = index;
+		wi->fi.load_dir_cb = workdir_iterator__load_dir;
+	}
+
 	return fs_iterator__initialize(out, &wi->fi, repo_workdir);
 }
 
@@ -33,6 +33,12 @@ typedef enum {
 	GIT_ITERATOR_DONT_AUTOEXPAND  = (1u << 3),
 	/** convert precomposed unicode to decomposed unicode */
 	GIT_ITERATOR_PRECOMPOSE_UNICODE = (1u << 4),
+	/** list directories from the index's untracked cache where it can;
+	 * ignored files and directories may then be left out */
+	GIT_ITERATOR_USE_UNTRACKED_CACHE = (1u << 5),
+	/** take what the index's filesystem monitor didn't report as changed
+	 * from the index instead of stat'ing it */
+	GIT_ITERATOR_USE_FSMONITOR = (1u << 6),
 } git_iterator_flag_t;
 
 typedef struct {
@@ -82,10 +88,12 @@ extern int git_iterator_for_index(
 	const char *start,
 	const char *end);
 
+/* the `index` is only needed with GIT_ITERATOR_USE_UNTRACKED_CACHE */
 extern int git_iterator_for_workdir_ext(
 	git_iterator **out,
 	git_repository *repo,
 	const char *repo_workdir,
+	git_index *index,
 	git_iterator_flag_t flags,
 	const char *start,
 	const char *end);
@@ -100,7 +108,8 @@ GIT_INLINE(int) git_iterator_for_workdir(
 	const char *start,
 	const char *end)
 {
-	return git_iterator_for_workdir_ext(out, repo, NULL, flags, start, end);
+	return git_iterator_for_workdir_ext(
+		out, repo, NULL, NULL, flags, start, end);
 }
 
 /* for filesystem iterators, you have to explicitly pass in the ignore_case
@@ -94,7 +94,7 @@ int git_merge_base_many(git_oid *out, git_repository *repo, size_t length, const
 	if (commit == NULL)
 		goto cleanup;
 
-	if (git_merge__bases_many(&result, walk, commit, &list) < 0)
+	if (git_merge__bases_many(&result, walk, commit, &list, 0) < 0)
 		goto cleanup;
 
 	if (!result) {
@@ -164,7 +164,7 @@ int git_merge_base(git_oid *out, git_repository *repo, const git_oid *one, const
 	if (commit == NULL)
 		goto on_error;
 
-	if (git_merge__bases_many(&result, walk, commit, &list) < 0)
+	if (git_merge__bases_many(&result, walk, commit, &list, 0) < 0)
 		goto on_error;
 
 	if (!result) {
@@ -197,7 +197,12 @@ static int interesting(git_pqueue *list)
 	return 0;
 }
 
-int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_list_node *one, git_vector *twos)
+int git_merge__bases_many(
+	git_commit_list **out,
+	git_revwalk *walk,
+	git_commit_list_node *one,
+	git_vector *twos,
+	uint32_t min_generation)
 {
 	int error;
 	unsigned int i;
@@ -217,7 +222,8 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 			return git_commit_list_insert(one, out) ? 0 : -1;
 	}
 
-	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_time_cmp) < 0)
+	/* Generation numbers guarantee that children are visited before parents */
+	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if (git_commit_list_parse(walk, one) < 0)
@@ -242,6 +248,10 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 		if (commit == NULL)
 			break;
 
+		/* Everything left in the queue is below the interesting part */
+		if (min_generation && git_commit_list_generation(commit) < min_generation)
+			break;
+
 		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->flags & RESULT)) {
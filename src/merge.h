@@ -120,11 +120,17 @@ struct git_merge_head {
 	git_commit *commit;
 };
 
+/*
+ * Find the merge bases of `one` and `twos`. When `min_generation` is not 0,
+ * the walk stops at the commits whose generation number is lower: only the
+ * commits (and flags) of that part of the graph can then be relied upon.
+ */
 int git_merge__bases_many(
 	git_commit_list **out,
 	git_revwalk *walk,
 	git_commit_list_node *one,
-	git_vector *twos);
+	git_vector *twos,
+	uint32_t min_generation);
 
 /*
  * Three-way tree differencing
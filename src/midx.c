@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "oid.h"
+#include "pack.h"
+#include "path.h"
+#include "sha1_lookup.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OBJECT_ID_VERSION 1 /* SHA-1 */
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d	   /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446	   /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c	   /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646	   /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_CHUNK_HEADER_SIZE 12
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+
+struct git_midx_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+struct git_midx_writer {
+	git_buf pack_dir;
+	git_vector packs;
+};
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint64_t) midx_get_be64(const unsigned char *p)
+{
+	return (((uint64_t)ntohl(*((uint32_t *)(p + 0)))) << 32) |
+		ntohl(*((uint32_t *)(p + 4)));
+}
+
+static int midx_parse_packfile_names(
+		git_midx_file *idx,
+		const unsigned char *data,
+		uint32_t packfiles,
+		struct git_midx_chunk *chunk)
+{
+	int error;
+	uint32_t i;
+	char *packfile_name = (char *)(data + chunk->offset);
+	size_t chunk_size = chunk->length, len;
+
+	if (chunk->offset == 0)
+		return midx_error("missing Packfile Names chunk");
+	if (chunk->length == 0)
+		return midx_error("empty Packfile Names chunk");
+
+	if ((error = git_vector_init(&idx->packfile_names, packfiles, git__strcmp_cb)) < 0)
+		return error;
+
+	for (i = 0; i < packfiles; ++i) {
+		len = p_strnlen(packfile_name, chunk_size);
+		if (len == 0)
+			return midx_error("empty packfile name");
+		if (len + 1 > chunk_size)
+			return midx_error("unterminated packfile name");
+
+		git_vector_insert(&idx->packfile_names, packfile_name);
+		if (i && strcmp(git_vector_get(&idx->packfile_names, i - 1), packfile_name) >= 0)
+			return midx_error("packfile names are not sorted");
+		if (strlen(packfile_name) <= strlen(".idx") ||
+			git__suffixcmp(packfile_name, ".idx") != 0)
+			return midx_error("non-.idx packfile name");
+		if (strchr(packfile_name, '/') != NULL || strchr(packfile_name, '\\') != NULL)
+			return midx_error("non-local packfile");
+
+		packfile_name += len + 1;
+		chunk_size -= len + 1;
+	}
+
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return midx_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+	idx->num_objects = nr;
+
+	return 0;
+}
+
+static int midx_parse_oid_lookup(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid, zero_oid = {{0}};
+	size_t len;
+
+	if (chunk_oid_lookup->offset == 0)
+		return midx_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return midx_error("empty OID Lookup chunk");
+	if (git__multiply_sizet_overflow(
+			&len, idx->num_objects, GIT_OID_RAWSZ) ||
+		chunk_oid_lookup->length != len)
+		return midx_error("OID Lookup chunk has wrong length");
+
+	idx->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = &zero_oid;
+	for (i = 0; i < idx->num_objects; ++i, ++oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return midx_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int midx_parse_object_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_offsets)
+{
+	size_t len;
+
+	if (chunk_object_offsets->offset == 0)
+		return midx_error("missing Object Offsets chunk");
+	if (chunk_object_offsets->length == 0)
+		return midx_error("empty Object Offsets chunk");
+	if (git__multiply_sizet_overflow(&len, idx->num_objects, 8) ||
+		chunk_object_offsets->length != len)
+		return midx_error("Object Offsets chunk has wrong length");
+
+	idx->object_offsets = data + chunk_object_offsets->offset;
+
+	return 0;
+}
+
+static int midx_parse_object_large_offsets(
+		git_midx_file *idx,
+		const unsigned char *data,
+		struct git_midx_chunk *chunk_object_large_offsets)
+{
+	if (chunk_object_large_offsets->length == 0)
+		return 0;
+	if (chunk_object_large_offsets->length % 8 != 0)
+		return midx_error("malformed Object Large Offsets chunk");
+
+	idx->object_large_offsets = data + chunk_object_large_offsets->offset;
+	idx->num_object_large_offsets = chunk_object_large_offsets->length / 8;
+
+	return 0;
+}
+
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_midx_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_midx_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_midx_chunk chunk_packfile_names = {0},
+					 chunk_oid_fanout = {0},
+					 chunk_oid_lookup = {0},
+					 chunk_object_offsets = {0},
+					 chunk_object_large_offsets = {0};
+
+	assert(idx);
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("multi-pack index is too short");
+
+	hdr = ((struct git_midx_header *)data);
+
+	if (hdr->signature != htonl(MIDX_SIGNATURE) ||
+		hdr->version != MIDX_VERSION ||
+		hdr->object_id_version != MIDX_OBJECT_ID_VERSION) {
+		return midx_error("unsupported multi-pack index version");
+	}
+	if (hdr->chunks == 0)
+		return midx_error("no chunks in multi-pack index");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset =
+			sizeof(struct git_midx_header) +
+			(1 + hdr->chunks) * MIDX_CHUNK_HEADER_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return midx_error("wrong index size");
+
+	/*
+	 * Like git, we don't verify the trailing checksum here: hashing the
+	 * whole file on every open would cost more than the lookups it saves.
+	 */
+	git_oid_fromraw(&idx->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += MIDX_CHUNK_HEADER_SIZE) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32 |
+				((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return midx_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return midx_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case MIDX_PACKFILE_NAMES_ID:
+			chunk_packfile_names.offset = last_chunk_offset;
+			last_chunk = &chunk_packfile_names;
+			break;
+
+		case MIDX_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case MIDX_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case MIDX_OBJECT_OFFSETS_ID:
+			chunk_object_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_offsets;
+			break;
+
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			chunk_object_large_offsets.offset = last_chunk_offset;
+			last_chunk = &chunk_object_large_offsets;
+			break;
+
+		default:
+			/* Unknown chunks (e.g. the reverse index) are skipped. */
+			last_chunk = NULL;
+			break;
+		}
+	}
+	if (last_chunk != NULL)
+		last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if ((error = midx_parse_packfile_names(
+			idx, data, ntohl(hdr->packfiles), &chunk_packfile_names)) < 0)
+		return error;
+	if ((error = midx_parse_oid_fanout(idx, data, &chunk_oid_fanout)) < 0)
+		return error;
+	if ((error = midx_parse_oid_lookup(idx, data, &chunk_oid_lookup)) < 0)
+		return error;
+	if ((error = midx_parse_object_offsets(idx, data, &chunk_object_offsets)) < 0)
+		return error;
+	if ((error = midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_midx_open(
+		git_midx_file **idx_out,
+		const char *path)
+{
+	git_midx_file *idx;
+	git_file fd = -1;
+	size_t idx_size;
+	struct stat st;
+	int error;
+
+	/* TODO: properly open the file without access time using O_NOATIME */
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "multi-pack-index file not found - '%s'", path);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "invalid pack index '%s'", path);
+		return -1;
+	}
+	idx_size = (size_t)st.st_size;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	git_futils_filestamp_set_from_stat(&idx->stamp, &st);
+
+	error = git_futils_mmap_ro(&idx->index_map, fd, 0, idx_size);
+	p_close(fd);
+	if (error < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	if ((error = git_midx_parse(idx, idx->index_map.data, idx_size)) < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	*idx_out = idx;
+	return 0;
+}
+
+bool git_midx_needs_refresh(
+		git_midx_file *idx,
+		const char *path)
+{
+	/* Refresh if the file disappeared, or if it was rewritten in place. */
+	return git_futils_filestamp_check(&idx->stamp, path) != 0;
+}
+
+static git_off_t nth_midx_offset(git_midx_file *idx, size_t *pack_index, uint32_t pos)
+{
+	const unsigned char *object_offset;
+	uint32_t offset32;
+
+	object_offset = idx->object_offsets + pos * 8;
+	*pack_index = ntohl(*((uint32_t *)(object_offset + 0)));
+	offset32 = ntohl(*((uint32_t *)(object_offset + 4)));
+
+	if (idx->object_large_offsets && offset32 & MIDX_LARGE_OFFSET_NEEDED) {
+		if ((offset32 & 0x7fffffff) >= idx->num_object_large_offsets)
+			return -1;
+
+		return (git_off_t)midx_get_be64(
+			idx->object_large_offsets + 8 * (offset32 & 0x7fffffff));
+	}
+
+	return offset32;
+}
+
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	size_t pack_index;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+	git_off_t offset;
+
+	assert(idx);
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len))
+			found = 2;
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for multi-pack index entry", short_oid);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
+
+	offset = nth_midx_offset(idx, &pack_index, pos);
+	if (offset < 0)
+		return midx_error("invalid index into the object large offsets table");
+	if (pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+
+	e->pack_index = pack_index;
+	e->offset = offset;
+	git_oid_cpy(&e->sha1, current);
+	return 0;
+}
+
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data)
+{
+	size_t i;
+	int error;
+
+	assert(idx);
+
+	for (i = 0; i < idx->num_objects; ++i)
+		if ((error = cb(&idx->oid_lookup[i], data)) != 0)
+			return giterr_set_after_callback(error);
+
+	return 0;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	if (idx->index_map.data)
+		git_futils_mmap_free(&idx->index_map);
+	git_vector_free(&idx->packfile_names);
+	git__free(idx);
+}
+
+/***********************************************************
+ *
+ * MULTI-PACK-INDEX WRITER
+ *
+ ***********************************************************/
+
+static int packfile__cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_file *a = a_;
+	const struct git_pack_file *b = b_;
+
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+int git_midx_writer_new(
+		git_midx_writer **out,
+		const char *pack_dir)
+{
+	git_midx_writer *w = git__calloc(1, sizeof(git_midx_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->pack_dir, pack_dir) < 0 ||
+		git_path_to_dir(&w->pack_dir) < 0 ||
+		git_vector_init(&w->packs, 0, packfile__cmp) < 0) {
+		git_buf_free(&w->pack_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_midx_writer_free(git_midx_writer *w)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->packs, i, p)
+		git_packfile_free(p);
+	git_vector_free(&w->packs);
+	git_buf_free(&w->pack_dir);
+	git__free(w);
+}
+
+int git_midx_writer_add(
+		git_midx_writer *w,
+		const char *idx_path)
+{
+	git_buf idx_path_buf = GIT_BUF_INIT;
+	int error;
+	struct git_pack_file *p;
+
+	assert(w && idx_path);
+
+	if ((error = git_path_join_unrooted(
+			&idx_path_buf, idx_path, git_buf_cstr(&w->pack_dir), NULL)) < 0)
+		return error;
+
+	if (!git_path_exists(git_buf_cstr(&idx_path_buf))) {
+		giterr_set(GITERR_ODB, "Failed to find packfile index '%s'",
+			git_buf_cstr(&idx_path_buf));
+		git_buf_free(&idx_path_buf);
+		return GIT_ENOTFOUND;
+	}
+
+	error = git_packfile_alloc(&p, git_buf_cstr(&idx_path_buf));
+	git_buf_free(&idx_path_buf);
+	if (error < 0)
+		return error;
+
+	if ((error = git_vector_insert(&w->packs, p)) < 0) {
+		git_packfile_free(p);
+		return error;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	git_oid id;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+	git_off_t offset;
+} midx_object_entry;
+
+typedef git_array_t(midx_object_entry) midx_object_entry_array_t;
+
+typedef struct {
+	midx_object_entry_array_t *objects;
+	uint32_t pack_index;
+	git_time_t pack_mtime;
+} midx_collect_data;
+
+static int midx_collect_cb(const git_oid *id, git_off_t offset, void *payload)
+{
+	midx_collect_data *data = payload;
+	midx_object_entry *entry = git_array_alloc(*data->objects);
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->pack_index = data->pack_index;
+	entry->pack_mtime = data->pack_mtime;
+	entry->offset = offset;
+	return 0;
+}
+
+static int midx_object_entry__cmp(const void *a_, const void *b_, void *payload)
+{
+	const midx_object_entry *a = a_;
+	const midx_object_entry *b = b_;
+	int cmp = git_oid__cmp(&a->id, &b->id);
+
+	GIT_UNUSED(payload);
+
+	if (cmp)
+		return cmp;
+
+	/* When an object is in several packs, prefer the newest pack. */
+	if (a->pack_mtime != b->pack_mtime)
+		return (a->pack_mtime > b->pack_mtime) ? -1 : 1;
+
+	return (a->pack_index < b->pack_index) ? -1 :
+		(a->pack_index > b->pack_index) ? 1 : 0;
+}
+
+static int midx_put_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int midx_put_be64(git_buf *buf, uint64_t value)
+{
+	if (midx_put_be32(buf, (uint32_t)(value >> 32)) < 0)
+		return -1;
+	return midx_put_be32(buf, (uint32_t)(value & 0xffffffff));
+}
+
+static int midx_write_chunk_header(git_buf *buf, uint32_t id, uint64_t offset)
+{
+	if (midx_put_be32(buf, id) < 0)
+		return -1;
+	return midx_put_be64(buf, offset);
+}
+
+int git_midx_writer_dump(
+		git_buf *midx,
+		git_midx_writer *w)
+{
+	struct git_midx_header hdr = {0};
+	git_buf packfile_names = GIT_BUF_INIT,
+		oid_lookup = GIT_BUF_INIT,
+		object_offsets = GIT_BUF_INIT,
+		object_large_offsets = GIT_BUF_INIT;
+	midx_object_entry_array_t objects = GIT_ARRAY_INIT;
+	midx_object_entry *entry, *prev = NULL;
+	struct git_pack_file *p;
+	uint32_t fanout[256] = {0}, object_count = 0, large_count = 0;
+	uint64_t offset;
+	git_oid checksum;
+	size_t i, base_len;
+	int error = 0;
+
+	assert(midx && w);
+
+	git_vector_sort(&w->packs);
+	base_len = git_buf_len(&w->pack_dir);
+
+	git_vector_foreach(&w->packs, i, p) {
+		midx_collect_data data;
+		const char *name = p->pack_name + base_len;
+		size_t name_len = strlen(name);
+
+		/* The names stored are those of the .idx files */
+		assert(name_len > strlen(".pack"));
+		if ((error = git_buf_put(&packfile_names, name, name_len - strlen(".pack"))) < 0 ||
+			(error = git_buf_put(&packfile_names, ".idx", strlen(".idx") + 1)) < 0)
+			goto cleanup;
+
+		data.objects = &objects;
+		data.pack_index = (uint32_t)i;
+		data.pack_mtime = p->mtime;
+
+		if ((error = git_pack_foreach_entry_offset(p, midx_collect_cb, &data)) < 0)
+			goto cleanup;
+	}
+
+	/* Pad the packfile names chunk to a multiple of four bytes */
+	if ((error = git_buf_putcn(&packfile_names, '\0',
+			(4 - (git_buf_len(&packfile_names) % 4)) % 4)) < 0)
+		goto cleanup;
+
+	git__qsort_r(objects.ptr, objects.size, sizeof(midx_object_entry),
+		midx_object_entry__cmp, NULL);
+
+	for (i = 0; i < git_array_size(objects); ++i) {
+		entry = git_array_get(objects, i);
+
+		/* Only the first (preferred) copy of each object is indexed */
+		if (prev && git_oid_equal(&prev->id, &entry->id))
+			continue;
+		prev = entry;
+
+		fanout[entry->id.id[0]]++;
+		object_count++;
+
+		if ((error = git_buf_put(&oid_lookup,
+				(const char *)entry->id.id, GIT_OID_RAWSZ)) < 0 ||
+			(error = midx_put_be32(&object_offsets, entry->pack_index)) < 0)
+			goto cleanup;
+
+		if (entry->offset > 0x7fffffff) {
+			error = midx_put_be32(&object_offsets,
+				MIDX_LARGE_OFFSET_NEEDED | large_count++);
+			if (!error)
+				error = midx_put_be64(&object_large_offsets, entry->offset);
+		} else {
+			error = midx_put_be32(&object_offsets, (uint32_t)entry->offset);
+		}
+
+		if (error < 0)
+			goto cleanup;
+	}
+
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	/* Write the header */
+	hdr.signature = htonl(MIDX_SIGNATURE);
+	hdr.version = MIDX_VERSION;
+	hdr.object_id_version = MIDX_OBJECT_ID_VERSION;
+	hdr.chunks = large_count ? 5 : 4;
+	hdr.base_midx_files = 0;
+	hdr.packfiles = htonl((uint32_t)git_vector_length(&w->packs));
+
+	git_buf_clear(midx);
+	if ((error = git_buf_put(midx, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk headers, followed by the terminating one */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * MIDX_CHUNK_HEADER_SIZE;
+
+	if ((error = midx_write_chunk_header(midx, MIDX_PACKFILE_NAMES_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&packfile_names);
+	if ((error = midx_write_chunk_header(midx, MIDX_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += sizeof(fanout);
+	if ((error = midx_write_chunk_header(midx, MIDX_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = midx_write_chunk_header(midx, MIDX_OBJECT_OFFSETS_ID, offset)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&object_offsets);
+	if (large_count) {
+		if ((error = midx_write_chunk_header(midx, MIDX_OBJECT_LARGE_OFFSETS_ID, offset)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&object_large_offsets);
+	}
+	if ((error = midx_write_chunk_header(midx, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Write the chunks themselves */
+	if ((error = git_buf_put(midx,
+			git_buf_cstr(&packfile_names), git_buf_len(&packfile_names))) < 0)
+		goto cleanup;
+	for (i = 0; i < 256; ++i) {
+		if ((error = midx_put_be32(midx, fanout[i])) < 0)
+			goto cleanup;
+	}
+	if ((error = git_buf_put(midx,
+			git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup))) < 0 ||
+		(error = git_buf_put(midx,
+			git_buf_cstr(&object_offsets), git_buf_len(&object_offsets))) < 0 ||
+		(error = git_buf_put(midx,
+			git_buf_cstr(&object_large_offsets), git_buf_len(&object_large_offsets))) < 0)
+		goto cleanup;
+
+	/* And the trailer: a checksum of everything that precedes it */
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(midx), git_buf_len(midx))) < 0)
+		goto cleanup;
+	error = git_buf_put(midx, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_array_clear(objects);
+	git_buf_free(&packfile_names);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&object_offsets);
+	git_buf_free(&object_large_offsets);
+	return error;
+}
+
+int git_midx_writer_commit(
+		git_midx_writer *w)
+{
+	git_buf midx = GIT_BUF_INIT, midx_path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_midx_writer_dump(&midx, w)) < 0 ||
+		(error = git_buf_joinpath(&midx_path,
+			git_buf_cstr(&w->pack_dir), GIT_MIDX_FILE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output,
+			git_buf_cstr(&midx_path), 0, GIT_PACK_FILE_MODE)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_write(&output,
+			git_buf_cstr(&midx), git_buf_len(&midx))) < 0) {
+		git_filebuf_cleanup(&output);
+		goto cleanup;
+	}
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_buf_free(&midx);
+	git_buf_free(&midx_path);
+	return error;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "git2/sys/midx.h"
+
+#include "common.h"
+#include "map.h"
+#include "fileops.h"
+#include "vector.h"
+#include "odb.h"
+
+#define GIT_MIDX_FILE "multi-pack-index"
+
+/*
+ * A multi-pack-index file.
+ *
+ * This file contains a merged index for multiple independent .pack files.
+ * This can help speed up locating objects without requiring a garbage
+ * collection cycle to create a single .pack file.
+ *
+ * The on-disk format is documented in git's
+ * Documentation/technical/multi-pack-index.txt: a header, a chunk table,
+ * the packfile names (PNAM), an oid fanout (OIDF), the sorted oids (OIDL),
+ * the (pack, offset) pairs (OOFF), the optional 64-bit offsets (LOFF) and a
+ * trailing SHA-1 of everything that precedes it.
+ */
+typedef struct git_midx_file {
+	git_map index_map;
+
+	/* The names of the packfiles, in PNAM order; they point into the map. */
+	git_vector packfile_names;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of objects in the index. */
+	uint32_t num_objects;
+
+	/* The OID Lookup table. */
+	const git_oid *oid_lookup;
+
+	/* The Object Offsets table. Each entry has two 4-byte fields with the pack index and the offset. */
+	const unsigned char *object_offsets;
+
+	/* The Object Large Offsets table. */
+	const unsigned char *object_large_offsets;
+	size_t num_object_large_offsets;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/* Stat data of the file when it was loaded, used to detect rewrites. */
+	git_futils_filestamp stamp;
+} git_midx_file;
+
+/*
+ * An entry in the multi-pack-index file. Similar in purpose to
+ * `struct git_pack_entry`.
+ */
+typedef struct git_midx_entry {
+	/* The index within idx->packfile_names where the object is found. */
+	size_t pack_index;
+	/* The offset within the .pack file where the requested object is found. */
+	git_off_t offset;
+	/* The SHA-1 of the requested object. */
+	git_oid sha1;
+} git_midx_entry;
+
+int git_midx_open(git_midx_file **idx_out, const char *path);
+bool git_midx_needs_refresh(git_midx_file *idx, const char *path);
+int git_midx_entry_find(
+		git_midx_entry *e,
+		git_midx_file *idx,
+		const git_oid *short_oid,
+		size_t len);
+int git_midx_foreach_entry(
+		git_midx_file *idx,
+		git_odb_foreach_cb cb,
+		void *data);
+void git_midx_free(git_midx_file *idx);
+
+/* Parse an in-memory multi-pack-index; exposed for the tests. */
+int git_midx_parse(
+		git_midx_file *idx,
+		const unsigned char *data,
+		size_t size);
+
+#endif
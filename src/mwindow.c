@@ -22,6 +22,7 @@
 
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
+int git_mwindow__whole_files = 0;
 
 /* Whenever you want to read or modify this, grab git__mwindow_mutex */
 static git_mwindow_ctl mem_ctl;
@@ -68,6 +69,16 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 		git__free(w);
 	}
 
+	/*
+	 * The whole-file mapping may be dropped as well: the file is either
+	 * going away, or (for the indexer) has grown and needs remapping.
+	 */
+	if (git_atomic_get(&mwf->whole_state) == 1)
+		git_futils_mmap_free(&mwf->whole.window_map);
+
+	memset(&mwf->whole, 0x0, sizeof(mwf->whole));
+	git_atomic_set(&mwf->whole_state, 0);
+
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
@@ -201,6 +212,74 @@ static git_mwindow *new_window(
 	return w;
 }
 
+/*
+ * Map the whole file the first time it's needed. This doesn't count
+ * against the mapped limit: the point is to map every pack once and
+ * leave the paging to the OS. Lookups jump all over the pack, so ask
+ * the OS not to read ahead.
+ */
+static int map_whole_file(git_mwindow_file *mwf)
+{
+	git_mwindow *w = &mwf->whole;
+	int state;
+
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
+		return -1;
+	}
+
+	if ((state = git_atomic_get(&mwf->whole_state)) != 0)
+		goto done;
+
+	state = -1;
+
+	if (mwf->size <= 0 || !git__is_sizet(mwf->size) ||
+		git_futils_mmap_ro(&w->window_map, mwf->fd, 0, (size_t)mwf->size) < 0) {
+		giterr_clear();
+		goto done;
+	}
+
+	w->offset = 0;
+	w->whole = true;
+	mem_ctl.mmap_calls++;
+	state = 1;
+
+	/* Readers don't take the lock, publish the window before the state */
+	GIT_MEMORY_BARRIER;
+
+done:
+	git_atomic_set(&mwf->whole_state, state);
+	git_mutex_unlock(&git__mwindow_mutex);
+	return state;
+}
+
+/*
+ * Serve the request from the whole-file mapping if there's one which
+ * covers it, without taking the lock. NULL means we need a window.
+ */
+static git_mwindow *whole_file_window(
+	git_mwindow_file *mwf,
+	git_off_t offset,
+	size_t extra)
+{
+	git_mwindow *w = &mwf->whole;
+	int state = git_atomic_get(&mwf->whole_state);
+
+	if (state == 0)
+		state = map_whole_file(mwf);
+
+	if (state != 1)
+		return NULL;
+
+	GIT_MEMORY_BARRIER;
+
+	if (!git_mwindow_contains(w, offset) ||
+		!git_mwindow_contains(w, offset + extra))
+		return NULL;
+
+	return w;
+}
+
 /*
  * Open a new window, closing the least recenty used until we have
  * enough space. Don't forget to add it to your list
@@ -215,6 +294,26 @@ unsigned char *git_mwindow_open(
 	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
 
+	if (git_mwindow__whole_files &&
+		(w = whole_file_window(mwf, offset, extra)) != NULL) {
+		if (*cursor != w) {
+			git_mwindow_close(cursor);
+			*cursor = w;
+		}
+
+		if (left)
+			*left = (unsigned int)min(w->window_map.len - (size_t)offset, UINT_MAX);
+
+		return (unsigned char *) w->window_map.data + offset;
+	}
+
+	w = *cursor;
+
+	if (w && w->whole) {
+		/* The whole-file mapping doesn't cover it, look for a window */
+		*cursor = w = NULL;
+	}
+
 	if (git_mutex_lock(&git__mwindow_mutex)) {
 		giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
 		return NULL;
@@ -306,6 +405,13 @@ void git_mwindow_file_deregister(git_mwindow_file *mwf)
 void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
+
+	/* The whole-file mapping is not reference counted */
+	if (w && w->whole) {
+		*window = NULL;
+		return;
+	}
+
 	if (w) {
 		if (git_mutex_lock(&git__mwindow_mutex)) {
 			giterr_set(GITERR_THREAD, "unable to lock mwindow mutex");
@@ -17,12 +17,21 @@ typedef struct git_mwindow {
 	git_off_t offset;
 	size_t last_used;
 	size_t inuse_cnt;
+	bool whole;
 } git_mwindow;
 
 typedef struct git_mwindow_file {
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
+
+	/*
+	 * The mapping of the whole file, when git_mwindow__whole_files is
+	 * set. `whole_state` is 0 until it has been attempted, 1 once it
+	 * is mapped and -1 if mapping it failed.
+	 */
+	git_mwindow whole;
+	git_atomic whole_state;
 } git_mwindow_file;
 
 typedef struct git_mwindow_ctl {
@@ -81,6 +81,51 @@ int git_odb__hashobj(git_oid *id, git_rawobj *obj)
 	return 0;
 }
 
+int git_odb__hashobj_many(git_oid *ids, git_rawobj *objs, size_t n)
+{
+	git_buf_vec *vec;
+	char *headers;
+	size_t i, vec_count, headers_size;
+	int error = 0;
+
+	assert(ids && objs);
+
+	GITERR_CHECK_ALLOC_MULTIPLY(&vec_count, n, 2);
+	GITERR_CHECK_ALLOC_MULTIPLY(&headers_size, n, 64);
+
+	vec = git__calloc(vec_count, sizeof(git_buf_vec));
+	headers = git__malloc(headers_size);
+
+	if (!vec || !headers) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < n; i++) {
+		char *header = headers + i * 64;
+
+		if (!git_object_typeisloose(objs[i].type) ||
+			(!objs[i].data && objs[i].len != 0)) {
+			giterr_set(GITERR_INVALID, "Invalid object for hash");
+			error = -1;
+			goto done;
+		}
+
+		vec[i * 2].data = header;
+		vec[i * 2].len = git_odb__format_object_header(
+			header, 64, objs[i].len, objs[i].type);
+		vec[i * 2 + 1].data = objs[i].data;
+		vec[i * 2 + 1].len = objs[i].len;
+	}
+
+	error = git_hash_many(ids, vec, 2, n);
+
+done:
+	git__free(vec);
+	git__free(headers);
+	return error;
+}
+
 
 static git_odb_object *odb_object__alloc(const git_oid *oid, git_rawobj *source)
 {
@@ -573,7 +618,8 @@ int git_odb_open(git_odb **out, const char *objects_dir)
 	if (git_odb_new(&db) < 0)
 		return -1;
 
-	if (add_default_backends(db, objects_dir, 0, 0) < 0) {
+	if (add_default_backends(db, objects_dir, 0, 0) < 0 ||
+		git_commit_graph_new(&db->cgraph, objects_dir, false) < 0) {
 		git_odb_free(db);
 		return -1;
 	}
@@ -598,6 +644,7 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_free(&db->own_cache);
+	git_commit_graph_free(db->cgraph);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -611,6 +658,31 @@ void git_odb_free(git_odb *db)
 	GIT_REFCOUNT_DEC(db, odb_free);
 }
 
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *db)
+{
+	assert(out && db);
+
+	return git_commit_graph_get_file(out, db->cgraph);
+}
+
+int git_odb__find_pack_entry(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id)
+{
+	size_t i;
+
+	assert(e && db && id);
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		if (git_odb__pack_backend_find_entry(e, internal->backend, id) == 0)
+			return 0;
+	}
+
+	giterr_clear();
+	return git_odb__error_notfound("no packfile has the object", id);
+}
+
 int git_odb_exists(git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
@@ -708,6 +780,134 @@ int git_odb_read_header(size_t *len_p, git_otype *type_p, git_odb *db, const git
 	return error;
 }
 
+static int odb_backend_read_header_many(
+	size_t *len, git_otype *type,
+	git_odb_backend *b, const git_oid *ids, size_t n)
+{
+	size_t i;
+	int error;
+
+	if (b->read_header_many != NULL)
+		return b->read_header_many(len, type, b, ids, n);
+
+	for (i = 0; i < n; ++i) {
+		error = b->read_header(&len[i], &type[i], b, &ids[i]);
+
+		if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+			giterr_clear();
+			type[i] = GIT_OBJ_BAD;
+		} else if (error < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+int git_odb_read_header_many(
+	size_t *len_out, git_otype *type_out,
+	git_odb *db, const git_oid *ids, size_t n)
+{
+	size_t i, j, backend_idx, pending = 0;
+	size_t *index = NULL, *len = NULL;
+	git_otype *type = NULL;
+	git_oid *pending_ids = NULL;
+	git_odb_object *object, **objects = NULL;
+	int error = 0;
+
+	assert(len_out && type_out && db && (ids || !n));
+
+	for (i = 0; i < n; ++i) {
+		if ((object = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL) {
+			len_out[i] = object->cached.size;
+			type_out[i] = object->cached.type;
+			git_odb_object_free(object);
+		} else {
+			type_out[i] = GIT_OBJ_BAD;
+			pending++;
+		}
+	}
+
+	if (!pending)
+		return 0;
+
+	index = git__calloc(pending, sizeof(size_t));
+	pending_ids = git__calloc(pending, sizeof(git_oid));
+	len = git__calloc(pending, sizeof(size_t));
+	type = git__calloc(pending, sizeof(git_otype));
+
+	if (!index || !pending_ids || !len || !type) {
+		error = -1;
+		goto done;
+	}
+
+	for (backend_idx = 0; backend_idx <= db->backends.length && pending; ++backend_idx) {
+		git_odb_backend *b = NULL;
+
+		if (backend_idx < db->backends.length) {
+			backend_internal *internal = git_vector_get(&db->backends, backend_idx);
+			b = internal->backend;
+
+			if (b->read_header == NULL && b->read_header_many == NULL)
+				continue;
+		}
+
+		for (i = 0, j = 0; i < n; ++i) {
+			if (type_out[i] != GIT_OBJ_BAD)
+				continue;
+
+			index[j] = i;
+			git_oid_cpy(&pending_ids[j], &ids[i]);
+			type[j] = GIT_OBJ_BAD;
+			j++;
+		}
+
+		if (b != NULL) {
+			if ((error = odb_backend_read_header_many(
+					len, type, b, pending_ids, pending)) < 0)
+				goto done;
+		} else {
+			/*
+			 * no backend could read only the headers of these;
+			 * read the whole objects instead
+			 */
+			if ((objects = git__calloc(pending, sizeof(git_odb_object *))) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			if ((error = git_odb_read_many(
+					objects, db, pending_ids, pending)) < 0)
+				goto done;
+
+			for (j = 0; j < pending; ++j) {
+				len[j] = objects[j]->cached.size;
+				type[j] = objects[j]->cached.type;
+				git_odb_object_free(objects[j]);
+			}
+		}
+
+		for (j = 0; j < pending; ++j) {
+			if (type[j] == GIT_OBJ_BAD)
+				continue;
+
+			len_out[index[j]] = len[j];
+			type_out[index[j]] = type[j];
+		}
+
+		for (i = 0, pending = 0; i < n; ++i)
+			if (type_out[i] == GIT_OBJ_BAD)
+				pending++;
+	}
+
+done:
+	git__free(index);
+	git__free(pending_ids);
+	git__free(len);
+	git__free(type);
+	git__free(objects);
+	return error;
+}
+
 int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id)
@@ -790,6 +990,145 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return 0;
 }
 
+/*
+ * Read the ids that have not been found yet (the ones with a NULL
+ * `data`) from one backend, either at once or one by one.
+ */
+static int odb_backend_read_many(
+	void **data, size_t *len, git_otype *type,
+	git_odb_backend *b, const git_oid *ids, size_t n)
+{
+	size_t i;
+	int error;
+
+	if (b->read_many != NULL)
+		return b->read_many(data, len, type, b, ids, n);
+
+	for (i = 0; i < n; ++i) {
+		error = b->read(&data[i], &len[i], &type[i], b, &ids[i]);
+
+		if (error == GIT_ENOTFOUND || error == GIT_PASSTHROUGH) {
+			giterr_clear();
+			data[i] = NULL;
+			continue;
+		}
+
+		if (error < 0) {
+			while (i-- > 0) {
+				git__free(data[i]);
+				data[i] = NULL;
+			}
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+int git_odb_read_many(
+	git_odb_object **out, git_odb *db, const git_oid *ids, size_t n)
+{
+	size_t i, j, backend_idx, pending = 0;
+	size_t *index = NULL, *len = NULL;
+	void **data = NULL;
+	git_otype *type = NULL;
+	git_oid *pending_ids = NULL;
+	git_rawobj raw;
+	git_odb_object *object;
+	int error = 0;
+
+	assert(out && db && (ids || !n));
+
+	for (i = 0; i < n; ++i) {
+		if ((out[i] = git_cache_get_raw(odb_cache(db), &ids[i])) == NULL)
+			pending++;
+	}
+
+	if (!pending)
+		return 0;
+
+	index = git__calloc(pending, sizeof(size_t));
+	pending_ids = git__calloc(pending, sizeof(git_oid));
+	data = git__calloc(pending, sizeof(void *));
+	len = git__calloc(pending, sizeof(size_t));
+	type = git__calloc(pending, sizeof(git_otype));
+
+	if (!index || !pending_ids || !data || !len || !type) {
+		error = -1;
+		goto done;
+	}
+
+	for (backend_idx = 0; backend_idx < db->backends.length && pending; ++backend_idx) {
+		backend_internal *internal = git_vector_get(&db->backends, backend_idx);
+		git_odb_backend *b = internal->backend;
+
+		if (b->read == NULL && b->read_many == NULL)
+			continue;
+
+		/* Gather the ids that the previous backends did not have */
+		for (i = 0, j = 0; i < n; ++i) {
+			if (out[i] != NULL)
+				continue;
+
+			index[j] = i;
+			git_oid_cpy(&pending_ids[j], &ids[i]);
+			data[j] = NULL;
+			j++;
+		}
+
+		if ((error = odb_backend_read_many(
+				data, len, type, b, pending_ids, pending)) < 0)
+			goto done;
+
+		for (j = 0; j < pending; ++j) {
+			if (data[j] == NULL)
+				continue;
+
+			raw.data = data[j];
+			raw.len = len[j];
+			raw.type = type[j];
+			data[j] = NULL;
+
+			if ((object = odb_object__alloc(&ids[index[j]], &raw)) == NULL) {
+				git__free(raw.data);
+				error = -1;
+				goto done;
+			}
+
+			out[index[j]] = git_cache_store_raw(odb_cache(db), object);
+		}
+
+		for (i = 0, pending = 0; i < n; ++i)
+			if (out[i] == NULL)
+				pending++;
+	}
+
+	if (pending) {
+		for (i = 0; out[i] != NULL; ++i)
+			/* find the first missing one */;
+
+		error = git_odb__error_notfound("no match for id", &ids[i]);
+	}
+
+done:
+	if (error < 0) {
+		for (j = 0; data && j < pending; ++j)
+			git__free(data[j]);
+
+		for (i = 0; i < n; ++i) {
+			git_odb_object_free(out[i]);
+			out[i] = NULL;
+		}
+	}
+
+	git__free(index);
+	git__free(pending_ids);
+	git__free(data);
+	git__free(len);
+	git__free(type);
+	return error;
+}
+
 int git_odb_read_prefix(
 	git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len)
 {
@@ -872,6 +1211,15 @@ int git_odb_foreach(git_odb *db, git_odb_foreach_cb cb, void *payload)
 
 int git_odb_write(
 	git_oid *oid, git_odb *db, const void *data, size_t len, git_otype type)
+{
+	assert(oid && db);
+
+	git_odb_hash(oid, data, len, type);
+	return git_odb__write_hashed(db, oid, data, len, type);
+}
+
+int git_odb__write_hashed(
+	git_odb *db, git_oid *oid, const void *data, size_t len, git_otype type)
 {
 	size_t i;
 	int error = GIT_ERROR;
@@ -879,7 +1227,6 @@ int git_odb_write(
 
 	assert(oid && db);
 
-	git_odb_hash(oid, data, len, type);
 	if (git_odb_exists(db, oid))
 		return 0;
 
@@ -1080,6 +1427,35 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer
 	return error;
 }
 
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	size_t i, writes = 0;
+	int error = GIT_ERROR;
+
+	assert(db);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate)
+			continue;
+
+		if (b->writemidx != NULL) {
+			++writes;
+			error = b->writemidx(b);
+		}
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = 0;
+	if (error < 0 && !writes)
+		error = git_odb__error_unsupported_in_backend("write multi-pack-index");
+
+	return error;
+}
+
 void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
@@ -1102,6 +1478,8 @@ int git_odb_refresh(struct git_odb *db)
 		}
 	}
 
+	git_commit_graph_refresh(db->cgraph);
+
 	return 0;
 }
 
@@ -15,6 +15,7 @@
 #include "cache.h"
 #include "posix.h"
 #include "filter.h"
+#include "commit_graph.h"
 
 #define GIT_OBJECTS_DIR "objects/"
 #define GIT_OBJECT_DIR_MODE 0777
@@ -38,14 +39,34 @@ struct git_odb {
 	git_refcount rc;
 	git_vector backends;
 	git_cache own_cache;
+	git_commit_graph *cgraph;
 };
 
+/*
+ * Get the commit-graph of the object database, if it has one; returns
+ * GIT_ENOTFOUND otherwise. Only the main objects directory (not its
+ * alternates) is searched for a commit-graph.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
 /*
  * Hash a git_rawobj internally.
  * The `git_rawobj` is supposed to be previously initialized
  */
 int git_odb__hashobj(git_oid *id, git_rawobj *obj);
 
+/*
+ * Hash `n` independent git_rawobjs at once, into `ids[0..n-1]`.
+ */
+int git_odb__hashobj_many(git_oid *ids, git_rawobj *objs, size_t n);
+
+/*
+ * Write an object whose id has already been calculated into `oid`, e.g.
+ * by git_odb__hashobj_many; nothing is written if the object exists.
+ */
+int git_odb__write_hashed(
+	git_odb *db, git_oid *oid, const void *data, size_t len, git_otype type);
+
 /*
  * Format the object header such as it would appear in the on-disk object
  */
@@ -97,6 +118,23 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id);
 
+struct git_pack_entry;
+
+/*
+ * Find the packfile entry of an object in the packed backends of the
+ * object database, in their order of priority. GIT_ENOTFOUND is returned
+ * when none of them has the object.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id);
+
+/*
+ * Find the packfile entry of an object in `backend`, if it is a packed
+ * backend; GIT_ENOTFOUND otherwise. Implemented by the packed backend.
+ */
+int git_odb__pack_backend_find_entry(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *id);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
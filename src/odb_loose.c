@@ -14,6 +14,7 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "filebuf.h"
+#include "zstream.h"
 
 #include "git2/odb_backend.h"
 #include "git2/types.h"
@@ -167,56 +168,6 @@ static size_t get_object_header(obj_hdr *hdr, unsigned char *data)
  *
  ***********************************************************/
 
-static void init_stream(z_stream *s, void *out, size_t len)
-{
-	memset(s, 0, sizeof(*s));
-	s->next_out = out;
-	s->avail_out = (uInt)len;
-}
-
-static void set_stream_input(z_stream *s, void *in, size_t len)
-{
-	s->next_in = in;
-	s->avail_in = (uInt)len;
-}
-
-static void set_stream_output(z_stream *s, void *out, size_t len)
-{
-	s->next_out = out;
-	s->avail_out = (uInt)len;
-}
-
-
-static int start_inflate(z_stream *s, git_buf *obj, void *out, size_t len)
-{
-	int status;
-
-	init_stream(s, out, len);
-	set_stream_input(s, obj->ptr, git_buf_len(obj));
-
-	if ((status = inflateInit(s)) < Z_OK)
-		return status;
-
-	return inflate(s, 0);
-}
-
-static int finish_inflate(z_stream *s)
-{
-	int status = Z_OK;
-
-	while (status == Z_OK)
-		status = inflate(s, Z_FINISH);
-
-	inflateEnd(s);
-
-	if ((status != Z_STREAM_END) || (s->avail_in != 0)) {
-		giterr_set(GITERR_ZLIB, "Failed to finish ZLib inflation. Stream aborted prematurely");
-		return -1;
-	}
-
-	return 0;
-}
-
 static int is_zlib_compressed_data(unsigned char *data)
 {
 	unsigned int w;
@@ -225,77 +176,6 @@ static int is_zlib_compressed_data(unsigned char *data)
 	return (data[0] & 0x8F) == 0x08 && !(w % 31);
 }
 
-static int inflate_buffer(void *in, size_t inlen, void *out, size_t outlen)
-{
-	z_stream zs;
-	int status = Z_OK;
-
-	memset(&zs, 0x0, sizeof(zs));
-
-	zs.next_out = out;
-	zs.avail_out = (uInt)outlen;
-
-	zs.next_in = in;
-	zs.avail_in = (uInt)inlen;
-
-	if (inflateInit(&zs) < Z_OK) {
-		giterr_set(GITERR_ZLIB, "Failed to inflate buffer");
-		return -1;
-	}
-
-	while (status == Z_OK)
-		status = inflate(&zs, Z_FINISH);
-
-	inflateEnd(&zs);
-
-	if (status != Z_STREAM_END /* || zs.avail_in != 0 */ ||
-		zs.total_out != outlen)
-	{
-		giterr_set(GITERR_ZLIB, "Failed to inflate buffer. Stream aborted prematurely");
-		return -1;
-	}
-
-	return 0;
-}
-
-static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
-{
-	unsigned char *buf, *head = hb;
-	size_t tail;
-
-	/*
-	 * allocate a buffer to hold the inflated data and copy the
-	 * initial sequence of inflated data from the tail of the
-	 * head buffer, if any.
-	 */
-	if ((buf = git__malloc(hdr->size + 1)) == NULL) {
-		inflateEnd(s);
-		return NULL;
-	}
-	tail = s->total_out - used;
-	if (used > 0 && tail > 0) {
-		if (tail > hdr->size)
-			tail = hdr->size;
-		memcpy(buf, head + used, tail);
-	}
-	used = tail;
-
-	/*
-	 * inflate the remainder of the object data, if any
-	 */
-	if (hdr->size < used)
-		inflateEnd(s);
-	else {
-		set_stream_output(s, buf + used, hdr->size - used);
-		if (finish_inflate(s)) {
-			git__free(buf);
-			return NULL;
-		}
-	}
-
-	return buf;
-}
-
 /*
  * At one point, there was a loose object format that was intended to
  * mimic the format used in pack-files. This was to allow easy copying
@@ -304,9 +184,11 @@ static void *inflate_tail(z_stream *s, void *hb, size_t used, obj_hdr *hdr)
  */
 static int inflate_packlike_loose_disk_obj(git_rawobj *out, git_buf *obj)
 {
+	git_zstream zs = GIT_ZSTREAM_INIT;
 	unsigned char *in, *buf;
 	obj_hdr hdr;
 	size_t len, used;
+	int error;
 
 	/*
 	 * read the object header, which is an (uncompressed)
@@ -326,7 +208,10 @@ static int inflate_packlike_loose_disk_obj(git_rawobj *out, git_buf *obj)
 
 	in = ((unsigned char *)obj->ptr) + used;
 	len = obj->size - used;
-	if (inflate_buffer(in, len, buf, hdr.size) < 0) {
+	error = git_zstream_inflate_exact(&zs, buf, hdr.size, NULL, in, len);
+	git_zstream_free(&zs);
+
+	if (error < 0) {
 		git__free(buf);
 		return -1;
 	}
@@ -341,8 +226,7 @@ static int inflate_packlike_loose_disk_obj(git_rawobj *out, git_buf *obj)
 
 static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 {
-	unsigned char head[64], *buf;
-	z_stream zs;
+	git_buf inflated = GIT_BUF_INIT;
 	obj_hdr hdr;
 	size_t used;
 
@@ -353,26 +237,23 @@ static int inflate_disk_obj(git_rawobj *out, git_buf *obj)
 		return inflate_packlike_loose_disk_obj(out, obj);
 
 	/*
-	 * inflate the initial part of the io buffer in order
-	 * to parse the object header (type and size).
+	 * inflate the whole object, then parse the header (type and
+	 * size) and move the object data to the front of the buffer.
 	 */
-	if (start_inflate(&zs, obj, head, sizeof(head)) < Z_OK ||
-		(used = get_object_header(&hdr, head)) == 0 ||
-		!git_object_typeisloose(hdr.type))
+	if (git_zstream_inflatebuf(&inflated, obj->ptr, obj->size) < 0 ||
+		(used = get_object_header(&hdr, (unsigned char *)inflated.ptr)) == 0 ||
+		!git_object_typeisloose(hdr.type) ||
+		inflated.size - used != hdr.size)
 	{
+		git_buf_free(&inflated);
 		giterr_set(GITERR_ODB, "Failed to inflate disk object.");
 		return -1;
 	}
 
-	/*
-	 * allocate a buffer and inflate the object data into it
-	 * (including the initial sequence in the head buffer).
-	 */
-	if ((buf = inflate_tail(&zs, head, used, &hdr)) == NULL)
-		return -1;
-	buf[hdr.size] = '\0';
+	memmove(inflated.ptr, inflated.ptr + used, hdr.size);
+	inflated.ptr[hdr.size] = '\0';
 
-	out->data = buf;
+	out->data = git_buf_detach(&inflated);
 	out->len = hdr.size;
 	out->type = hdr.type;
 
@@ -417,11 +298,12 @@ static int read_loose(git_rawobj *out, git_buf *loc)
 
 static int read_header_loose(git_rawobj *out, git_buf *loc)
 {
-	int error = 0, z_return = Z_ERRNO, read_bytes;
+	int error = 0, read_bytes;
 	git_file fd;
-	z_stream zs;
+	git_zstream zs = GIT_ZSTREAM_INIT;
 	obj_hdr header_obj;
 	unsigned char raw_buffer[16], inflated_buffer[64];
+	size_t inflated = 0, written;
 
 	assert(out && loc);
 
@@ -433,19 +315,24 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 	if ((fd = git_futils_open_ro(loc->ptr)) < 0)
 		return fd;
 
-	init_stream(&zs, inflated_buffer, sizeof(inflated_buffer));
+	memset(inflated_buffer, 0, sizeof(inflated_buffer));
+
+	if ((error = git_zstream_init(&zs, GIT_ZSTREAM_INFLATE)) < 0)
+		goto done;
+
+	while (inflated < sizeof(inflated_buffer) && !git_zstream_eos(&zs) &&
+		(read_bytes = p_read(fd, raw_buffer, sizeof(raw_buffer))) > 0) {
+		written = sizeof(inflated_buffer) - inflated;
 
-	z_return = inflateInit(&zs);
+		if ((error = git_zstream_set_input(&zs, raw_buffer, read_bytes)) < 0 ||
+			(error = git_zstream_get_output(
+				inflated_buffer + inflated, &written, &zs)) < 0)
+			break;
 
-	while (z_return == Z_OK) {
-		if ((read_bytes = p_read(fd, raw_buffer, sizeof(raw_buffer))) > 0) {
-			set_stream_input(&zs, raw_buffer, read_bytes);
-			z_return = inflate(&zs, 0);
-		} else
-			z_return = Z_STREAM_END;
+		inflated += written;
 	}
 
-	if ((z_return != Z_STREAM_END && z_return != Z_BUF_ERROR)
+	if (error < 0
 		|| get_object_header(&header_obj, inflated_buffer) == 0
 		|| git_object_typeisloose(header_obj.type) == 0)
 	{
@@ -456,7 +343,8 @@ static int read_header_loose(git_rawobj *out, git_buf *loc)
 		out->type = header_obj.type;
 	}
 
-	finish_inflate(&zs);
+done:
+	git_zstream_free(&zs);
 	p_close(fd);
 
 	return error;
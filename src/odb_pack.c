@@ -17,11 +17,15 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "array.h"
+#include "midx.h"
 
 #include "git2/odb_backend.h"
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
@@ -70,10 +74,15 @@ struct pack_writepack {
  *	 |		We don't actually open the packfile to check for internal consistency.
  *	|
  *	|-# packfile_sort__cb
- *		Sort all the preloaded packs according to some specific criteria:
- *		we prioritize the "newer" packs because it's more likely they
- *		contain the objects we are looking for, and we prioritize local
- *		packs over remote ones.
+ *	|	Sort all the preloaded packs according to some specific criteria:
+ *	|	we prioritize the "newer" packs because it's more likely they
+ *	|	contain the objects we are looking for, and we prioritize local
+ *	|	packs over remote ones.
+ *	|
+ *	|-# refresh_multi_pack_index
+ *		If there's a `multi-pack-index` file in the `pack` folder, map it
+ *		and load the packs it covers into `midx_packs` instead of `packs`,
+ *		so that a single lookup in it replaces a scan of all those packs.
  *
  *
  *
@@ -86,7 +95,8 @@ struct pack_writepack {
  * | that have been loaded for our ODB.
  * |
  * |-# pack_entry_find
- *	| Iterate through all the packs that have been preloaded
+ *	| Look the OID up in the multi-pack-index, if there is one, and
+ *	| otherwise iterate through all the packs it doesn't cover
  *	| (starting by the pack where the latest object was found)
  *	| to try to find the OID in one of them.
  *	|
@@ -203,6 +213,13 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 	cmp_len -= strlen(".idx");
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
+			return 0;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 
@@ -225,6 +242,28 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 }
 
+static int pack_entry_find_midx(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	int error;
+
+	if ((error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	if (midx_entry.pack_index >= backend->midx_packs.length)
+		return git_odb__error_notfound("multi-pack-index refers to an unknown pack", short_oid);
+
+	e->p = git_vector_get(&backend->midx_packs, midx_entry.pack_index);
+	e->offset = midx_entry.offset;
+	git_oid_cpy(&e->sha1, &midx_entry.sha1);
+
+	return 0;
+}
+
 static int pack_entry_find_inner(
 	struct git_pack_entry *e,
 	struct pack_backend *backend,
@@ -257,6 +296,10 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 {
 	struct git_pack_file *last_found = backend->last_found;
 
+	if (backend->midx &&
+		pack_entry_find_midx(e, backend, oid, GIT_OID_HEXSZ) == 0)
+		return 0;
+
 	if (backend->last_found &&
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
@@ -289,6 +332,18 @@ static int pack_entry_find_prefix(
 		}
 	}
 
+	if (backend->midx) {
+		error = pack_entry_find_midx(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+		}
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -322,6 +377,107 @@ static int pack_entry_find_prefix(
  * Implement the git_odb_backend API calls
  *
  ***********************************************************/
+static void remove_multi_pack_index(struct pack_backend *backend)
+{
+	size_t i;
+
+	/* The packs it covered are looked up one by one again */
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (git_vector_insert(&backend->packs, p) < 0) {
+			if (backend->last_found == p)
+				backend->last_found = NULL;
+			git_packfile_free(p);
+		}
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+static int midx_packfile_load(
+	struct git_pack_file **out,
+	struct pack_backend *backend,
+	const char *idx_path)
+{
+	size_t i, cmp_len = strlen(idx_path) - strlen(".idx");
+
+	/* Take over the pack if it was already loaded on its own */
+	for (i = 0; i < backend->packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i);
+
+		if (memcmp(p->pack_name, idx_path, cmp_len) == 0 &&
+			strcmp(p->pack_name + cmp_len, ".pack") == 0) {
+			git_vector_remove(&backend->packs, i);
+			*out = p;
+			return 0;
+		}
+	}
+
+	return git_packfile_alloc(out, idx_path);
+}
+
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	int error;
+	git_buf midx_path = GIT_BUF_INIT, idx_path = GIT_BUF_INIT;
+	const char *packfile_name;
+	size_t i;
+
+	if ((error = git_buf_joinpath(&midx_path, backend->pack_folder, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	if (backend->midx) {
+		if (!git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path))) {
+			git_buf_free(&midx_path);
+			return 0;
+		}
+
+		remove_multi_pack_index(backend);
+	}
+
+	if (!git_path_exists(git_buf_cstr(&midx_path))) {
+		git_buf_free(&midx_path);
+		return 0;
+	}
+
+	/* A broken multi-pack-index is ignored, as git does */
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		giterr_clear();
+		backend->midx = NULL;
+		git_buf_free(&midx_path);
+		return 0;
+	}
+
+	git_vector_foreach(&backend->midx->packfile_names, i, packfile_name) {
+		struct git_pack_file *p;
+
+		if ((error = git_buf_joinpath(&idx_path, backend->pack_folder, packfile_name)) < 0)
+			break;
+
+		error = midx_packfile_load(&p, backend, git_buf_cstr(&idx_path));
+
+		/* the index refers to a pack that's gone: it's stale, drop it */
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			remove_multi_pack_index(backend);
+			error = 0;
+			break;
+		}
+
+		if (error < 0 || (error = git_vector_insert(&backend->midx_packs, p)) < 0)
+			break;
+	}
+
+	backend->last_found = NULL;
+
+	git_buf_free(&idx_path);
+	git_buf_free(&midx_path);
+	return error;
+}
+
 static int pack_backend__refresh(git_odb_backend *backend_)
 {
 	int error;
@@ -335,6 +491,9 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -414,6 +573,164 @@ static int pack_backend__read(
 	return pack_backend__read_internal(buffer_p, len_p, type_p, backend, oid);
 }
 
+typedef struct {
+	struct git_pack_entry e;
+	size_t index; /* in the arrays of the caller */
+} pack_batch_entry;
+
+typedef git_array_t(pack_batch_entry) pack_batch_array;
+
+static int pack_batch_cmp(const void *a_, const void *b_, void *payload)
+{
+	const pack_batch_entry *a = a_, *b = b_;
+	int cmp;
+
+	GIT_UNUSED(payload);
+
+	if (a->e.p != b->e.p &&
+		(cmp = strcmp(a->e.p->pack_name, b->e.p->pack_name)) != 0)
+		return cmp;
+
+	return (a->e.offset > b->e.offset) - (a->e.offset < b->e.offset);
+}
+
+/*
+ * Find the objects that are in the packs, and sort them in the order in
+ * which they are stored.
+ */
+static int pack_backend__locate_many(
+	pack_batch_array *entries,
+	struct pack_backend *backend,
+	const git_oid *ids,
+	size_t n)
+{
+	pack_batch_entry *entry;
+	size_t i, missing;
+	bool *found, refreshed = false;
+	int error = 0;
+
+	found = git__calloc(n ? n : 1, sizeof(bool));
+	GITERR_CHECK_ALLOC(found);
+
+	do {
+		missing = 0;
+
+		for (i = 0; i < n; ++i) {
+			struct git_pack_entry e;
+
+			if (found[i])
+				continue;
+
+			if ((error = pack_entry_find(&e, backend, &ids[i])) == GIT_ENOTFOUND) {
+				giterr_clear();
+				error = 0;
+				missing++;
+				continue;
+			} else if (error < 0)
+				goto done;
+
+			if ((entry = git_array_alloc(*entries)) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			memcpy(&entry->e, &e, sizeof(e));
+			entry->index = i;
+			found[i] = true;
+		}
+
+		/* Look for the ones that are missing in new packs, once */
+		if (!missing || refreshed)
+			break;
+
+		if ((error = pack_backend__refresh((git_odb_backend *)backend)) < 0)
+			goto done;
+
+		refreshed = true;
+	} while (true);
+
+	git__qsort_r(entries->ptr, entries->size,
+		sizeof(pack_batch_entry), pack_batch_cmp, NULL);
+
+done:
+	git__free(found);
+	return error;
+}
+
+static int pack_backend__read_many(
+	void **buffers, size_t *lens, git_otype *types,
+	git_odb_backend *backend, const git_oid *ids, size_t n)
+{
+	pack_batch_array entries = GIT_ARRAY_INIT;
+	pack_batch_entry *entry;
+	git_rawobj raw;
+	size_t i;
+	int error;
+
+	if ((error = pack_backend__locate_many(
+			&entries, (struct pack_backend *)backend, ids, n)) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(entries); ++i) {
+		entry = git_array_get(entries, i);
+
+		if ((error = git_packfile_unpack(&raw, entry->e.p, &entry->e.offset)) < 0)
+			break;
+
+		buffers[entry->index] = raw.data;
+		lens[entry->index] = raw.len;
+		types[entry->index] = raw.type;
+	}
+
+	/* Leave the caller's arrays as they were */
+	if (error < 0) {
+		while (i-- > 0) {
+			entry = git_array_get(entries, i);
+			git__free(buffers[entry->index]);
+			buffers[entry->index] = NULL;
+		}
+	}
+
+done:
+	git_array_clear(entries);
+	return error;
+}
+
+static int pack_backend__read_header_many(
+	size_t *lens, git_otype *types,
+	git_odb_backend *backend, const git_oid *ids, size_t n)
+{
+	pack_batch_array entries = GIT_ARRAY_INIT;
+	pack_batch_entry *entry;
+	size_t i;
+	int error;
+
+	if ((error = pack_backend__locate_many(
+			&entries, (struct pack_backend *)backend, ids, n)) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(entries); ++i) {
+		entry = git_array_get(entries, i);
+
+		if ((error = git_packfile_resolve_header(&lens[entry->index],
+				&types[entry->index], entry->e.p, entry->e.offset)) < 0)
+			break;
+	}
+
+done:
+	git_array_clear(entries);
+	return error;
+}
+
+int git_odb__pack_backend_find_entry(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *oid)
+{
+	if (backend->read != &pack_backend__read)
+		return GIT_ENOTFOUND;
+
+	return pack_entry_find(e, (struct pack_backend *)backend, oid);
+}
+
 static int pack_backend__read_prefix_internal(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -524,6 +841,10 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(backend->midx, cb, data)) < 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
@@ -594,6 +915,66 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 	return 0;
 }
 
+static int get_idx_path(
+	git_buf *idx_path,
+	struct git_pack_file *p)
+{
+	int error;
+
+	if ((error = git_path_basename_r(idx_path, p->pack_name)) < 0)
+		return error;
+
+	if (git__suffixcmp(git_buf_cstr(idx_path), ".pack") != 0) {
+		giterr_set(GITERR_ODB, "Invalid packfile name '%s'", p->pack_name);
+		return -1;
+	}
+
+	git_buf_shorten(idx_path, strlen(".pack"));
+	return git_buf_puts(idx_path, ".idx");
+}
+
+static int pack_backend__writemidx(git_odb_backend *_backend)
+{
+	struct pack_backend *backend;
+	git_midx_writer *w = NULL;
+	struct git_pack_file *p;
+	git_buf idx_path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	assert(_backend);
+
+	backend = (struct pack_backend *)_backend;
+
+	/* Make sure we know about all the packfiles */
+	if ((error = pack_backend__refresh(_backend)) < 0 ||
+		(error = git_midx_writer_new(&w, backend->pack_folder)) < 0)
+		return error;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if ((error = get_idx_path(&idx_path, p)) < 0 ||
+			(error = git_midx_writer_add(w, git_buf_cstr(&idx_path))) < 0)
+			goto cleanup;
+	}
+
+	git_vector_foreach(&backend->packs, i, p) {
+		if ((error = get_idx_path(&idx_path, p)) < 0 ||
+			(error = git_midx_writer_add(w, git_buf_cstr(&idx_path))) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_midx_writer_commit(w)) < 0)
+		goto cleanup;
+
+	/* Start using the freshly written index right away */
+	error = refresh_multi_pack_index(backend);
+
+cleanup:
+	git_midx_writer_free(w);
+	git_buf_free(&idx_path);
+	return error;
+}
+
 static void pack_backend__free(git_odb_backend *_backend)
 {
 	struct pack_backend *backend;
@@ -603,11 +984,18 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+		git_packfile_free(p);
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_packfile_free(p);
 	}
 
+	git_midx_free(backend->midx);
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
@@ -618,7 +1006,9 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GITERR_CHECK_ALLOC(backend);
 
-	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0 ||
+		git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
@@ -628,6 +1018,8 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.read_many = &pack_backend__read_many;
+	backend->parent.read_header_many = &pack_backend__read_header_many;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
@@ -671,6 +1063,7 @@ int git_odb_backend_pack(git_odb_backend **backend_out, const char *objects_dir)
 		git_path_isdir(git_buf_cstr(&path)))
 	{
 		backend->pack_folder = git_buf_detach(&path);
+		backend->parent.writemidx = &pack_backend__writemidx;
 
 		error = pack_backend__refresh((git_odb_backend *)backend);
 	}
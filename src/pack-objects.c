@@ -9,9 +9,12 @@
 
 #include "zstream.h"
 #include "delta.h"
+#include "fileops.h"
 #include "iterator.h"
 #include "netops.h"
 #include "pack.h"
+#include "pack_bitmap.h"
+#include "repository.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
@@ -64,30 +67,10 @@ struct pack_write_context {
 /* Size of the buffer to feed to zlib */
 #define COMPRESS_BUFLEN (1024 * 1024)
 
-static unsigned name_hash(const char *name)
-{
-	unsigned c, hash = 0;
-
-	if (!name)
-		return 0;
-
-	/*
-	 * This effectively just creates a sortable number from the
-	 * last sixteen non-whitespace characters. Last characters
-	 * count "most", so things that end in ".c" sort together.
-	 */
-	while ((c = *name++) != 0) {
-		if (git__isspace(c))
-			continue;
-		hash = (hash >> 2) + (c << 24);
-	}
-	return hash;
-}
-
 static int packbuilder_config(git_packbuilder *pb)
 {
 	git_config *config;
-	int ret;
+	int ret, val_bool;
 	int64_t val;
 
 	if (git_repository_config__weakptr(&config, pb->repo) < 0)
@@ -103,12 +86,20 @@ static int packbuilder_config(git_packbuilder *pb)
 		   GIT_PACK_DELTA_CACHE_SIZE);
 	config_get("pack.deltaCacheLimit", pb->cache_max_small_delta_size,
 		   GIT_PACK_DELTA_CACHE_LIMIT);
-	config_get("pack.deltaCacheSize", pb->big_file_threshold,
+	config_get("core.bigFileThreshold", pb->big_file_threshold,
 		   GIT_PACK_BIG_FILE_THRESHOLD);
 	config_get("pack.windowMemory", pb->window_memory_limit, 0);
 
 #undef config_get
 
+	ret = git_config_get_bool(&val_bool, config, "repack.writeBitmaps");
+	if (!ret)
+		pb->write_bitmaps = !!val_bool;
+	else if (ret == GIT_ENOTFOUND)
+		giterr_clear();
+	else
+		return -1;
+
 	return 0;
 }
 
@@ -128,9 +119,11 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse_objects = true;
+	pb->spill_fd = -1;
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
-		git_zstream_init(&pb->zstream) < 0 ||
+		git_zstream_init(&pb->zstream, GIT_ZSTREAM_DEFLATE) < 0 ||
 		git_repository_odb(&pb->odb, repo) < 0 ||
 		packbuilder_config(pb) < 0)
 		goto on_error;
@@ -183,8 +176,46 @@ static void rehash(git_packbuilder *pb)
 	}
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+GIT_INLINE(bool) is_delta_type(git_otype type)
+{
+	return (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA);
+}
+
+/*
+ * Read the type and size of the object. When it is already packed, also
+ * remember where, so that its data can be copied as-is into the pack.
+ */
+static int read_object_info(git_packbuilder *pb, git_pobject *po)
+{
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos;
+	size_t size;
+	int error;
+
+	if (!pb->reuse_objects ||
+		git_odb__find_pack_entry(&e, pb->odb, &po->id) < 0 ||
+		git_packfile_resolve_header(&po->size, &po->type, e.p, e.offset) < 0) {
+		giterr_clear();
+		return git_odb_read_header(&po->size, &po->type, pb->odb, &po->id);
+	}
+
+	curpos = e.offset;
+	error = git_packfile_unpack_header(
+		&size, &po->in_pack_type, &e.p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+
+	if (error < 0)
+		return error;
+
+	po->in_pack = e.p;
+	po->in_pack_offset = e.offset;
+
+	return 0;
+}
+
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      uint32_t hash)
 {
 	git_pobject *po;
 	khiter_t pos;
@@ -208,13 +239,13 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	po = pb->object_list + pb->nr_objects;
 	memset(po, 0x0, sizeof(*po));
+	git_oid_cpy(&po->id, oid);
 
-	if ((ret = git_odb_read_header(&po->size, &po->type, pb->odb, oid)) < 0)
+	if ((ret = read_object_info(pb, po)) < 0)
 		return ret;
 
 	pb->nr_objects++;
-	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
 	if (ret < 0) {
@@ -245,6 +276,12 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	return packbuilder_insert(pb, oid, git_packbuilder__name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -279,6 +316,126 @@ on_error:
 	return -1;
 }
 
+static int read_spilled_delta(void **out, git_packbuilder *pb, git_pobject *po)
+{
+	void *data;
+
+	data = git__malloc(po->z_delta_size);
+	GITERR_CHECK_ALLOC(data);
+
+	if (p_lseek(pb->spill_fd, po->spill_offset, SEEK_SET) < 0 ||
+		p_read(pb->spill_fd, data, po->z_delta_size) != (int)po->z_delta_size) {
+		giterr_set(GITERR_OS,
+			"Failed to read delta from '%s'", pb->spill_path.ptr);
+		git__free(data);
+		return -1;
+	}
+
+	*out = data;
+	return 0;
+}
+
+struct reuse_write_context {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+};
+
+static int reuse_crc_cb(const unsigned char *data, size_t len, void *payload)
+{
+	uLong *crc = payload;
+
+	*crc = crc32(*crc, data, (uInt)len);
+	return 0;
+}
+
+static int reuse_write_cb(const unsigned char *data, size_t len, void *payload)
+{
+	struct reuse_write_context *ctx = payload;
+	int error;
+
+	if ((error = ctx->write_cb((void *)data, len, ctx->cb_data)) < 0 ||
+		(error = git_hash_update(&ctx->pb->ctx, data, len)) < 0)
+		return error;
+
+	return 0;
+}
+
+/*
+ * Copy the packed data of the object as-is from the pack where it is
+ * stored: either the whole object, or the delta that it is stored as
+ * (in which case its base is sent as well). The data is checked against
+ * the CRC32 in the index first, and GIT_PASSTHROUGH is returned when it
+ * cannot be, so that the object is written from scratch instead.
+ */
+static int write_reused_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct git_pack_file *p = po->in_pack;
+	struct reuse_write_context ctx;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = po->in_pack_offset, end, base_offset = 0;
+	unsigned char hdr[10];
+	size_t hdr_len, size;
+	git_otype type;
+	uint32_t n, expected_crc;
+	uLong crc = crc32(0L, Z_NULL, 0);
+	int error;
+
+	if ((error = git_pack_entry_at_offset(&n, &end, p, po->in_pack_offset)) < 0 ||
+		(error = git_pack_nth_crc32(&expected_crc, p, n)) < 0)
+		goto passthrough;
+
+	if ((error = git_packfile_foreach_raw(
+			p, po->in_pack_offset, end, reuse_crc_cb, &crc)) < 0)
+		return error;
+
+	if ((uint32_t)crc != expected_crc)
+		goto passthrough;
+
+	error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
+
+	if (!error && po->reuse_delta)
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, po->in_pack_offset);
+
+	git_mwindow_close(&w_curs);
+
+	if (error < 0 || base_offset < 0 || (po->reuse_delta && !base_offset))
+		goto passthrough;
+
+	/* We send deltas against the id of their base, like the others */
+	hdr_len = git_packfile__object_header(hdr, size,
+		po->reuse_delta ? GIT_OBJ_REF_DELTA : type);
+
+	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+		return error;
+
+	if (po->reuse_delta &&
+		((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0))
+		return error;
+
+	ctx.pb = pb;
+	ctx.write_cb = write_cb;
+	ctx.cb_data = cb_data;
+
+	if ((error = git_packfile_foreach_raw(
+			p, curpos, end, reuse_write_cb, &ctx)) < 0)
+		return error;
+
+	pb->nr_written++;
+	pb->nr_reused++;
+	return 0;
+
+passthrough:
+	giterr_clear();
+	return GIT_PASSTHROUGH;
+}
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -292,6 +449,19 @@ static int write_object(
 	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
 	int error;
 
+	if (pb->reuse_objects && po->in_pack &&
+		(po->reuse_delta ? po->delta != NULL :
+			(!po->delta && !is_delta_type(po->in_pack_type)))) {
+		if ((error = write_reused_object(pb, po, write_cb, cb_data)) != GIT_PASSTHROUGH)
+			return error;
+
+		/* The packed data can't be trusted, start from the object */
+		if (po->reuse_delta) {
+			po->delta = NULL;
+			po->reuse_delta = 0;
+		}
+	}
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
@@ -300,7 +470,10 @@ static int write_object(
 	if (po->delta) {
 		if (po->delta_data)
 			data = po->delta_data;
-		else if ((error = get_delta(&data, pb->odb, po)) < 0)
+		else if (po->spilled) {
+			if ((error = read_spilled_delta(&data, pb, po)) < 0)
+				goto done;
+		} else if ((error = get_delta(&data, pb->odb, po)) < 0)
 				goto done;
 
 		data_len = po->delta_size;
@@ -328,7 +501,7 @@ static int write_object(
 	}
 
 	/* Write data */
-	if (po->z_delta_size) {
+	if (po->delta && po->z_delta_size) {
 		data_len = po->z_delta_size;
 
 		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
@@ -410,6 +583,9 @@ static int write_one(
 	po->written = 1;
 	po->recursing = 0;
 
+	/* Bases are written before their deltas, not in write order */
+	po->position = pb->nr_objects - pb->nr_remaining + pb->nr_written;
+
 	return write_object(pb, po, write_cb, cb_data);
 }
 
@@ -616,6 +792,7 @@ static int write_pack(git_packbuilder *pb,
 		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
 		goto done;
 
+	pb->nr_reused = 0;
 	pb->nr_remaining = pb->nr_objects;
 	do {
 		pb->nr_written = 0;
@@ -632,6 +809,7 @@ static int write_pack(git_packbuilder *pb,
 	if ((error = git_hash_final(&entry_oid, &pb->ctx)) < 0)
 		goto done;
 
+	git_oid_cpy(&pb->pack_checksum, &entry_oid);
 	error = write_cb(entry_oid.id, GIT_OID_RAWSZ, cb_data);
 
 done:
@@ -719,7 +897,15 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
-	/* TODO: support reuse-delta */
+	/*
+	 * When both come from the same pack and the target is stored whole
+	 * there, whoever wrote that pack already decided against a delta;
+	 * keep the target as it is, so that it can be copied as-is.
+	 */
+	if (pb->reuse_objects && trg_object->in_pack &&
+		trg_object->in_pack == src_object->in_pack &&
+		!is_delta_type(trg_object->in_pack_type))
+		return 0;
 
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
@@ -811,15 +997,27 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 	git_packbuilder__cache_lock(pb);
 	if (trg_object->delta_data) {
 		git__free(trg_object->delta_data);
-		pb->delta_cache_size -= trg_object->delta_size;
+		if (!trg_object->spill)
+			pb->delta_cache_size -= trg_object->delta_size;
 		trg_object->delta_data = NULL;
 	}
+	trg_object->z_delta_size = 0;
+	trg_object->spill = 0;
+	trg_object->spilled = 0;
+
 	if (delta_cacheable(pb, src_size, trg_size, delta_size)) {
 		pb->delta_cache_size += delta_size;
 		git_packbuilder__cache_unlock(pb);
 
 		trg_object->delta_data = git__realloc(delta_buf, delta_size);
 		GITERR_CHECK_ALLOC(trg_object->delta_data);
+	} else if (pb->spill_deltas) {
+		/* keep it until the window is done with the target */
+		git_packbuilder__cache_unlock(pb);
+
+		trg_object->delta_data = git__realloc(delta_buf, delta_size);
+		GITERR_CHECK_ALLOC(trg_object->delta_data);
+		trg_object->spill = 1;
 	} else {
 		/* create delta when writing the pack */
 		git_packbuilder__cache_unlock(pb);
@@ -863,9 +1061,60 @@ static unsigned long free_unpacked(struct unpacked *n)
 	return freed_mem;
 }
 
+/*
+ * Append the compressed delta of the object to the spill file, which is
+ * created on first use next to the objects of the repository.
+ */
+static int spill_delta(git_packbuilder *pb, git_pobject *po, const git_buf *zdelta)
+{
+	git_buf base = GIT_BUF_INIT;
+	int error = 0;
+
+	git_packbuilder__cache_lock(pb);
+
+	if (pb->spill_fd < 0) {
+		if ((error = git_buf_joinpath(&base,
+				pb->repo->path_repository, GIT_OBJECTS_DIR "pack_deltas")) < 0 ||
+			(error = pb->spill_fd = git_futils_mktmp(&pb->spill_path, base.ptr, 0600)) < 0)
+			goto done;
+	}
+
+	if (p_write(pb->spill_fd, zdelta->ptr, zdelta->size) < 0) {
+		giterr_set(GITERR_OS,
+			"Failed to write delta to '%s'", pb->spill_path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	po->spill_offset = pb->spill_size;
+	po->z_delta_size = (unsigned long)zdelta->size;
+	po->spill = 0;
+	po->spilled = 1;
+
+	pb->spill_size += zdelta->size;
+
+done:
+	git_packbuilder__cache_unlock(pb);
+	git_buf_free(&base);
+	return error < 0 ? -1 : 0;
+}
+
+/*
+ * Report how many objects have been searched for a delta. In threaded
+ * mode, the workers only flag that it is time to do so, and the thread
+ * that started the search calls the callback.
+ */
+static int report_delta_progress(git_packbuilder *pb)
+{
+	int ret = pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION,
+		pb->delta_searched, pb->delta_total, pb->progress_cb_payload);
+
+	return ret ? giterr_set_after_callback(ret) : 0;
+}
+
 static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		       unsigned int *list_size, unsigned int window,
-		       int depth)
+		       int depth, git_packbuilder_thread_stats *stats)
 {
 	git_pobject *po;
 	git_buf zbuf = GIT_BUF_INIT;
@@ -881,17 +1130,37 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 	for (;;) {
 		struct unpacked *n = array + idx;
 		int max_depth, j, best_base = -1;
+		bool report = false;
 
 		git_packbuilder__progress_lock(pb);
-		if (!*list_size) {
+		if (!*list_size || pb->delta_search_abort) {
 			git_packbuilder__progress_unlock(pb);
 			break;
 		}
 
 		po = *list++;
 		(*list_size)--;
+		stats->objects++;
+		pb->delta_searched++;
+
+		if (pb->progress_cb && git__timer() - pb->last_progress_report_time >=
+				MIN_PROGRESS_UPDATE_INTERVAL) {
+			pb->last_progress_report_time = git__timer();
+			report = true;
+		}
+
+#ifdef GIT_THREADS
+		if (report && pb->delta_search_threaded) {
+			pb->delta_progress_due = true;
+			git_cond_signal(&pb->progress_cond);
+			report = false;
+		}
+#endif
 		git_packbuilder__progress_unlock(pb);
 
+		if (report && report_delta_progress(pb) < 0)
+			goto on_error;
+
 		mem_usage -= free_unpacked(n);
 		n->object = po;
 
@@ -955,17 +1224,26 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 				goto on_error;
 
 			git__free(po->delta_data);
-			po->delta_data = git__malloc(zbuf.size);
-			GITERR_CHECK_ALLOC(po->delta_data);
+			po->delta_data = NULL;
 
-			memcpy(po->delta_data, zbuf.ptr, zbuf.size);
-			po->z_delta_size = (unsigned long)zbuf.size;
-			git_buf_clear(&zbuf);
+			if (po->spill) {
+				/* It didn't fit in the cache, keep it on disk */
+				if (spill_delta(pb, po, &zbuf) < 0)
+					goto on_error;
+			} else {
+				po->delta_data = git__malloc(zbuf.size);
+				GITERR_CHECK_ALLOC(po->delta_data);
+
+				memcpy(po->delta_data, zbuf.ptr, zbuf.size);
+				po->z_delta_size = (unsigned long)zbuf.size;
+
+				git_packbuilder__cache_lock(pb);
+				pb->delta_cache_size -= po->delta_size;
+				pb->delta_cache_size += po->z_delta_size;
+				git_packbuilder__cache_unlock(pb);
+			}
 
-			git_packbuilder__cache_lock(pb);
-			pb->delta_cache_size -= po->delta_size;
-			pb->delta_cache_size += po->z_delta_size;
-			git_packbuilder__cache_unlock(pb);
+			git_buf_clear(&zbuf);
 		}
 
 		/*
@@ -1013,61 +1291,144 @@ on_error:
 	return error;
 }
 
+static int alloc_thread_stats(git_packbuilder *pb, unsigned int n)
+{
+	git__free(pb->thread_stats);
+
+	pb->nr_thread_stats = 0;
+	pb->thread_stats = git__calloc(n, sizeof(git_packbuilder_thread_stats));
+	GITERR_CHECK_ALLOC(pb->thread_stats);
+
+	pb->nr_thread_stats = n;
+	return 0;
+}
+
+static int timed_find_deltas(git_packbuilder *pb, git_pobject **list,
+			     unsigned int *list_size, unsigned int window,
+			     int depth, git_packbuilder_thread_stats *stats)
+{
+	double start = git__timer();
+	int error = find_deltas(pb, list, list_size, window, depth, stats);
+
+	git_packbuilder__progress_lock(pb);
+	stats->search_time += git__timer() - start;
+	git_packbuilder__progress_unlock(pb);
+
+	return error;
+}
+
 #ifdef GIT_THREADS
 
 struct thread_params {
 	git_thread thread;
 	git_packbuilder *pb;
+	git_packbuilder_thread_stats *stats;
 
+	/*
+	 * The segment of the list this thread works on; it goes through it
+	 * from the front, while others may steal from its back.
+	 */
 	git_pobject **list;
-
-	git_cond cond;
-	git_mutex mutex;
-
 	unsigned int list_size;
 	unsigned int remaining;
 
+	struct thread_params *threads;
+	unsigned int nr_threads;
+
 	int window;
 	int depth;
-	int working;
-	int data_ready;
+	int done;
+
+	int error;
+	int error_class;
+	git_buf error_msg;
 };
 
+/*
+ * Take half of the work that remains for the thread with the most of it,
+ * ending on a path boundary. Called with the progress lock held.
+ */
+static void steal_deltas(struct thread_params *me)
+{
+	struct thread_params *victim = NULL;
+	git_pobject **list;
+	unsigned int i, sub_size;
+
+	for (i = 0; i < me->nr_threads; i++) {
+		struct thread_params *p = &me->threads[i];
+
+		if (p->remaining > 2 * (unsigned int)me->window &&
+		    (!victim || victim->remaining < p->remaining))
+			victim = p;
+	}
+
+	if (!victim)
+		return;
+
+	sub_size = victim->remaining / 2;
+	list = victim->list + victim->list_size - sub_size;
+	while (sub_size && list[0]->hash &&
+	       list[0]->hash == list[-1]->hash) {
+		list++;
+		sub_size--;
+	}
+	if (!sub_size) {
+		/*
+		 * It is possible for some "paths" to have
+		 * so many objects that no hash boundary
+		 * might be found.  Let's just steal the
+		 * exact half in that case.
+		 */
+		sub_size = victim->remaining / 2;
+		list -= sub_size;
+	}
+
+	victim->list_size -= sub_size;
+	victim->remaining -= sub_size;
+
+	me->list = list;
+	me->list_size = sub_size;
+	me->remaining = sub_size;
+	me->stats->steals++;
+}
+
 static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
+	git_packbuilder *pb = me->pb;
+	const git_error *e;
+	int error;
 
-	while (me->remaining) {
-		if (find_deltas(me->pb, me->list, &me->remaining,
-				me->window, me->depth) < 0) {
-			; /* TODO */
+	for (;;) {
+		if (me->remaining &&
+		    (error = timed_find_deltas(pb, me->list, &me->remaining,
+				me->window, me->depth, me->stats)) < 0) {
+			e = giterr_last();
+
+			git_packbuilder__progress_lock(pb);
+			me->error = error;
+			me->error_class = e ? e->klass : GITERR_INVALID;
+			git_buf_sets(&me->error_msg, e ? e->message : "delta search failed");
+			pb->delta_search_abort = true;
+			git_packbuilder__progress_unlock(pb);
+			break;
 		}
 
-		git_packbuilder__progress_lock(me->pb);
-		me->working = 0;
-		git_cond_signal(&me->pb->progress_cond);
-		git_packbuilder__progress_unlock(me->pb);
+		/* Once our own segment is done, help the busiest thread */
+		git_packbuilder__progress_lock(pb);
+		if (!pb->delta_search_abort)
+			steal_deltas(me);
+		git_packbuilder__progress_unlock(pb);
 
-		if (git_mutex_lock(&me->mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock packfile condition mutex");
-			return NULL;
-		}
+		if (!me->remaining)
+			break;
+	}
 
-		while (!me->data_ready)
-			git_cond_wait(&me->cond, &me->mutex);
+	git_packbuilder__progress_lock(pb);
+	me->done = 1;
+	git_cond_signal(&pb->progress_cond);
+	git_packbuilder__progress_unlock(pb);
 
-		/*
-		 * We must not set ->data_ready before we wait on the
-		 * condition because the main thread may have set it to 1
-		 * before we get here. In order to be sure that new
-		 * work is available if we see 1 in ->data_ready, it
-		 * was initialized to 0 before this thread was spawned
-		 * and we reset it to 0 right away.
-		 */
-		me->data_ready = 0;
-		git_mutex_unlock(&me->mutex);
-	}
-	/* leave ->working 1 so that this doesn't get more work assigned */
 	return NULL;
 }
 
@@ -1076,17 +1437,20 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 			  int depth)
 {
 	struct thread_params *p;
-	int i, ret, active_threads = 0;
+	unsigned int searched;
+	int i, ret, started = 0, running, error = 0;
 
 	if (!pb->nr_threads)
 		pb->nr_threads = git_online_cpus();
 
-	if (pb->nr_threads <= 1) {
-		find_deltas(pb, list, &list_size, window, depth);
-		return 0;
-	}
+	if (alloc_thread_stats(pb, pb->nr_threads > 1 ? pb->nr_threads : 1) < 0)
+		return -1;
 
-	p = git__malloc(pb->nr_threads * sizeof(*p));
+	if (pb->nr_threads <= 1)
+		return timed_find_deltas(pb, list, &list_size, window, depth,
+			&pb->thread_stats[0]);
+
+	p = git__calloc(pb->nr_threads, sizeof(*p));
 	GITERR_CHECK_ALLOC(p);
 
 	/* Partition the work among the threads */
@@ -1098,10 +1462,11 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 			sub_size = 0;
 
 		p[i].pb = pb;
+		p[i].stats = &pb->thread_stats[i];
+		p[i].threads = p;
+		p[i].nr_threads = pb->nr_threads;
 		p[i].window = window;
 		p[i].depth = depth;
-		p[i].working = 1;
-		p[i].data_ready = 0;
 
 		/* try to split chunks on "path" boundaries */
 		while (sub_size && sub_size < list_size &&
@@ -1117,111 +1482,181 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 		list_size -= sub_size;
 	}
 
-	/* Start work threads */
-	for (i = 0; i < pb->nr_threads; ++i) {
-		if (!p[i].list_size)
-			continue;
-
-		git_mutex_init(&p[i].mutex);
-		git_cond_init(&p[i].cond);
+	/*
+	 * Start the threads, including the ones without a segment of their
+	 * own: they go straight to stealing work from the others. Each one
+	 * that runs out of work steals half of what remains for the thread
+	 * with the most left, so they keep busy until the segments are too
+	 * short to be worth splitting anymore.
+	 */
+	pb->delta_search_threaded = true;
 
+	git_packbuilder__progress_lock(pb);
+	for (i = 0; i < pb->nr_threads; ++i) {
 		ret = git_thread_create(&p[i].thread, NULL,
 					threaded_find_deltas, &p[i]);
 		if (ret) {
 			giterr_set(GITERR_THREAD, "unable to create thread");
-			return -1;
+			pb->delta_search_abort = true;
+			error = -1;
+			break;
 		}
-		active_threads++;
+		started++;
 	}
 
-	/*
-	 * Now let's wait for work completion.  Each time a thread is done
-	 * with its work, we steal half of the remaining work from the
-	 * thread with the largest number of unprocessed objects and give
-	 * it to that newly idle thread.  This ensure good load balancing
-	 * until the remaining object list segments are simply too short
-	 * to be worth splitting anymore.
-	 */
-	while (active_threads) {
-		struct thread_params *target = NULL;
-		struct thread_params *victim = NULL;
-		unsigned sub_size = 0;
-
-		/* Start by locating a thread that has transitioned its
-		 * 'working' flag from 1 -> 0. This indicates that it is
-		 * ready to receive more work using our work-stealing
-		 * algorithm. */
-		git_packbuilder__progress_lock(pb);
-		for (;;) {
-			for (i = 0; !target && i < pb->nr_threads; i++)
-				if (!p[i].working)
-					target = &p[i];
-			if (target)
-				break;
-			git_cond_wait(&pb->progress_cond, &pb->progress_mutex);
-		}
+	/* Report the progress from this thread until they are all done */
+	for (;;) {
+		for (i = 0, running = 0; i < started; ++i)
+			running += !p[i].done;
 
-		/* At this point we hold the progress lock and have located
-		 * a thread to receive more work. We still need to locate a
-		 * thread from which to steal work (the victim). */
-		for (i = 0; i < pb->nr_threads; i++)
-			if (p[i].remaining > 2*window &&
-			    (!victim || victim->remaining < p[i].remaining))
-				victim = &p[i];
-
-		if (victim) {
-			sub_size = victim->remaining / 2;
-			list = victim->list + victim->list_size - sub_size;
-			while (sub_size && list[0]->hash &&
-			       list[0]->hash == list[-1]->hash) {
-				list++;
-				sub_size--;
-			}
-			if (!sub_size) {
-				/*
-				 * It is possible for some "paths" to have
-				 * so many objects that no hash boundary
-				 * might be found.  Let's just steal the
-				 * exact half in that case.
-				 */
-				sub_size = victim->remaining / 2;
-				list -= sub_size;
+		if (pb->delta_progress_due && !error) {
+			pb->delta_progress_due = false;
+			searched = pb->delta_searched;
+			git_packbuilder__progress_unlock(pb);
+
+			ret = pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION,
+				searched, pb->delta_total, pb->progress_cb_payload);
+
+			git_packbuilder__progress_lock(pb);
+			if (ret) {
+				error = giterr_set_after_callback(ret);
+				pb->delta_search_abort = true;
 			}
-			target->list = list;
-			victim->list_size -= sub_size;
-			victim->remaining -= sub_size;
+			continue;
 		}
-		target->list_size = sub_size;
-		target->remaining = sub_size;
-		target->working = 1;
-		git_packbuilder__progress_unlock(pb);
 
-		if (git_mutex_lock(&target->mutex)) {
-			giterr_set(GITERR_THREAD, "unable to lock packfile condition mutex");
-			git__free(p);
-			return -1;
-		}
+		if (!running)
+			break;
+
+		git_cond_wait(&pb->progress_cond, &pb->progress_mutex);
+	}
+	git_packbuilder__progress_unlock(pb);
+
+	for (i = 0; i < started; ++i)
+		git_thread_join(p[i].thread, NULL);
 
-		target->data_ready = 1;
-		git_cond_signal(&target->cond);
-		git_mutex_unlock(&target->mutex);
+	pb->delta_search_threaded = false;
 
-		if (!sub_size) {
-			git_thread_join(target->thread, NULL);
-			git_cond_free(&target->cond);
-			git_mutex_free(&target->mutex);
-			active_threads--;
+	for (i = 0; i < pb->nr_threads; ++i) {
+		if (p[i].error && !error) {
+			giterr_set(p[i].error_class, "%s", p[i].error_msg.ptr);
+			error = p[i].error;
 		}
+		git_buf_free(&p[i].error_msg);
 	}
 
 	git__free(p);
-	return 0;
+	return error;
 }
 
 #else
-#define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
+
+static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
+			  unsigned int list_size, unsigned int window,
+			  int depth)
+{
+	if (alloc_thread_stats(pb, 1) < 0)
+		return -1;
+
+	return timed_find_deltas(pb, list, &list_size, window, depth,
+		&pb->thread_stats[0]);
+}
+
 #endif
 
+/*
+ * Reuse the deltas that objects are already stored as, when their base
+ * is part of the pack too. The base must come from the same pack as the
+ * delta, so that the chains cannot have cycles, and the chains are cut
+ * where they get deeper than we would make them. The objects whose delta
+ * is reused are not searched for another one.
+ */
+static void reuse_deltas(git_packbuilder *pb)
+{
+	git_pobject *po, *base;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos, base_offset, end;
+	size_t size;
+	git_otype type;
+	khiter_t pos;
+	uint32_t i, n;
+	int depth;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		po = pb->object_list + i;
+
+		if (po->reuse_delta) {
+			po->delta = NULL;
+			po->reuse_delta = 0;
+		}
+
+		po->delta_child = NULL;
+		po->delta_sibling = NULL;
+	}
+
+	if (!pb->reuse_objects)
+		return;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		po = pb->object_list + i;
+
+		/* Keep the deltas found by an earlier search */
+		if (!po->in_pack || !is_delta_type(po->in_pack_type) || po->delta)
+			continue;
+
+		curpos = po->in_pack_offset;
+
+		if (git_packfile_unpack_header(&size, &type,
+				&po->in_pack->mwf, &w_curs, &curpos) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		base_offset = get_delta_base(
+			po->in_pack, &w_curs, &curpos, type, po->in_pack_offset);
+		git_mwindow_close(&w_curs);
+
+		/* A base in another pack or a bad one: search for a delta */
+		if (base_offset <= 0 ||
+			git_pack_entry_at_offset(&n, &end, po->in_pack, base_offset) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		pos = kh_get(oid, pb->object_ix, git_pack_nth_oid(po->in_pack, n));
+		if (pos == kh_end(pb->object_ix))
+			continue;
+
+		base = kh_value(pb->object_ix, pos);
+		if (base->in_pack != po->in_pack)
+			continue;
+
+		po->delta = base;
+		po->delta_size = (unsigned long)size;
+		po->reuse_delta = 1;
+	}
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		po = pb->object_list + i;
+
+		if (!po->reuse_delta)
+			continue;
+
+		for (depth = 0, base = po; base->delta; base = base->delta)
+			depth++;
+
+		if (depth > GIT_PACK_DEPTH) {
+			po->delta = NULL;
+			po->reuse_delta = 0;
+			continue;
+		}
+
+		/* so that the search doesn't make these chains too deep */
+		po->delta_sibling = po->delta->delta_child;
+		po->delta->delta_child = po;
+	}
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1230,12 +1665,7 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->nr_objects == 0 || pb->done)
 		return 0; /* nothing to do */
 
-	/*
-	 * Although we do not report progress during deltafication, we
-	 * at least report that we are in the deltafication stage
-	 */
-	if (pb->progress_cb)
-			pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, pb->nr_objects, pb->progress_cb_payload);
+	reuse_deltas(pb);
 
 	delta_list = git__malloc(pb->nr_objects * sizeof(*delta_list));
 	GITERR_CHECK_ALLOC(delta_list);
@@ -1247,14 +1677,33 @@ static int prepare_pack(git_packbuilder *pb)
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
 
+		/* Its delta was taken from the pack it's stored in */
+		if (po->reuse_delta)
+			continue;
+
 		delta_list[n++] = po;
 	}
 
+	pb->delta_searched = 0;
+	pb->delta_total = n;
+
+	/*
+	 * Report that we are in the deltafication stage; the number of
+	 * objects searched out of the same total is reported periodically
+	 * as the search goes on, and once more when it is done.
+	 */
+	if (pb->progress_cb)
+		pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, n, pb->progress_cb_payload);
+
 	if (n > 1) {
 		git__tsort((void **)delta_list, n, type_size_sort);
+
+		pb->delta_search_abort = false;
+
 		if (ll_find_deltas(pb, delta_list, n,
 				   GIT_PACK_WINDOW + 1,
-				   GIT_PACK_DEPTH) < 0) {
+				   GIT_PACK_DEPTH) < 0 ||
+		    (pb->progress_cb && report_delta_progress(pb) < 0)) {
 			git__free(delta_list);
 			return -1;
 		}
@@ -1279,6 +1728,50 @@ int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb)
 	return write_pack(pb, &write_pack_buf, buf);
 }
 
+/*
+ * Write the reachability bitmap of the pack that was just written to
+ * `path`. Packs that are not closed under reachability get none, like in
+ * git.
+ */
+static int write_bitmap(git_packbuilder *pb, const char *path)
+{
+	git_pack_bitmap_writer *writer;
+	git_buf bitmap_path = GIT_BUF_INIT;
+	char name[GIT_OID_HEXSZ + 1];
+	uint32_t i;
+	int error;
+
+	if ((error = git_pack_bitmap_writer_new(&writer, pb->repo, pb->nr_objects)) < 0)
+		return error;
+
+	for (i = 0; i < pb->nr_objects; ++i) {
+		git_pobject *po = &pb->object_list[i];
+
+		if ((error = git_pack_bitmap_writer_add(writer,
+				&po->id, po->type, po->position, po->hash)) < 0)
+			goto done;
+	}
+
+	git_oid_tostr(name, sizeof(name), &pb->pack_oid);
+
+	if ((error = git_buf_joinpath(&bitmap_path, path, "pack-")) < 0 ||
+		(error = git_buf_printf(&bitmap_path, "%s.bitmap", name)) < 0)
+		goto done;
+
+	error = git_pack_bitmap_writer_commit(
+		writer, git_buf_cstr(&bitmap_path), &pb->pack_checksum);
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+done:
+	git_buf_free(&bitmap_path);
+	git_pack_bitmap_writer_free(writer);
+	return error;
+}
+
 static int write_cb(void *buf, size_t len, void *payload)
 {
 	struct pack_write_context *ctx = payload;
@@ -1314,6 +1807,10 @@ int git_packbuilder_write(
 	git_oid_cpy(&pb->pack_oid, git_indexer_hash(indexer));
 
 	git_indexer_free(indexer);
+
+	if (pb->write_bitmaps)
+		return write_bitmap(pb, path);
+
 	return 0;
 }
 
@@ -1324,6 +1821,24 @@ const git_oid *git_packbuilder_hash(git_packbuilder *pb)
 	return &pb->pack_oid;
 }
 
+void git_packbuilder_set_spill_deltas(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+	pb->spill_deltas = (enabled != 0);
+}
+
+void git_packbuilder_set_reuse_objects(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+	pb->reuse_objects = (enabled != 0);
+}
+
+void git_packbuilder_set_write_bitmaps(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+	pb->write_bitmaps = !!enabled;
+}
+
 static int cb_tree_walk(
 	const char *root, const git_tree_entry *entry, void *payload)
 {
@@ -1372,6 +1887,41 @@ int git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid)
 	return error;
 }
 
+static int cb_insert_reachable(
+	const git_oid *id, git_otype type, uint32_t hash, void *payload)
+{
+	GIT_UNUSED(type);
+
+	return packbuilder_insert(payload, id, hash);
+}
+
+int git_packbuilder_insert_reachable(
+	git_packbuilder *pb,
+	const git_oid *wants,
+	size_t wants_len,
+	const git_oid *haves,
+	size_t haves_len)
+{
+	git_pack_bitmap_walk *walk;
+	git_bitvec reachable;
+	int error;
+
+	assert(pb && (wants || !wants_len) && (haves || !haves_len));
+
+	if ((error = git_pack_bitmap_walk_new(&walk, pb->repo)) < 0)
+		return error;
+
+	if (!(error = git_pack_bitmap_walk_reachable(&reachable, walk,
+			wants, wants_len, haves, haves_len))) {
+		error = git_pack_bitmap_walk_foreach(
+			walk, &reachable, cb_insert_reachable, pb);
+		git_bitvec_free(&reachable);
+	}
+
+	git_pack_bitmap_walk_free(walk);
+	return error;
+}
+
 uint32_t git_packbuilder_object_count(git_packbuilder *pb)
 {
 	return pb->nr_objects;
@@ -1393,6 +1943,21 @@ int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress
 	return 0;
 }
 
+int git_packbuilder_get_thread_stats(
+	git_packbuilder_thread_stats *out, git_packbuilder *pb, unsigned int n)
+{
+	assert(out && pb);
+
+	if (n >= pb->nr_thread_stats)
+		return GIT_ENOTFOUND;
+
+	git_packbuilder__progress_lock(pb);
+	memcpy(out, &pb->thread_stats[n], sizeof(git_packbuilder_thread_stats));
+	git_packbuilder__progress_unlock(pb);
+
+	return 0;
+}
+
 void git_packbuilder_free(git_packbuilder *pb)
 {
 	if (pb == NULL)
@@ -1415,6 +1980,13 @@ void git_packbuilder_free(git_packbuilder *pb)
 	if (pb->object_list)
 		git__free(pb->object_list);
 
+	if (pb->spill_fd >= 0) {
+		p_close(pb->spill_fd);
+		p_unlink(pb->spill_path.ptr);
+	}
+	git_buf_free(&pb->spill_path);
+
+	git__free(pb->thread_stats);
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
 
@@ -33,6 +33,7 @@ typedef struct git_pobject {
 	size_t size;
 
 	unsigned int hash; /* name hint hash */
+	uint32_t position; /* position in the written pack */
 
 	struct git_pobject *delta; /* delta base object */
 	struct git_pobject *delta_child; /* deltified objects who bases me */
@@ -43,11 +44,21 @@ typedef struct git_pobject {
 	void *delta_data;
 	unsigned long delta_size;
 	unsigned long z_delta_size;
+	git_off_t spill_offset; /* of the compressed delta in the spill file */
+
+	/* where the object is already packed, if it is */
+	struct git_pack_file *in_pack;
+	git_off_t in_pack_offset;
+	git_otype in_pack_type;
 
 	int written:1,
 	    recursing:1,
 	    tagged:1,
 	    filled:1;
+
+	unsigned int reuse_delta:1, /* the delta is copied from in_pack */
+	             spill:1, /* delta_data goes to the spill file once searched */
+	             spilled:1; /* the delta is in the spill file */
 } git_pobject;
 
 struct git_packbuilder {
@@ -67,6 +78,7 @@ struct git_packbuilder {
 	git_oidmap *object_ix;
 
 	git_oid pack_oid; /* hash of written pack */
+	git_oid pack_checksum; /* trailer of written pack */
 
 	/* synchronization objects */
 	git_mutex cache_mutex;
@@ -81,14 +93,57 @@ struct git_packbuilder {
 	uint64_t window_memory_limit;
 
 	int nr_threads; /* nr of threads to use */
+	bool write_bitmaps; /* write a reachability bitmap with the pack */
+	bool reuse_objects; /* copy the data of packed objects as-is */
+
+	/* the deltas that don't fit in the delta cache go to a temporary file */
+	bool spill_deltas;
+	git_file spill_fd;
+	git_buf spill_path;
+	git_off_t spill_size;
+
+	/* the number of objects copied as-is in the last written pack */
+	uint32_t nr_reused;
 
 	git_packbuilder_progress progress_cb;
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
 
+	/* the state of the delta search, protected by progress_mutex */
+	unsigned int delta_searched;
+	unsigned int delta_total;
+	bool delta_search_threaded;
+	bool delta_search_abort;
+	bool delta_progress_due;
+
+	/* what each thread did in the last delta search */
+	git_packbuilder_thread_stats *thread_stats;
+	unsigned int nr_thread_stats;
+
 	bool done;
 };
 
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+GIT_INLINE(uint32_t) git_packbuilder__name_hash(const char *name)
+{
+	unsigned c;
+	uint32_t hash = 0;
+
+	if (!name)
+		return 0;
+
+	/*
+	 * This effectively just creates a sortable number from the
+	 * last sixteen non-whitespace characters. Last characters
+	 * count "most", so things that end in ".c" sort together.
+	 */
+	while ((c = *name++) != 0) {
+		if (git__isspace(c))
+			continue;
+		hash = (hash >> 2) + (c << 24);
+	}
+	return hash;
+}
+
 #endif /* INCLUDE_pack_objects_h__ */
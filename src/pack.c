@@ -13,6 +13,8 @@
 #include "mwindow.h"
 #include "fileops.h"
 #include "oid.h"
+#include "global.h"
+#include "array.h"
 
 #include <zlib.h>
 
@@ -24,7 +26,8 @@ int packfile_unpack_compressed(
 		git_mwindow **w_curs,
 		git_off_t *curpos,
 		size_t size,
-		git_otype type);
+		git_otype type,
+		git_zstream *zs);
 
 /* Can find the offset of an object given
  * a prefix of an identifier.
@@ -50,12 +53,27 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
+size_t git_pack__cache_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+/* Whenever you want to read or modify this, grab git__pack_cache_mutex */
+static struct {
+	size_t memory_used;
+
+	/* from the most to the least recently used */
+	git_pack_cache_entry *lru_head, *lru_tail;
+
+	size_t hits, misses, evictions;
+} pack_cache_ctl;
+
+static git_pack_cache_entry *new_cache_object(
+	struct git_pack_file *p, git_off_t offset, git_rawobj *source)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
 	if (!e)
 		return NULL;
 
+	e->pack = p;
+	e->offset = offset;
 	memcpy(&e->raw, source, sizeof(git_rawobj));
 
 	return e;
@@ -72,42 +90,68 @@ static void free_cache_object(void *o)
 	}
 }
 
-static void cache_free(git_pack_cache *cache)
+/* Run with the cache lock held */
+static void lru_unlink(git_pack_cache_entry *entry)
 {
-	khiter_t k;
-
-	if (cache->entries) {
-		for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-			if (kh_exist(cache->entries, k))
-				free_cache_object(kh_value(cache->entries, k));
-		}
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		pack_cache_ctl.lru_head = entry->lru_next;
 
-		git_offmap_free(cache->entries);
-		git_mutex_free(&cache->lock);
-	}
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		pack_cache_ctl.lru_tail = entry->lru_prev;
 
-	memset(cache, 0, sizeof(*cache));
+	entry->lru_prev = entry->lru_next = NULL;
 }
 
-static int cache_init(git_pack_cache *cache)
+/* Run with the cache lock held */
+static void lru_push(git_pack_cache_entry *entry)
 {
-	memset(cache, 0, sizeof(*cache));
+	entry->lru_prev = NULL;
+	entry->lru_next = pack_cache_ctl.lru_head;
 
-	cache->entries = git_offmap_alloc();
-	GITERR_CHECK_ALLOC(cache->entries);
+	if (pack_cache_ctl.lru_head)
+		pack_cache_ctl.lru_head->lru_prev = entry;
+	else
+		pack_cache_ctl.lru_tail = entry;
 
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+	pack_cache_ctl.lru_head = entry;
+}
 
-	if (git_mutex_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize pack cache mutex");
+/* Run with the cache lock held */
+static void cache_remove(git_pack_cache_entry *entry)
+{
+	git_pack_cache *cache = &entry->pack->bases;
 
-		git__free(cache->entries);
-		cache->entries = NULL;
+	lru_unlink(entry);
+	git_offmap_delete(cache->entries, entry->offset);
+	pack_cache_ctl.memory_used -= entry->raw.len;
+	free_cache_object(entry);
+}
 
-		return -1;
+static void cache_free(git_pack_cache *cache)
+{
+	git_pack_cache_entry *entry;
+
+	if (!cache->entries)
+		return;
+
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
+		giterr_set(GITERR_THREAD, "unable to lock pack cache mutex");
+		return;
 	}
 
-	return 0;
+	git_offmap_foreach_value(cache->entries, entry, {
+		lru_unlink(entry);
+		pack_cache_ctl.memory_used -= entry->raw.len;
+		free_cache_object(entry);
+	});
+
+	git_offmap_free(cache->entries);
+
+	git_mutex_unlock(&git__pack_cache_mutex);
 }
 
 static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
@@ -115,67 +159,80 @@ static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
 	khiter_t k;
 	git_pack_cache_entry *entry = NULL;
 
-	if (git_mutex_lock(&cache->lock) < 0)
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0)
 		return NULL;
 
-	k = kh_get(off, cache->entries, offset);
-	if (k != kh_end(cache->entries)) { /* found it */
+	if (cache->entries &&
+		(k = kh_get(off, cache->entries, offset)) != kh_end(cache->entries)) {
 		entry = kh_value(cache->entries, k);
 		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
-	}
-	git_mutex_unlock(&cache->lock);
+
+		lru_unlink(entry);
+		lru_push(entry);
+		pack_cache_ctl.hits++;
+	} else
+		pack_cache_ctl.misses++;
+
+	git_mutex_unlock(&git__pack_cache_mutex);
 
 	return entry;
 }
 
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+/*
+ * Run with the cache lock held. Evict the least recently used entries
+ * (of any pack) that are not in use until `size` more bytes fit.
+ */
+static void cache_make_room(size_t size)
 {
-	git_pack_cache_entry *entry;
-	khiter_t k;
-
-	for (k = kh_begin(cache->entries); k != kh_end(cache->entries); k++) {
-		if (!kh_exist(cache->entries, k))
-			continue;
+	git_pack_cache_entry *entry = pack_cache_ctl.lru_tail, *prev;
 
-		entry = kh_value(cache->entries, k);
+	while (entry && pack_cache_ctl.memory_used + size > git_pack__cache_limit) {
+		prev = entry->lru_prev;
 
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			kh_del(off, cache->entries, k);
-			free_cache_object(entry);
+		if (entry->refcount.val == 0) {
+			cache_remove(entry);
+			pack_cache_ctl.evictions++;
 		}
+
+		entry = prev;
 	}
 }
 
-static int cache_add(git_pack_cache *cache, git_rawobj *base, git_off_t offset)
+static int cache_add(git_pack_cache *cache, struct git_pack_file *p, git_rawobj *base, git_off_t offset)
 {
 	git_pack_cache_entry *entry;
 	int error, exists = 0;
 	khiter_t k;
 
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
+	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT || base->len > git_pack__cache_limit)
 		return -1;
 
-	entry = new_cache_object(base);
+	entry = new_cache_object(p, offset, base);
 	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
+		if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
 			giterr_set(GITERR_OS, "failed to lock cache");
+			git__free(entry);
+			return -1;
+		}
+
+		if (!cache->entries && (cache->entries = git_offmap_alloc()) == NULL) {
+			git_mutex_unlock(&git__pack_cache_mutex);
+			git__free(entry);
 			return -1;
 		}
+
 		/* Add it to the cache if nobody else has */
 		exists = kh_get(off, cache->entries, offset) != kh_end(cache->entries);
 		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
+			cache_make_room(base->len);
 
 			k = kh_put(off, cache->entries, offset, &error);
 			assert(error != 0);
 			kh_value(cache->entries, k) = entry;
-			cache->memory_used += entry->raw.len;
+			lru_push(entry);
+			pack_cache_ctl.memory_used += entry->raw.len;
 		}
-		git_mutex_unlock(&cache->lock);
+		git_mutex_unlock(&git__pack_cache_mutex);
 		/* Somebody beat us to adding it into the cache */
 		if (exists) {
 			git__free(entry);
@@ -186,6 +243,25 @@ static int cache_add(git_pack_cache *cache, git_rawobj *base, git_off_t offset)
 	return 0;
 }
 
+int git_pack_cache_stats(
+	size_t *memory_used, size_t *hits, size_t *misses, size_t *evictions)
+{
+	*memory_used = *hits = *misses = *evictions = 0;
+
+	if (git_mutex_lock(&git__pack_cache_mutex) < 0) {
+		giterr_set(GITERR_THREAD, "unable to lock pack cache mutex");
+		return -1;
+	}
+
+	*memory_used = pack_cache_ctl.memory_used;
+	*hits = pack_cache_ctl.hits;
+	*misses = pack_cache_ctl.misses;
+	*evictions = pack_cache_ctl.evictions;
+
+	git_mutex_unlock(&git__pack_cache_mutex);
+	return 0;
+}
+
 /***********************************************************
  *
  * PACK INDEX METHODS
@@ -198,6 +274,10 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->oids);
 		p->oids = NULL;
 	}
+	if (p->revindex) {
+		git__free(p->revindex);
+		p->revindex = NULL;
+	}
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
@@ -239,6 +319,9 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	if (error < 0)
 		return error;
 
+	/* Lookups bisect the index, reading around them is wasted I/O */
+	p_madvise(p->index_map.data, p->index_map.len, GIT_MADV_RANDOM);
+
 	hdr = idx_map = p->index_map.data;
 
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
@@ -477,6 +560,10 @@ int git_packfile_resolve_header(
 	git_off_t base_offset;
 	int error;
 
+	/* entries found through a multi-pack-index may not be open yet */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
 	error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
 	git_mwindow_close(&w_curs);
 	if (error < 0)
@@ -485,10 +572,12 @@ int git_packfile_resolve_header(
 	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
 		size_t base_size;
 		git_rawobj delta;
+		git_zstream zs = GIT_ZSTREAM_INIT;
 		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
 		git_mwindow_close(&w_curs);
-		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, size, type);
+		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, size, type, &zs);
 		git_mwindow_close(&w_curs);
+		git_zstream_free(&zs);
 		if (error < 0)
 			return error;
 		error = git__delta_read_header(delta.data, delta.len, &base_size, size_p);
@@ -514,38 +603,79 @@ int git_packfile_resolve_header(
 	return error;
 }
 
-static int packfile_unpack_delta(
-		git_rawobj *obj,
-		struct git_pack_file *p,
-		git_mwindow **w_curs,
-		git_off_t *curpos,
-		size_t delta_size,
-		git_otype delta_type,
-		git_off_t obj_offset)
+/* A delta on the way from an object down to the base it is built on. */
+typedef struct {
+	git_off_t offset; /* of the delta itself, its key in the cache */
+	git_off_t data_offset; /* of its compressed data */
+	size_t size;
+	git_otype type;
+} pack_chain_elem;
+
+/*
+ * Unpack the object at `obj_offset`, resolving its chain of deltas
+ * without recursing: the chain is followed down to a base that is either
+ * in the delta base cache or not a delta itself, and the deltas are then
+ * applied from there back up. Every intermediate object is added to the
+ * delta base cache, so that the next object of the same chain (say, the
+ * previous version of a file) only needs the deltas that are above it.
+ */
+int git_packfile_unpack(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_off_t *obj_offset)
 {
-	git_off_t base_offset, base_key;
-	git_rawobj base, delta;
+	git_array_t(pack_chain_elem) chain = GIT_ARRAY_INIT;
+	pack_chain_elem *elem;
 	git_pack_cache_entry *cached = NULL;
-	int error, found_base = 0;
+	git_mwindow *w_curs = NULL;
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	git_off_t offset = *obj_offset, curpos, base_offset;
+	git_rawobj base, delta, result;
+	size_t size = 0, i;
+	git_otype type;
+	int error;
 
-	base_offset = get_delta_base(p, w_curs, curpos, delta_type, obj_offset);
-	git_mwindow_close(w_curs);
-	if (base_offset == 0)
-		return packfile_error("delta offset is zero");
-	if (base_offset < 0) /* must actually be an error code */
-		return (int)base_offset;
+	/*
+	 * TODO: optionally check the CRC on the packfile
+	 */
 
-	if (!p->bases.entries && (cache_init(&p->bases) < 0))
-		return -1;
+	obj->data = NULL;
+	obj->len = 0;
+	obj->type = GIT_OBJ_BAD;
 
-	base_key = base_offset; /* git_packfile_unpack modifies base_offset */
-	if ((cached = cache_get(&p->bases, base_offset)) != NULL) {
-		memcpy(&base, &cached->raw, sizeof(git_rawobj));
-		found_base = 1;
-	}
+	base.data = NULL;
+
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	/* Walk down the chain, stopping at the first base that is cached */
+	while (true) {
+		if (git_array_size(chain) > 0 &&
+			(cached = cache_get(&p->bases, offset)) != NULL)
+			break;
+
+		curpos = offset;
+		error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			goto cleanup;
 
-	if (!cached) { /* have to inflate it */
-		error = git_packfile_unpack(&base, p, &base_offset);
+		if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA)
+			break;
+
+		if ((elem = git_array_alloc(chain)) == NULL) {
+			giterr_set_oom();
+			error = -1;
+			goto cleanup;
+		}
+
+		elem->offset = offset;
+		elem->size = size;
+		elem->type = type;
+
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+		git_mwindow_close(&w_curs);
 
 		/*
 		 * TODO: git.git tries to load the base from other packfiles
@@ -553,154 +683,146 @@ static int packfile_unpack_delta(
 		 *
 		 * We'll need to do this in order to support thin packs.
 		 */
-		if (error < 0)
-			return error;
-	}
-
-	error = packfile_unpack_compressed(&delta, p, w_curs, curpos, delta_size, delta_type);
-	git_mwindow_close(w_curs);
+		if (base_offset == 0) {
+			error = packfile_error("delta offset is zero");
+			goto cleanup;
+		}
+		if (base_offset < 0) { /* must actually be an error code */
+			error = (int)base_offset;
+			goto cleanup;
+		}
 
-	if (error < 0) {
-		if (!found_base)
-			git__free(base.data);
-		return error;
+		elem->data_offset = curpos;
+		offset = base_offset;
 	}
 
-	obj->type = base.type;
-	error = git__delta_apply(obj, base.data, base.len, delta.data, delta.len);
-	if (error < 0)
-		goto on_error;
-
-	if (found_base)
-		git_atomic_dec(&cached->refcount);
-	else if (cache_add(&p->bases, &base, base_key) < 0)
-		git__free(base.data);
-
-on_error:
-	git__free(delta.data);
+	if (cached) {
+		memcpy(&base, &cached->raw, sizeof(git_rawobj));
+	} else {
+		switch (type) {
+		case GIT_OBJ_COMMIT:
+		case GIT_OBJ_TREE:
+		case GIT_OBJ_BLOB:
+		case GIT_OBJ_TAG:
+			error = packfile_unpack_compressed(
+					&base, p, &w_curs, &curpos,
+					size, type, &zs);
+			git_mwindow_close(&w_curs);
+			break;
 
-	return error; /* error set by git__delta_apply */
-}
+		default:
+			error = packfile_error("invalid packfile type in header");
+			break;
+		}
 
-int git_packfile_unpack(
-	git_rawobj *obj,
-	struct git_pack_file *p,
-	git_off_t *obj_offset)
-{
-	git_mwindow *w_curs = NULL;
-	git_off_t curpos = *obj_offset;
-	int error;
+		if (error < 0)
+			goto cleanup;
+	}
 
-	size_t size = 0;
-	git_otype type;
+	/* Then apply the deltas, from the deepest one up */
+	for (i = git_array_size(chain); i > 0; --i) {
+		elem = git_array_get(chain, i - 1);
 
-	/*
-	 * TODO: optionally check the CRC on the packfile
-	 */
+		curpos = elem->data_offset;
+		error = packfile_unpack_compressed(
+				&delta, p, &w_curs, &curpos, elem->size, elem->type, &zs);
+		git_mwindow_close(&w_curs);
 
-	obj->data = NULL;
-	obj->len = 0;
-	obj->type = GIT_OBJ_BAD;
+		if (error < 0)
+			goto cleanup;
 
-	error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
-	git_mwindow_close(&w_curs);
+		result.type = base.type;
+		error = git__delta_apply(&result, base.data, base.len, delta.data, delta.len);
+		git__free(delta.data);
 
-	if (error < 0)
-		return error;
+		if (error < 0) /* error set by git__delta_apply */
+			goto cleanup;
 
-	switch (type) {
-	case GIT_OBJ_OFS_DELTA:
-	case GIT_OBJ_REF_DELTA:
-		error = packfile_unpack_delta(
-				obj, p, &w_curs, &curpos,
-				size, type, *obj_offset);
-		break;
-
-	case GIT_OBJ_COMMIT:
-	case GIT_OBJ_TREE:
-	case GIT_OBJ_BLOB:
-	case GIT_OBJ_TAG:
-		error = packfile_unpack_compressed(
-				obj, p, &w_curs, &curpos,
-				size, type);
-		break;
+		/* The base is done with, and left for the next read of the chain */
+		if (cached) {
+			git_atomic_dec(&cached->refcount);
+			cached = NULL;
+		} else if (cache_add(&p->bases, p, &base, offset) < 0)
+			git__free(base.data);
 
-	default:
-		error = packfile_error("invalid packfile type in header");;
-		break;
+		memcpy(&base, &result, sizeof(git_rawobj));
+		offset = elem->offset;
 	}
 
+	memcpy(obj, &base, sizeof(git_rawobj));
+	base.data = NULL;
+
 	*obj_offset = curpos;
+
+cleanup:
+	if (cached)
+		git_atomic_dec(&cached->refcount);
+	else
+		git__free(base.data);
+
+	git_zstream_free(&zs);
+	git_array_clear(chain);
 	return error;
 }
 
-static void *use_git_alloc(void *opaq, unsigned int count, unsigned int size)
-{
-	GIT_UNUSED(opaq);
-	return git__calloc(count, size);
-}
+/* Objects whose inflated size is below this are not worth a syscall */
+#define PACK_ADVISE_MIN_SIZE (64 * 1024)
 
-static void use_git_free(void *opaq, void *ptr)
+/*
+ * Ask for read-ahead on the compressed data of an object of `size`
+ * bytes, which starts at `in` and of which `avail` bytes are mapped.
+ */
+static void pack_advise_inflate(
+	unsigned char *in, unsigned int avail, size_t size)
 {
-	GIT_UNUSED(opaq);
-	git__free(ptr);
+	/* deflate adds at most 5 bytes per 16KB block, plus the header */
+	size_t len = size + (size >> 11) + 64;
+
+	if (size < PACK_ADVISE_MIN_SIZE)
+		return;
+
+	p_madvise(in, min(len, (size_t)avail), GIT_MADV_WILLNEED);
 }
 
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos)
 {
-	int st;
-
 	memset(obj, 0, sizeof(git_packfile_stream));
 	obj->curpos = curpos;
 	obj->p = p;
-	obj->zstream.zalloc = use_git_alloc;
-	obj->zstream.zfree = use_git_free;
-	obj->zstream.next_in = Z_NULL;
-	obj->zstream.next_out = Z_NULL;
-	st = inflateInit(&obj->zstream);
-	if (st != Z_OK) {
-		git__free(obj);
-		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
-		return -1;
-	}
 
-	return 0;
+	return git_zstream_init(&obj->zstream, GIT_ZSTREAM_INFLATE);
 }
 
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len)
 {
 	unsigned char *in;
-	size_t written;
-	int st;
+	unsigned int avail;
+	size_t written = len;
+	int error;
 
 	if (obj->done)
 		return 0;
 
-	in = pack_window_open(obj->p, &obj->mw, obj->curpos, &obj->zstream.avail_in);
+	in = pack_window_open(obj->p, &obj->mw, obj->curpos, &avail);
 	if (in == NULL)
 		return GIT_EBUFS;
 
-	obj->zstream.next_out = buffer;
-	obj->zstream.avail_out = (unsigned int)len;
-	obj->zstream.next_in = in;
+	pack_advise_inflate(in, avail, len);
 
-	st = inflate(&obj->zstream, Z_SYNC_FLUSH);
+	if ((error = git_zstream_set_input(&obj->zstream, in, avail)) == 0)
+		error = git_zstream_get_output(buffer, &written, &obj->zstream);
 	git_mwindow_close(&obj->mw);
 
-	obj->curpos += obj->zstream.next_in - in;
-	written = len - obj->zstream.avail_out;
+	if (error < 0)
+		return error;
 
-	if (st != Z_OK && st != Z_STREAM_END) {
-		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
-		return -1;
-	}
+	obj->curpos += avail - obj->zstream.in_len;
 
-	if (st == Z_STREAM_END)
+	if (git_zstream_eos(&obj->zstream))
 		obj->done = 1;
 
-
 	/* If we didn't write anything out but we're not done, we need more data */
-	if (!written && st != Z_STREAM_END)
+	if (!written && !obj->done)
 		return GIT_EBUFS;
 
 	return written;
@@ -709,7 +831,7 @@ ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t
 
 void git_packfile_stream_free(git_packfile_stream *obj)
 {
-	inflateEnd(&obj->zstream);
+	git_zstream_free(&obj->zstream);
 }
 
 int packfile_unpack_compressed(
@@ -718,55 +840,75 @@ int packfile_unpack_compressed(
 	git_mwindow **w_curs,
 	git_off_t *curpos,
 	size_t size,
-	git_otype type)
+	git_otype type,
+	git_zstream *zs)
 {
-	int st;
-	z_stream stream;
+	git_zstream zstream = GIT_ZSTREAM_INIT;
 	unsigned char *buffer, *in;
+	unsigned int avail;
+	size_t used, total = 0, written;
+	int error;
 
 	buffer = git__calloc(1, size + 1);
 	GITERR_CHECK_ALLOC(buffer);
 
-	memset(&stream, 0, sizeof(stream));
-	stream.next_out = buffer;
-	stream.avail_out = (uInt)size + 1;
-	stream.zalloc = use_git_alloc;
-	stream.zfree = use_git_free;
+	/* most objects are entirely in the current window: inflate them at once */
+	if ((in = pack_window_open(p, w_curs, *curpos, &avail)) != NULL) {
+		pack_advise_inflate(in, avail, size);
 
-	st = inflateInit(&stream);
-	if (st != Z_OK) {
-		git__free(buffer);
-		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		error = git_zstream_inflate_exact(zs, buffer, size, &used, in, avail);
+		git_mwindow_close(w_curs);
 
-		return -1;
+		if (!error) {
+			*curpos += used;
+			goto done;
+		} else if (error != GIT_EBUFS) {
+			git__free(buffer);
+			return error;
+		}
+
+		giterr_clear();
+	}
+
+	/* otherwise, inflate it window by window */
+	if ((error = git_zstream_init(&zstream, GIT_ZSTREAM_INFLATE)) < 0) {
+		git__free(buffer);
+		return error;
 	}
 
 	do {
-		in = pack_window_open(p, w_curs, *curpos, &stream.avail_in);
-		stream.next_in = in;
-		st = inflate(&stream, Z_FINISH);
+		if ((in = pack_window_open(p, w_curs, *curpos, &avail)) == NULL) {
+			error = GIT_EBUFS;
+			break;
+		}
+
+		written = size + 1 - total;
+		pack_advise_inflate(in, avail, size - min(total, size));
+
+		if ((error = git_zstream_set_input(&zstream, in, avail)) == 0)
+			error = git_zstream_get_output(buffer + total, &written, &zstream);
 		git_mwindow_close(w_curs);
 
-		if (!stream.avail_out)
-			break; /* the payload is larger than it should be */
+		if (error < 0)
+			break;
 
-		if (st == Z_BUF_ERROR && in == NULL) {
-			inflateEnd(&stream);
-			git__free(buffer);
-			return GIT_EBUFS;
-		}
+		*curpos += avail - zstream.in_len;
+		total += written;
+	} while (total <= size && !git_zstream_eos(&zstream));
 
-		*curpos += stream.next_in - in;
-	} while (st == Z_OK || st == Z_BUF_ERROR);
+	git_zstream_free(&zstream);
 
-	inflateEnd(&stream);
+	if (!error && (!git_zstream_eos(&zstream) || total != size)) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		error = -1;
+	}
 
-	if ((st != Z_STREAM_END) || stream.total_out != size) {
+	if (error < 0) {
 		git__free(buffer);
-		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
-		return -1;
+		return error;
 	}
 
+done:
 	obj->type = type;
 	obj->len = size;
 	obj->data = buffer;
@@ -1089,6 +1231,188 @@ int git_pack_foreach_entry(
 	return error;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	uint32_t i;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	assert(p->index_map.data);
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	for (i = 0; i < p->num_objects; i++) {
+		const git_oid *oid = (const git_oid *)((p->index_version > 1) ?
+			&index[20 * i] : &index[24 * i + 4]);
+
+		if ((error = cb(oid, nth_packed_object_offset(p, i), data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return 0;
+}
+
+const git_oid *git_pack_nth_oid(struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index = p->index_map.data;
+
+	assert(index && n < p->num_objects);
+
+	if (p->index_version > 1)
+		return (const git_oid *)(index + 8 + 4 * 256 + 20 * n);
+
+	return (const git_oid *)(index + 4 * 256 + 24 * n + 4);
+}
+
+git_off_t git_pack_nth_offset(struct git_pack_file *p, uint32_t n)
+{
+	assert(p->index_map.data && n < p->num_objects);
+
+	return nth_packed_object_offset(p, n);
+}
+
+static int revindex_cmp(const void *a_, const void *b_, void *payload)
+{
+	const git_pack_revindex_entry *a = a_, *b = b_;
+
+	GIT_UNUSED(payload);
+
+	return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+/*
+ * Build the reverse index outside of the lock and publish it whole, so
+ * that a reader which sees the pointer also sees what it points to.
+ */
+static int pack_revindex_load(
+	git_pack_revindex_entry **out, struct git_pack_file *p)
+{
+	git_pack_revindex_entry *revindex, *existing;
+	uint32_t i;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	revindex = git__malloc(p->num_objects * sizeof(*revindex));
+	GITERR_CHECK_ALLOC(revindex);
+
+	for (i = 0; i < p->num_objects; i++) {
+		revindex[i].offset = nth_packed_object_offset(p, i);
+		revindex[i].nr = i;
+	}
+
+	git__qsort_r(revindex, p->num_objects, sizeof(*revindex),
+		revindex_cmp, NULL);
+
+	/* another thread may have been quicker */
+	if ((existing = git__compare_and_swap(
+			&p->revindex, NULL, revindex)) != NULL) {
+		git__free(revindex);
+		revindex = existing;
+	}
+
+	*out = revindex;
+	return 0;
+}
+
+int git_pack_entry_at_offset(
+	uint32_t *n_out,
+	git_off_t *end_out,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	git_pack_revindex_entry *revindex = p->revindex;
+	uint32_t lo = 0, hi;
+	int error;
+
+	if (revindex == NULL && (error = pack_revindex_load(&revindex, p)) < 0)
+		return error;
+
+	hi = p->num_objects;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		git_off_t cur = revindex[mid].offset;
+
+		if (cur == offset) {
+			*n_out = revindex[mid].nr;
+			*end_out = (mid + 1 < p->num_objects) ?
+				revindex[mid + 1].offset :
+				p->mwf.size - GIT_OID_RAWSZ;
+			return 0;
+		}
+
+		if (cur < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	giterr_set(GITERR_ODB, "No object at offset %"PRIuZ" of the packfile",
+		(size_t)offset);
+	return GIT_ENOTFOUND;
+}
+
+int git_pack_nth_crc32(uint32_t *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index = p->index_map.data;
+
+	assert(index && n < p->num_objects);
+
+	if (p->index_version < 2)
+		return GIT_ENOTFOUND;
+
+	index += 8 + 4 * 256 + 20 * p->num_objects;
+	*out = ntohl(*((uint32_t *)(index + 4 * n)));
+
+	return 0;
+}
+
+int git_packfile_foreach_raw(
+	struct git_pack_file *p,
+	git_off_t start,
+	git_off_t end,
+	git_packfile_raw_cb cb,
+	void *payload)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left;
+	size_t len;
+	int error = 0;
+
+	while (start < end) {
+		if ((data = pack_window_open(p, &w_curs, start, &left)) == NULL) {
+			error = packfile_error("packed object is truncated");
+			break;
+		}
+
+		len = (size_t)min((git_off_t)left, end - start);
+
+		/* We're about to read all of it, get the OS started on it */
+		p_madvise(data, len, GIT_MADV_WILLNEED);
+
+		if ((error = cb(data, len, payload)) != 0)
+			break;
+
+		start += len;
+	}
+
+	git_mwindow_close(&w_curs);
+	return error;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
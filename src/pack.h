@@ -17,6 +17,7 @@
 #include "mwindow.h"
 #include "odb.h"
 #include "oidmap.h"
+#include "zstream.h"
 
 #define GIT_PACK_FILE_MODE 0444
 
@@ -55,9 +56,13 @@ struct git_pack_idx_header {
 };
 
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
+	git_off_t offset;
+	struct git_pack_file *pack;
 	git_atomic refcount;
 	git_rawobj raw;
+
+	/* neighbours in the LRU list of the delta base cache */
+	struct git_pack_cache_entry *lru_prev, *lru_next;
 } git_pack_cache_entry;
 
 #include "offmap.h"
@@ -65,17 +70,31 @@ typedef struct git_pack_cache_entry {
 GIT__USE_OFFMAP;
 GIT__USE_OIDMAP;
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
+#define GIT_PACK_CACHE_MEMORY_LIMIT 96 * 1024 * 1024
 #define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
 
+/*
+ * The delta bases of a pack that are in the delta base cache, by offset.
+ *
+ * The cache itself is shared by all the packs of the process: a single
+ * byte budget and a single LRU list, guarded by `git__pack_cache_mutex`.
+ */
 typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
 	git_offmap *entries;
 } git_pack_cache;
 
+extern size_t git_pack__cache_limit;
+
+/* Get the statistics of the delta base cache. */
+int git_pack_cache_stats(
+	size_t *memory_used, size_t *hits, size_t *misses, size_t *evictions);
+
+/* An entry of the reverse index of a pack: its objects by offset */
+typedef struct {
+	git_off_t offset;
+	uint32_t nr; /* the position of the object in the index */
+} git_pack_revindex_entry;
+
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -90,6 +109,7 @@ struct git_pack_file {
 	unsigned pack_local:1, pack_keep:1, has_cache:1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
+	git_pack_revindex_entry *revindex; /* built on first use */
 
 	git_pack_cache bases; /* delta base cache */
 
@@ -106,7 +126,7 @@ struct git_pack_entry {
 typedef struct git_packfile_stream {
 	git_off_t curpos;
 	int done;
-	z_stream zstream;
+	git_zstream zstream;
 	struct git_pack_file *p;
 	git_mwindow *mw;
 } git_packfile_stream;
@@ -133,7 +153,8 @@ int packfile_unpack_compressed(
 	git_mwindow **w_curs,
 	git_off_t *curpos,
 	size_t size,
-	git_otype type);
+	git_otype type,
+	git_zstream *zs);
 
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos);
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
@@ -156,4 +177,50 @@ int git_pack_foreach_entry(
 		git_odb_foreach_cb cb,
 		void *data);
 
+/* Visit every entry of the index, in index (oid) order, with its offset. */
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/*
+ * The id and the offset of the n-th entry of the index, in oid order. The
+ * index must already be open (e.g. by `git_pack_foreach_entry_offset`).
+ */
+const git_oid *git_pack_nth_oid(struct git_pack_file *p, uint32_t n);
+git_off_t git_pack_nth_offset(struct git_pack_file *p, uint32_t n);
+
+/*
+ * Find the object that starts at `offset` in the pack: its position in
+ * the index, and the offset where its packed data ends (where the next
+ * object starts, or the trailer of the pack).
+ */
+int git_pack_entry_at_offset(
+		uint32_t *n_out,
+		git_off_t *end_out,
+		struct git_pack_file *p,
+		git_off_t offset);
+
+/*
+ * The CRC32 of the packed data of the n-th entry of the index, header
+ * included. Only indexes from version 2 on have them; GIT_ENOTFOUND is
+ * returned for the others.
+ */
+int git_pack_nth_crc32(uint32_t *out, struct git_pack_file *p, uint32_t n);
+
+/* Call `cb` with the raw bytes of the pack from `start` to `end`. */
+typedef int (*git_packfile_raw_cb)(const unsigned char *data, size_t len, void *payload);
+
+int git_packfile_foreach_raw(
+		struct git_pack_file *p,
+		git_off_t start,
+		git_off_t end,
+		git_packfile_raw_cb cb,
+		void *payload);
+
 #endif
@@ -0,0 +1,1431 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack_bitmap.h"
+
+#include "git2/commit.h"
+#include "git2/refs.h"
+#include "git2/tag.h"
+#include "git2/tree.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "odb.h"
+#include "pack-objects.h"
+#include "path.h"
+#include "repository.h"
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+#define BITMAP_HEADER_SIZE 32 /* signature, version, options, entries, checksum */
+#define BITMAP_ENTRY_HEADER_SIZE 6 /* position, xor offset, flags */
+
+typedef struct {
+	git_oid id;
+	git_otype type;
+	uint32_t hash;
+	uint32_t position;
+} bitmap_extended_object;
+
+struct git_pack_bitmap_walk {
+	git_repository *repo;
+
+	/* The bitmap index, or NULL when there is none. */
+	git_pack_bitmap *bitmap;
+	uint32_t num_packed;
+
+	/*
+	 * The position of the first object outside of the pack; the bitmaps
+	 * span whole words, so this is the next word after the pack's objects.
+	 */
+	uint32_t extended_base;
+
+	/* The objects outside of the bitmapped pack that have been seen. */
+	git_pool extended_pool;
+	git_vector extended;
+	git_oidmap *extended_map;
+};
+
+typedef struct {
+	git_oid id;
+	git_otype type;
+	uint32_t hash;
+} bitmap_walk_item;
+
+typedef git_array_t(bitmap_walk_item) bitmap_walk_stack;
+
+struct pack_order_entry {
+	git_off_t offset;
+	uint32_t position;
+};
+
+typedef git_array_t(struct pack_order_entry) pack_order_array;
+
+static int bitmap_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid bitmap file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) bitmap_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint16_t) bitmap_get_be16(const unsigned char *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+GIT_INLINE(bool) bits_get(git_bitvec *bits, uint32_t position)
+{
+	return bits != NULL &&
+		position < GIT_BITVEC_LENGTH(bits) * 64 &&
+		git_bitvec_get(bits, position);
+}
+
+GIT_INLINE(int) bits_set(git_bitvec *bits, uint32_t position)
+{
+	size_t capacity = GIT_BITVEC_LENGTH(bits) * 64;
+
+	/* Grow geometrically, new positions are mostly handed out in order */
+	if (position >= capacity &&
+		git_bitvec_grow(bits, max((size_t)position, capacity * 2)) < 0)
+		return -1;
+
+	git_bitvec_set(bits, position, true);
+	return 0;
+}
+
+static int pack_order_collect_cb(const git_oid *id, git_off_t offset, void *payload)
+{
+	pack_order_array *objects = payload;
+	struct pack_order_entry *entry;
+
+	GIT_UNUSED(id);
+
+	entry = git_array_alloc(*objects);
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->offset = offset;
+	entry->position = git_array_size(*objects) - 1;
+	return 0;
+}
+
+static int pack_order_cmp(const void *a, const void *b, void *payload)
+{
+	const struct pack_order_entry *entry_a = a;
+	const struct pack_order_entry *entry_b = b;
+
+	GIT_UNUSED(payload);
+
+	if (entry_a->offset < entry_b->offset)
+		return -1;
+	return entry_a->offset > entry_b->offset;
+}
+
+static int bitmap_load_pack_order(git_pack_bitmap *bitmap)
+{
+	pack_order_array objects = GIT_ARRAY_INIT;
+	uint32_t i;
+	int error;
+
+	if ((error = git_pack_foreach_entry_offset(
+			bitmap->pack, pack_order_collect_cb, &objects)) < 0)
+		goto done;
+
+	git__qsort_r(objects.ptr, git_array_size(objects),
+		sizeof(struct pack_order_entry), pack_order_cmp, NULL);
+
+	bitmap->pack_order = git__calloc(
+		max(git_array_size(objects), 1), sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(bitmap->pack_order);
+
+	for (i = 0; i < git_array_size(objects); ++i)
+		bitmap->pack_order[i] = objects.ptr[i].position;
+
+done:
+	git_array_clear(objects);
+	return error;
+}
+
+/* Find the position in the bitmaps of the object at `offset` in the pack */
+static int bitmap_position(uint32_t *out, git_pack_bitmap *bitmap, git_off_t offset)
+{
+	uint32_t lo = 0, hi = bitmap->pack->num_objects;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		git_off_t mid_offset = git_pack_nth_offset(
+			bitmap->pack, bitmap->pack_order[mid]);
+
+		if (mid_offset == offset) {
+			*out = mid;
+			return 0;
+		}
+
+		if (mid_offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+static int bitmap_parse_ewah(
+	git_ewah *ewah,
+	git_pack_bitmap *bitmap,
+	const unsigned char **data,
+	size_t *size)
+{
+	size_t len;
+
+	if (git_ewah_parse(ewah, &len, *data, *size) < 0)
+		return -1;
+
+	/* git rounds the size of the bitmaps up to whole words */
+	if ((ewah->bit_size + 63) / 64 > ((size_t)bitmap->pack->num_objects + 63) / 64)
+		return bitmap_error("bitmap is larger than the pack");
+
+	*data += len;
+	*size -= len;
+	return 0;
+}
+
+static int bitmap_parse(git_pack_bitmap *bitmap, const unsigned char *data, size_t size)
+{
+	struct git_pack_file *p = bitmap->pack;
+	git_bitvec *types[] = { &bitmap->commits, &bitmap->trees, &bitmap->blobs, &bitmap->tags };
+	const unsigned char *pack_checksum;
+	git_ewah ewah;
+	size_t i;
+	khiter_t pos;
+	int ret;
+
+	if (size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ)
+		return bitmap_error("bitmap is too short");
+
+	if (memcmp(data, BITMAP_SIGNATURE, 4) != 0 ||
+		bitmap_get_be16(data + 4) != BITMAP_VERSION)
+		return bitmap_error("unsupported bitmap signature or version");
+
+	bitmap->options = bitmap_get_be16(data + 6);
+	bitmap->num_entries = bitmap_get_be32(data + 8);
+
+	if (!(bitmap->options & GIT_PACK_BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmap does not cover the full history");
+
+	pack_checksum = (const unsigned char *)p->index_map.data +
+		p->index_map.len - 2 * GIT_OID_RAWSZ;
+	if (memcmp(data + 12, pack_checksum, GIT_OID_RAWSZ) != 0)
+		return bitmap_error("bitmap does not match the packfile");
+
+	data += BITMAP_HEADER_SIZE;
+	size -= BITMAP_HEADER_SIZE + GIT_OID_RAWSZ;
+
+	for (i = 0; i < ARRAY_SIZE(types); ++i) {
+		if (git_bitvec_init(types[i], p->num_objects) < 0 ||
+			bitmap_parse_ewah(&ewah, bitmap, &data, &size) < 0 ||
+			git_ewah_or(types[i], &ewah) < 0)
+			return -1;
+	}
+
+	if (bitmap->num_entries > size / BITMAP_ENTRY_HEADER_SIZE)
+		return bitmap_error("bitmap entries are truncated");
+
+	bitmap->entries = git__calloc(
+		max(bitmap->num_entries, 1), sizeof(git_pack_bitmap_entry));
+	GITERR_CHECK_ALLOC(bitmap->entries);
+
+	bitmap->entry_map = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(bitmap->entry_map);
+
+	for (i = 0; i < bitmap->num_entries; ++i) {
+		git_pack_bitmap_entry *e = &bitmap->entries[i];
+		uint32_t index_position;
+
+		if (size < BITMAP_ENTRY_HEADER_SIZE)
+			return bitmap_error("bitmap entries are truncated");
+
+		index_position = bitmap_get_be32(data);
+		e->xor_offset = data[4];
+		e->flags = data[5];
+
+		if (index_position >= p->num_objects || e->xor_offset > i)
+			return bitmap_error("invalid bitmap entry");
+
+		e->commit = git_pack_nth_oid(p, index_position);
+
+		if (bitmap_position(&e->position, bitmap,
+				git_pack_nth_offset(p, index_position)) < 0)
+			return bitmap_error("invalid bitmap entry");
+
+		data += BITMAP_ENTRY_HEADER_SIZE;
+		size -= BITMAP_ENTRY_HEADER_SIZE;
+
+		if (bitmap_parse_ewah(&e->bitmap, bitmap, &data, &size) < 0)
+			return -1;
+
+		pos = kh_put(oid, bitmap->entry_map, e->commit, &ret);
+		if (ret < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+		kh_value(bitmap->entry_map, pos) = e;
+	}
+
+	if (bitmap->options & GIT_PACK_BITMAP_OPT_HASH_CACHE) {
+		if (size / 4 < p->num_objects)
+			return bitmap_error("name hash cache is truncated");
+
+		bitmap->hash_cache = data;
+	}
+
+	return 0;
+}
+
+int git_pack_bitmap_open(git_pack_bitmap **bitmap_out, const char *path)
+{
+	git_pack_bitmap *bitmap;
+	git_buf idx_path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	if (git__suffixcmp(path, ".bitmap") != 0) {
+		giterr_set(GITERR_ODB, "invalid bitmap file name '%s'", path);
+		return -1;
+	}
+
+	bitmap = git__calloc(1, sizeof(git_pack_bitmap));
+	GITERR_CHECK_ALLOC(bitmap);
+
+	if ((error = git_buf_put(&idx_path, path, strlen(path) - strlen(".bitmap"))) < 0 ||
+		(error = git_buf_puts(&idx_path, ".idx")) < 0 ||
+		(error = git_packfile_alloc(&bitmap->pack, git_buf_cstr(&idx_path))) < 0 ||
+		(error = bitmap_load_pack_order(bitmap)) < 0)
+		goto done;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "failed to stat bitmap file '%s'", path);
+		error = -1;
+		goto done;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size) ||
+		(size_t)st.st_size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ) {
+		error = bitmap_error("bitmap is too short");
+		goto done;
+	}
+
+	if ((error = git_futils_mmap_ro(&bitmap->bitmap_map, fd, 0, (size_t)st.st_size)) < 0)
+		goto done;
+
+	error = bitmap_parse(bitmap, bitmap->bitmap_map.data, bitmap->bitmap_map.len);
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+	git_buf_free(&idx_path);
+
+	if (error < 0)
+		git_pack_bitmap_free(bitmap);
+	else
+		*bitmap_out = bitmap;
+
+	return error;
+}
+
+static int bitmap_find_cb(void *payload, git_buf *path)
+{
+	git_pack_bitmap **bitmap_out = payload;
+
+	if (git__suffixcmp(git_buf_cstr(path), ".bitmap") != 0)
+		return 0;
+
+	/* Like git, make do without the bitmaps that cannot be used */
+	if (git_pack_bitmap_open(bitmap_out, git_buf_cstr(path)) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
+int git_pack_bitmap_find(git_pack_bitmap **bitmap_out, const char *pack_dir)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	*bitmap_out = NULL;
+
+	if ((error = git_buf_sets(&path, pack_dir)) < 0)
+		return error;
+
+	error = git_path_direach(&path, 0, bitmap_find_cb, bitmap_out);
+	git_buf_free(&path);
+
+	if (error == GIT_ITEROVER) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	giterr_set(GITERR_ODB, "no bitmap found in '%s'", pack_dir);
+	return GIT_ENOTFOUND;
+}
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap)
+{
+	size_t i;
+
+	if (!bitmap)
+		return;
+
+	if (bitmap->bitmap_map.data)
+		git_futils_mmap_free(&bitmap->bitmap_map);
+
+	if (bitmap->pack)
+		git_packfile_free(bitmap->pack);
+
+	git_bitvec_free(&bitmap->commits);
+	git_bitvec_free(&bitmap->trees);
+	git_bitvec_free(&bitmap->blobs);
+	git_bitvec_free(&bitmap->tags);
+
+	if (bitmap->entry_map)
+		git_oidmap_free(bitmap->entry_map);
+
+	for (i = 0; bitmap->entries && i < bitmap->num_entries; ++i)
+		git_buf_free(&bitmap->entries[i].resolved);
+
+	git__free(bitmap->entries);
+	git__free(bitmap->pack_order);
+	git__free(bitmap);
+}
+
+static git_pack_bitmap_entry *bitmap_entry(git_pack_bitmap *bitmap, const git_oid *id)
+{
+	khiter_t pos = kh_get(oid, bitmap->entry_map, id);
+
+	if (pos == kh_end(bitmap->entry_map))
+		return NULL;
+
+	return kh_value(bitmap->entry_map, pos);
+}
+
+/*
+ * The bitmap of `e` with the ones it is xor'ed with applied. The result is
+ * compressed again and kept, so that every entry is only resolved once.
+ */
+static int bitmap_entry_resolve(git_ewah *out, git_pack_bitmap *bitmap, git_pack_bitmap_entry *e)
+{
+	git_array_t(git_pack_bitmap_entry *) chain = GIT_ARRAY_INIT;
+	git_pack_bitmap_entry *base, **link;
+	git_bitvec resolved;
+	size_t len;
+	int error;
+
+	if (!e->xor_offset) {
+		*out = e->bitmap;
+		return 0;
+	}
+
+	/* Go down the chain until an entry that needs no xor'ing */
+	for (base = e; base->xor_offset && !git_buf_len(&base->resolved); base -= base->xor_offset) {
+		link = git_array_alloc(chain);
+		GITERR_CHECK_ALLOC(link);
+		*link = base;
+	}
+
+	if ((error = git_bitvec_init(&resolved, bitmap->pack->num_objects)) < 0)
+		goto done;
+
+	if (git_buf_len(&base->resolved))
+		error = git_ewah_parse(out, &len,
+			(const unsigned char *)base->resolved.ptr, base->resolved.size);
+	else
+		*out = base->bitmap;
+
+	if (error < 0 || (error = git_ewah_or(&resolved, out)) < 0)
+		goto done;
+
+	while ((link = git_array_pop(chain)) != NULL) {
+		if ((error = git_ewah_xor(&resolved, &(*link)->bitmap)) < 0 ||
+			(error = git_ewah_write(&(*link)->resolved, &resolved)) < 0)
+			goto done;
+	}
+
+	error = git_ewah_parse(out, &len,
+		(const unsigned char *)e->resolved.ptr, e->resolved.size);
+
+done:
+	git_bitvec_free(&resolved);
+	git_array_clear(chain);
+	return error;
+}
+
+/* Set in `out` the objects that are reachable from the commit of `e` */
+static int bitmap_entry_or(git_bitvec *out, git_pack_bitmap *bitmap, git_pack_bitmap_entry *e)
+{
+	git_ewah ewah;
+
+	if (bitmap_entry_resolve(&ewah, bitmap, e) < 0)
+		return -1;
+
+	return git_ewah_or(out, &ewah);
+}
+
+static git_otype bitmap_type(git_pack_bitmap *bitmap, uint32_t position)
+{
+	if (bits_get(&bitmap->commits, position))
+		return GIT_OBJ_COMMIT;
+	if (bits_get(&bitmap->trees, position))
+		return GIT_OBJ_TREE;
+	if (bits_get(&bitmap->blobs, position))
+		return GIT_OBJ_BLOB;
+	if (bits_get(&bitmap->tags, position))
+		return GIT_OBJ_TAG;
+
+	return GIT_OBJ_BAD;
+}
+
+int git_pack_bitmap_walk_new(git_pack_bitmap_walk **walk_out, git_repository *repo)
+{
+	git_pack_bitmap_walk *walk;
+	git_buf pack_dir = GIT_BUF_INIT;
+	int error;
+
+	walk = git__calloc(1, sizeof(git_pack_bitmap_walk));
+	GITERR_CHECK_ALLOC(walk);
+
+	walk->repo = repo;
+
+	if ((error = git_pool_init(&walk->extended_pool, sizeof(bitmap_extended_object), 0)) < 0 ||
+		(error = git_vector_init(&walk->extended, 0, NULL)) < 0)
+		goto done;
+
+	walk->extended_map = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(walk->extended_map);
+
+	if ((error = git_buf_joinpath(&pack_dir,
+			git_repository_path(repo), GIT_OBJECTS_DIR "pack")) < 0)
+		goto done;
+
+	if ((error = git_pack_bitmap_find(&walk->bitmap, git_buf_cstr(&pack_dir))) == 0)
+		walk->num_packed = walk->bitmap->pack->num_objects;
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	walk->extended_base = ((walk->num_packed + 63) / 64) * 64;
+
+done:
+	git_buf_free(&pack_dir);
+
+	if (error < 0)
+		git_pack_bitmap_walk_free(walk);
+	else
+		*walk_out = walk;
+
+	return error;
+}
+
+void git_pack_bitmap_walk_free(git_pack_bitmap_walk *walk)
+{
+	if (!walk)
+		return;
+
+	git_pack_bitmap_free(walk->bitmap);
+
+	if (walk->extended_map)
+		git_oidmap_free(walk->extended_map);
+
+	git_vector_free(&walk->extended);
+	git_pool_clear(&walk->extended_pool);
+	git__free(walk);
+}
+
+bool git_pack_bitmap_walk_has_bitmap(git_pack_bitmap_walk *walk)
+{
+	return walk->bitmap != NULL;
+}
+
+static int walk_position(uint32_t *out, git_pack_bitmap_walk *walk, const git_oid *id)
+{
+	khiter_t pos;
+
+	if (walk->bitmap) {
+		struct git_pack_entry e;
+
+		if (git_pack_entry_find(&e, walk->bitmap->pack, id, GIT_OID_HEXSZ) == 0)
+			return bitmap_position(out, walk->bitmap, e.offset);
+
+		giterr_clear();
+	}
+
+	pos = kh_get(oid, walk->extended_map, id);
+	if (pos == kh_end(walk->extended_map))
+		return GIT_ENOTFOUND;
+
+	*out = ((bitmap_extended_object *)kh_value(walk->extended_map, pos))->position;
+	return 0;
+}
+
+static int walk_add_extended(
+	uint32_t *out,
+	git_pack_bitmap_walk *walk,
+	const git_oid *id,
+	git_otype type,
+	uint32_t hash)
+{
+	bitmap_extended_object *obj;
+	khiter_t pos;
+	int ret;
+
+	obj = git_pool_malloc(&walk->extended_pool, 1);
+	GITERR_CHECK_ALLOC(obj);
+
+	git_oid_cpy(&obj->id, id);
+	obj->type = type;
+	obj->hash = hash;
+	obj->position = walk->extended_base + (uint32_t)walk->extended.length;
+
+	if (git_vector_insert(&walk->extended, obj) < 0)
+		return -1;
+
+	pos = kh_put(oid, walk->extended_map, &obj->id, &ret);
+	if (ret < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+	kh_value(walk->extended_map, pos) = obj;
+
+	*out = obj->position;
+	return 0;
+}
+
+static int walk_push(bitmap_walk_stack *stack, const git_oid *id, git_otype type, uint32_t hash)
+{
+	bitmap_walk_item *item = git_array_alloc(*stack);
+	GITERR_CHECK_ALLOC(item);
+
+	git_oid_cpy(&item->id, id);
+	item->type = type;
+	item->hash = hash;
+	return 0;
+}
+
+/* Blobs are marked right away, there is no need to read them */
+static int walk_mark_blob(
+	git_bitvec *out,
+	git_pack_bitmap_walk *walk,
+	git_bitvec *stop,
+	const git_oid *id,
+	uint32_t hash)
+{
+	uint32_t position;
+	int error = walk_position(&position, walk, id);
+
+	if (error == GIT_ENOTFOUND)
+		error = walk_add_extended(&position, walk, id, GIT_OBJ_BLOB, hash);
+	else if (!error && bits_get(stop, position))
+		return 0;
+
+	if (error < 0)
+		return error;
+
+	return bits_set(out, position);
+}
+
+static int walk_push_tree(
+	git_bitvec *out,
+	git_pack_bitmap_walk *walk,
+	git_bitvec *stop,
+	bitmap_walk_stack *stack,
+	git_tree *tree)
+{
+	size_t i;
+	int error = 0;
+
+	for (i = 0; !error && i < git_tree_entrycount(tree); ++i) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		uint32_t hash = git_packbuilder__name_hash(git_tree_entry_name(entry));
+
+		/* A commit inside a tree is a submodule, which is not ours */
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = walk_push(stack, git_tree_entry_id(entry), GIT_OBJ_TREE, hash);
+			break;
+		case GIT_OBJ_BLOB:
+			error = walk_mark_blob(out, walk, stop, git_tree_entry_id(entry), hash);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return error;
+}
+
+static int walk_push_commit(bitmap_walk_stack *stack, git_commit *commit)
+{
+	unsigned int i;
+
+	for (i = 0; i < git_commit_parentcount(commit); ++i)
+		if (walk_push(stack, git_commit_parent_id(commit, i), GIT_OBJ_COMMIT, 0) < 0)
+			return -1;
+
+	return walk_push(stack, git_commit_tree_id(commit), GIT_OBJ_TREE, 0);
+}
+
+/*
+ * Set in `out` all the objects reachable from the `tips`, without going
+ * through the objects that are set in `stop`.
+ */
+static int walk_fill(
+	git_bitvec *out,
+	git_pack_bitmap_walk *walk,
+	const git_oid *tips,
+	size_t tips_len,
+	git_bitvec *stop)
+{
+	bitmap_walk_stack stack = GIT_ARRAY_INIT;
+	bitmap_walk_item item, *top;
+	git_pack_bitmap_entry *entry;
+	git_object *obj = NULL;
+	uint32_t position;
+	size_t i;
+	int error = 0;
+
+	for (i = tips_len; i > 0; --i)
+		if ((error = walk_push(&stack, &tips[i - 1], GIT_OBJ_ANY, 0)) < 0)
+			goto done;
+
+	while ((top = git_array_pop(stack)) != NULL) {
+		bool found;
+
+		/* Pushing more items may move the stack around */
+		item = *top;
+
+		if ((error = walk_position(&position, walk, &item.id)) < 0 &&
+			error != GIT_ENOTFOUND)
+			goto done;
+
+		if ((found = (error == 0)) &&
+			(bits_get(out, position) || bits_get(stop, position)))
+			continue;
+
+		if (found && walk->bitmap &&
+			(entry = bitmap_entry(walk->bitmap, &item.id)) != NULL) {
+			if ((error = bitmap_entry_or(out, walk->bitmap, entry)) < 0)
+				goto done;
+			continue;
+		}
+
+		if ((error = git_object_lookup(&obj, walk->repo, &item.id, item.type)) < 0 ||
+			(!found && (error = walk_add_extended(&position, walk,
+				&item.id, git_object_type(obj), item.hash)) < 0) ||
+			(error = bits_set(out, position)) < 0)
+			goto done;
+
+		switch (git_object_type(obj)) {
+		case GIT_OBJ_COMMIT:
+			error = walk_push_commit(&stack, (git_commit *)obj);
+			break;
+		case GIT_OBJ_TREE:
+			error = walk_push_tree(out, walk, stop, &stack, (git_tree *)obj);
+			break;
+		case GIT_OBJ_TAG:
+			error = walk_push(&stack, git_tag_target_id((git_tag *)obj), GIT_OBJ_ANY, 0);
+			break;
+		default:
+			break;
+		}
+
+		git_object_free(obj);
+		obj = NULL;
+
+		if (error < 0)
+			goto done;
+	}
+
+	error = 0;
+
+done:
+	git_object_free(obj);
+	git_array_clear(stack);
+	return error;
+}
+
+int git_pack_bitmap_walk_reachable(
+	git_bitvec *out,
+	git_pack_bitmap_walk *walk,
+	const git_oid *wants,
+	size_t wants_len,
+	const git_oid *haves,
+	size_t haves_len)
+{
+	git_bitvec have_bits;
+	int error;
+
+	if (git_bitvec_init(out, walk->num_packed) < 0)
+		return -1;
+
+	if ((error = git_bitvec_init(&have_bits, walk->num_packed)) < 0) {
+		git_bitvec_free(out);
+		return error;
+	}
+
+	/* The objects reachable from the haves need not be walked again */
+	if ((error = walk_fill(&have_bits, walk, haves, haves_len, NULL)) < 0 ||
+		(error = walk_fill(out, walk, wants, wants_len, &have_bits)) < 0)
+		git_bitvec_free(out);
+	else
+		git_bitvec_and_not(out, &have_bits);
+
+	git_bitvec_free(&have_bits);
+	return error;
+}
+
+int git_pack_bitmap_walk_foreach(
+	git_pack_bitmap_walk *walk,
+	git_bitvec *bits,
+	git_pack_bitmap_foreach_cb cb,
+	void *payload)
+{
+	const uint64_t *words = GIT_BITVEC_WORDS(bits);
+	size_t i, num_words;
+	bitmap_extended_object *obj;
+	int error;
+
+	git_vector_foreach(&walk->extended, i, obj) {
+		if (!bits_get(bits, obj->position))
+			continue;
+
+		if ((error = cb(&obj->id, obj->type, obj->hash, payload)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	num_words = min(GIT_BITVEC_LENGTH(bits), ((size_t)walk->num_packed + 63) / 64);
+
+	for (i = 0; i < num_words; ++i) {
+		uint64_t word = words[i];
+
+		while (word) {
+			uint32_t position = (uint32_t)(i * 64);
+			git_otype type;
+			uint32_t hash = 0;
+
+			/* Visit the lowest bit that is still set */
+			while (!(word & GIT_BITVEC_MASK(position)))
+				position++;
+			word &= word - 1;
+
+			if (position >= walk->num_packed)
+				break;
+
+			if ((type = bitmap_type(walk->bitmap, position)) == GIT_OBJ_BAD)
+				return bitmap_error("object has no type");
+
+			if (walk->bitmap->hash_cache)
+				hash = bitmap_get_be32(walk->bitmap->hash_cache + position * 4);
+
+			error = cb(git_pack_nth_oid(walk->bitmap->pack,
+					walk->bitmap->pack_order[position]),
+				type, hash, payload);
+
+			if (error)
+				return giterr_set_after_callback(error);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The commits that get a bitmap are chosen the way git does: all of the
+ * most recent ones, then one every so often, more and more spaced out
+ * the further back in history, preferring the tips of the references
+ * and then merges.
+ */
+#define BITMAP_MUST_REGION 100
+#define BITMAP_MIN_REGION 20000
+#define BITMAP_MIN_COMMITS 100
+#define BITMAP_MAX_COMMITS 5000
+
+/* How many of the previous bitmaps to try to xor a new one with */
+#define BITMAP_MAX_XOR_OFFSET 10
+
+typedef struct {
+	const git_oid *id;
+	git_otype type;
+	uint32_t hash;
+	unsigned int tip:1;
+} bitmap_writer_object;
+
+typedef struct {
+	uint32_t position;
+	git_bitvec bits;
+	bool computed;
+} bitmap_writer_selected;
+
+struct git_pack_bitmap_writer {
+	git_repository *repo;
+
+	/* The objects of the pack, by position. */
+	bitmap_writer_object *objects;
+	uint32_t num_objects;
+	uint32_t num_added;
+	git_oidmap *object_map;
+
+	/* The commits that get a bitmap, and a map from their ids. */
+	git_array_t(bitmap_writer_selected) selected;
+	git_oidmap *selected_map;
+};
+
+int git_pack_bitmap_writer_new(
+	git_pack_bitmap_writer **writer_out,
+	git_repository *repo,
+	uint32_t num_objects)
+{
+	git_pack_bitmap_writer *w;
+
+	w = git__calloc(1, sizeof(git_pack_bitmap_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	w->repo = repo;
+	w->num_objects = num_objects;
+
+	if ((w->objects = git__calloc(max(num_objects, 1), sizeof(bitmap_writer_object))) == NULL ||
+		(w->object_map = git_oidmap_alloc()) == NULL ||
+		(w->selected_map = git_oidmap_alloc()) == NULL) {
+		git_pack_bitmap_writer_free(w);
+		giterr_set_oom();
+		return -1;
+	}
+
+	*writer_out = w;
+	return 0;
+}
+
+void git_pack_bitmap_writer_free(git_pack_bitmap_writer *w)
+{
+	size_t i;
+
+	if (!w)
+		return;
+
+	for (i = 0; i < git_array_size(w->selected); ++i)
+		git_bitvec_free(&w->selected.ptr[i].bits);
+
+	if (w->object_map)
+		git_oidmap_free(w->object_map);
+	if (w->selected_map)
+		git_oidmap_free(w->selected_map);
+
+	git_array_clear(w->selected);
+	git__free(w->objects);
+	git__free(w);
+}
+
+int git_pack_bitmap_writer_add(
+	git_pack_bitmap_writer *w,
+	const git_oid *id,
+	git_otype type,
+	uint32_t position,
+	uint32_t name_hash)
+{
+	bitmap_writer_object *obj;
+	khiter_t pos;
+	int ret;
+
+	assert(w && id);
+
+	if (position >= w->num_objects || w->objects[position].id != NULL) {
+		giterr_set(GITERR_INVALID, "invalid position %u for bitmapped object", position);
+		return -1;
+	}
+
+	obj = &w->objects[position];
+	obj->id = id;
+	obj->type = type;
+	obj->hash = name_hash;
+
+	pos = kh_put(oid, w->object_map, id, &ret);
+	if (ret < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+	kh_value(w->object_map, pos) = obj;
+
+	w->num_added++;
+	return 0;
+}
+
+static int writer_position(uint32_t *out, git_pack_bitmap_writer *w, const git_oid *id)
+{
+	khiter_t pos = kh_get(oid, w->object_map, id);
+	char str[GIT_OID_HEXSZ + 1];
+
+	if (pos != kh_end(w->object_map)) {
+		*out = (uint32_t)((bitmap_writer_object *)kh_value(w->object_map, pos) - w->objects);
+		return 0;
+	}
+
+	giterr_set(GITERR_ODB, "object %s is reachable from the pack but not in it",
+		git_oid_tostr(str, sizeof(str), id));
+	return GIT_ENOTFOUND;
+}
+
+static int writer_mark_tip_cb(git_reference *ref, void *payload)
+{
+	git_pack_bitmap_writer *w = payload;
+	git_object *commit;
+	uint32_t position;
+
+	if (git_reference_peel(&commit, ref, GIT_OBJ_COMMIT) == 0) {
+		if (writer_position(&position, w, git_object_id(commit)) == 0)
+			w->objects[position].tip = 1;
+
+		git_object_free(commit);
+	}
+
+	giterr_clear();
+	git_reference_free(ref);
+	return 0;
+}
+
+static int writer_select_commit(git_pack_bitmap_writer *w, uint32_t position)
+{
+	bitmap_writer_selected *selected = git_array_alloc(w->selected);
+	GITERR_CHECK_ALLOC(selected);
+
+	memset(selected, 0x0, sizeof(*selected));
+	selected->position = position;
+	return 0;
+}
+
+static size_t writer_next_commit_index(size_t idx)
+{
+	size_t offset, next;
+
+	if (idx <= BITMAP_MUST_REGION)
+		return 0;
+
+	if (idx <= BITMAP_MIN_REGION) {
+		offset = idx - BITMAP_MUST_REGION;
+		return min(offset, (size_t)BITMAP_MIN_COMMITS);
+	}
+
+	offset = idx - BITMAP_MIN_REGION;
+	next = min(offset, (size_t)BITMAP_MAX_COMMITS);
+	return max(next, (size_t)BITMAP_MIN_COMMITS);
+}
+
+static int writer_select_commits(git_pack_bitmap_writer *w)
+{
+	git_array_t(uint32_t) commits = GIT_ARRAY_INIT;
+	git_commit *commit = NULL;
+	uint32_t *position;
+	size_t i, j, next;
+	int error = 0;
+
+	if ((error = git_reference_foreach(w->repo, writer_mark_tip_cb, w)) < 0)
+		return error;
+
+	/* The write order has the most recent commits first */
+	for (i = 0; i < w->num_objects; ++i) {
+		if (w->objects[i].type != GIT_OBJ_COMMIT)
+			continue;
+
+		position = git_array_alloc(commits);
+		GITERR_CHECK_ALLOC(position);
+		*position = (uint32_t)i;
+	}
+
+	if (git_array_size(commits) < BITMAP_MIN_COMMITS) {
+		for (i = 0; !error && i < git_array_size(commits); ++i)
+			error = writer_select_commit(w, commits.ptr[i]);
+		goto done;
+	}
+
+	for (i = 0; ; i += next + 1) {
+		uint32_t chosen;
+
+		next = writer_next_commit_index(i);
+
+		if (i + next >= git_array_size(commits))
+			break;
+
+		chosen = commits.ptr[i + next];
+
+		for (j = 0; next && j <= next; ++j) {
+			uint32_t candidate = commits.ptr[i + j];
+
+			if (w->objects[candidate].tip) {
+				chosen = candidate;
+				break;
+			}
+
+			if ((error = git_commit_lookup(&commit, w->repo,
+					w->objects[candidate].id)) < 0)
+				goto done;
+
+			if (git_commit_parentcount(commit) > 1)
+				chosen = candidate;
+
+			git_commit_free(commit);
+			commit = NULL;
+		}
+
+		if ((error = writer_select_commit(w, chosen)) < 0)
+			goto done;
+	}
+
+done:
+	git_commit_free(commit);
+	git_array_clear(commits);
+	return error;
+}
+
+static bitmap_writer_selected *writer_selected(git_pack_bitmap_writer *w, const git_oid *id)
+{
+	khiter_t pos = kh_get(oid, w->selected_map, id);
+
+	if (pos == kh_end(w->selected_map))
+		return NULL;
+
+	return kh_value(w->selected_map, pos);
+}
+
+static int writer_push_tree(
+	git_pack_bitmap_writer *w,
+	git_bitvec *bits,
+	bitmap_walk_stack *stack,
+	git_tree *tree)
+{
+	uint32_t position;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; !error && i < git_tree_entrycount(tree); ++i) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = walk_push(stack, git_tree_entry_id(entry), GIT_OBJ_TREE, 0);
+			break;
+		case GIT_OBJ_BLOB:
+			if (!(error = writer_position(&position, w, git_tree_entry_id(entry))))
+				error = bits_set(bits, position);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return error;
+}
+
+/*
+ * Fill the bitmap of a selected commit, reusing the bitmaps of the selected
+ * commits that are already done.
+ */
+static int writer_fill(git_pack_bitmap_writer *w, bitmap_writer_selected *selected)
+{
+	bitmap_walk_stack stack = GIT_ARRAY_INIT;
+	bitmap_walk_item item, *top;
+	bitmap_writer_selected *other;
+	git_object *obj = NULL;
+	uint32_t position;
+	int error;
+
+	if ((error = git_bitvec_init(&selected->bits, w->num_objects)) < 0 ||
+		(error = walk_push(&stack, w->objects[selected->position].id, GIT_OBJ_COMMIT, 0)) < 0)
+		goto done;
+
+	while ((top = git_array_pop(stack)) != NULL) {
+		item = *top;
+
+		if ((error = writer_position(&position, w, &item.id)) < 0)
+			goto done;
+
+		if (bits_get(&selected->bits, position))
+			continue;
+
+		if ((other = writer_selected(w, &item.id)) != NULL && other->computed) {
+			if ((error = git_bitvec_or(&selected->bits, &other->bits)) < 0)
+				goto done;
+			continue;
+		}
+
+		if ((error = bits_set(&selected->bits, position)) < 0)
+			goto done;
+
+		if (w->objects[position].type == GIT_OBJ_BLOB)
+			continue;
+
+		if ((error = git_object_lookup(&obj, w->repo, &item.id, w->objects[position].type)) < 0)
+			goto done;
+
+		switch (git_object_type(obj)) {
+		case GIT_OBJ_COMMIT:
+			error = walk_push_commit(&stack, (git_commit *)obj);
+			break;
+		case GIT_OBJ_TREE:
+			error = writer_push_tree(w, &selected->bits, &stack, (git_tree *)obj);
+			break;
+		case GIT_OBJ_TAG:
+			error = walk_push(&stack, git_tag_target_id((git_tag *)obj), GIT_OBJ_ANY, 0);
+			break;
+		default:
+			break;
+		}
+
+		git_object_free(obj);
+		obj = NULL;
+
+		if (error < 0)
+			goto done;
+	}
+
+	selected->computed = true;
+
+done:
+	git_object_free(obj);
+	git_array_clear(stack);
+	return error;
+}
+
+static int writer_build(git_pack_bitmap_writer *w)
+{
+	bitmap_writer_selected *selected;
+	khiter_t pos;
+	size_t i;
+	int ret, error;
+
+	if (w->num_added != w->num_objects) {
+		giterr_set(GITERR_INVALID, "not every object of the pack was added to the bitmap");
+		return -1;
+	}
+
+	if (git_array_size(w->selected) == 0 && writer_select_commits(w) < 0)
+		return -1;
+
+	for (i = 0; i < git_array_size(w->selected); ++i) {
+		selected = git_array_get(w->selected, i);
+
+		pos = kh_put(oid, w->selected_map, w->objects[selected->position].id, &ret);
+		if (ret < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+		kh_value(w->selected_map, pos) = selected;
+	}
+
+	/* The oldest commits first, so that newer ones can reuse their bitmaps */
+	for (i = git_array_size(w->selected); i > 0; --i) {
+		selected = git_array_get(w->selected, i - 1);
+
+		if (!selected->computed && (error = writer_fill(w, selected)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int writer_put_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int writer_put_be16(git_buf *buf, uint16_t value)
+{
+	value = htons(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int writer_type_bitmap(git_buf *out, git_pack_bitmap_writer *w, git_otype type)
+{
+	git_bitvec bits;
+	uint32_t i;
+	int error;
+
+	if (git_bitvec_init(&bits, w->num_objects) < 0)
+		return -1;
+
+	for (i = 0; i < w->num_objects; ++i)
+		if (w->objects[i].type == type)
+			git_bitvec_set(&bits, i, true);
+
+	error = git_ewah_write(out, &bits);
+	git_bitvec_free(&bits);
+	return error;
+}
+
+/* Compress the bitmap of the i-th entry, xor'ed with a previous one if that is smaller */
+static int writer_entry_bitmap(git_buf *out, uint8_t *xor_offset, git_pack_bitmap_writer *w, size_t i)
+{
+	git_bitvec *bits = &w->selected.ptr[i].bits, xored;
+	git_buf candidate = GIT_BUF_INIT;
+	size_t offset;
+	int error;
+
+	*xor_offset = 0;
+	if ((error = git_ewah_write(out, bits)) < 0)
+		return error;
+
+	for (offset = 1; offset <= BITMAP_MAX_XOR_OFFSET && offset <= i; ++offset) {
+		git_buf_clear(&candidate);
+
+		if ((error = git_bitvec_init(&xored, w->num_objects)) < 0)
+			break;
+
+		if (!(error = git_bitvec_or(&xored, bits)) &&
+			!(error = git_bitvec_xor(&xored, &w->selected.ptr[i - offset].bits)))
+			error = git_ewah_write(&candidate, &xored);
+
+		git_bitvec_free(&xored);
+
+		if (error < 0)
+			break;
+
+		if (git_buf_len(&candidate) < git_buf_len(out)) {
+			git_buf_swap(out, &candidate);
+			*xor_offset = (uint8_t)offset;
+		}
+	}
+
+	git_buf_free(&candidate);
+	return error;
+}
+
+static int writer_index_order_cmp(const void *a, const void *b, void *payload)
+{
+	git_pack_bitmap_writer *w = payload;
+
+	return git_oid__cmp(
+		w->objects[*(const uint32_t *)a].id, w->objects[*(const uint32_t *)b].id);
+}
+
+int git_pack_bitmap_writer_dump(
+	git_buf *out,
+	git_pack_bitmap_writer *w,
+	const git_oid *pack_checksum)
+{
+	git_otype types[] = { GIT_OBJ_COMMIT, GIT_OBJ_TREE, GIT_OBJ_BLOB, GIT_OBJ_TAG };
+	git_buf entry = GIT_BUF_INIT;
+	uint32_t *index_order = NULL, *index_positions = NULL;
+	git_oid checksum;
+	size_t i;
+	int error;
+
+	assert(out && w && pack_checksum);
+
+	git_buf_clear(out);
+
+	if ((error = writer_build(w)) < 0)
+		goto done;
+
+	/* The entries name their commit by its position in the index */
+	index_order = git__calloc(max(w->num_objects, 1), sizeof(uint32_t));
+	index_positions = git__calloc(max(w->num_objects, 1), sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(index_order);
+	GITERR_CHECK_ALLOC(index_positions);
+
+	for (i = 0; i < w->num_objects; ++i)
+		index_order[i] = (uint32_t)i;
+
+	git__qsort_r(index_order, w->num_objects, sizeof(uint32_t), writer_index_order_cmp, w);
+
+	for (i = 0; i < w->num_objects; ++i)
+		index_positions[index_order[i]] = (uint32_t)i;
+
+	if ((error = git_buf_put(out, BITMAP_SIGNATURE, 4)) < 0 ||
+		(error = writer_put_be16(out, BITMAP_VERSION)) < 0 ||
+		(error = writer_put_be16(out,
+			GIT_PACK_BITMAP_OPT_FULL_DAG | GIT_PACK_BITMAP_OPT_HASH_CACHE)) < 0 ||
+		(error = writer_put_be32(out, git_array_size(w->selected))) < 0 ||
+		(error = git_buf_put(out, (const char *)pack_checksum->id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	for (i = 0; i < ARRAY_SIZE(types); ++i)
+		if ((error = writer_type_bitmap(out, w, types[i])) < 0)
+			goto done;
+
+	for (i = 0; i < git_array_size(w->selected); ++i) {
+		uint8_t xor_offset, flags = 0;
+
+		git_buf_clear(&entry);
+
+		if ((error = writer_entry_bitmap(&entry, &xor_offset, w, i)) < 0 ||
+			(error = writer_put_be32(out,
+				index_positions[w->selected.ptr[i].position])) < 0 ||
+			(error = git_buf_put(out, (const char *)&xor_offset, 1)) < 0 ||
+			(error = git_buf_put(out, (const char *)&flags, 1)) < 0 ||
+			(error = git_buf_put(out, git_buf_cstr(&entry), git_buf_len(&entry))) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < w->num_objects; ++i)
+		if ((error = writer_put_be32(out, w->objects[i].hash)) < 0)
+			goto done;
+
+	/* And the trailer: a checksum of everything that precedes it */
+	if ((error = git_hash_buf(&checksum, git_buf_cstr(out), git_buf_len(out))) < 0)
+		goto done;
+
+	error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ);
+
+done:
+	git__free(index_order);
+	git__free(index_positions);
+	git_buf_free(&entry);
+	return error;
+}
+
+int git_pack_bitmap_writer_commit(
+	git_pack_bitmap_writer *w,
+	const char *path,
+	const git_oid *pack_checksum)
+{
+	git_buf bitmap = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	if ((error = git_pack_bitmap_writer_dump(&bitmap, w, pack_checksum)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_open(&output, path, 0, GIT_PACK_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_write(&output,
+			git_buf_cstr(&bitmap), git_buf_len(&bitmap))) < 0) {
+		git_filebuf_cleanup(&output);
+		goto done;
+	}
+
+	error = git_filebuf_commit(&output);
+
+done:
+	git_buf_free(&bitmap);
+	return error;
+}
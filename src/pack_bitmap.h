@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+#include "bitvec.h"
+#include "buffer.h"
+#include "ewah.h"
+#include "map.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "pool.h"
+#include "vector.h"
+
+#define GIT_PACK_BITMAP_OPT_FULL_DAG 0x1
+#define GIT_PACK_BITMAP_OPT_HASH_CACHE 0x4
+#define GIT_PACK_BITMAP_OPT_LOOKUP_TABLE 0x10
+
+/* A commit with a reachability bitmap. */
+typedef struct {
+	/* The commit; points into the pack index. */
+	const git_oid *commit;
+
+	/* The position of the commit in the bitmaps. */
+	uint32_t position;
+
+	/*
+	 * The bitmap, which must be xor'ed with the bitmap of the entry
+	 * `xor_offset` places before this one, unless that is 0.
+	 */
+	git_ewah bitmap;
+	uint8_t xor_offset;
+	uint8_t flags;
+
+	/* The bitmap with the xor'ed ones applied, once it has been needed. */
+	git_buf resolved;
+} git_pack_bitmap_entry;
+
+/*
+ * A reachability bitmap index for a packfile.
+ *
+ * The on-disk format is documented in git's
+ * Documentation/technical/bitmap-format.txt: a header with the checksum
+ * of the pack, four EWAH bitmaps with the commits, trees, blobs and tags
+ * of the pack, the bitmaps of a selection of commits (each one possibly
+ * xor'ed with a previous one), an optional cache of the name hashes of
+ * the objects and a trailing SHA-1 of all that precedes it.
+ *
+ * Bit `n` of the bitmaps stands for the `n`-th object of the pack, in
+ * the order in which the objects are laid out in the packfile.
+ */
+typedef struct git_pack_bitmap {
+	git_map bitmap_map;
+
+	/* The packfile the bitmaps describe. */
+	struct git_pack_file *pack;
+
+	uint16_t options;
+
+	/* The objects of each type. */
+	git_bitvec commits, trees, blobs, tags;
+
+	git_pack_bitmap_entry *entries;
+	size_t num_entries;
+
+	/* The entries, by commit id. */
+	git_oidmap *entry_map;
+
+	/* The name hash of each object, in pack order, or NULL. */
+	const unsigned char *hash_cache;
+
+	/* The index (oid order) position of each object, in pack order. */
+	uint32_t *pack_order;
+} git_pack_bitmap;
+
+/* Open the `.bitmap` file at `path` along with its packfile. */
+int git_pack_bitmap_open(git_pack_bitmap **bitmap_out, const char *path);
+
+/*
+ * Open the bitmap of one of the packs in `pack_dir`; returns GIT_ENOTFOUND
+ * if none of them has one.
+ */
+int git_pack_bitmap_find(git_pack_bitmap **bitmap_out, const char *pack_dir);
+
+void git_pack_bitmap_free(git_pack_bitmap *bitmap);
+
+/*
+ * The reachability state for a set of objects.
+ *
+ * The objects of the bitmapped pack keep their bit position, and the
+ * objects that are not in it (or all of them, when there is no bitmap)
+ * are assigned new positions after those. The objects reachable from
+ * commits without a bitmap are found by walking their history and trees,
+ * which stops at the first commits that have one.
+ */
+typedef struct git_pack_bitmap_walk git_pack_bitmap_walk;
+
+int git_pack_bitmap_walk_new(git_pack_bitmap_walk **walk_out, git_repository *repo);
+void git_pack_bitmap_walk_free(git_pack_bitmap_walk *walk);
+
+/* Whether the walk is backed by a bitmap index. */
+bool git_pack_bitmap_walk_has_bitmap(git_pack_bitmap_walk *walk);
+
+/*
+ * Fill `out` with the objects reachable from the `wants` but not from
+ * any of the `haves`.
+ */
+int git_pack_bitmap_walk_reachable(
+		git_bitvec *out,
+		git_pack_bitmap_walk *walk,
+		const git_oid *wants,
+		size_t wants_len,
+		const git_oid *haves,
+		size_t haves_len);
+
+typedef int (*git_pack_bitmap_foreach_cb)(
+		const git_oid *id,
+		git_otype type,
+		uint32_t name_hash,
+		void *payload);
+
+/*
+ * Visit the objects in `bits`: the ones that were found by walking the
+ * trees first, then the ones in the pack, in pack order.
+ */
+int git_pack_bitmap_walk_foreach(
+		git_pack_bitmap_walk *walk,
+		git_bitvec *bits,
+		git_pack_bitmap_foreach_cb cb,
+		void *payload);
+
+/*
+ * A writer for the `.bitmap` file of a pack.
+ *
+ * Every object of the pack is added with its position in the pack; a
+ * selection of the commits (the tips of the references, a few of the
+ * most recent ones and then spaced out through history, as git does)
+ * gets a bitmap with every object that it can reach.
+ */
+typedef struct git_pack_bitmap_writer git_pack_bitmap_writer;
+
+int git_pack_bitmap_writer_new(
+		git_pack_bitmap_writer **writer_out,
+		git_repository *repo,
+		uint32_t num_objects);
+void git_pack_bitmap_writer_free(git_pack_bitmap_writer *w);
+
+/*
+ * Add one of the objects of the pack; `id` must remain valid for as long
+ * as the writer is used.
+ */
+int git_pack_bitmap_writer_add(
+		git_pack_bitmap_writer *w,
+		const git_oid *id,
+		git_otype type,
+		uint32_t position,
+		uint32_t name_hash);
+
+/*
+ * Write the bitmaps of the pack with the given checksum to `out`. Returns
+ * GIT_ENOTFOUND when the pack does not have every object that its commits
+ * can reach, since git only reads bitmaps that cover the full history.
+ */
+int git_pack_bitmap_writer_dump(
+		git_buf *out,
+		git_pack_bitmap_writer *w,
+		const git_oid *pack_checksum);
+
+/* Like `git_pack_bitmap_writer_dump`, but to the file at `path`. */
+int git_pack_bitmap_writer_commit(
+		git_pack_bitmap_writer *w,
+		const char *path,
+		const git_oid *pack_checksum);
+
+#endif
@@ -1002,7 +1002,27 @@ int git_path_dirload_with_stat(
 	const char *end_stat,
 	git_vector *contents)
 {
-	int error;
+	int error = git_path_dirload(
+		path, prefix_len, sizeof(git_path_with_stat) + 1, flags, contents);
+
+	if (error < 0)
+		return error;
+
+	return git_path_with_stat_fill(
+		path, prefix_len, flags, start_stat, end_stat, contents, NULL, NULL);
+}
+
+int git_path_with_stat_fill(
+	const char *path,
+	size_t prefix_len,
+	unsigned int flags,
+	const char *start_stat,
+	const char *end_stat,
+	git_vector *contents,
+	git_path_stat_cb stat_cb,
+	void *payload)
+{
+	int error = 0;
 	unsigned int i;
 	git_path_with_stat *ps;
 	git_buf full = GIT_BUF_INIT;
@@ -1013,13 +1033,6 @@ int git_path_dirload_with_stat(
 	if (git_buf_set(&full, path, prefix_len) < 0)
 		return -1;
 
-	error = git_path_dirload(
-		path, prefix_len, sizeof(git_path_with_stat) + 1, flags, contents);
-	if (error < 0) {
-		git_buf_free(&full);
-		return error;
-	}
-
 	strncomp = (flags & GIT_PATH_DIR_IGNORE_CASE) != 0 ?
 		git__strncasecmp : git__strncmp;
 
@@ -1039,13 +1052,20 @@ int git_path_dirload_with_stat(
 		if (cmp_len && strncomp(ps->path, end_stat, cmp_len) > 0)
 			continue;
 
-		git_buf_truncate(&full, prefix_len);
+		error = stat_cb ? stat_cb(ps, payload) : GIT_PASSTHROUGH;
+
+		if (error == GIT_PASSTHROUGH) {
+			git_buf_truncate(&full, prefix_len);
+
+			if ((error = git_buf_joinpath(&full, full.ptr, ps->path)) == 0)
+				error = git_path_lstat(full.ptr, &ps->st);
+		}
 
-		if ((error = git_buf_joinpath(&full, full.ptr, ps->path)) < 0 ||
-			(error = git_path_lstat(full.ptr, &ps->st)) < 0) {
+		if (error < 0) {
 			if (error == GIT_ENOTFOUND) {
 				giterr_clear();
 				error = 0;
+				git__free(ps);
 				git_vector_remove(contents, i--);
 				continue;
 			}
@@ -367,6 +367,31 @@ extern int git_path_dirload_with_stat(
 	const char *end_stat,
 	git_vector *contents);
 
+/*
+ * Fill in the stat data of `ps` without asking the filesystem; return
+ * GIT_PASSTHROUGH to have it `lstat`ed after all.
+ */
+typedef int (*git_path_stat_cb)(git_path_with_stat *ps, void *payload);
+
+/**
+ * Do the work of `git_path_dirload_with_stat` on names from elsewhere.
+ *
+ * The entries of `contents` are paths relative to the first `prefix_len`
+ * bytes of `path`, allocated like `git_path_dirload` does with
+ * `sizeof(git_path_with_stat) + 1` extra bytes.  They become sorted
+ * `git_path_with_stat` structures, and the ones which don't exist are
+ * dropped.  `stat_cb`, when given, is asked for the stat data first.
+ */
+extern int git_path_with_stat_fill(
+	const char *path,
+	size_t prefix_len,
+	uint32_t flags,
+	const char *start_stat,
+	const char *end_stat,
+	git_vector *contents,
+	git_path_stat_cb stat_cb,
+	void *payload);
+
 enum { GIT_PATH_NOTEQUAL = 0, GIT_PATH_EQUAL = 1, GIT_PATH_PREFIX = 2 };
 
 /*
@@ -239,4 +239,11 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+void p_madvise(void *data, size_t len, int advice)
+{
+	GIT_UNUSED(data);
+	GIT_UNUSED(len);
+	GIT_UNUSED(advice);
+}
+
 #endif
@@ -9,6 +9,7 @@
 #include "git2/object.h"
 #include "git2/refdb.h"
 #include "git2/sys/repository.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "common.h"
 #include "repository.h"
@@ -117,6 +118,9 @@ void git_repository_free(git_repository *repo)
 	git_diff_driver_registry_free(repo->diff_drivers);
 	repo->diff_drivers = NULL;
 
+	if (repo->_fsmonitor)
+		repo->_fsmonitor->free(repo->_fsmonitor);
+
 	git__free(repo->path_repository);
 	git__free(repo->workdir);
 	git__free(repo->namespace);
@@ -718,6 +722,22 @@ void git_repository_set_refdb(git_repository *repo, git_refdb *refdb)
 	set_refdb(repo, refdb);
 }
 
+int git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor *fsmonitor)
+{
+	git_fsmonitor *old;
+
+	assert(repo);
+
+	GITERR_CHECK_VERSION(fsmonitor, GIT_FSMONITOR_VERSION, "git_fsmonitor");
+
+	if ((old = git__swap(repo->_fsmonitor, fsmonitor)) != NULL &&
+		old != fsmonitor)
+		old->free(old);
+
+	return 0;
+}
+
 int git_repository_index__weakptr(git_index **out, git_repository *repo)
 {
 	int error = 0;
@@ -39,6 +39,7 @@ typedef enum {
 	GIT_CVAR_ABBREV,        /* core.abbrev */
 	GIT_CVAR_PRECOMPOSE,    /* core.precomposeunicode */
 	GIT_CVAR_SAFE_CRLF,		/* core.safecrlf */
+	GIT_CVAR_UNTRACKEDCACHE, /* core.untrackedcache */
 	GIT_CVAR_CACHE_MAX
 } git_cvar_cached;
 
@@ -92,6 +93,11 @@ typedef enum {
 	GIT_PRECOMPOSE_DEFAULT = GIT_CVAR_FALSE,
 	/* core.safecrlf */
 	GIT_SAFE_CRLF_DEFAULT = GIT_CVAR_FALSE,
+	/* core.untrackedcache: false, true, 'keep' */
+	GIT_UNTRACKEDCACHE_FALSE = 0,
+	GIT_UNTRACKEDCACHE_TRUE = 1,
+	GIT_UNTRACKEDCACHE_KEEP = 2,
+	GIT_UNTRACKEDCACHE_DEFAULT = GIT_UNTRACKEDCACHE_KEEP,
 } git_cvar_value;
 
 /* internal repository init flags */
@@ -108,6 +114,7 @@ struct git_repository {
 	git_config *_config;
 	git_index *_index;
 	git_submodule_cache *_submodules;
+	git_fsmonitor *_fsmonitor;
 
 	git_cache objects;
 	git_attr_cache *attrcache;
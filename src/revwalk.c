@@ -285,6 +285,11 @@ static int revwalk_enqueue_timesort(git_revwalk *walk, git_commit_list_node *com
 	return git_pqueue_insert(&walk->iterator_time, commit);
 }
 
+static int revwalk_enqueue_generation(git_revwalk *walk, git_commit_list_node *commit)
+{
+	return git_pqueue_insert(&walk->iterator_generation, commit);
+}
+
 static int revwalk_enqueue_unsorted(git_revwalk *walk, git_commit_list_node *commit)
 {
 	return git_commit_list_insert(commit, &walk->iterator_rand) ? 0 : -1;
@@ -363,6 +368,99 @@ static int revwalk_next_toposort(git_commit_list_node **object_out, git_revwalk
 	}
 }
 
+/*
+ * Count, as children of their parents, all the commits of the walk whose
+ * generation is at least `generation`, and queue them for output.
+ */
+static int revwalk_count_generation(git_revwalk *walk, uint32_t generation)
+{
+	git_commit_list_node *next;
+	unsigned short i, max;
+	int error;
+
+	while ((next = git_pqueue_get(&walk->iterator_generation, 0)) != NULL &&
+		git_commit_list_generation(next) >= generation) {
+		git_pqueue_pop(&walk->iterator_generation);
+
+		if (next->uninteresting)
+			continue;
+
+		max = next->out_degree;
+		if (walk->first_parent && next->out_degree)
+			max = 1;
+
+		for (i = 0; i < max; ++i)
+			next->parents[i]->in_degree++;
+
+		if ((error = process_commit_parents(walk, next)) < 0)
+			return error;
+
+		if (git_commit_list_insert(next, &walk->iterator_topo) == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * A topological walk that does not need to see the whole history first:
+ * children always have a higher generation number than their parents, so
+ * once all the commits above a commit's generation have been counted, its
+ * in-degree is final.
+ */
+static int revwalk_next_toposort_generation(git_commit_list_node **object_out, git_revwalk *walk)
+{
+	git_commit_list_node *next;
+	uint32_t generation;
+	unsigned short i, max;
+	int error;
+
+	for (;;) {
+		if (walk->iterator_topo == NULL) {
+			if ((next = git_pqueue_get(&walk->iterator_generation, 0)) == NULL) {
+				giterr_clear();
+				return GIT_ITEROVER;
+			}
+
+			if ((error = revwalk_count_generation(walk, git_commit_list_generation(next))) < 0)
+				return error;
+			continue;
+		}
+
+		next = git_commit_list_pop(&walk->iterator_topo);
+
+		/* Commits outside of the graph can only have children outside of it */
+		generation = git_commit_list_generation(next);
+		if (generation != GIT_COMMIT_LIST_GENERATION_INFINITY)
+			generation++;
+
+		if ((error = revwalk_count_generation(walk, generation)) < 0)
+			return error;
+
+		if (next->in_degree > 0) {
+			next->topo_delay = 1;
+			continue;
+		}
+
+		max = next->out_degree;
+		if (walk->first_parent && next->out_degree)
+			max = 1;
+
+		for (i = 0; i < max; ++i) {
+			git_commit_list_node *parent = next->parents[i];
+
+			if (--parent->in_degree == 0 && parent->topo_delay) {
+				parent->topo_delay = 0;
+				if (git_commit_list_insert(parent, &walk->iterator_topo) == NULL)
+					return -1;
+			}
+		}
+
+		*object_out = next;
+		return 0;
+	}
+}
+
 static int revwalk_next_reverse(git_commit_list_node **object_out, git_revwalk *walk)
 {
 	*object_out = git_commit_list_pop(&walk->iterator_reverse);
@@ -375,6 +473,7 @@ static int prepare_walk(git_revwalk *walk)
 	int error;
 	unsigned int i;
 	git_commit_list_node *next, *two;
+	git_commit_graph_file *cgraph_file;
 
 	/*
 	 * If walk->one is NULL, there were no positive references,
@@ -385,6 +484,13 @@ static int prepare_walk(git_revwalk *walk)
 		return GIT_ITEROVER;
 	}
 
+	/* With generation numbers, the topological walk can start right away */
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) &&
+		git_revwalk__commit_graph_file(&cgraph_file, walk) == 0) {
+		walk->enqueue = &revwalk_enqueue_generation;
+		walk->get_next = &revwalk_next_toposort_generation;
+	}
+
 	if (process_commit(walk, walk->one, walk->one->uninteresting) < 0)
 		return -1;
 
@@ -393,7 +499,8 @@ static int prepare_walk(git_revwalk *walk)
 			return -1;
 	}
 
-	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) &&
+		walk->get_next != &revwalk_next_toposort_generation) {
 		unsigned short i;
 
 		while ((error = walk->get_next(&next, walk)) == 0) {
@@ -443,6 +550,8 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 
 	if (git_pqueue_init(
 			&walk->iterator_time, 0, 8, git_commit_list_time_cmp) < 0 ||
+		git_pqueue_init(
+			&walk->iterator_generation, 0, 8, git_commit_list_generation_cmp) < 0 ||
 		git_vector_init(&walk->twos, 4, NULL) < 0 ||
 		git_pool_init(&walk->commit_pool, 1,
 			git_pool__suggest_items_per_page(COMMIT_ALLOC) * COMMIT_ALLOC) < 0)
@@ -473,6 +582,7 @@ void git_revwalk_free(git_revwalk *walk)
 	git_oidmap_free(walk->commits);
 	git_pool_clear(&walk->commit_pool);
 	git_pqueue_free(&walk->iterator_time);
+	git_pqueue_free(&walk->iterator_generation);
 	git_vector_free(&walk->twos);
 	git__free(walk);
 }
@@ -546,6 +656,7 @@ void git_revwalk_reset(git_revwalk *walk)
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
+	git_pqueue_clear(&walk->iterator_generation);
 	git_commit_list_free(&walk->iterator_topo);
 	git_commit_list_free(&walk->iterator_rand);
 	git_commit_list_free(&walk->iterator_reverse);
@@ -553,6 +664,26 @@ void git_revwalk_reset(git_revwalk *walk)
 
 	walk->one = NULL;
 	git_vector_clear(&walk->twos);
+
+	/* the next walk may see a graph that was written since */
+	git_commit_graph_file_free(walk->cgraph_file);
+	walk->cgraph_file = NULL;
+	walk->cgraph_checked = 0;
+}
+
+int git_revwalk__commit_graph_file(git_commit_graph_file **out, git_revwalk *walk)
+{
+	if (!walk->cgraph_checked) {
+		if (git_odb__get_commit_graph_file(&walk->cgraph_file, walk->odb) < 0) {
+			giterr_clear();
+			walk->cgraph_file = NULL;
+		}
+
+		walk->cgraph_checked = 1;
+	}
+
+	*out = walk->cgraph_file;
+	return *out ? 0 : GIT_ENOTFOUND;
 }
 
 int git_revwalk_add_hide_cb(
@@ -13,6 +13,7 @@
 #include "pqueue.h"
 #include "pool.h"
 #include "vector.h"
+#include "commit_graph.h"
 
 GIT__USE_OIDMAP;
 
@@ -27,14 +28,19 @@ struct git_revwalk {
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
 	git_pqueue iterator_time;
+	git_pqueue iterator_generation;
 
 	int (*get_next)(git_commit_list_node **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, git_commit_list_node *);
 
 	unsigned walking:1,
-		first_parent: 1;
+		first_parent: 1,
+		cgraph_checked: 1;
 	unsigned int sorting;
 
+	/* commit-graph of the odb, looked up once per walk */
+	git_commit_graph_file *cgraph_file;
+
 	/* merge base calculation */
 	git_commit_list_node *one;
 	git_vector twos;
@@ -46,4 +52,10 @@ struct git_revwalk {
 
 git_commit_list_node *git_revwalk__commit_lookup(git_revwalk *walk, const git_oid *oid);
 
+/*
+ * Get the commit-graph for this walk, or GIT_ENOTFOUND when there is none.
+ * The walk keeps the reference until it is reset.
+ */
+int git_revwalk__commit_graph_file(git_commit_graph_file **out, git_revwalk *walk);
+
 #endif
@@ -9,6 +9,7 @@
 #include "common.h"
 #include "sysdir.h"
 #include "cache.h"
+#include "pack.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
 {
@@ -35,6 +36,8 @@ int git_libgit2_features()
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern int git_indexer__pipeline;
+extern int git_mwindow__whole_files;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -131,6 +134,62 @@ int git_libgit2_opts(int key, ...)
 	case GIT_OPT_SET_TEMPLATE_PATH:
 		error = git_sysdir_set(GIT_SYSDIR_TEMPLATE, va_arg(ap, const char *));
 		break;
+
+	case GIT_OPT_SET_CACHE_EVICTION:
+		error = git_cache_set_eviction((git_cache_eviction_t)va_arg(ap, int));
+		break;
+
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+
+			error = git_cache_stats(hits, misses, evictions);
+		}
+		break;
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_LIMIT:
+		*(va_arg(ap, size_t *)) = git_pack__cache_limit;
+		break;
+
+	case GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT:
+		git_pack__cache_limit = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_STATS:
+		{
+			size_t *memory_used = va_arg(ap, size_t *);
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+
+			error = git_pack_cache_stats(
+				memory_used, hits, misses, evictions);
+		}
+		break;
+
+	case GIT_OPT_ENABLE_INDEXER_PIPELINE:
+#ifdef GIT_THREADS
+		git_indexer__pipeline = (va_arg(ap, int) != 0);
+#else
+		if (va_arg(ap, int) != 0) {
+			giterr_set(GITERR_INVALID,
+				"Pipelined indexing requires libgit2 to be built with threads");
+			error = -1;
+		}
+#endif
+		break;
+
+	case GIT_OPT_ENABLE_WHOLE_PACK_MMAP:
+#ifdef GIT_ARCH_64
+		git_mwindow__whole_files = (va_arg(ap, int) != 0);
+#else
+		giterr_set(GITERR_INVALID,
+			"Mapping whole packfiles is only supported on 64-bit platforms");
+		error = -1;
+#endif
+		break;
 	}
 
 	va_end(ap);
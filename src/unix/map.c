@@ -11,6 +11,7 @@
 #include "map.h"
 #include <sys/mman.h>
 #include <errno.h>
+#include <unistd.h>
 
 int p_mmap(git_map *out, size_t len, int prot, int flags, int fd, git_off_t offset)
 {
@@ -54,5 +55,29 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+void p_madvise(void *data, size_t len, int advice)
+{
+	static size_t page_size;
+	uintptr_t start, end;
+	int madv;
+
+	switch (advice) {
+	case GIT_MADV_RANDOM:     madv = POSIX_MADV_RANDOM; break;
+	case GIT_MADV_SEQUENTIAL: madv = POSIX_MADV_SEQUENTIAL; break;
+	case GIT_MADV_WILLNEED:   madv = POSIX_MADV_WILLNEED; break;
+	default:                  madv = POSIX_MADV_NORMAL; break;
+	}
+
+	if (!page_size)
+		page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+	/* The advice has to start on a page boundary */
+	start = (uintptr_t)data & ~(uintptr_t)(page_size - 1);
+	end = (uintptr_t)data + len;
+
+	if (end > start)
+		posix_madvise((void *)start, (size_t)(end - start), madv);
+}
+
 #endif
 
@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+#include "untracked-cache.h"
+#include "repository.h"
+#include "attrcache.h"
+#include "ignore.h"
+#include "bitvec.h"
+#include "ewah.h"
+#include "varint.h"
+#include "git2/odb.h"
+
+#define UNTRACKED_STAT_SIZE (9 * sizeof(uint32_t))
+
+static int untracked_dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_dir *dir_a = a, *dir_b = b;
+	return strcmp(dir_a->name, dir_b->name);
+}
+
+struct untracked_dir_key {
+	const char *name;
+	size_t namelen;
+};
+
+static int untracked_dir_srch(const void *key, const void *array_member)
+{
+	const struct untracked_dir_key *k = key;
+	const git_untracked_dir *dir = array_member;
+	int cmp = memcmp(k->name, dir->name, min(k->namelen, dir->namelen));
+
+	if (cmp)
+		return cmp;
+
+	return (k->namelen < dir->namelen) ? -1 : (k->namelen > dir->namelen);
+}
+
+static git_untracked_dir *untracked_dir_alloc(const char *name, size_t namelen)
+{
+	git_untracked_dir *dir =
+		git__calloc(1, sizeof(git_untracked_dir) + namelen + 1);
+
+	if (!dir)
+		return NULL;
+
+	if (git_vector_init(&dir->untracked, 0, NULL) < 0 ||
+		git_vector_init(&dir->dirs, 0, untracked_dir_cmp) < 0) {
+		git_vector_free(&dir->untracked);
+		git__free(dir);
+		return NULL;
+	}
+
+	memcpy(dir->name, name, namelen);
+	dir->namelen = namelen;
+
+	return dir;
+}
+
+static void untracked_dir_free(git_untracked_dir *dir)
+{
+	git_untracked_dir *child;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		untracked_dir_free(child);
+
+	git_vector_free(&dir->dirs);
+	git_vector_free_deep(&dir->untracked);
+	git__free(dir);
+}
+
+void git_untracked_dir_invalidate(git_untracked_dir *dir, bool recursive)
+{
+	git_untracked_dir *child;
+	char *untracked;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	dir->valid = 0;
+
+	git_vector_foreach(&dir->untracked, i, untracked)
+		git__free(untracked);
+	git_vector_clear(&dir->untracked);
+
+	if (recursive)
+		git_vector_foreach(&dir->dirs, i, child)
+			git_untracked_dir_invalidate(child, true);
+}
+
+int git_untracked_dir_child(
+	git_untracked_dir **out,
+	git_untracked_dir *dir,
+	const char *name,
+	size_t namelen,
+	bool create)
+{
+	struct untracked_dir_key key;
+	git_untracked_dir *child;
+	size_t pos;
+
+	key.name = name;
+	key.namelen = namelen;
+
+	if (!git_vector_bsearch2(&pos, &dir->dirs, untracked_dir_srch, &key)) {
+		*out = git_vector_get(&dir->dirs, pos);
+		return 0;
+	}
+
+	*out = NULL;
+
+	if (!create)
+		return 0;
+
+	child = untracked_dir_alloc(name, namelen);
+	GITERR_CHECK_ALLOC(child);
+
+	if (git_vector_insert_sorted(&dir->dirs, child, NULL) < 0) {
+		untracked_dir_free(child);
+		return -1;
+	}
+
+	*out = child;
+	return 0;
+}
+
+void git_untracked_dir_update(
+	git_untracked_dir *dir,
+	git_vector *untracked,
+	git_vector *dirs,
+	const struct stat *st,
+	bool valid)
+{
+	git_untracked_dir *child;
+	size_t i;
+
+	git_vector_set_cmp(dirs, untracked_dir_cmp);
+	git_vector_sort(dirs);
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (git_vector_bsearch(NULL, dirs, child) < 0)
+			untracked_dir_free(child);
+	}
+
+	git_vector_swap(&dir->dirs, dirs);
+	git_vector_free(dirs);
+
+	git_untracked_dir_invalidate(dir, false);
+	git_vector_swap(&dir->untracked, untracked);
+	git_vector_free(untracked);
+
+	git_untracked_stat_from_stat(&dir->st, st);
+	dir->check_only = 0;
+	dir->valid = valid;
+}
+
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc, const char *path)
+{
+	git_untracked_dir *dir;
+	const char *slash;
+
+	if (!uc || !(dir = uc->root))
+		return;
+
+	/* untracked directories are listed in their parent, so every
+	 * directory on the way may have changed as well
+	 */
+	while (dir != NULL) {
+		git_untracked_dir_invalidate(dir, false);
+
+		if ((slash = strchr(path, '/')) == NULL ||
+			git_untracked_dir_child(
+				&dir, dir, path, slash - path, false) < 0)
+			break;
+
+		path = slash + 1;
+	}
+}
+
+void git_untracked_stat_from_stat(
+	git_untracked_stat *out, const struct stat *st)
+{
+	memset(out, 0, sizeof(*out));
+
+	out->ctime = (uint32_t)st->st_ctime;
+	out->mtime = (uint32_t)st->st_mtime;
+	out->dev = (uint32_t)st->st_dev;
+	out->ino = (uint32_t)st->st_ino;
+	out->uid = (uint32_t)st->st_uid;
+	out->gid = (uint32_t)st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+/* We don't know the nanoseconds (and git itself ignores the device) */
+bool git_untracked_stat_changed(
+	const git_untracked_stat *a, const git_untracked_stat *b)
+{
+	return (a->ctime != b->ctime ||
+		a->mtime != b->mtime ||
+		a->ino != b->ino ||
+		a->uid != b->uid ||
+		a->gid != b->gid ||
+		a->size != b->size);
+}
+
+int git_untracked_cache_new(git_untracked_cache **out)
+{
+	git_untracked_cache *uc = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(uc);
+
+	git_buf_init(&uc->ident, 0);
+	uc->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	uc->exclude_per_dir = git__strdup(GIT_IGNORE_FILE);
+
+	if (!uc->exclude_per_dir) {
+		git_untracked_cache_free(uc);
+		return -1;
+	}
+
+	*out = uc;
+	return 0;
+}
+
+void git_untracked_cache_free(git_untracked_cache *uc)
+{
+	if (!uc)
+		return;
+
+	untracked_dir_free(uc->root);
+	git_buf_free(&uc->ident);
+	git__free(uc->exclude_per_dir);
+	git__free(uc);
+}
+
+/*
+ * Reading
+ */
+
+typedef struct {
+	const char *data;
+	const char *end;
+	git_vector dirs; /* in the order they're stored */
+} untracked_reader;
+
+static int read_varint(size_t *out, untracked_reader *rd)
+{
+	size_t used;
+	uintmax_t value = git_decode_varint(
+		(const unsigned char *)rd->data, rd->end - rd->data, &used);
+
+	if (!used || value > SIZE_MAX)
+		return -1;
+
+	rd->data += used;
+	*out = (size_t)value;
+	return 0;
+}
+
+static int read_string(const char **out, size_t *len, untracked_reader *rd)
+{
+	const char *eos = memchr(rd->data, '\0', rd->end - rd->data);
+
+	if (!eos)
+		return -1;
+
+	*out = rd->data;
+	*len = eos - rd->data;
+	rd->data = eos + 1;
+	return 0;
+}
+
+static uint32_t read_be32(untracked_reader *rd)
+{
+	uint32_t value;
+
+	memcpy(&value, rd->data, sizeof(value));
+	rd->data += sizeof(value);
+
+	return ntohl(value);
+}
+
+static int read_stat(git_untracked_stat *st, untracked_reader *rd)
+{
+	if ((size_t)(rd->end - rd->data) < UNTRACKED_STAT_SIZE)
+		return -1;
+
+	st->ctime = read_be32(rd);
+	st->ctime_nsec = read_be32(rd);
+	st->mtime = read_be32(rd);
+	st->mtime_nsec = read_be32(rd);
+	st->dev = read_be32(rd);
+	st->ino = read_be32(rd);
+	st->uid = read_be32(rd);
+	st->gid = read_be32(rd);
+	st->size = read_be32(rd);
+	return 0;
+}
+
+static int read_oid(git_oid *oid, untracked_reader *rd)
+{
+	if ((size_t)(rd->end - rd->data) < GIT_OID_RAWSZ)
+		return -1;
+
+	git_oid_fromraw(oid, (const unsigned char *)rd->data);
+	rd->data += GIT_OID_RAWSZ;
+	return 0;
+}
+
+static int read_dir(git_untracked_dir **out, untracked_reader *rd)
+{
+	git_untracked_dir *dir, *child;
+	size_t untracked_nr, dirs_nr, namelen, i;
+	const char *name;
+	char *untracked;
+
+	if (read_varint(&untracked_nr, rd) < 0 ||
+		read_varint(&dirs_nr, rd) < 0 ||
+		read_string(&name, &namelen, rd) < 0)
+		return -1;
+
+	dir = untracked_dir_alloc(name, namelen);
+	GITERR_CHECK_ALLOC(dir);
+
+	if (git_vector_insert(&rd->dirs, dir) < 0) {
+		untracked_dir_free(dir);
+		return -1;
+	}
+
+	*out = dir;
+
+	for (i = 0; i < untracked_nr; ++i) {
+		if (read_string(&name, &namelen, rd) < 0)
+			return -1;
+
+		untracked = git__strndup(name, namelen);
+		GITERR_CHECK_ALLOC(untracked);
+
+		if (git_vector_insert(&dir->untracked, untracked) < 0) {
+			git__free(untracked);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < dirs_nr; ++i) {
+		int error;
+
+		child = NULL;
+		error = read_dir(&child, rd);
+
+		/* keep what was read reachable from the root, to be freed */
+		if (child && git_vector_insert(&dir->dirs, child) < 0) {
+			untracked_dir_free(child);
+			return -1;
+		}
+
+		if (error < 0)
+			return error;
+	}
+
+	/* git keeps them sorted, but don't rely on it for lookups */
+	git_vector_set_sorted(&dir->dirs, false);
+	git_vector_sort(&dir->dirs);
+
+	return 0;
+}
+
+static int read_bitmap(git_bitvec *bv, size_t nbits, untracked_reader *rd)
+{
+	git_ewah ewah;
+	size_t len;
+
+	if (git_bitvec_init(bv, nbits) < 0)
+		return -1;
+
+	if (git_ewah_parse(&ewah, &len,
+			(const unsigned char *)rd->data, rd->end - rd->data) < 0 ||
+		ewah.bit_size > nbits ||
+		git_ewah_or(bv, &ewah) < 0)
+		return -1;
+
+	rd->data += len;
+	return 0;
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *uc = NULL;
+	git_untracked_dir *dir;
+	git_bitvec valid, check_only, sha1_valid;
+	untracked_reader rd;
+	size_t len, ndirs, i;
+	const char *str;
+	int error = -1;
+
+	*out = NULL;
+
+	memset(&valid, 0, sizeof(valid));
+	memset(&check_only, 0, sizeof(check_only));
+	memset(&sha1_valid, 0, sizeof(sha1_valid));
+
+	if (git_vector_init(&rd.dirs, 16, NULL) < 0 ||
+		git_untracked_cache_new(&uc) < 0)
+		goto done;
+
+	/* a NUL guards the strings against running off the end */
+	if (buffer_size <= 1 || buffer[buffer_size - 1] != '\0')
+		goto corrupted;
+
+	rd.data = buffer;
+	rd.end = buffer + buffer_size - 1;
+
+	if (read_varint(&len, &rd) < 0 || len > (size_t)(rd.end - rd.data))
+		goto corrupted;
+
+	if (git_buf_put(&uc->ident, rd.data, len) < 0)
+		goto done;
+	rd.data += len;
+
+	if (read_stat(&uc->info_exclude_st, &rd) < 0 ||
+		read_stat(&uc->excludes_file_st, &rd) < 0 ||
+		(size_t)(rd.end - rd.data) < sizeof(uint32_t))
+		goto corrupted;
+
+	uc->dir_flags = read_be32(&rd);
+
+	if (read_oid(&uc->info_exclude_oid, &rd) < 0 ||
+		read_oid(&uc->excludes_file_oid, &rd) < 0 ||
+		read_string(&str, &len, &rd) < 0)
+		goto corrupted;
+
+	git__free(uc->exclude_per_dir);
+	uc->exclude_per_dir = git__strndup(str, len);
+	GITERR_CHECK_ALLOC(uc->exclude_per_dir);
+
+	/* nothing is cached yet */
+	if (rd.data >= rd.end) {
+		error = 0;
+		goto done;
+	}
+
+	if (read_varint(&ndirs, &rd) < 0)
+		goto corrupted;
+
+	if (!ndirs) {
+		error = 0;
+		goto done;
+	}
+
+	if (read_dir(&uc->root, &rd) < 0 ||
+		rd.dirs.length != ndirs ||
+		read_bitmap(&valid, ndirs, &rd) < 0 ||
+		read_bitmap(&check_only, ndirs, &rd) < 0 ||
+		read_bitmap(&sha1_valid, ndirs, &rd) < 0)
+		goto corrupted;
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (git_bitvec_get(&check_only, i))
+			dir->check_only = 1;
+	}
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (!git_bitvec_get(&valid, i))
+			continue;
+		if (read_stat(&dir->st, &rd) < 0)
+			goto corrupted;
+		dir->valid = 1;
+	}
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (git_bitvec_get(&sha1_valid, i) &&
+			read_oid(&dir->exclude_oid, &rd) < 0)
+			goto corrupted;
+	}
+
+	error = 0;
+	goto done;
+
+corrupted:
+	giterr_set(GITERR_INDEX, "Corrupted UNTR extension in index");
+	error = -1;
+
+done:
+	git_bitvec_free(&valid);
+	git_bitvec_free(&check_only);
+	git_bitvec_free(&sha1_valid);
+	git_vector_free(&rd.dirs);
+
+	if (error < 0)
+		git_untracked_cache_free(uc);
+	else
+		*out = uc;
+
+	return error;
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+	git_buf dirs;
+	git_buf stats;
+	git_buf oids;
+	git_bitvec valid;
+	git_bitvec check_only;
+	git_bitvec sha1_valid;
+	size_t index;
+} untracked_writer;
+
+static int put_varint(git_buf *out, size_t value)
+{
+	unsigned char buf[16];
+	int len = git_encode_varint(buf, sizeof(buf), value);
+
+	return git_buf_put(out, (const char *)buf, len);
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int put_stat(git_buf *out, const git_untracked_stat *st)
+{
+	if (put_be32(out, st->ctime) < 0 ||
+		put_be32(out, st->ctime_nsec) < 0 ||
+		put_be32(out, st->mtime) < 0 ||
+		put_be32(out, st->mtime_nsec) < 0 ||
+		put_be32(out, st->dev) < 0 ||
+		put_be32(out, st->ino) < 0 ||
+		put_be32(out, st->uid) < 0 ||
+		put_be32(out, st->gid) < 0 ||
+		put_be32(out, st->size) < 0)
+		return -1;
+
+	return 0;
+}
+
+static size_t count_dirs(const git_untracked_dir *dir)
+{
+	const git_untracked_dir *child;
+	size_t i, count = 1;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		count += count_dirs(child);
+
+	return count;
+}
+
+static int write_dir(untracked_writer *wr, const git_untracked_dir *dir)
+{
+	const git_untracked_dir *child;
+	const char *untracked;
+	size_t i, pos = wr->index++;
+
+	if (dir->valid) {
+		git_bitvec_set(&wr->valid, pos, true);
+		if (put_stat(&wr->stats, &dir->st) < 0)
+			return -1;
+	}
+
+	if (dir->check_only)
+		git_bitvec_set(&wr->check_only, pos, true);
+
+	if (!git_oid_iszero(&dir->exclude_oid)) {
+		git_bitvec_set(&wr->sha1_valid, pos, true);
+		if (git_buf_put(&wr->oids,
+				(const char *)dir->exclude_oid.id, GIT_OID_RAWSZ) < 0)
+			return -1;
+	}
+
+	if (put_varint(&wr->dirs, dir->untracked.length) < 0 ||
+		put_varint(&wr->dirs, dir->dirs.length) < 0 ||
+		git_buf_put(&wr->dirs, dir->name, dir->namelen + 1) < 0)
+		return -1;
+
+	git_vector_foreach(&dir->untracked, i, untracked) {
+		if (git_buf_put(&wr->dirs, untracked, strlen(untracked) + 1) < 0)
+			return -1;
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (write_dir(wr, child) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_write(git_buf *out, const git_untracked_cache *uc)
+{
+	untracked_writer wr;
+	size_t ndirs;
+	int error = -1;
+
+	if (put_varint(out, uc->ident.size) < 0 ||
+		git_buf_put(out, uc->ident.ptr, uc->ident.size) < 0 ||
+		put_stat(out, &uc->info_exclude_st) < 0 ||
+		put_stat(out, &uc->excludes_file_st) < 0 ||
+		put_be32(out, uc->dir_flags) < 0 ||
+		git_buf_put(out, (const char *)uc->info_exclude_oid.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, (const char *)uc->excludes_file_oid.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1) < 0)
+		return -1;
+
+	if (!uc->root)
+		return put_varint(out, 0);
+
+	memset(&wr, 0, sizeof(wr));
+	ndirs = count_dirs(uc->root);
+
+	if (git_bitvec_init(&wr.valid, ndirs) < 0 ||
+		git_bitvec_init(&wr.check_only, ndirs) < 0 ||
+		git_bitvec_init(&wr.sha1_valid, ndirs) < 0 ||
+		write_dir(&wr, uc->root) < 0)
+		goto done;
+
+	if (put_varint(out, ndirs) < 0 ||
+		git_buf_put(out, wr.dirs.ptr, wr.dirs.size) < 0 ||
+		git_ewah_write(out, &wr.valid) < 0 ||
+		git_ewah_write(out, &wr.check_only) < 0 ||
+		git_ewah_write(out, &wr.sha1_valid) < 0 ||
+		git_buf_put(out, wr.stats.ptr, wr.stats.size) < 0 ||
+		git_buf_put(out, wr.oids.ptr, wr.oids.size) < 0 ||
+		git_buf_putc(out, '\0') < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	git_buf_free(&wr.dirs);
+	git_buf_free(&wr.stats);
+	git_buf_free(&wr.oids);
+	git_bitvec_free(&wr.valid);
+	git_bitvec_free(&wr.check_only);
+	git_bitvec_free(&wr.sha1_valid);
+	return error;
+}
+
+/*
+ * Validation against the working directory
+ */
+
+static int untracked_cache_ident(git_buf *out, git_repository *repo)
+{
+	const char *workdir = git_repository_workdir(repo);
+	const char *sysname;
+	size_t len;
+#ifdef GIT_WIN32
+	sysname = "Windows";
+#else
+	struct utsname uts;
+
+	if (uname(&uts) < 0) {
+		giterr_set(GITERR_OS, "Failed to get the name of the system");
+		return -1;
+	}
+	sysname = uts.sysname;
+#endif
+
+	if (!workdir) {
+		giterr_set(GITERR_INVALID,
+			"Cannot use an untracked cache without a working directory");
+		return -1;
+	}
+
+	/* git names the working directory without its trailing slash */
+	len = strlen(workdir);
+	if (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	git_buf_puts(out, "Location ");
+	git_buf_put(out, workdir, len);
+	git_buf_printf(out, ", system %s", sysname);
+	git_buf_putc(out, '\0');
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+/* The cache is shared by everyone using the working directory */
+static bool untracked_cache_has_ident(
+	const git_untracked_cache *uc, const git_buf *ident)
+{
+	const char *ptr = uc->ident.ptr, *end = uc->ident.ptr + uc->ident.size;
+	const char *eos;
+
+	while (ptr < end && (eos = memchr(ptr, '\0', end - ptr)) != NULL) {
+		if ((size_t)(eos + 1 - ptr) == ident->size &&
+			!memcmp(ptr, ident->ptr, ident->size))
+			return true;
+
+		ptr = eos + 1;
+	}
+
+	return false;
+}
+
+static int untracked_cache_reset(
+	git_untracked_cache *uc, const git_buf *ident)
+{
+	untracked_dir_free(uc->root);
+	uc->root = NULL;
+
+	memset(&uc->info_exclude_st, 0, sizeof(git_untracked_stat));
+	memset(&uc->excludes_file_st, 0, sizeof(git_untracked_stat));
+	memset(&uc->info_exclude_oid, 0, sizeof(git_oid));
+	memset(&uc->excludes_file_oid, 0, sizeof(git_oid));
+
+	uc->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+
+	git__free(uc->exclude_per_dir);
+	uc->exclude_per_dir = git__strdup(GIT_IGNORE_FILE);
+	GITERR_CHECK_ALLOC(uc->exclude_per_dir);
+
+	return git_buf_set(&uc->ident, ident->ptr, ident->size);
+}
+
+int git_untracked_cache_hash_ignore_file(git_oid *out, const char *path)
+{
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	memset(out, 0, sizeof(*out));
+
+	if ((error = git_futils_readbuffer(&buf, path)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		return error;
+	}
+
+	/* git hashes what it parses, which always ends in a newline */
+	if (buf.size > 0)
+		git_buf_putc(&buf, '\n');
+
+	if (git_buf_oom(&buf))
+		error = -1;
+	else
+		error = git_odb_hash(out, buf.ptr, buf.size, GIT_OBJ_BLOB);
+
+	git_buf_free(&buf);
+	return error;
+}
+
+/* Missing files are recorded with zeroed stat data and id */
+static int untracked_ignore_file_check(
+	bool *changed, git_untracked_stat *st, git_oid *oid, const char *path)
+{
+	struct stat s;
+	git_oid id;
+	int error;
+
+	memset(st, 0, sizeof(git_untracked_stat));
+	memset(&id, 0, sizeof(id));
+
+	if (path && p_stat(path, &s) == 0) {
+		git_untracked_stat_from_stat(st, &s);
+
+		if ((error = git_untracked_cache_hash_ignore_file(&id, path)) < 0)
+			return error;
+	}
+
+	if (!git_oid_equal(&id, oid)) {
+		git_oid_cpy(oid, &id);
+		*changed = true;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_validate(
+	git_untracked_cache *uc, git_repository *repo)
+{
+	git_buf ident = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	bool changed = false;
+	int error;
+
+	if ((error = untracked_cache_ident(&ident, repo)) < 0)
+		goto done;
+
+	if ((!untracked_cache_has_ident(uc, &ident) ||
+		 uc->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS ||
+		 strcmp(uc->exclude_per_dir, GIT_IGNORE_FILE) != 0) &&
+		(error = untracked_cache_reset(uc, &ident)) < 0)
+		goto done;
+
+	if ((error = git_attr_cache__init(repo)) < 0 ||
+		(error = git_buf_joinpath(&path,
+			git_repository_path(repo), GIT_IGNORE_FILE_INREPO)) < 0 ||
+		(error = untracked_ignore_file_check(&changed,
+			&uc->info_exclude_st, &uc->info_exclude_oid, path.ptr)) < 0 ||
+		(error = untracked_ignore_file_check(&changed,
+			&uc->excludes_file_st, &uc->excludes_file_oid,
+			git_repository_attr_cache(repo)->cfg_excl_file)) < 0)
+		goto done;
+
+	if (changed)
+		git_untracked_dir_invalidate(uc->root, true);
+
+	if (!uc->root) {
+		uc->root = untracked_dir_alloc("", 0);
+		GITERR_CHECK_ALLOC(uc->root);
+	}
+
+done:
+	git_buf_free(&ident);
+	git_buf_free(&path);
+	return error;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "vector.h"
+#include "git2/oid.h"
+
+/*
+ * The untracked cache ("UNTR" index extension) remembers the untracked
+ * files of each directory of the working directory, together with what
+ * the directory and its .gitignore looked like then.  As long as both are
+ * unchanged the directory doesn't need to be read again to find them.
+ *
+ * The format and the rules for trusting an entry are core git's; it only
+ * keeps the cache for directories listed with `--directory` and
+ * `--no-empty-directory`, so those are the flags we record.
+ */
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS ((1u << 1) | (1u << 2))
+
+/* The stat data git records, in its on-disk order */
+typedef struct {
+	uint32_t ctime;
+	uint32_t ctime_nsec;
+	uint32_t mtime;
+	uint32_t mtime_nsec;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_stat;
+
+typedef struct git_untracked_dir git_untracked_dir;
+
+struct git_untracked_dir {
+	/* names of the untracked files, untracked directories end in '/' */
+	git_vector untracked;
+	/* the subdirectories known to the cache, sorted by name */
+	git_vector dirs;
+
+	git_untracked_stat st;
+	git_oid exclude_oid; /* of its .gitignore, zero if it has none */
+
+	/* `untracked` is complete for a directory matching `st` */
+	unsigned int valid:1;
+	/* git stopped reading it at the first untracked file */
+	unsigned int check_only:1;
+
+	size_t namelen;
+	char name[GIT_FLEX_ARRAY];
+};
+
+typedef struct {
+	/* "Location <workdir>, system <sysname>" with its NUL, per user */
+	git_buf ident;
+
+	git_untracked_stat info_exclude_st;
+	git_untracked_stat excludes_file_st;
+	git_oid info_exclude_oid;
+	git_oid excludes_file_oid;
+
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+
+	git_untracked_dir *root;
+} git_untracked_cache;
+
+extern int git_untracked_cache_new(git_untracked_cache **out);
+extern int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size);
+extern int git_untracked_cache_write(
+	git_buf *out, const git_untracked_cache *uc);
+extern void git_untracked_cache_free(git_untracked_cache *uc);
+
+/*
+ * The id the cache records for an ignore file: git adds a newline to its
+ * contents before hashing them, unless it can take the id from an index
+ * entry which is up to date.  A missing file gets the zero id.
+ */
+extern int git_untracked_cache_hash_ignore_file(
+	git_oid *out, const char *path);
+
+/*
+ * Make the cache fit for the working directory of `repo`: start over if
+ * it was written for another one (or by git with other flags), and
+ * forget all of it when info/exclude or core.excludesfile changed.
+ */
+extern int git_untracked_cache_validate(
+	git_untracked_cache *uc, git_repository *repo);
+
+/*
+ * `path` was added to or removed from the index: the untracked files of
+ * its directory, and of the ones above it, are not known anymore.
+ */
+extern void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc, const char *path);
+
+/* Forget the untracked files of `dir`, and of everything below it */
+extern void git_untracked_dir_invalidate(
+	git_untracked_dir *dir, bool recursive);
+
+/*
+ * Look up the subdirectory `name` of `dir`, adding it when `create` is
+ * set; `*out` is NULL when it isn't there.
+ */
+extern int git_untracked_dir_child(
+	git_untracked_dir **out,
+	git_untracked_dir *dir,
+	const char *name,
+	size_t namelen,
+	bool create);
+
+/*
+ * Record what `dir` holds after reading it again: the `untracked` names
+ * and the `dirs` (from `git_untracked_dir_child`) are taken over, and the
+ * subdirectories not among them dropped.  It is only `valid` when it can
+ * not have changed anymore in the second it was read.
+ */
+extern void git_untracked_dir_update(
+	git_untracked_dir *dir,
+	git_vector *untracked,
+	git_vector *dirs,
+	const struct stat *st,
+	bool valid);
+
+extern void git_untracked_stat_from_stat(
+	git_untracked_stat *out, const struct stat *st);
+
+extern bool git_untracked_stat_changed(
+	const git_untracked_stat *a, const git_untracked_stat *b);
+
+#endif
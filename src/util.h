@@ -31,6 +31,19 @@
  */
 #define CONST_STRLEN(x) ((sizeof(x)/sizeof(x[0])) - 1)
 
+/*
+ * Multiply two sizes into `out`, returning true (and leaving `out`
+ * alone) if the product would overflow.
+ */
+GIT_INLINE(bool) git__multiply_sizet_overflow(size_t *out, size_t one, size_t two)
+{
+	if (one && SIZE_MAX / one < two)
+		return true;
+
+	*out = one * two;
+	return false;
+}
+
 /*
  * Custom memory allocation wrappers
  * that set error code and error message
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "varint.h"
+
+uintmax_t git_decode_varint(const unsigned char *buf, size_t bufsize, size_t *used)
+{
+	size_t pos = 0;
+	unsigned char c;
+	uintmax_t val;
+
+	*used = 0;
+
+	if (!bufsize)
+		return 0;
+
+	c = buf[pos++];
+	val = c & 127;
+
+	while (c & 128) {
+		if (pos >= bufsize)
+			return 0;
+
+		val += 1;
+		if (!val || MSB(val, 7))
+			return 0; /* overflow */
+
+		c = buf[pos++];
+		val = (val << 7) + (c & 127);
+	}
+
+	*used = pos;
+	return val;
+}
+
+int git_encode_varint(unsigned char *buf, size_t bufsize, uintmax_t value)
+{
+	unsigned char varint[16];
+	unsigned pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 127;
+	while (value >>= 7)
+		varint[--pos] = 128 | (--value & 127);
+
+	if (buf) {
+		if (bufsize < sizeof(varint) - pos)
+			return -1;
+
+		memcpy(buf, varint + pos, sizeof(varint) - pos);
+	}
+
+	return (int)(sizeof(varint) - pos);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_varint_h__
+#define INCLUDE_varint_h__
+
+#include <stdint.h>
+
+/*
+ * Variable-length integers as git writes them in the index (and as the
+ * offsets of OFS_DELTA objects): seven bits per byte, most significant
+ * first, with the high bit set on every byte but the last.
+ */
+
+/*
+ * Encode `value` into `buf`, which is `bufsize` bytes long. Returns the
+ * number of bytes used, or -1 if the buffer is too small. Passing a NULL
+ * buffer returns the number of bytes the encoding needs.
+ */
+extern int git_encode_varint(unsigned char *buf, size_t bufsize, uintmax_t value);
+
+/*
+ * Decode the integer at `buf`, which has `bufsize` readable bytes. On
+ * success the number of bytes consumed is stored in `used`; it's set to
+ * 0 if the integer is truncated or overflows.
+ */
+extern uintmax_t git_decode_varint(const unsigned char *buf, size_t bufsize, size_t *used);
+
+#endif
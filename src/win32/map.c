@@ -113,4 +113,12 @@ int p_munmap(git_map *map)
 	return error;
 }
 
+void p_madvise(void *data, size_t len, int advice)
+{
+	/* The view is paged in on demand; there is nothing to tune */
+	GIT_UNUSED(data);
+	GIT_UNUSED(len);
+	GIT_UNUSED(advice);
+}
+
 #endif
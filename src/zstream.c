@@ -7,6 +7,10 @@
 
 #include <zlib.h>
 
+#ifdef GIT_LIBDEFLATE
+# include <libdeflate.h>
+#endif
+
 #include "zstream.h"
 #include "buffer.h"
 
@@ -28,20 +32,39 @@ static int zstream_seterr(git_zstream *zs)
 	return -1;
 }
 
-int git_zstream_init(git_zstream *zstream)
+int git_zstream_init(git_zstream *zstream, git_zstream_t type)
 {
-	zstream->zerr = deflateInit(&zstream->z, Z_DEFAULT_COMPRESSION);
+	zstream->type = type;
+
+	if (type == GIT_ZSTREAM_INFLATE)
+		zstream->zerr = inflateInit(&zstream->z);
+	else
+		zstream->zerr = deflateInit(&zstream->z, Z_DEFAULT_COMPRESSION);
+
 	return zstream_seterr(zstream);
 }
 
 void git_zstream_free(git_zstream *zstream)
 {
-	deflateEnd(&zstream->z);
+	if (zstream->type == GIT_ZSTREAM_INFLATE)
+		inflateEnd(&zstream->z);
+	else
+		deflateEnd(&zstream->z);
+
+#ifdef GIT_LIBDEFLATE
+	if (zstream->decompressor) {
+		libdeflate_free_decompressor(zstream->decompressor);
+		zstream->decompressor = NULL;
+	}
+#endif
 }
 
 void git_zstream_reset(git_zstream *zstream)
 {
-	deflateReset(&zstream->z);
+	if (zstream->type == GIT_ZSTREAM_INFLATE)
+		inflateReset(&zstream->z);
+	else
+		deflateReset(&zstream->z);
 	zstream->in = NULL;
 	zstream->in_len = 0;
 	zstream->zerr = Z_STREAM_END;
@@ -60,6 +83,11 @@ bool git_zstream_done(git_zstream *zstream)
 	return (!zstream->in_len && zstream->zerr == Z_STREAM_END);
 }
 
+bool git_zstream_eos(git_zstream *zstream)
+{
+	return zstream->zerr == Z_STREAM_END;
+}
+
 size_t git_zstream_suggest_output_len(git_zstream *zstream)
 {
 	if (zstream->in_len > ZSTREAM_BUFFER_SIZE)
@@ -96,11 +124,20 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 			zstream->z.avail_out = INT_MAX;
 		out_queued = (size_t)zstream->z.avail_out;
 
-		/* compress next chunk */
-		zstream->zerr = deflate(&zstream->z, zflush);
+		/* compress or decompress next chunk */
+		if (zstream->type == GIT_ZSTREAM_INFLATE) {
+			zstream->zerr = inflate(&zstream->z, Z_SYNC_FLUSH);
 
-		if (zstream->zerr == Z_STREAM_ERROR)
-			return zstream_seterr(zstream);
+			if (zstream->zerr == Z_NEED_DICT)
+				zstream->zerr = Z_DATA_ERROR;
+			if (zstream->zerr < 0 && zstream->zerr != Z_BUF_ERROR)
+				return zstream_seterr(zstream);
+		} else {
+			zstream->zerr = deflate(&zstream->z, zflush);
+
+			if (zstream->zerr == Z_STREAM_ERROR)
+				return zstream_seterr(zstream);
+		}
 
 		out_used = (out_queued - zstream->z.avail_out);
 		out_remain -= out_used;
@@ -109,10 +146,18 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 		in_used = (in_queued - zstream->z.avail_in);
 		zstream->in_len -= in_used;
 		zstream->in += in_used;
+
+		/* inflate needs more input to go on */
+		if (zstream->type == GIT_ZSTREAM_INFLATE &&
+			zstream->zerr == Z_BUF_ERROR) {
+			zstream->zerr = Z_OK;
+			break;
+		}
 	}
 
 	/* either we finished the input or we did not flush the data */
-	assert(zstream->in_len > 0 || zflush == Z_FINISH);
+	assert(zstream->type == GIT_ZSTREAM_INFLATE ||
+		zstream->in_len > 0 || zflush == Z_FINISH);
 
 	/* set out_size to number of bytes actually written to output */
 	*out_len = *out_len - out_remain;
@@ -125,7 +170,7 @@ int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len)
 	git_zstream zs = GIT_ZSTREAM_INIT;
 	int error = 0;
 
-	if ((error = git_zstream_init(&zs)) < 0)
+	if ((error = git_zstream_init(&zs, GIT_ZSTREAM_DEFLATE)) < 0)
 		return error;
 
 	if ((error = git_zstream_set_input(&zs, in, in_len)) < 0)
@@ -154,3 +199,180 @@ done:
 	git_zstream_free(&zs);
 	return error;
 }
+
+#ifdef GIT_LIBDEFLATE
+
+/*
+ * libdeflate inflates a whole buffer at once, much faster than zlib can;
+ * it is used when all of the compressed data is in memory. Deflating
+ * stays with zlib, so that what we write does not depend on the build.
+ */
+
+static int libdeflate_seterr(enum libdeflate_result result)
+{
+	switch (result) {
+	case LIBDEFLATE_SUCCESS:
+		return 0;
+	case LIBDEFLATE_SHORT_OUTPUT:
+	case LIBDEFLATE_INSUFFICIENT_SPACE:
+		giterr_set(GITERR_ZLIB, "Inflated data has an unexpected size");
+		return -1;
+	default:
+		giterr_set(GITERR_ZLIB, "Compressed data is invalid or truncated");
+		return GIT_EBUFS;
+	}
+}
+
+static struct libdeflate_decompressor *zstream_decompressor(git_zstream *zs)
+{
+	if (!zs->decompressor &&
+		(zs->decompressor = libdeflate_alloc_decompressor()) == NULL)
+		giterr_set_oom();
+
+	return zs->decompressor;
+}
+
+int git_zstream_inflatebuf(git_buf *out, const void *in, size_t in_len)
+{
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result result;
+	size_t step = max(in_len * 4, 1024), written = 0;
+	int error = 0;
+
+	if ((d = zstream_decompressor(&zs)) == NULL)
+		return -1;
+
+	do {
+		if ((error = git_buf_grow(out, out->size + step)) < 0)
+			goto done;
+
+		result = libdeflate_zlib_decompress(d, in, in_len,
+			out->ptr + out->size, out->asize - out->size - 1, &written);
+		step *= 2;
+	} while (result == LIBDEFLATE_INSUFFICIENT_SPACE);
+
+	if ((error = libdeflate_seterr(result)) < 0) {
+		if (error == GIT_EBUFS)
+			error = -1;
+		goto done;
+	}
+
+	out->size += written;
+	out->ptr[out->size] = '\0';
+
+done:
+	git_zstream_free(&zs);
+	return error;
+}
+
+int git_zstream_inflate_exact(
+	git_zstream *zstream,
+	void *out, size_t out_len, size_t *in_used, const void *in, size_t in_len)
+{
+	struct libdeflate_decompressor *d;
+	enum libdeflate_result result;
+	size_t used, written;
+
+	if ((d = zstream_decompressor(zstream)) == NULL)
+		return -1;
+
+	result = libdeflate_zlib_decompress_ex(
+		d, in, in_len, out, out_len + 1, &used, &written);
+
+	if (result == LIBDEFLATE_SUCCESS && written != out_len)
+		result = LIBDEFLATE_SHORT_OUTPUT;
+
+	if (result == LIBDEFLATE_SUCCESS && in_used)
+		*in_used = used;
+
+	return libdeflate_seterr(result);
+}
+
+#else
+
+int git_zstream_inflatebuf(git_buf *out, const void *in, size_t in_len)
+{
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	int error = 0;
+
+	if ((error = git_zstream_init(&zs, GIT_ZSTREAM_INFLATE)) < 0)
+		return error;
+
+	if ((error = git_zstream_set_input(&zs, in, in_len)) < 0)
+		goto done;
+
+	while (!git_zstream_eos(&zs)) {
+		size_t step = max(in_len * 2, 1024), written;
+
+		if ((error = git_buf_grow(out, out->size + step)) < 0)
+			goto done;
+
+		written = out->asize - out->size - 1;
+
+		if ((error = git_zstream_get_output(
+				out->ptr + out->size, &written, &zs)) < 0)
+			goto done;
+
+		out->size += written;
+
+		if (!written && !git_zstream_eos(&zs)) {
+			giterr_set(GITERR_ZLIB, "Compressed data is truncated");
+			error = -1;
+			goto done;
+		}
+	}
+
+	out->ptr[out->size] = '\0';
+
+done:
+	git_zstream_free(&zs);
+	return error;
+}
+
+int git_zstream_inflate_exact(
+	git_zstream *zstream,
+	void *out, size_t out_len, size_t *in_used, const void *in, size_t in_len)
+{
+	z_stream z;
+	int zerr;
+
+	GIT_UNUSED(zstream);
+
+	memset(&z, 0, sizeof(z));
+
+	if (inflateInit(&z) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to initialize zlib");
+		return -1;
+	}
+
+	z.next_in = (Bytef *)in;
+	z.avail_in = (uInt)min(in_len, (size_t)UINT_MAX);
+	z.next_out = out;
+	z.avail_out = (uInt)out_len + 1;
+
+	zerr = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+
+	if (zerr == Z_STREAM_END && z.total_out == out_len) {
+		if (in_used)
+			*in_used = (size_t)z.total_in;
+		return 0;
+	}
+
+	if (zerr == Z_BUF_ERROR && z.avail_in == 0 && z.avail_out > 0) {
+		giterr_set(GITERR_ZLIB, "Compressed data is truncated");
+		return GIT_EBUFS;
+	}
+
+	if (zerr == Z_STREAM_END || zerr == Z_BUF_ERROR)
+		giterr_set(GITERR_ZLIB, "Inflated data has an unexpected size");
+	else if (z.msg)
+		giterr_set(GITERR_ZLIB, z.msg);
+	else
+		giterr_set(GITERR_ZLIB, "Failed to inflate data");
+
+	return -1;
+}
+
+#endif
@@ -12,28 +12,67 @@
 #include "common.h"
 #include "buffer.h"
 
+typedef enum {
+	GIT_ZSTREAM_INFLATE,
+	GIT_ZSTREAM_DEFLATE,
+} git_zstream_t;
+
+#ifdef GIT_LIBDEFLATE
+struct libdeflate_decompressor;
+#endif
+
 typedef struct {
 	z_stream z;
+	git_zstream_t type;
 	const char *in;
 	size_t in_len;
 	int zerr;
+#ifdef GIT_LIBDEFLATE
+	struct libdeflate_decompressor *decompressor;
+#endif
 } git_zstream;
 
 #define GIT_ZSTREAM_INIT {{0}}
 
-int git_zstream_init(git_zstream *zstream);
+int git_zstream_init(git_zstream *zstream, git_zstream_t type);
 void git_zstream_free(git_zstream *zstream);
 
 int git_zstream_set_input(git_zstream *zstream, const void *in, size_t in_len);
 
 size_t git_zstream_suggest_output_len(git_zstream *zstream);
 
+/*
+ * Produce up to `*out_len` bytes of output. When inflating, this stops
+ * early if the input runs out before the end of the stream; the caller
+ * can then provide more with `git_zstream_set_input`. `zstream->in_len`
+ * is what is left of the input.
+ */
 int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream);
 
+/* All the input has been used, and the stream is complete */
 bool git_zstream_done(git_zstream *zstream);
 
+/* The end of the stream has been reached; there may be input left after it */
+bool git_zstream_eos(git_zstream *zstream);
+
 void git_zstream_reset(git_zstream *zstream);
 
 int git_zstream_deflatebuf(git_buf *out, const void *in, size_t in_len);
+int git_zstream_inflatebuf(git_buf *out, const void *in, size_t in_len);
+
+/*
+ * Inflate a whole stream of `in_len` bytes at most, which must inflate to
+ * exactly `out_len` bytes. `out` must have room for one more byte, used to
+ * detect data that is longer than expected. The number of input bytes the
+ * stream took is stored in `in_used`, if given. This returns GIT_EBUFS
+ * (with an error set) when the stream does not end within the input.
+ *
+ * `zstream` keeps the decompressor between calls, so that inflating many
+ * objects does not set one up for each. It needs no `git_zstream_init`,
+ * but must be freed with `git_zstream_free`.
+ */
+int git_zstream_inflate_exact(
+	git_zstream *zstream,
+	void *out, size_t out_len, size_t *in_used, const void *in, size_t in_len);
 
 #endif /* INCLUDE_zstream_h__ */
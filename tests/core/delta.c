@@ -0,0 +1,127 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "delta.h"
+#include "delta-apply.h"
+#include "cpu.h"
+
+static unsigned int features;
+
+void test_core_delta__initialize(void)
+{
+	features = git_cpu__features;
+}
+
+void test_core_delta__cleanup(void)
+{
+	git_cpu__features = features;
+}
+
+/* Some text, and a copy of it with bytes changed, inserted and removed */
+static void make_buffers(
+	git_buf *base, git_buf *target, size_t len, unsigned int seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		git_buf_putc(base, "abcdefgh \n"[(seed >> 16) % 10]);
+	}
+
+	for (i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+
+		switch ((seed >> 16) % 500) {
+		case 0:
+			git_buf_putc(target, 'X');
+			break;
+		case 1:
+			git_buf_puts(target, "inserted");
+			/* fall through */
+		default:
+			git_buf_putc(target, base->ptr[i]);
+			break;
+		case 2:
+			break;
+		}
+	}
+
+	cl_assert(!git_buf_oom(base) && !git_buf_oom(target));
+}
+
+static void assert_delta_applies(
+	git_buf *delta, git_buf *base, git_buf *target)
+{
+	git_rawobj result;
+
+	cl_git_pass(git__delta_apply(&result,
+		(const unsigned char *)base->ptr, base->size,
+		(const unsigned char *)delta->ptr, delta->size));
+	cl_assert_equal_i(target->size, result.len);
+	cl_assert(memcmp(target->ptr, result.data, result.len) == 0);
+
+	git__free(result.data);
+}
+
+static void create_delta(
+	git_buf *out, git_buf *base, git_buf *target, unsigned int cpu_features)
+{
+	void *delta;
+	unsigned long delta_len;
+
+	git_cpu__features = cpu_features;
+
+	cl_assert(delta = git_delta(
+		base->ptr, base->size, target->ptr, target->size, &delta_len, 0));
+	cl_git_pass(git_buf_set(out, delta, delta_len));
+	git__free(delta);
+
+	assert_delta_applies(out, base, target);
+}
+
+void test_core_delta__kernels_create_the_same_delta(void)
+{
+	git_buf base = GIT_BUF_INIT, target = GIT_BUF_INIT,
+		scalar = GIT_BUF_INIT, sse2 = GIT_BUF_INIT, avx2 = GIT_BUF_INIT;
+	size_t sizes[] = { 17, 100, 131, 1000, 4099, 100000 };
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		make_buffers(&base, &target, sizes[i], (unsigned int)i);
+
+		create_delta(&scalar, &base, &target, 0);
+		create_delta(&sse2, &base, &target,
+			features & GIT_CPU_SSE2);
+		create_delta(&avx2, &base, &target,
+			features & (GIT_CPU_SSE2 | GIT_CPU_AVX2));
+
+		cl_assert_equal_i(scalar.size, sse2.size);
+		cl_assert(memcmp(scalar.ptr, sse2.ptr, scalar.size) == 0);
+		cl_assert_equal_i(scalar.size, avx2.size);
+		cl_assert(memcmp(scalar.ptr, avx2.ptr, scalar.size) == 0);
+
+		git_buf_clear(&base);
+		git_buf_clear(&target);
+	}
+
+	git_buf_free(&base);
+	git_buf_free(&target);
+	git_buf_free(&scalar);
+	git_buf_free(&sse2);
+	git_buf_free(&avx2);
+}
+
+void test_core_delta__identical_buffers(void)
+{
+	git_buf base = GIT_BUF_INIT, delta = GIT_BUF_INIT;
+
+	make_buffers(&base, &delta, 10000, 42);
+	git_buf_clear(&delta);
+
+	create_delta(&delta, &base, &base, git_cpu__features);
+
+	/* the header, and copies of at most 64k each */
+	cl_assert(delta.size < 16);
+
+	git_buf_free(&base);
+	git_buf_free(&delta);
+}
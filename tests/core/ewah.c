@@ -0,0 +1,66 @@
+#include "clar_libgit2.h"
+#include "ewah.h"
+
+static void assert_roundtrip(git_bitvec *bv, size_t length)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_bitvec decoded;
+	git_ewah ewah;
+	size_t i, parsed;
+
+	cl_git_pass(git_ewah_write(&buf, bv));
+	cl_git_pass(git_ewah_parse(&ewah, &parsed,
+		(const unsigned char *)git_buf_cstr(&buf), git_buf_len(&buf)));
+	cl_assert_equal_sz(git_buf_len(&buf), parsed);
+
+	cl_git_pass(git_bitvec_init(&decoded, length));
+	cl_git_pass(git_ewah_or(&decoded, &ewah));
+
+	for (i = 0; i < length; ++i)
+		cl_assert_equal_b(git_bitvec_get(bv, i), git_bitvec_get(&decoded, i));
+
+	git_bitvec_free(&decoded);
+	git_buf_free(&buf);
+}
+
+void test_core_ewah__empty(void)
+{
+	git_bitvec bv;
+
+	cl_git_pass(git_bitvec_init(&bv, 100));
+	assert_roundtrip(&bv, 100);
+	git_bitvec_free(&bv);
+}
+
+void test_core_ewah__literals(void)
+{
+	git_bitvec bv;
+	size_t i;
+
+	cl_git_pass(git_bitvec_init(&bv, 1000));
+	for (i = 0; i < 1000; ++i)
+		if (i % 3 == 0 || i % 7 == 0)
+			git_bitvec_set(&bv, i, true);
+
+	assert_roundtrip(&bv, 1000);
+	git_bitvec_free(&bv);
+}
+
+void test_core_ewah__runs(void)
+{
+	git_bitvec bv;
+	size_t i;
+
+	cl_git_pass(git_bitvec_init(&bv, 10000));
+
+	/* ones, zeroes, a few literal words, then ones up to the end */
+	for (i = 0; i < 640; ++i)
+		git_bitvec_set(&bv, i, true);
+	for (i = 5000; i < 5200; i += 5)
+		git_bitvec_set(&bv, i, true);
+	for (i = 6400; i < 9999; ++i)
+		git_bitvec_set(&bv, i, true);
+
+	assert_roundtrip(&bv, 10000);
+	git_bitvec_free(&bv);
+}
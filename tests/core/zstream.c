@@ -48,7 +48,7 @@ void test_core_zstream__basic(void)
 	char out[128];
 	size_t outlen = sizeof(out);
 
-	cl_git_pass(git_zstream_init(&z));
+	cl_git_pass(git_zstream_init(&z, GIT_ZSTREAM_DEFLATE));
 	cl_git_pass(git_zstream_set_input(&z, data, strlen(data) + 1));
 	cl_git_pass(git_zstream_get_output(out, &outlen, &z));
 	cl_assert(git_zstream_done(&z));
@@ -93,7 +93,7 @@ static void compress_input_various_ways(git_buf *input)
 		}
 		cl_assert(use_fixed_size <= fixed_size);
 
-		cl_git_pass(git_zstream_init(&zs));
+		cl_git_pass(git_zstream_init(&zs, GIT_ZSTREAM_DEFLATE));
 		cl_git_pass(git_zstream_set_input(&zs, input->ptr, input->size));
 
 		while (!git_zstream_done(&zs)) {
@@ -141,3 +141,75 @@ void test_core_zstream__big_data(void)
 
 	git_buf_free(&in);
 }
+
+void test_core_zstream__inflate(void)
+{
+	git_buf in = GIT_BUF_INIT, deflated = GIT_BUF_INIT, out = GIT_BUF_INIT;
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	char chunk[100];
+	size_t i, written;
+
+	while (in.size < 100000)
+		cl_git_pass(git_buf_put(&in, BIG_STRING_PART, strlen(BIG_STRING_PART)));
+	cl_git_pass(git_zstream_deflatebuf(&deflated, in.ptr, in.size));
+
+	/* the whole buffer at once */
+	cl_git_pass(git_zstream_inflatebuf(&out, deflated.ptr, deflated.size));
+	cl_assert_equal_sz(in.size, out.size);
+	cl_assert(!memcmp(in.ptr, out.ptr, in.size));
+	git_buf_clear(&out);
+
+	/* input and output a little at a time */
+	cl_git_pass(git_zstream_init(&zs, GIT_ZSTREAM_INFLATE));
+
+	for (i = 0; !git_zstream_eos(&zs); i += 7) {
+		size_t len = min(7, deflated.size - i);
+
+		cl_assert(i < deflated.size);
+		cl_git_pass(git_zstream_set_input(&zs, deflated.ptr + i, len));
+
+		do {
+			written = sizeof(chunk);
+			cl_git_pass(git_zstream_get_output(chunk, &written, &zs));
+			cl_git_pass(git_buf_put(&out, chunk, written));
+		} while (written == sizeof(chunk));
+	}
+
+	git_zstream_free(&zs);
+
+	cl_assert_equal_sz(in.size, out.size);
+	cl_assert(!memcmp(in.ptr, out.ptr, in.size));
+
+	git_buf_free(&in);
+	git_buf_free(&deflated);
+	git_buf_free(&out);
+}
+
+void test_core_zstream__inflate_exact(void)
+{
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	git_buf deflated = GIT_BUF_INIT;
+	char out[128];
+	size_t len = strlen(data), used;
+
+	cl_git_pass(git_zstream_deflatebuf(&deflated, data, len));
+	cl_git_pass(git_buf_puts(&deflated, "trailing data"));
+
+	cl_git_pass(git_zstream_inflate_exact(&zs,
+		out, len, &used, deflated.ptr, deflated.size));
+	cl_assert(!memcmp(data, out, len));
+	cl_assert_equal_sz(deflated.size - strlen("trailing data"), used);
+
+	/* the data is not the expected size */
+	cl_git_fail(git_zstream_inflate_exact(&zs,
+		out, len - 1, NULL, deflated.ptr, deflated.size));
+	cl_git_fail(git_zstream_inflate_exact(&zs,
+		out, len + 1, NULL, deflated.ptr, deflated.size));
+
+	/* the input ends before the data does */
+	cl_assert_equal_i(GIT_EBUFS, git_zstream_inflate_exact(&zs,
+		out, len, NULL, deflated.ptr, used / 2));
+
+	git_zstream_free(&zs);
+	git_buf_free(&deflated);
+}
@@ -1586,3 +1586,36 @@ void test_diff_rename__by_config_doesnt_mess_with_whitespace_settings(void)
 	git_tree_free(tree1);
 	git_tree_free(tree2);
 }
+
+void test_diff_rename__exact_match_in_workdir(void)
+{
+	git_index *index;
+	git_diff *diff;
+	git_diff_options diffopts = GIT_DIFF_OPTIONS_INIT;
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	diff_expects exp;
+
+	cl_git_pass(p_rename("renames/ikeepsix.txt", "renames/ikeepsix2.txt"));
+	cl_git_pass(p_rename("renames/sixserving.txt", "renames/sixserving2.txt"));
+	cl_git_pass(p_rename("renames/untimely.txt", "renames/untimely2.txt"));
+	cl_git_append2file("renames/untimely2.txt", "and one more line\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	diffopts.flags = GIT_DIFF_INCLUDE_UNTRACKED;
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, index, &diffopts));
+
+	opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_FOR_UNTRACKED |
+		GIT_DIFF_FIND_EXACT_MATCH_ONLY;
+	cl_git_pass(git_diff_find_similar(diff, &opts));
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, diff_file_cb, NULL, NULL, &exp));
+	cl_assert_equal_i(4, exp.files);
+	cl_assert_equal_i(2, exp.file_status[GIT_DELTA_RENAMED]);
+	cl_assert_equal_i(1, exp.file_status[GIT_DELTA_DELETED]);
+	cl_assert_equal_i(1, exp.file_status[GIT_DELTA_UNTRACKED]);
+
+	git_diff_free(diff);
+	git_index_free(index);
+}
@@ -1580,3 +1580,43 @@ void test_diff_workdir__can_update_index(void)
 
 	git_diff_free(diff);
 }
+
+void test_diff_workdir__touched_files_are_unmodified(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_diff *diff = NULL;
+	const git_diff_delta *delta;
+	size_t i, modified = 0, unmodified = 0;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	/* touch all the files so stat times are different */
+	{
+		git_buf path = GIT_BUF_INIT;
+		cl_git_pass(git_buf_sets(&path, "status"));
+		cl_git_pass(git_path_direach(&path, 0, touch_file, NULL));
+		git_buf_free(&path);
+	}
+
+	/* the workdir is the old side of a reversed diff */
+	opts.flags |= GIT_DIFF_INCLUDE_UNMODIFIED | GIT_DIFF_REVERSE;
+
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, NULL, &opts));
+
+	for (i = 0; i < git_diff_num_deltas(diff); i++) {
+		delta = git_diff_get_delta(diff, i);
+
+		if (delta->status == GIT_DELTA_MODIFIED)
+			modified++;
+		else if (delta->status == GIT_DELTA_UNMODIFIED) {
+			unmodified++;
+			cl_assert((delta->old_file.flags & GIT_DIFF_FLAG_VALID_ID) != 0);
+			cl_assert(git_oid_equal(&delta->old_file.id, &delta->new_file.id));
+		}
+	}
+
+	cl_assert_equal_sz(4, modified);
+	cl_assert_equal_sz(5, unmodified);
+
+	git_diff_free(diff);
+}
@@ -0,0 +1,393 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/commit_graph.h>
+
+#include "commit_graph.h"
+#include "fileops.h"
+#include "path.h"
+
+/* What git writes for testrepo.git and push_src; the fixtures themselves
+ * have no commit-graph, so that everything else walks the commits.
+ */
+#define TESTREPO_GRAPH "commit-graph/testrepo.commit-graph"
+#define PUSH_SRC_GRAPH "commit-graph/push_src.commit-graph"
+
+void test_graph_commitgraph__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static git_repository *sandbox_with_graph(void)
+{
+	git_repository *repo = cl_git_sandbox_init("testrepo.git");
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_futils_cp(cl_fixture(TESTREPO_GRAPH), path.ptr, 0444));
+	git_buf_free(&path);
+
+	return repo;
+}
+
+void test_graph_commitgraph__parse(void)
+{
+	git_repository *repo;
+	struct git_commit_graph_file *file;
+	struct git_commit_graph_entry e, parent;
+	git_oid id;
+	git_buf commit_graph_path = GIT_BUF_INIT;
+
+	repo = sandbox_with_graph();
+	cl_git_pass(git_buf_joinpath(&commit_graph_path, git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_file_open(&file, git_buf_cstr(&commit_graph_path)));
+	cl_assert_equal_i(git_commit_graph_file_needs_refresh(file, git_buf_cstr(&commit_graph_path)), 0);
+	cl_assert_equal_i(file->num_commits, 15);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(git_oid_cmp(&e.sha1, &id), 0);
+	cl_git_pass(git_oid_fromstr(&id, "418382dff1ffb8bdfba833f4d8bbcde58b1e7f47"));
+	cl_assert_equal_i(git_oid_cmp(&e.tree_oid, &id), 0);
+	cl_assert_equal_i(e.generation, 1);
+	cl_assert_equal_i(e.commit_time, 1273610423);
+	cl_assert_equal_i(e.parent_count, 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(git_oid_cmp(&e.sha1, &id), 0);
+	cl_assert_equal_i(e.generation, 5);
+	cl_assert_equal_i(e.parent_count, 2);
+
+	cl_git_pass(git_oid_fromstr(&id, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_i(git_oid_cmp(&parent.sha1, &id), 0);
+	cl_assert_equal_i(parent.generation, 4);
+
+	cl_git_pass(git_oid_fromstr(&id, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 1));
+	cl_assert_equal_i(git_oid_cmp(&parent.sha1, &id), 0);
+	cl_assert_equal_i(parent.generation, 3);
+
+	cl_assert_equal_i(git_commit_graph_entry_parent(&parent, file, &e, 2), GIT_ENOTFOUND);
+
+	/* Lookup by prefix */
+	cl_git_pass(git_oid_fromstrn(&id, "be3563a", 7));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, 7));
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_assert_equal_i(git_oid_cmp(&e.sha1, &id), 0);
+
+	git_commit_graph_file_free(file);
+	git_buf_free(&commit_graph_path);
+}
+
+void test_graph_commitgraph__parse_octopus_merge(void)
+{
+	struct git_commit_graph_file *file;
+	struct git_commit_graph_entry e, parent;
+	git_oid id;
+
+	cl_git_pass(git_commit_graph_file_open(&file,
+		cl_fixture(PUSH_SRC_GRAPH)));
+
+	cl_git_pass(git_oid_fromstr(&id, "951bbbb90e2259a4c8950db78946784fb53fcbce"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(e.parent_count, 3);
+
+	cl_git_pass(git_oid_fromstr(&id, "d9b63a88223d8367516f50bd131a5f7349b7f3e4"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_i(git_oid_cmp(&parent.sha1, &id), 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "27b7ce66243eb1403862d05f958c002312df173d"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 1));
+	cl_assert_equal_i(git_oid_cmp(&parent.sha1, &id), 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "fa38b91f199934685819bea316186d8b008c52a2"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 2));
+	cl_assert_equal_i(git_oid_cmp(&parent.sha1, &id), 0);
+
+	git_commit_graph_file_free(file);
+}
+
+void test_graph_commitgraph__corrupt(void)
+{
+	git_commit_graph_file file = {{{0}}};
+	git_buf contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&contents,
+		cl_fixture(TESTREPO_GRAPH)));
+
+	/* Truncating the Commit Data chunk makes the file inconsistent */
+	cl_git_fail(git_commit_graph_file_parse(&file,
+		(const unsigned char *)contents.ptr, contents.size / 2));
+
+	git_buf_free(&contents);
+}
+
+void test_graph_commitgraph__revwalk(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_oid id, expected;
+	int count = 0;
+
+	repo = sandbox_with_graph();
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_revwalk_push(walk, &id));
+
+	cl_git_pass(git_oid_fromstr(&expected, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_revwalk_next(&id, walk));
+	cl_assert_equal_i(git_oid_cmp(&id, &expected), 0);
+	count++;
+
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+
+	cl_assert_equal_i(count, 7);
+
+	git_revwalk_free(walk);
+}
+
+static void assert_graphs_equal(
+	const git_commit_graph_file *expected, const git_commit_graph_file *actual)
+{
+	git_commit_graph_entry e, a, e_parent, a_parent;
+	size_t i, j;
+
+	for (i = 0; i < expected->num_commits; ++i) {
+		cl_git_pass(git_commit_graph_entry_find(&e, expected, &expected->oid_lookup[i], GIT_OID_HEXSZ));
+		cl_git_pass(git_commit_graph_entry_find(&a, actual, &expected->oid_lookup[i], GIT_OID_HEXSZ));
+
+		cl_assert(git_oid_equal(&e.tree_oid, &a.tree_oid));
+		/* git can't parse the committer of 25afa... and records no time */
+		if (e.commit_time)
+			cl_assert_equal_i(e.commit_time, a.commit_time);
+		cl_assert_equal_i(e.generation, a.generation);
+		cl_assert_equal_i(e.parent_count, a.parent_count);
+
+		for (j = 0; j < e.parent_count; ++j) {
+			cl_git_pass(git_commit_graph_entry_parent(&e_parent, expected, &e, j));
+			cl_git_pass(git_commit_graph_entry_parent(&a_parent, actual, &a, j));
+			cl_assert(git_oid_equal(&e_parent.sha1, &a_parent.sha1));
+		}
+	}
+}
+
+static void push_all(git_revwalk *walk, const git_commit_graph_file *file)
+{
+	size_t i;
+
+	for (i = 0; i < file->num_commits; ++i)
+		cl_git_pass(git_revwalk_push(walk, &file->oid_lookup[i]));
+}
+
+static void assert_writer_matches_fixture(const char *repo_path, const char *graph_path)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit_graph_writer *w;
+	git_commit_graph_file *expected, actual = {{{0}}};
+	git_buf cgraph = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture(repo_path)));
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_commit_graph_file_open(&expected, cl_fixture(graph_path)));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	push_all(walk, expected);
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_dump(&cgraph, w, NULL));
+	cl_git_pass(git_commit_graph_file_parse(&actual,
+		(const unsigned char *)git_buf_cstr(&cgraph), git_buf_len(&cgraph)));
+	cl_assert_equal_i(expected->num_commits, actual.num_commits);
+	assert_graphs_equal(expected, &actual);
+
+	git_commit_graph_file_free(expected);
+	git_buf_free(&cgraph);
+	git_buf_free(&path);
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+	git_repository_free(repo);
+}
+
+void test_graph_commitgraph__writer(void)
+{
+	assert_writer_matches_fixture("testrepo.git", TESTREPO_GRAPH);
+	assert_writer_matches_fixture("push_src/.gitted", PUSH_SRC_GRAPH);
+}
+
+static size_t chain_length(git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT, chain = GIT_BUF_INIT;
+	size_t i, lines = 0;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo),
+		"objects/info/commit-graphs/commit-graph-chain"));
+	cl_git_pass(git_futils_readbuffer(&chain, git_buf_cstr(&path)));
+
+	for (i = 0; i < git_buf_len(&chain); ++i)
+		lines += (chain.ptr[i] == '\n');
+
+	git_buf_free(&path);
+	git_buf_free(&chain);
+	return lines;
+}
+
+void test_graph_commitgraph__writer_split(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit_graph *cgraph;
+	git_commit_graph_file *file, *expected;
+	git_commit_graph_entry e, parent;
+	git_commit_graph_writer_options opts = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_signature *sig;
+	git_commit *head;
+	git_tree *tree;
+	git_oid id, root;
+
+	cl_git_pass(git_commit_graph_file_open(&expected, cl_fixture(TESTREPO_GRAPH)));
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info/commit-graph"));
+	opts.split_strategy = GIT_COMMIT_GRAPH_SPLIT_STRATEGY_SPLIT;
+
+	/* A first layer with some older history */
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_oid_fromstr(&id, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_revwalk_push(walk, &id));
+	cl_git_pass(git_commit_graph_write(walk, &opts));
+	cl_assert_equal_sz(chain_length(repo), 1);
+
+	/* The rest of the history is bigger, and gets merged with it */
+	push_all(walk, expected);
+	cl_git_pass(git_commit_graph_write(walk, &opts));
+	cl_assert_equal_sz(chain_length(repo), 1);
+	cl_assert(!git_path_exists(git_buf_cstr(&path)));
+
+	/* Nothing new: nothing is written */
+	push_all(walk, expected);
+	cl_git_pass(git_commit_graph_write(walk, &opts));
+	cl_assert_equal_sz(chain_length(repo), 1);
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects"));
+	cl_git_pass(git_commit_graph_new(&cgraph, git_buf_cstr(&path), true));
+	cl_git_pass(git_commit_graph_get_file(&file, cgraph));
+	cl_assert_equal_i(file->num_commits, 15);
+	assert_graphs_equal(expected, file);
+	git_commit_graph_file_free(file);
+	git_commit_graph_free(cgraph);
+
+	/* A single new commit goes in a small layer of its own */
+	cl_git_pass(git_signature_now(&sig, "Someone", "someone@example.com"));
+	cl_git_pass(git_revparse_single((git_object **)&head, repo, "HEAD"));
+	cl_git_pass(git_commit_tree(&tree, head));
+	cl_git_pass(git_commit_create_v(&id, repo, NULL, sig, sig, NULL, "new commit\n",
+		tree, 1, head));
+
+	cl_git_pass(git_revwalk_push(walk, &id));
+	push_all(walk, expected);
+	cl_git_pass(git_commit_graph_write(walk, &opts));
+	cl_assert_equal_sz(chain_length(repo), 2);
+
+	cl_git_pass(git_commit_graph_new(&cgraph, git_buf_cstr(&path), true));
+	cl_git_pass(git_commit_graph_get_file(&file, cgraph));
+	cl_assert_equal_i(file->num_base_graphs, 1);
+	cl_assert_equal_i(file->num_commits, 1);
+	cl_assert_equal_i(file->num_commits_in_base, 15);
+	assert_graphs_equal(expected, file);
+
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(e.position, 15);
+	cl_assert_equal_i(e.parent_count, 1);
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert(git_oid_equal(&parent.sha1, git_commit_id(head)));
+	cl_assert(parent.position < 15);
+	cl_assert_equal_i(e.generation, parent.generation + 1);
+
+	/* The repository reads the chain */
+	cl_git_pass(git_oid_fromstr(&root, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_assert_equal_i(1, git_graph_descendant_of(repo, &id, &root));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &root, &id));
+
+	git_commit_graph_file_free(file);
+	git_commit_graph_free(cgraph);
+	git_commit_graph_file_free(expected);
+	git_tree_free(tree);
+	git_commit_free(head);
+	git_signature_free(sig);
+	git_revwalk_free(walk);
+	git_buf_free(&path);
+}
+
+void test_graph_commitgraph__refresh_keeps_files_in_use(void)
+{
+	git_repository *repo = sandbox_with_graph();
+	git_commit_graph *cgraph;
+	git_commit_graph_file *file, *other;
+	git_commit_graph_entry e;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects"));
+	cl_git_pass(git_commit_graph_new(&cgraph, git_buf_cstr(&path), true));
+	cl_git_pass(git_commit_graph_get_file(&file, cgraph));
+
+	cl_git_pass(git_buf_joinpath(&path, git_buf_cstr(&path), "info/commit-graph"));
+	cl_must_pass(p_unlink(git_buf_cstr(&path)));
+	git_commit_graph_refresh(cgraph);
+
+	/* the graph is gone, but the file we got is still there for us */
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_get_file(&other, cgraph));
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id, GIT_OID_HEXSZ));
+
+	git_commit_graph_file_free(file);
+	git_commit_graph_free(cgraph);
+	git_buf_free(&path);
+}
+
+void test_graph_commitgraph__topological_walk(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid ids[32], id;
+	size_t count = 0, time_count = 0, i, j, k;
+
+	repo = sandbox_with_graph();
+	cl_git_pass(git_revwalk_new(&walk, repo));
+
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	while (git_revwalk_next(&id, walk) == 0)
+		time_count++;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL);
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	while (git_revwalk_next(&ids[count], walk) == 0)
+		cl_assert(++count < ARRAY_SIZE(ids));
+
+	cl_assert_equal_sz(time_count, count);
+
+	/* Children always come before their parents */
+	for (i = 0; i < count; ++i) {
+		cl_git_pass(git_commit_lookup(&commit, repo, &ids[i]));
+
+		for (j = 0; j < git_commit_parentcount(commit); ++j) {
+			for (k = 0; k < i; ++k)
+				cl_assert(!git_oid_equal(&ids[k], git_commit_parent_id(commit, j)));
+		}
+
+		git_commit_free(commit);
+	}
+
+	git_revwalk_free(walk);
+}
@@ -354,3 +354,63 @@ void test_index_addall__callback_filtering(void)
 
 	git_index_free(index);
 }
+
+void test_index_addall__hashes_many_files(void)
+{
+	git_index *index;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	const git_index_entry *entry;
+	git_oid expected;
+	size_t i;
+
+	cl_git_pass(git_repository_init(&g_repo, TEST_DIR, false));
+
+	/* enough files for more than one batch, and one that is filtered */
+	for (i = 0; i < 70; i++) {
+		git_buf_clear(&path);
+		git_buf_clear(&content);
+		cl_git_pass(git_buf_printf(&path, TEST_DIR "/file%02d", (int)i));
+		cl_git_pass(git_buf_printf(&content, "contents of file %d\n", (int)i));
+		cl_git_mkfile(path.ptr, content.ptr);
+	}
+	cl_git_mkfile(TEST_DIR "/.gitattributes", "crlf.txt text eol=lf\n");
+	cl_git_mkfile(TEST_DIR "/crlf.txt", "one\r\ntwo\r\n");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_all(index, NULL, 0, NULL, NULL));
+	cl_assert_equal_sz(72, git_index_entrycount(index));
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+
+	for (i = 0; i < 70; i++) {
+		git_buf_clear(&path);
+		git_buf_clear(&content);
+		cl_git_pass(git_buf_printf(&path, "file%02d", (int)i));
+		cl_git_pass(git_buf_printf(&content, "contents of file %d\n", (int)i));
+
+		cl_git_pass(git_odb_hash(
+			&expected, content.ptr, content.size, GIT_OBJ_BLOB));
+
+		cl_assert((entry = git_index_get_bypath(index, path.ptr, 0)) != NULL);
+		cl_assert(git_oid_equal(&expected, &entry->id));
+
+		/* what was written is what is in the file */
+		cl_git_pass(git_odb_read(&obj, odb, &entry->id));
+		cl_assert_equal_sz(content.size, git_odb_object_size(obj));
+		cl_assert(!memcmp(content.ptr, git_odb_object_data(obj), content.size));
+		git_odb_object_free(obj);
+	}
+
+	cl_git_pass(git_odb_hash(&expected, "one\ntwo\n", 8, GIT_OBJ_BLOB));
+	cl_assert((entry = git_index_get_bypath(index, "crlf.txt", 0)) != NULL);
+	cl_assert(git_oid_equal(&expected, &entry->id));
+
+	check_status(g_repo, 72, 0, 0, 0, 0, 0, 0);
+
+	git_odb_free(odb);
+	git_index_free(index);
+	git_buf_free(&content);
+	git_buf_free(&path);
+}
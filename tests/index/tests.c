@@ -563,3 +563,91 @@ void test_index_tests__reload_while_ignoring_case(void)
 
 	git_index_free(index);
 }
+
+static int add_blob_entry(git_index *index, const char *path, int stage)
+{
+	git_index_entry entry;
+
+	memset(&entry, 0x0, sizeof(entry));
+	entry.path = path;
+	entry.mode = GIT_FILEMODE_BLOB;
+	GIT_IDXENTRY_STAGE_SET(&entry, stage);
+	cl_git_pass(git_oid_fromstr(&entry.id, "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391"));
+
+	return git_index_add(index, &entry);
+}
+
+void test_index_tests__lookups_follow_changes(void)
+{
+	git_index *index;
+	size_t pos;
+
+	cl_git_pass(git_index_new(&index));
+
+	cl_git_pass(add_blob_entry(index, "a/b/c", 0));
+	cl_git_pass(add_blob_entry(index, "a/d", 0));
+	cl_git_pass(add_blob_entry(index, "e", 1));
+	cl_git_pass(add_blob_entry(index, "e", 3));
+
+	cl_assert(git_index_get_bypath(index, "a/b/c", 0) != NULL);
+	cl_assert(git_index_get_bypath(index, "a/b/c", 1) == NULL);
+	cl_assert(git_index_get_bypath(index, "a/b", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "e", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "e", 3) != NULL);
+
+	cl_git_pass(git_index_find(&pos, index, "e"));
+	cl_assert_equal_i(1, git_index_entry_stage(git_index_get_byindex(index, pos)));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_index_find(&pos, index, "a"));
+
+	/* "a/b" is a directory at stage 0 while "a/b/c" is in it; the
+	 * failed add replaces it all the same
+	 */
+	cl_git_fail(add_blob_entry(index, "a/b", 0));
+	cl_assert(git_index_get_bypath(index, "a/b/c", 0) == NULL);
+	cl_git_pass(add_blob_entry(index, "a/b", 0));
+	cl_git_pass(add_blob_entry(index, "a/b", 1));
+	cl_assert(git_index_get_bypath(index, "a/b", 0) != NULL);
+
+	cl_git_pass(git_index_remove_directory(index, "a", 0));
+	cl_assert(git_index_get_bypath(index, "a/b", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "a/d", 0) == NULL);
+	cl_assert(git_index_get_bypath(index, "a/b", 1) != NULL);
+	cl_git_pass(add_blob_entry(index, "a", 0));
+
+	cl_git_pass(git_index_clear(index));
+	cl_assert(git_index_get_bypath(index, "a", 0) == NULL);
+	cl_assert_equal_i(GIT_ENOTFOUND, git_index_find(NULL, index, "e"));
+
+	git_index_free(index);
+}
+
+void test_index_tests__lookups_while_ignoring_case(void)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	unsigned int caps;
+
+	cl_git_pass(git_index_new(&index));
+	caps = git_index_caps(index);
+	cl_git_pass(git_index_set_caps(index, caps & ~GIT_INDEXCAP_IGNORE_CASE));
+
+	cl_git_pass(add_blob_entry(index, "dir/File", 0));
+	cl_git_pass(add_blob_entry(index, "dir/file", 0));
+	cl_assert(git_index_get_bypath(index, "DIR/FILE", 0) == NULL);
+
+	/* entries which only differ in case can still be found one by one */
+	cl_git_pass(git_index_set_caps(index, caps | GIT_INDEXCAP_IGNORE_CASE));
+	cl_assert_equal_sz(2, git_index_entrycount(index));
+	cl_assert(git_index_get_bypath(index, "DIR/FILE", 0) != NULL);
+	cl_git_pass(git_index_find(NULL, index, "Dir/File"));
+
+	cl_git_pass(git_index_remove(index, "dir/FILE", 0));
+	cl_assert_equal_sz(1, git_index_entrycount(index));
+	cl_assert((entry = git_index_get_bypath(index, "dir/FILE", 0)) != NULL);
+	cl_assert(entry == git_index_get_byindex(index, 0));
+
+	cl_git_pass(git_index_remove(index, "dir/FILE", 0));
+	cl_assert(git_index_get_bypath(index, "dir/FILE", 0) == NULL);
+
+	git_index_free(index);
+}
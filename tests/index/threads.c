@@ -0,0 +1,132 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "git2/sys/index.h"
+
+#define BIG_INDEX_PATH "big_index"
+#define BIG_INDEX_ENTRIES 25000
+
+static git_index *g_index;
+
+void test_index_threads__initialize(void)
+{
+	git_index_entry entry;
+	git_oid id;
+	char path[64];
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_git_pass(git_index_open(&g_index, BIG_INDEX_PATH));
+
+	for (i = 0; i < BIG_INDEX_ENTRIES; i++) {
+		memset(&entry, 0x0, sizeof(entry));
+		p_snprintf(path, sizeof(path), "dir_%03d/subdir_%02d/file_%05d.c",
+			i / 1000, (i / 50) % 20, i);
+
+		entry.path = path;
+		entry.mode = GIT_FILEMODE_BLOB;
+		entry.file_size = i;
+		git_oid_cpy(&entry.id, &id);
+
+		cl_git_pass(git_index_add(g_index, &entry));
+	}
+
+	/* An extension after the offset table */
+	cl_git_pass(git_index_reuc_add(g_index, "dir_000/conflicted",
+		0100644, &id, 0100644, &id, 0100644, &id));
+}
+
+void test_index_threads__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+
+	p_unlink(BIG_INDEX_PATH);
+}
+
+static void assert_big_index_reads(unsigned int nr_threads)
+{
+	git_index *index;
+	size_t i;
+
+	cl_git_pass(git_index_open(&index, BIG_INDEX_PATH));
+	git_index_set_threads(index, nr_threads);
+	cl_git_pass(git_index_read(index, true));
+
+	cl_assert_equal_i(git_index_version(g_index), git_index_version(index));
+	cl_assert_equal_sz(BIG_INDEX_ENTRIES, git_index_entrycount(index));
+	cl_assert_equal_i(1, git_index_reuc_entrycount(index));
+
+	for (i = 0; i < BIG_INDEX_ENTRIES; i++) {
+		const git_index_entry *expected = git_index_get_byindex(g_index, i);
+		const git_index_entry *actual = git_index_get_byindex(index, i);
+
+		cl_assert_equal_s(expected->path, actual->path);
+		cl_assert_equal_sz((size_t)expected->file_size, (size_t)actual->file_size);
+		cl_assert(git_oid_equal(&expected->id, &actual->id));
+	}
+
+	git_index_free(index);
+}
+
+static bool buf_contains(git_buf *buf, const char *sig)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= buf->size; i++)
+		if (memcmp(buf->ptr + i, sig, 4) == 0)
+			return true;
+
+	return false;
+}
+
+static void assert_has_offset_table(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	const char *eoie;
+
+	cl_git_pass(git_futils_readbuffer(&buf, BIG_INDEX_PATH));
+	cl_assert(buf.size > 20 + 32);
+
+	/* EOIE is the last extension, right before the checksum */
+	eoie = buf.ptr + buf.size - 20 - 32;
+	cl_assert(memcmp(eoie, "EOIE", 4) == 0);
+	cl_assert(buf_contains(&buf, "IEOT"));
+
+	git_buf_free(&buf);
+}
+
+void test_index_threads__read_v2(void)
+{
+	cl_git_pass(git_index_write(g_index));
+	assert_has_offset_table();
+
+	assert_big_index_reads(1);
+	assert_big_index_reads(4);
+}
+
+void test_index_threads__read_v4(void)
+{
+	cl_git_pass(git_index_set_version(g_index, 4));
+	cl_git_pass(git_index_write(g_index));
+	assert_has_offset_table();
+
+	assert_big_index_reads(1);
+	assert_big_index_reads(4);
+}
+
+void test_index_threads__small_index_has_no_offset_table(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	size_t i;
+
+	for (i = git_index_entrycount(g_index); i > 100; i--)
+		cl_git_pass(git_index_remove(g_index,
+			git_index_get_byindex(g_index, i - 1)->path, 0));
+
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_futils_readbuffer(&buf, BIG_INDEX_PATH));
+	cl_assert(!buf_contains(&buf, "IEOT"));
+	cl_assert(!buf_contains(&buf, "EOIE"));
+	git_buf_free(&buf);
+}
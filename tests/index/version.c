@@ -0,0 +1,110 @@
+#include "clar_libgit2.h"
+#include "index.h"
+
+#define TEST_INDEX_V2_PATH cl_fixture("gitgit.index")
+#define TEST_INDEX_V4_PATH cl_fixture("gitgit-v4.index")
+
+static git_index *g_index;
+
+void test_index_version__cleanup(void)
+{
+	git_index_free(g_index);
+	g_index = NULL;
+
+	cl_fixture_cleanup("gitgit.index");
+	cl_fixture_cleanup("gitgit-v4.index");
+}
+
+static void assert_same_entries(git_index *a, git_index *b)
+{
+	size_t i;
+
+	cl_assert_equal_sz(git_index_entrycount(a), git_index_entrycount(b));
+
+	for (i = 0; i < git_index_entrycount(a); i++) {
+		const git_index_entry *ea = git_index_get_byindex(a, i);
+		const git_index_entry *eb = git_index_get_byindex(b, i);
+
+		cl_assert_equal_s(ea->path, eb->path);
+		cl_assert(git_oid_equal(&ea->id, &eb->id));
+		cl_assert_equal_i(ea->mode, eb->mode);
+		cl_assert_equal_i(ea->flags, eb->flags);
+		cl_assert_equal_i((int)ea->mtime.seconds, (int)eb->mtime.seconds);
+		cl_assert_equal_sz((size_t)ea->file_size, (size_t)eb->file_size);
+	}
+}
+
+static git_off_t index_file_size(const char *path)
+{
+	struct stat st;
+
+	cl_must_pass(p_stat(path, &st));
+	return st.st_size;
+}
+
+void test_index_version__read_v4(void)
+{
+	git_index *v2;
+
+	cl_git_pass(git_index_open(&g_index, TEST_INDEX_V4_PATH));
+	cl_assert_equal_i(4, git_index_version(g_index));
+
+	cl_git_pass(git_index_open(&v2, TEST_INDEX_V2_PATH));
+	cl_assert_equal_i(2, git_index_version(v2));
+
+	assert_same_entries(v2, g_index);
+
+	git_index_free(v2);
+}
+
+void test_index_version__write_v4(void)
+{
+	git_index *v2;
+
+	cl_fixture_sandbox("gitgit.index");
+
+	cl_git_pass(git_index_open(&g_index, "gitgit.index"));
+	cl_git_pass(git_index_set_version(g_index, 4));
+	cl_git_pass(git_index_write(g_index));
+	git_index_free(g_index);
+
+	cl_assert(index_file_size("gitgit.index") < index_file_size(TEST_INDEX_V2_PATH));
+
+	cl_git_pass(git_index_open(&g_index, "gitgit.index"));
+	cl_assert_equal_i(4, git_index_version(g_index));
+
+	cl_git_pass(git_index_open(&v2, TEST_INDEX_V2_PATH));
+	assert_same_entries(v2, g_index);
+
+	git_index_free(v2);
+}
+
+void test_index_version__write_v2_from_v4(void)
+{
+	git_index *v4;
+
+	cl_fixture_sandbox("gitgit-v4.index");
+
+	cl_git_pass(git_index_open(&g_index, "gitgit-v4.index"));
+	cl_git_pass(git_index_set_version(g_index, 2));
+	cl_git_pass(git_index_write(g_index));
+	git_index_free(g_index);
+
+	cl_git_pass(git_index_open(&g_index, "gitgit-v4.index"));
+	cl_assert_equal_i(2, git_index_version(g_index));
+
+	cl_git_pass(git_index_open(&v4, TEST_INDEX_V4_PATH));
+	assert_same_entries(v4, g_index);
+
+	git_index_free(v4);
+}
+
+void test_index_version__set_invalid_version(void)
+{
+	cl_git_pass(git_index_new(&g_index));
+	cl_assert_equal_i(2, git_index_version(g_index));
+
+	cl_git_fail(git_index_set_version(g_index, 1));
+	cl_git_fail(git_index_set_version(g_index, 5));
+	cl_assert_equal_i(2, git_index_version(g_index));
+}
@@ -14,6 +14,8 @@ void test_object_cache__cleanup(void)
 	g_repo = NULL;
 
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, (int)GIT_CACHE_EVICT_CLOCK);
 }
 
 static struct {
@@ -140,6 +142,93 @@ void test_object_cache__cache_no_blobs(void)
 	git_odb_free(odb);
 }
 
+void test_object_cache__clock_keeps_hot_objects(void)
+{
+	int i, count;
+	size_t hits, misses, evictions, prev_hits, prev_misses, prev_evictions;
+	git_oid oid;
+	git_odb_object *odb_obj;
+	git_object *obj;
+	git_odb *odb;
+
+	git_libgit2_opts(
+		GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)32767);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		cl_git_pass(git_oid_fromstr(&oid, g_data[i].sha));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+		git_object_free(obj);
+	}
+
+	count = (int)git_cache_size(&g_repo->objects);
+	cl_assert_equal_i(i, count);
+
+	/* Look one of them up again */
+	git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &prev_hits, &prev_misses, &prev_evictions);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions);
+	cl_assert_equal_sz(prev_hits + 1, hits);
+	cl_assert_equal_sz(prev_misses, misses);
+
+	/* Then overflow the cache with a new object */
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)0);
+
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_odb_read(&odb_obj, odb, &oid));
+	git_odb_object_free(odb_obj);
+
+	git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions);
+	cl_assert_equal_sz(prev_evictions + 8, evictions);
+	cl_assert_equal_i(count - 8 + 1, (int)git_cache_size(&g_repo->objects));
+
+	/* The one that was used again has survived */
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+	obj = git_cache_get_parsed(&g_repo->objects, &oid);
+	cl_assert(obj != NULL);
+	git_object_free(obj);
+
+	git_odb_free(odb);
+}
+
+void test_object_cache__stats_outlive_the_cache(void)
+{
+	size_t prev_hits, prev_misses, prev_evictions, hits, misses, evictions;
+	git_object *obj;
+	git_oid oid;
+
+	git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &prev_hits, &prev_misses, &prev_evictions);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	/* the hit of the repository's cache is still counted once it is gone */
+	git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions);
+	cl_assert(hits >= prev_hits + 1);
+	cl_assert(misses > prev_misses);
+	cl_assert(evictions >= prev_evictions);
+}
+
+void test_object_cache__eviction_policy(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, (int)GIT_CACHE_EVICT_RANDOM));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, (int)GIT_CACHE_EVICT_CLOCK));
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, 42));
+}
+
 static void *cache_parsed(void *arg)
 {
 	int i;
@@ -3,6 +3,7 @@
 
 #include "odb.h"
 #include "hash.h"
+#include "cpu.h"
 
 #include "data.h"
 
@@ -164,3 +165,100 @@ void test_object_raw_hash__hash_multi_byte_object(void)
 	hash_object_pass(&id2, &some_obj);
 	cl_assert(git_oid_cmp(&id1, &id2) == 0);
 }
+
+static void hash_in_pieces(git_oid *out, const char *data, size_t len)
+{
+	git_hash_ctx ctx;
+	size_t step = 1;
+
+	cl_git_pass(git_hash_ctx_init(&ctx));
+
+	while (len) {
+		size_t n = min(len, step);
+
+		cl_git_pass(git_hash_update(&ctx, data, n));
+		data += n;
+		len -= n;
+		step = step * 3 + 1;
+	}
+
+	cl_git_pass(git_hash_final(out, &ctx));
+	git_hash_ctx_cleanup(&ctx);
+}
+
+/* The accelerated implementations agree with the portable one */
+void test_object_raw_hash__cpu_implementations(void)
+{
+	unsigned int features = git_cpu__features;
+	size_t sizes[] = { 0, 1, 55, 56, 63, 64, 65, 127, 128, 1000, 100000 };
+	char *data;
+	git_oid generic, accelerated, expected;
+	size_t i;
+
+	data = git__malloc(100000);
+	cl_assert(data);
+
+	for (i = 0; i < 100000; i++)
+		data[i] = (char)(i * 7 + (i >> 8));
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		git_cpu__features = 0;
+		cl_git_pass(git_hash_global_init());
+		cl_git_pass(git_hash_buf(&generic, data, sizes[i]));
+
+		git_cpu__features = features;
+		cl_git_pass(git_hash_global_init());
+		cl_git_pass(git_hash_buf(&accelerated, data, sizes[i]));
+		cl_assert(git_oid_cmp(&generic, &accelerated) == 0);
+
+		hash_in_pieces(&accelerated, data, sizes[i]);
+		cl_assert(git_oid_cmp(&generic, &accelerated) == 0);
+	}
+
+	cl_git_pass(git_oid_fromstr(&expected,
+		"a9993e364706816aba3e25717850c26c9cd0d89d"));
+	cl_git_pass(git_hash_buf(&accelerated, "abc", 3));
+	cl_assert(git_oid_cmp(&expected, &accelerated) == 0);
+
+	git__free(data);
+}
+
+void test_object_raw_hash__hash_many(void)
+{
+	unsigned int features = git_cpu__features;
+	git_buf_vec vec[40];
+	git_oid ids[20], expected;
+	char *data;
+	size_t i;
+
+	data = git__malloc(40000);
+	cl_assert(data);
+
+	for (i = 0; i < 40000; i++)
+		data[i] = (char)(i * 13 + (i >> 7));
+
+	/* inputs of different lengths, in two pieces each */
+	for (i = 0; i < 20; i++) {
+		vec[i * 2].data = data;
+		vec[i * 2].len = i * 7;
+		vec[i * 2 + 1].data = data + 1000 * i;
+		vec[i * 2 + 1].len = i * i * 45;
+	}
+
+	for (i = 0; i < 2; i++) {
+		size_t j;
+
+		git_cpu__features = i ? features : 0;
+		memset(ids, 0, sizeof(ids));
+
+		cl_git_pass(git_hash_many(ids, vec, 2, 20));
+
+		for (j = 0; j < 20; j++) {
+			cl_git_pass(git_hash_vec(&expected, &vec[j * 2], 2));
+			cl_assert(git_oid_cmp(&expected, &ids[j]) == 0);
+		}
+	}
+
+	git_cpu__features = features;
+	git__free(data);
+}
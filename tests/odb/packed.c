@@ -13,6 +13,24 @@ void test_odb_packed__cleanup(void)
 {
 	git_odb_free(_odb);
 	_odb = NULL;
+
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1);
+	git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT, (size_t)(96 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 0);
+}
+
+static void read_all_packed(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i) {
+		git_oid id;
+		git_odb_object *obj;
+
+		cl_git_pass(git_oid_fromstr(&id, packed_objects[i]));
+		cl_git_pass(git_odb_read(&obj, _odb, &id));
+		git_odb_object_free(obj);
+	}
 }
 
 void test_odb_packed__mass_read(void)
@@ -77,3 +95,176 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+void test_odb_packed__delta_base_cache(void)
+{
+	size_t used, hits, misses, evictions, prev_hits, prev_misses, prev_evictions;
+
+	/* Go to the pack every time */
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	read_all_packed();
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &prev_hits, &prev_misses, &prev_evictions);
+	cl_assert(used > 0);
+
+	/* The bases are all there the second time around */
+	read_all_packed();
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &hits, &misses, &evictions);
+	cl_assert(hits > prev_hits);
+	cl_assert_equal_sz(prev_misses, misses);
+	cl_assert_equal_sz(prev_evictions, evictions);
+}
+
+void test_odb_packed__delta_base_cache_limit(void)
+{
+	size_t limit, used, hits, misses, evictions, prev_evictions;
+
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT, (size_t)1024);
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_LIMIT, &limit);
+	cl_assert_equal_sz(1024, limit);
+
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &hits, &misses, &prev_evictions);
+
+	read_all_packed();
+	read_all_packed();
+
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &hits, &misses, &evictions);
+	cl_assert(used <= 1024);
+	cl_assert(evictions > prev_evictions);
+}
+
+static void packed_ids(git_oid *ids)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i)
+		cl_git_pass(git_oid_fromstr(&ids[i], packed_objects[i]));
+}
+
+void test_odb_packed__whole_pack_mmap(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects)];
+	git_odb_object *windowed[ARRAY_SIZE(packed_objects)];
+	unsigned int i;
+
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	packed_ids(ids);
+	for (i = 0; i < ARRAY_SIZE(ids); ++i)
+		cl_git_pass(git_odb_read(&windowed[i], _odb, &ids[i]));
+
+	if (git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 1) < 0) {
+		for (i = 0; i < ARRAY_SIZE(ids); ++i)
+			git_odb_object_free(windowed[i]);
+		cl_skip();
+	}
+
+	/* Start over, so that the packs are mapped whole from the start */
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+
+	for (i = 0; i < ARRAY_SIZE(ids); ++i) {
+		git_odb_object *obj;
+
+		cl_git_pass(git_odb_read(&obj, _odb, &ids[i]));
+		cl_assert_equal_i(git_odb_object_type(windowed[i]), git_odb_object_type(obj));
+		cl_assert_equal_sz(git_odb_object_size(windowed[i]), git_odb_object_size(obj));
+		cl_assert(memcmp(git_odb_object_data(windowed[i]), git_odb_object_data(obj),
+			git_odb_object_size(obj)) == 0);
+
+		git_odb_object_free(obj);
+		git_odb_object_free(windowed[i]);
+	}
+}
+
+void test_odb_packed__read_many(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects)];
+	git_odb_object *objs[ARRAY_SIZE(packed_objects)];
+	unsigned int i;
+
+	/* Make every object come from the pack */
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	packed_ids(ids);
+	cl_git_pass(git_odb_read_many(objs, _odb, ids, ARRAY_SIZE(ids)));
+
+	for (i = 0; i < ARRAY_SIZE(ids); ++i) {
+		git_odb_object *obj;
+
+		cl_git_pass(git_odb_read(&obj, _odb, &ids[i]));
+		cl_assert(git_oid_equal(&ids[i], git_odb_object_id(objs[i])));
+		cl_assert_equal_i(git_odb_object_type(obj), git_odb_object_type(objs[i]));
+		cl_assert_equal_sz(git_odb_object_size(obj), git_odb_object_size(objs[i]));
+		cl_assert(memcmp(git_odb_object_data(obj), git_odb_object_data(objs[i]),
+			git_odb_object_size(obj)) == 0);
+
+		git_odb_object_free(obj);
+		git_odb_object_free(objs[i]);
+	}
+}
+
+void test_odb_packed__read_many_loose_and_packed(void)
+{
+	git_oid ids[3];
+	git_odb_object *objs[3];
+	unsigned int i;
+
+	/* The second one is only stored as a loose object */
+	cl_git_pass(git_oid_fromstr(&ids[0], packed_objects[0]));
+	cl_git_pass(git_oid_fromstr(&ids[1], "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_oid_fromstr(&ids[2], packed_objects[1]));
+
+	cl_git_pass(git_odb_read_many(objs, _odb, ids, 3));
+
+	for (i = 0; i < 3; ++i) {
+		cl_assert(git_oid_equal(&ids[i], git_odb_object_id(objs[i])));
+		git_odb_object_free(objs[i]);
+	}
+}
+
+void test_odb_packed__read_many_missing(void)
+{
+	git_oid ids[3];
+	git_odb_object *objs[3];
+
+	cl_git_pass(git_oid_fromstr(&ids[0], packed_objects[0]));
+	cl_git_pass(git_oid_fromstr(&ids[1], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_git_pass(git_oid_fromstr(&ids[2], packed_objects[1]));
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_odb_read_many(objs, _odb, ids, 3));
+	cl_assert(objs[0] == NULL && objs[1] == NULL && objs[2] == NULL);
+}
+
+void test_odb_packed__read_header_many(void)
+{
+	git_oid ids[ARRAY_SIZE(packed_objects)];
+	size_t lens[ARRAY_SIZE(packed_objects)];
+	git_otype types[ARRAY_SIZE(packed_objects)];
+	unsigned int i;
+
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+
+	packed_ids(ids);
+	cl_git_pass(git_odb_read_header_many(lens, types, _odb, ids, ARRAY_SIZE(ids)));
+
+	for (i = 0; i < ARRAY_SIZE(ids); ++i) {
+		git_odb_object *obj;
+
+		cl_git_pass(git_odb_read(&obj, _odb, &ids[i]));
+		cl_assert_equal_i(git_odb_object_type(obj), types[i]);
+		cl_assert_equal_sz(git_odb_object_size(obj), lens[i]);
+		git_odb_object_free(obj);
+	}
+
+	ids[0] = ids[ARRAY_SIZE(ids) - 1];
+	cl_git_pass(git_oid_fromstr(&ids[1], "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_read_header_many(lens, types, _odb, ids, 2));
+}
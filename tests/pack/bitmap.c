@@ -0,0 +1,360 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+
+#include "pack_bitmap.h"
+#include "array.h"
+#include "buffer.h"
+#include "fileops.h"
+#include "path.h"
+#include "posix.h"
+
+#define BITMAP_FILE "objects/pack/pack-810e3550d0233b4b47db110d556cd2c430426fde.bitmap"
+
+static git_repository *_repo;
+static git_array_t(git_oid) _tips;
+
+static int collect_tip_cb(git_reference *ref, void *payload)
+{
+	git_oid *id = git_array_alloc(_tips);
+	GITERR_CHECK_ALLOC(id);
+
+	GIT_UNUSED(payload);
+
+	if (git_reference_type(ref) == GIT_REF_OID)
+		git_oid_cpy(id, git_reference_target(ref));
+	else
+		_tips.size--;
+
+	git_reference_free(ref);
+	return 0;
+}
+
+void test_pack_bitmap__initialize(void)
+{
+	_repo = cl_git_sandbox_init("bitmap.git");
+
+	git_array_init(_tips);
+	cl_git_pass(git_reference_foreach(_repo, collect_tip_cb, NULL));
+}
+
+void test_pack_bitmap__cleanup(void)
+{
+	git_array_clear(_tips);
+	cl_git_sandbox_cleanup();
+}
+
+static void remove_bitmap(void)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), BITMAP_FILE));
+	cl_must_pass(p_unlink(git_buf_cstr(&path)));
+	git_buf_free(&path);
+}
+
+static size_t count_reachable(
+	const git_oid *wants, size_t wants_len,
+	const git_oid *haves, size_t haves_len)
+{
+	git_packbuilder *pb;
+	size_t count;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_packbuilder_insert_reachable(pb, wants, wants_len, haves, haves_len));
+	count = git_packbuilder_object_count(pb);
+	git_packbuilder_free(pb);
+
+	return count;
+}
+
+static int collect_object_cb(
+	const git_oid *id, git_otype type, uint32_t hash, void *payload)
+{
+	git_buf *buf = payload;
+	char str[GIT_OID_HEXSZ + 1];
+
+	GIT_UNUSED(hash);
+
+	git_oid_tostr(str, sizeof(str), id);
+	return git_buf_printf(buf, "%s %s\n", str, git_object_type2string(type));
+}
+
+static void assert_reachable(
+	const char *expected,
+	const char *want, const char *have)
+{
+	git_pack_bitmap_walk *walk;
+	git_bitvec reachable;
+	git_oid want_id, have_id;
+	git_buf actual = GIT_BUF_INIT;
+
+	cl_git_pass(git_oid_fromstr(&want_id, want));
+	if (have)
+		cl_git_pass(git_oid_fromstr(&have_id, have));
+
+	cl_git_pass(git_pack_bitmap_walk_new(&walk, _repo));
+	cl_git_pass(git_pack_bitmap_walk_reachable(
+		&reachable, walk, &want_id, 1, &have_id, have ? 1 : 0));
+	cl_git_pass(git_pack_bitmap_walk_foreach(
+		walk, &reachable, collect_object_cb, &actual));
+
+	cl_assert_equal_s(expected, git_buf_cstr(&actual));
+
+	git_buf_free(&actual);
+	git_bitvec_free(&reachable);
+	git_pack_bitmap_walk_free(walk);
+}
+
+void test_pack_bitmap__parse(void)
+{
+	git_pack_bitmap *bitmap;
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), BITMAP_FILE));
+	cl_git_pass(git_pack_bitmap_open(&bitmap, git_buf_cstr(&path)));
+
+	cl_assert_equal_i(bitmap->pack->num_objects, 55);
+	cl_assert_equal_sz(bitmap->num_entries, 15);
+	cl_assert(bitmap->hash_cache != NULL);
+
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->commits), 15);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->trees), 20);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->blobs), 15);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->tags), 5);
+
+	git_pack_bitmap_free(bitmap);
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__corrupt(void)
+{
+	git_pack_bitmap *bitmap;
+	git_pack_bitmap_walk *walk;
+	git_buf path = GIT_BUF_INIT, pack_dir = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), BITMAP_FILE));
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_futils_readbuffer(&contents, git_buf_cstr(&path)));
+
+	/* The bitmap of another pack */
+	contents.ptr[12] ^= 0xff;
+	cl_must_pass(p_unlink(git_buf_cstr(&path)));
+	cl_git_pass(git_futils_writebuffer(&contents, git_buf_cstr(&path), 0, 0644));
+	cl_git_fail(git_pack_bitmap_open(&bitmap, git_buf_cstr(&path)));
+
+	/* Which is then ignored */
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_pack_bitmap_find(&bitmap, git_buf_cstr(&pack_dir)));
+
+	cl_git_pass(git_pack_bitmap_walk_new(&walk, _repo));
+	cl_assert(!git_pack_bitmap_walk_has_bitmap(walk));
+	git_pack_bitmap_walk_free(walk);
+
+	git_buf_free(&contents);
+	git_buf_free(&pack_dir);
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__reachable(void)
+{
+	git_pack_bitmap_walk *walk;
+	git_oid master, merge;
+
+	cl_git_pass(git_pack_bitmap_walk_new(&walk, _repo));
+	cl_assert(git_pack_bitmap_walk_has_bitmap(walk));
+	git_pack_bitmap_walk_free(walk);
+
+	cl_git_pass(git_oid_fromstr(&master, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&merge, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+
+	cl_assert_equal_sz(55, count_reachable(_tips.ptr, _tips.size, NULL, 0));
+	cl_assert_equal_sz(20, count_reachable(&master, 1, NULL, 0));
+	cl_assert_equal_sz(3, count_reachable(&master, 1, &merge, 1));
+	cl_assert_equal_sz(0, count_reachable(&merge, 1, &master, 1));
+	cl_assert_equal_sz(35, count_reachable(_tips.ptr, _tips.size, &master, 1));
+
+	assert_reachable(
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 commit\n"
+		"944c0f6e4dfa41595e6eb3ceecdb14f50fe18162 tree\n"
+		"3697d64be941a53d4ae8f6a271e4e3fa56b022cc blob\n",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644");
+}
+
+void test_pack_bitmap__reachable_without_bitmap(void)
+{
+	git_pack_bitmap_walk *walk;
+	git_oid master, merge;
+
+	remove_bitmap();
+
+	cl_git_pass(git_pack_bitmap_walk_new(&walk, _repo));
+	cl_assert(!git_pack_bitmap_walk_has_bitmap(walk));
+	git_pack_bitmap_walk_free(walk);
+
+	cl_git_pass(git_oid_fromstr(&master, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&merge, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+
+	cl_assert_equal_sz(55, count_reachable(_tips.ptr, _tips.size, NULL, 0));
+	cl_assert_equal_sz(20, count_reachable(&master, 1, NULL, 0));
+	cl_assert_equal_sz(3, count_reachable(&master, 1, &merge, 1));
+	cl_assert_equal_sz(0, count_reachable(&merge, 1, &master, 1));
+	cl_assert_equal_sz(35, count_reachable(_tips.ptr, _tips.size, &master, 1));
+}
+
+void test_pack_bitmap__reachable_past_the_bitmap(void)
+{
+	git_oid blob_id, tree_id, commit_id, master;
+	git_treebuilder *builder;
+	git_tree *tree, *parent_tree;
+	git_commit *parent;
+	git_signature *sig;
+	char str[GIT_OID_HEXSZ + 1];
+	git_buf expected = GIT_BUF_INIT;
+
+	cl_git_pass(git_oid_fromstr(&master, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_commit_lookup(&parent, _repo, &master));
+
+	/* A loose commit on top of the bitmapped history */
+	cl_git_pass(git_blob_create_frombuffer(&blob_id, _repo, "new\n", 4));
+	cl_git_pass(git_commit_tree(&parent_tree, parent));
+	cl_git_pass(git_treebuilder_create(&builder, parent_tree));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "new.txt", &blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, _repo, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	cl_git_pass(git_signature_new(&sig, "Bitmap", "bitmap@example.com", 1234567890, 0));
+	cl_git_pass(git_commit_create(&commit_id, _repo, NULL, sig, sig,
+		NULL, "new commit\n", tree, 1, (const git_commit **)&parent));
+
+	cl_assert_equal_sz(23, count_reachable(&commit_id, 1, NULL, 0));
+	cl_assert_equal_sz(3, count_reachable(&commit_id, 1, &master, 1));
+
+	cl_git_pass(git_buf_printf(&expected, "%s commit\n",
+		git_oid_tostr(str, sizeof(str), &commit_id)));
+	cl_git_pass(git_buf_printf(&expected, "%s tree\n",
+		git_oid_tostr(str, sizeof(str), &tree_id)));
+	cl_git_pass(git_buf_printf(&expected, "%s blob\n",
+		git_oid_tostr(str, sizeof(str), &blob_id)));
+
+	assert_reachable(git_buf_cstr(&expected),
+		git_oid_tostr(str, sizeof(str), &commit_id),
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	git_buf_free(&expected);
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_tree_free(parent_tree);
+	git_treebuilder_free(builder);
+	git_commit_free(parent);
+}
+
+static void write_pack(git_oid *pack_name, bool write_bitmaps)
+{
+	git_packbuilder *pb;
+	git_buf pack_dir = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(_repo), "objects/pack"));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	git_packbuilder_set_write_bitmaps(pb, write_bitmaps);
+	cl_git_pass(git_packbuilder_insert_reachable(pb, _tips.ptr, _tips.size, NULL, 0));
+	cl_git_pass(git_packbuilder_write(pb, git_buf_cstr(&pack_dir), 0, NULL, NULL));
+	git_oid_cpy(pack_name, git_packbuilder_hash(pb));
+	git_packbuilder_free(pb);
+
+	git_buf_free(&pack_dir);
+}
+
+static void bitmap_path(git_buf *path, const git_oid *pack_name)
+{
+	char name[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(name, sizeof(name), pack_name);
+	cl_git_pass(git_buf_joinpath(path, git_repository_path(_repo), "objects/pack/pack-"));
+	cl_git_pass(git_buf_printf(path, "%s.bitmap", name));
+}
+
+void test_pack_bitmap__write(void)
+{
+	git_pack_bitmap *bitmap;
+	git_pack_bitmap_walk *walk;
+	git_oid pack_name, master, merge;
+	git_buf path = GIT_BUF_INIT;
+
+	remove_bitmap();
+	write_pack(&pack_name, true);
+
+	bitmap_path(&path, &pack_name);
+	cl_git_pass(git_pack_bitmap_open(&bitmap, git_buf_cstr(&path)));
+
+	cl_assert_equal_i(bitmap->pack->num_objects, 55);
+	cl_assert_equal_sz(bitmap->num_entries, 15);
+	cl_assert(bitmap->hash_cache != NULL);
+
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->commits), 15);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->trees), 20);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->blobs), 15);
+	cl_assert_equal_sz(git_bitvec_count(&bitmap->tags), 5);
+
+	git_pack_bitmap_free(bitmap);
+
+	/* The only bitmap left is the one that was just written */
+	cl_git_pass(git_pack_bitmap_walk_new(&walk, _repo));
+	cl_assert(git_pack_bitmap_walk_has_bitmap(walk));
+	git_pack_bitmap_walk_free(walk);
+
+	cl_git_pass(git_oid_fromstr(&master, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&merge, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+
+	cl_assert_equal_sz(55, count_reachable(_tips.ptr, _tips.size, NULL, 0));
+	cl_assert_equal_sz(20, count_reachable(&master, 1, NULL, 0));
+	cl_assert_equal_sz(3, count_reachable(&master, 1, &merge, 1));
+	cl_assert_equal_sz(0, count_reachable(&merge, 1, &master, 1));
+	cl_assert_equal_sz(35, count_reachable(_tips.ptr, _tips.size, &master, 1));
+
+	assert_reachable(
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 commit\n"
+		"944c0f6e4dfa41595e6eb3ceecdb14f50fe18162 tree\n"
+		"3697d64be941a53d4ae8f6a271e4e3fa56b022cc blob\n",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644");
+
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__write_disabled(void)
+{
+	git_oid pack_name;
+	git_buf path = GIT_BUF_INIT;
+
+	write_pack(&pack_name, false);
+
+	bitmap_path(&path, &pack_name);
+	cl_assert(!git_path_exists(git_buf_cstr(&path)));
+
+	git_buf_free(&path);
+}
+
+void test_pack_bitmap__write_incomplete_pack(void)
+{
+	git_packbuilder *pb;
+	git_oid master;
+	git_buf pack_dir = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	cl_git_pass(git_oid_fromstr(&master, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(_repo), "objects/pack"));
+
+	/* Just the commit, without its history: no bitmap, but no error */
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	git_packbuilder_set_write_bitmaps(pb, true);
+	cl_git_pass(git_packbuilder_insert(pb, &master, NULL));
+	cl_git_pass(git_packbuilder_write(pb, git_buf_cstr(&pack_dir), 0, NULL, NULL));
+
+	bitmap_path(&path, git_packbuilder_hash(pb));
+	cl_assert(!git_path_exists(git_buf_cstr(&path)));
+
+	git_packbuilder_free(pb);
+	git_buf_free(&path);
+	git_buf_free(&pack_dir);
+}
@@ -0,0 +1,82 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+void test_pack_deltachain__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("deltachain.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+
+	/* Read from the pack every time */
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 0);
+}
+
+void test_pack_deltachain__cleanup(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_CACHING, 1);
+
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+}
+
+/* Read every version of the file, from the newest to the oldest */
+static size_t read_history(void)
+{
+	git_revwalk *walk;
+	git_oid commit_id, blob_id, actual;
+	git_commit *commit;
+	git_tree *tree;
+	git_odb_object *obj;
+	size_t count = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+
+	while (git_revwalk_next(&commit_id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &commit_id));
+		cl_git_pass(git_commit_tree(&tree, commit));
+		git_oid_cpy(&blob_id, git_tree_entry_id(git_tree_entry_byname(tree, "file.txt")));
+
+		cl_git_pass(git_odb_read(&obj, _odb, &blob_id));
+		cl_git_pass(git_odb_hash(&actual,
+			git_odb_object_data(obj), git_odb_object_size(obj), GIT_OBJ_BLOB));
+		cl_assert(git_oid_equal(&blob_id, &actual));
+
+		git_odb_object_free(obj);
+		git_tree_free(tree);
+		git_commit_free(commit);
+		count++;
+	}
+
+	git_revwalk_free(walk);
+	return count;
+}
+
+void test_pack_deltachain__read_long_chains(void)
+{
+	size_t used, hits, misses, evictions, prev_hits, prev_misses;
+
+	/* The oldest versions are over 50 deltas away from their base */
+	cl_assert_equal_sz(60, read_history());
+
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &prev_hits, &prev_misses, &evictions);
+
+	/* Every intermediate base was cached on the way */
+	cl_assert_equal_sz(60, read_history());
+
+	git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&used, &hits, &misses, &evictions);
+	cl_assert(hits > prev_hits);
+	cl_assert_equal_sz(prev_misses, misses);
+}
+
+void test_pack_deltachain__read_long_chains_without_cache(void)
+{
+	git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT, (size_t)0);
+
+	cl_assert_equal_sz(60, read_history());
+
+	git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_LIMIT, (size_t)(96 * 1024 * 1024));
+}
@@ -43,6 +43,12 @@ static const unsigned int thin_pack_len = 78;
 static const unsigned char base_obj[] = { 07, 076 };
 static const unsigned int base_obj_len = 2;
 
+void test_pack_indexer__cleanup(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_INDEXER_PIPELINE, 0);
+	git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 0);
+}
+
 void test_pack_indexer__out_of_order(void)
 {
 	git_indexer *idx = 0;
@@ -125,3 +131,128 @@ void test_pack_indexer__fix_thin(void)
 		git_indexer_free(idx);
 	}
 }
+
+static int cancel_after_deltas(const git_transfer_progress *stats, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	return (stats->indexed_deltas > 10) ? -42 : 0;
+}
+
+static int cancel_after_objects(const git_transfer_progress *stats, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	return (stats->received_objects > 10) ? -42 : 0;
+}
+
+static void index_deltachain_pack(
+	unsigned int threads, git_transfer_progress_cb progress_cb, int expected)
+{
+	git_indexer *idx;
+	git_transfer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT, expected_idx = GIT_BUF_INIT;
+	git_buf idx_path = GIT_BUF_INIT, actual_idx = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t offset, chunk;
+	const char *name = "deltachain.git/objects/pack/pack-4d6592757df330ad79ff9d76f11318966747ecee";
+
+	cl_git_pass(git_buf_printf(&idx_path, "%s.pack", cl_fixture(name)));
+	cl_git_pass(git_futils_readbuffer(&pack, idx_path.ptr));
+	git_buf_clear(&idx_path);
+	cl_git_pass(git_buf_printf(&idx_path, "%s.idx", cl_fixture(name)));
+	cl_git_pass(git_futils_readbuffer(&expected_idx, idx_path.ptr));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, progress_cb, NULL));
+	git_indexer_set_threads(idx, threads);
+
+	/* Feed it the way the network would */
+	for (offset = 0; offset < pack.size; offset += chunk) {
+		int error;
+
+		chunk = min(pack.size - offset, 1024);
+		error = git_indexer_append(idx, pack.ptr + offset, chunk, &stats);
+
+		if (error == expected && expected)
+			goto cleanup;
+
+		cl_git_pass(error);
+	}
+
+	if (expected) {
+		cl_assert_equal_i(expected, git_indexer_commit(idx, &stats));
+		goto cleanup;
+	}
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert(stats.total_deltas > 0);
+	cl_assert_equal_i(stats.total_deltas, stats.indexed_deltas);
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+
+	/* The index is the same as the one git wrote */
+	git_buf_clear(&idx_path);
+	cl_git_pass(git_buf_printf(&idx_path, "pack-%s.idx",
+		git_oid_tostr(hex, sizeof(hex), git_indexer_hash(idx))));
+	cl_git_pass(git_futils_readbuffer(&actual_idx, idx_path.ptr));
+
+	cl_assert_equal_sz(expected_idx.size, actual_idx.size);
+	cl_assert(memcmp(expected_idx.ptr, actual_idx.ptr, actual_idx.size) == 0);
+
+cleanup:
+	git_indexer_free(idx);
+	git_buf_free(&pack);
+	git_buf_free(&expected_idx);
+	git_buf_free(&actual_idx);
+	git_buf_free(&idx_path);
+}
+
+void test_pack_indexer__resolve_delta_trees(void)
+{
+	index_deltachain_pack(1, NULL, 0);
+}
+
+void test_pack_indexer__resolve_delta_trees_threaded(void)
+{
+	index_deltachain_pack(4, NULL, 0);
+}
+
+void test_pack_indexer__resolve_delta_trees_cancel(void)
+{
+	index_deltachain_pack(1, cancel_after_deltas, -42);
+	index_deltachain_pack(4, cancel_after_deltas, -42);
+}
+
+void test_pack_indexer__pipelined(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_INDEXER_PIPELINE, 1);
+
+	index_deltachain_pack(1, NULL, 0);
+	index_deltachain_pack(4, NULL, 0);
+}
+
+void test_pack_indexer__pipelined_cancel(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_INDEXER_PIPELINE, 1);
+
+	index_deltachain_pack(1, cancel_after_objects, -42);
+	index_deltachain_pack(1, cancel_after_deltas, -42);
+}
+
+void test_pack_indexer__pipelined_thin(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_INDEXER_PIPELINE, 1);
+
+	test_pack_indexer__out_of_order();
+	test_pack_indexer__fix_thin();
+}
+
+void test_pack_indexer__whole_pack_mmap(void)
+{
+	/* The pack grows while it's being indexed */
+	if (git_libgit2_opts(GIT_OPT_ENABLE_WHOLE_PACK_MMAP, 1) < 0)
+		cl_skip();
+
+	index_deltachain_pack(1, NULL, 0);
+	test_pack_indexer__fix_thin();
+}
@@ -0,0 +1,155 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/midx.h>
+
+#include "midx.h"
+#include "buffer.h"
+#include "fileops.h"
+#include "path.h"
+
+/* What git writes for the packs of testrepo.git; the fixture itself has
+ * no multi-pack-index, so that everything else reads the pack indexes.
+ */
+#define MIDX_FIXTURE "midx/testrepo.multi-pack-index"
+
+void test_pack_midx__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static git_repository *sandbox_with_midx(void)
+{
+	git_repository *repo = cl_git_sandbox_init("testrepo.git");
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_git_pass(git_futils_cp(cl_fixture(MIDX_FIXTURE), path.ptr, 0444));
+	git_buf_free(&path);
+
+	return repo;
+}
+
+void test_pack_midx__parse(void)
+{
+	git_repository *repo;
+	struct git_midx_file *idx;
+	struct git_midx_entry e;
+	git_oid id;
+	git_buf midx_path = GIT_BUF_INIT;
+
+	repo = sandbox_with_midx();
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_git_pass(git_midx_open(&idx, git_buf_cstr(&midx_path)));
+	cl_assert_equal_i(git_midx_needs_refresh(idx, git_buf_cstr(&midx_path)), 0);
+	cl_assert_equal_i(idx->num_objects, 1640);
+	cl_assert_equal_sz(git_vector_length(&idx->packfile_names), 3);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_i(git_oid_cmp(&e.sha1, &id), 0);
+	cl_assert_equal_s(
+			(const char *)git_vector_get(&idx->packfile_names, e.pack_index),
+			"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx");
+
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 7));
+	cl_assert_equal_i(git_oid_cmp(&e.sha1, &id), 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert_equal_i(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ), GIT_ENOTFOUND);
+
+	git_midx_free(idx);
+	git_buf_free(&midx_path);
+}
+
+void test_pack_midx__corrupt(void)
+{
+	git_midx_file idx = {{0}};
+	git_buf contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&contents,
+		cl_fixture(MIDX_FIXTURE)));
+
+	contents.ptr[0] ^= 0xff;
+	cl_git_fail(git_midx_parse(&idx,
+		(const unsigned char *)contents.ptr, contents.size));
+
+	git_vector_free(&idx.packfile_names);
+	git_buf_free(&contents);
+}
+
+void test_pack_midx__lookup(void)
+{
+	git_repository *repo;
+	git_commit *commit;
+	git_oid id;
+
+	repo = sandbox_with_midx();
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_lookup_prefix(&commit, repo, &id, GIT_OID_MINPREFIXLEN));
+	cl_assert_equal_s(git_commit_message(commit), "packed commit one\n");
+
+	git_commit_free(commit);
+}
+
+void test_pack_midx__writer(void)
+{
+	git_repository *repo;
+	git_midx_writer *w = NULL;
+	git_buf midx = GIT_BUF_INIT, expected_midx = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_midx_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+	cl_git_pass(git_futils_readbuffer(&expected_midx, cl_fixture(MIDX_FIXTURE)));
+
+	cl_assert_equal_i(git_buf_len(&midx), git_buf_len(&expected_midx));
+	cl_assert(memcmp(git_buf_cstr(&midx), git_buf_cstr(&expected_midx), git_buf_len(&midx)) == 0);
+
+	git_buf_free(&midx);
+	git_buf_free(&expected_midx);
+	git_buf_free(&path);
+	git_midx_writer_free(w);
+	git_repository_free(repo);
+}
+
+void test_pack_midx__odb_create(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_oid id;
+	size_t len;
+	git_otype type;
+	git_buf midx = GIT_BUF_INIT, expected_midx = GIT_BUF_INIT, midx_path = GIT_BUF_INIT;
+
+	repo = cl_git_sandbox_init("testrepo");
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_assert(!git_path_exists(git_buf_cstr(&midx_path)));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+
+	cl_git_pass(git_futils_readbuffer(&expected_midx, cl_fixture(MIDX_FIXTURE)));
+	cl_git_pass(git_futils_readbuffer(&midx, git_buf_cstr(&midx_path)));
+	cl_assert_equal_i(git_buf_len(&midx), git_buf_len(&expected_midx));
+	cl_assert(memcmp(git_buf_cstr(&midx), git_buf_cstr(&expected_midx), git_buf_len(&midx)) == 0);
+
+	/* The new index is picked up by the backend right away */
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_odb_read_header(&len, &type, odb, &id));
+	cl_assert_equal_i(type, GIT_OBJ_COMMIT);
+
+	git_odb_free(odb);
+	git_buf_free(&midx);
+	git_buf_free(&midx_path);
+	git_buf_free(&expected_midx);
+}
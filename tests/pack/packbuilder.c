@@ -1,6 +1,7 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -221,3 +222,251 @@ void test_pack_packbuilder__foreach_with_cancel(void)
 		git_packbuilder_foreach(_packbuilder, foreach_cancel_cb, idx), -1111);
 	git_indexer_free(idx);
 }
+
+static void count_searched_objects(unsigned int *objects, unsigned int nr_threads)
+{
+	git_packbuilder_thread_stats stats;
+	unsigned int i;
+
+	*objects = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		cl_git_pass(git_packbuilder_get_thread_stats(&stats, _packbuilder, i));
+		cl_assert(stats.search_time >= 0.0);
+		*objects += stats.objects;
+	}
+
+	cl_git_fail_with(git_packbuilder_get_thread_stats(
+		&stats, _packbuilder, nr_threads), GIT_ENOTFOUND);
+}
+
+typedef struct {
+	unsigned int searched;
+	unsigned int total;
+} deltafication_progress;
+
+static int deltafication_cb(int stage, unsigned int current, unsigned int total, void *payload)
+{
+	deltafication_progress *progress = payload;
+
+	if (stage == GIT_PACKBUILDER_DELTAFICATION) {
+		/* every report is out of the same total */
+		if (progress->total)
+			cl_assert_equal_i(progress->total, total);
+
+		cl_assert(current <= total);
+		progress->searched = current;
+		progress->total = total;
+	}
+
+	return 0;
+}
+
+void test_pack_packbuilder__thread_stats(void)
+{
+	git_packbuilder_thread_stats stats;
+	unsigned int objects;
+	deltafication_progress progress = { 0 };
+
+	cl_git_fail_with(git_packbuilder_get_thread_stats(
+		&stats, _packbuilder, 0), GIT_ENOTFOUND);
+
+	seed_packbuilder();
+	cl_git_pass(git_packbuilder_set_callbacks(
+		_packbuilder, deltafication_cb, &progress));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+
+	count_searched_objects(&objects, 1);
+	cl_assert(objects > 0);
+	cl_assert_equal_i(objects, progress.searched);
+}
+
+void test_pack_packbuilder__threaded_delta_search(void)
+{
+	git_indexer *idx;
+	unsigned int objects, nr_threads = 1;
+	deltafication_progress progress = { 0 };
+
+#ifdef GIT_THREADS
+	nr_threads = 4;
+#endif
+
+	cl_assert_equal_i(nr_threads, git_packbuilder_set_threads(_packbuilder, 4));
+
+	seed_packbuilder();
+	cl_git_pass(git_packbuilder_set_callbacks(
+		_packbuilder, deltafication_cb, &progress));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, foreach_cb, idx));
+	cl_git_pass(git_indexer_commit(idx, &_stats));
+	git_indexer_free(idx);
+
+	cl_assert_equal_i(_stats.total_objects, git_packbuilder_object_count(_packbuilder));
+
+	count_searched_objects(&objects, nr_threads);
+	cl_assert(objects > 0);
+	cl_assert_equal_i(objects, progress.searched);
+}
+
+static void insert_objects_from(git_packbuilder *pb, git_packbuilder *from)
+{
+	uint32_t i;
+
+	for (i = 0; i < from->nr_objects; i++)
+		cl_git_pass(git_packbuilder_insert(pb, &from->object_list[i].id, NULL));
+}
+
+/* A repository with the objects of the test repository in a single pack */
+static git_repository *create_repacked_repo(void)
+{
+	git_repository *repo;
+
+	seed_packbuilder();
+
+	cl_git_pass(git_repository_init(&repo, "repacked.git", true));
+	cl_git_pass(git_packbuilder_write(
+		_packbuilder, "repacked.git/objects/pack", 0, NULL, NULL));
+
+	return repo;
+}
+
+void test_pack_packbuilder__reuse_packed_objects(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_indexer *idx;
+
+	repo = create_repacked_repo();
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	insert_objects_from(pb, _packbuilder);
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(pb, foreach_cb, idx));
+	cl_git_pass(git_indexer_commit(idx, &_stats));
+	git_indexer_free(idx);
+
+	/* nothing was compressed or searched for a delta again */
+	cl_assert_equal_i(git_packbuilder_object_count(pb), pb->nr_reused);
+	cl_assert_equal_i(git_packbuilder_object_count(pb), _stats.indexed_objects);
+
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+}
+
+void test_pack_packbuilder__reuse_can_be_disabled(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_buf buf = GIT_BUF_INIT;
+
+	repo = create_repacked_repo();
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	git_packbuilder_set_reuse_objects(pb, 0);
+	insert_objects_from(pb, _packbuilder);
+
+	cl_git_pass(git_packbuilder_write_buf(&buf, pb));
+	cl_assert_equal_i(0, pb->nr_reused);
+
+	git_buf_free(&buf);
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+}
+
+void test_pack_packbuilder__reuse_checks_crc(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_indexer *idx;
+	git_buf path = GIT_BUF_INIT, data = GIT_BUF_INIT;
+	size_t crc_offset;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	repo = create_repacked_repo();
+	git_repository_free(repo);
+
+	/* Damage the CRC32 of the first object of the index */
+	git_oid_tostr(hex, sizeof(hex), git_packbuilder_hash(_packbuilder));
+	cl_git_pass(git_buf_printf(&path, "repacked.git/objects/pack/pack-%s.idx", hex));
+	cl_git_pass(git_futils_readbuffer(&data, path.ptr));
+
+	crc_offset = 8 + 4 * 256 + GIT_OID_RAWSZ * git_packbuilder_object_count(_packbuilder);
+	data.ptr[crc_offset] ^= 0xff;
+
+	cl_must_pass(p_chmod(path.ptr, 0644));
+	cl_git_pass(git_futils_writebuffer(&data, path.ptr, O_WRONLY | O_TRUNC, 0644));
+
+	cl_git_pass(git_repository_open(&repo, "repacked.git"));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	insert_objects_from(pb, _packbuilder);
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(pb, foreach_cb, idx));
+	cl_git_pass(git_indexer_commit(idx, &_stats));
+	git_indexer_free(idx);
+
+	/* that object was written from scratch */
+	cl_assert_equal_i(git_packbuilder_object_count(pb) - 1, pb->nr_reused);
+	cl_assert_equal_i(git_packbuilder_object_count(pb), _stats.indexed_objects);
+
+	git_buf_free(&data);
+	git_buf_free(&path);
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+}
+
+static void build_without_delta_cache(git_buf *out, bool spill, uint32_t *spilled)
+{
+	git_packbuilder *pb;
+	git_config *cfg;
+	git_buf spill_path = GIT_BUF_INIT;
+	uint32_t i;
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_int64(cfg, "pack.deltaCacheSize", 1));
+	git_config_free(cfg);
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	git_packbuilder_set_reuse_objects(pb, 0);
+	git_packbuilder_set_spill_deltas(pb, spill);
+	insert_objects_from(pb, _packbuilder);
+
+	cl_git_pass(git_packbuilder_write_buf(out, pb));
+
+	for (i = 0, *spilled = 0; i < pb->nr_objects; i++)
+		*spilled += pb->object_list[i].spilled;
+
+	if (*spilled) {
+		cl_assert(git_path_isfile(pb->spill_path.ptr));
+		cl_git_pass(git_buf_set(&spill_path, pb->spill_path.ptr, pb->spill_path.size));
+	}
+
+	git_packbuilder_free(pb);
+
+	/* the spill file goes away with the packbuilder */
+	if (*spilled)
+		cl_assert(!git_path_exists(spill_path.ptr));
+
+	git_buf_free(&spill_path);
+}
+
+void test_pack_packbuilder__spill_deltas(void)
+{
+	git_buf spilled_pack = GIT_BUF_INIT, recomputed_pack = GIT_BUF_INIT;
+	uint32_t spilled;
+
+	seed_packbuilder();
+
+	build_without_delta_cache(&recomputed_pack, false, &spilled);
+	cl_assert_equal_i(0, spilled);
+
+	build_without_delta_cache(&spilled_pack, true, &spilled);
+	cl_assert(spilled > 0);
+
+	/* the deltas read back are the ones that would have been recomputed */
+	cl_assert_equal_i(recomputed_pack.size, spilled_pack.size);
+	cl_assert(!memcmp(recomputed_pack.ptr, spilled_pack.ptr, spilled_pack.size));
+
+	git_buf_free(&spilled_pack);
+	git_buf_free(&recomputed_pack);
+}
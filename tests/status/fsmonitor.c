@@ -0,0 +1,267 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "repository.h"
+#include "index.h"
+#include "hash.h"
+#include "git2/sys/diff.h"
+#include "git2/sys/fsmonitor.h"
+
+#ifndef GIT_WIN32
+# include <utime.h>
+#endif
+
+static git_repository *g_repo = NULL;
+
+void test_status_fsmonitor__initialize(void)
+{
+	git_fsmonitor *fsmonitor;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	/* the reference monitor is built on inotify */
+	if (git_fsmonitor_inotify(&fsmonitor, "status") < 0) {
+		giterr_clear();
+		cl_skip();
+	}
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, fsmonitor));
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Entries changed in the second the index was written are never
+ * trusted, so move the working directory back in time.
+ */
+static void backdate_workdir(void)
+{
+#ifndef GIT_WIN32
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+	struct utimbuf times;
+	size_t i;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+
+	for (i = 0; i < git_index_entrycount(index); i++) {
+		const git_index_entry *entry = git_index_get_byindex(index, i);
+
+		cl_git_pass(git_buf_joinpath(&path, "status", entry->path));
+		if (p_lstat(path.ptr, &st) < 0)
+			continue;
+
+		times.actime = times.modtime = st.st_mtime - 10;
+		cl_must_pass(utime(path.ptr, &times));
+	}
+
+	git_buf_free(&path);
+#endif
+}
+
+static void status_to_buf(git_buf *out, git_repository *repo, size_t *stat_calls)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	const git_status_entry *entry;
+	const git_diff_delta *delta;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+	if (repo == g_repo)
+		opts.flags |= GIT_STATUS_OPT_UPDATE_INDEX;
+
+	git_buf_clear(out);
+	cl_git_pass(git_status_list_new(&status, repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(status); i++) {
+		entry = git_status_byindex(status, i);
+		delta = entry->index_to_workdir ?
+			entry->index_to_workdir : entry->head_to_index;
+
+		git_buf_printf(out, "%04x %s\n", entry->status, delta->new_file.path);
+	}
+
+	if (stat_calls) {
+		cl_git_pass(git_status_list_get_perfdata(&perf, status));
+		*stat_calls = perf.stat_calls;
+	}
+
+	cl_assert(!git_buf_oom(out));
+	git_status_list_free(status);
+}
+
+/* what a repository without a monitor sees */
+static void assert_status(git_buf *actual)
+{
+	git_repository *repo;
+	git_buf expected = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_open(&repo, "status"));
+	status_to_buf(&expected, repo, NULL);
+	cl_assert_equal_s(expected.ptr, actual->ptr);
+
+	git_buf_free(&expected);
+	git_repository_free(repo);
+}
+
+/* the first status refreshes the index, after which it is trusted */
+static void warm_up(git_buf *actual)
+{
+	backdate_workdir();
+	status_to_buf(actual, g_repo, NULL);
+	assert_status(actual);
+
+	status_to_buf(actual, g_repo, NULL);
+	assert_status(actual);
+}
+
+static size_t count_valid(git_index *index)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < git_index_entrycount(index); i++) {
+		const git_index_entry *entry = git_index_get_byindex(index, i);
+
+		if ((entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0)
+			count++;
+	}
+
+	return count;
+}
+
+void test_status_fsmonitor__is_written_with_the_index(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	git_index *index, *repo_index;
+
+	warm_up(&actual);
+
+	cl_git_pass(git_repository_index__weakptr(&repo_index, g_repo));
+	cl_assert(repo_index->fsmonitor_token != NULL);
+	cl_assert(count_valid(repo_index) > 0);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert_equal_s(repo_index->fsmonitor_token, index->fsmonitor_token);
+	cl_assert_equal_sz(count_valid(repo_index), count_valid(index));
+	git_index_free(index);
+
+	/* and dropped once there is no monitor to keep it up to date */
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	status_to_buf(&actual, g_repo, NULL);
+	cl_assert(repo_index->fsmonitor_token == NULL);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->fsmonitor_token == NULL);
+	cl_assert_equal_sz(0, count_valid(index));
+	git_index_free(index);
+
+	git_buf_free(&actual);
+}
+
+void test_status_fsmonitor__spares_stat_calls(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	size_t before, after;
+
+	backdate_workdir();
+	status_to_buf(&actual, g_repo, &before);
+	status_to_buf(&actual, g_repo, NULL);
+
+	status_to_buf(&actual, g_repo, &after);
+	assert_status(&actual);
+	cl_assert(after < before);
+
+	git_buf_free(&actual);
+}
+
+void test_status_fsmonitor__notices_changes(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+
+	warm_up(&actual);
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	cl_must_pass(p_unlink("status/subdir/current_file"));
+	cl_git_mkfile("status/subdir/another_file", "hello\n");
+
+	status_to_buf(&actual, g_repo, NULL);
+	cl_assert(strstr(actual.ptr, " current_file\n") != NULL);
+	cl_assert(strstr(actual.ptr, " subdir/current_file\n") != NULL);
+	cl_assert(strstr(actual.ptr, " subdir/another_file\n") != NULL);
+	assert_status(&actual);
+
+	/* a directory replaced whole */
+	cl_git_pass(git_futils_rmdir_r("status/subdir", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_mkfile("status/subdir", "not a directory\n");
+
+	status_to_buf(&actual, g_repo, NULL);
+	assert_status(&actual);
+
+	git_buf_free(&actual);
+}
+
+void test_status_fsmonitor__notices_changes_with_untracked_cache(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", true);
+	warm_up(&actual);
+
+	cl_git_mkfile("status/subdir/another_file", "hello\n");
+
+	status_to_buf(&actual, g_repo, NULL);
+	cl_assert(strstr(actual.ptr, " subdir/another_file\n") != NULL);
+	assert_status(&actual);
+
+	cl_must_pass(p_unlink("status/new_file"));
+
+	status_to_buf(&actual, g_repo, NULL);
+	cl_assert(strstr(actual.ptr, " new_file\n") == NULL);
+	assert_status(&actual);
+
+	git_buf_free(&actual);
+}
+
+void test_status_fsmonitor__rejects_dirty_bits_past_the_entries(void)
+{
+	git_buf actual = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_index *index;
+	git_oid checksum;
+	char *ext = NULL;
+	uint32_t bit_size;
+	size_t i, token_len;
+
+	warm_up(&actual);
+
+	cl_git_pass(git_futils_readbuffer(&contents, "status/.git/index"));
+	for (i = contents.size - GIT_OID_RAWSZ - 4; i > 12 && !ext; i--)
+		if (!memcmp(contents.ptr + i, "FSMN", 4))
+			ext = contents.ptr + i;
+	cl_assert(ext != NULL);
+
+	/* skip the signature, the size, the version and the token */
+	token_len = strlen(ext + 12);
+	ext += 12 + token_len + 1 + 4;
+
+	bit_size = htonl(1000000);
+	memcpy(ext, &bit_size, 4);
+
+	git_hash_buf(&checksum, contents.ptr, contents.size - GIT_OID_RAWSZ);
+	memcpy(contents.ptr + contents.size - GIT_OID_RAWSZ,
+		checksum.id, GIT_OID_RAWSZ);
+	cl_git_pass(git_futils_writebuffer(
+		&contents, "status/.git/index", O_WRONLY | O_TRUNC, 0666));
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->fsmonitor_token == NULL);
+	cl_assert_equal_sz(0, count_valid(index));
+	git_index_free(index);
+
+	git_buf_free(&contents);
+	git_buf_free(&actual);
+}
@@ -0,0 +1,294 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "repository.h"
+#include "index.h"
+#include "untracked-cache.h"
+
+#ifndef GIT_WIN32
+# include <utime.h>
+#endif
+
+static git_repository *g_repo = NULL;
+
+void test_status_untracked_cache__initialize(void)
+{
+#ifdef GIT_WIN32
+	/* directory times can't be set to make the cache trusted */
+	cl_skip();
+#endif
+
+	g_repo = cl_git_sandbox_init("status");
+	cl_git_mkfile("status/subdir/.gitignore", "");
+}
+
+void test_status_untracked_cache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* The cache only trusts directories which were last changed before
+ * the second it was filled in.
+ */
+static void backdate(const char *path, int seconds)
+{
+#ifndef GIT_WIN32
+	struct stat st;
+	struct utimbuf times;
+
+	cl_must_pass(p_stat(path, &st));
+	times.actime = times.modtime = st.st_mtime - seconds;
+	cl_must_pass(utime(path, &times));
+#else
+	GIT_UNUSED(path);
+	GIT_UNUSED(seconds);
+#endif
+}
+
+static void backdate_workdir(int seconds)
+{
+	backdate("status", seconds);
+	backdate("status/subdir", seconds);
+}
+
+static void status_to_buf(git_buf *out)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	const git_status_entry *entry;
+	const git_diff_delta *delta;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_UPDATE_INDEX;
+
+	git_buf_clear(out);
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(status); i++) {
+		entry = git_status_byindex(status, i);
+		delta = entry->index_to_workdir ?
+			entry->index_to_workdir : entry->head_to_index;
+
+		git_buf_printf(out, "%04x %s\n", entry->status, delta->new_file.path);
+	}
+
+	cl_assert(!git_buf_oom(out));
+	git_status_list_free(status);
+}
+
+static git_untracked_cache *untracked_cache(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	return index->untracked;
+}
+
+static void assert_untracked(
+	git_untracked_dir *dir, const char **expected, size_t count)
+{
+	size_t i;
+
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(count, git_vector_length(&dir->untracked));
+
+	for (i = 0; i < count; i++)
+		cl_assert_equal_s(expected[i], git_vector_get(&dir->untracked, i));
+}
+
+static void assert_filled(git_untracked_cache *uc)
+{
+	static const char *root[] = {
+		"new_file", "staged_delete_modified_file", "\xe8\xbf\x99"
+	};
+	static const char *subdir[] = { ".gitignore", "new_file" };
+	git_untracked_dir *dir;
+
+	cl_assert(uc != NULL && uc->root != NULL);
+	assert_untracked(uc->root, root, ARRAY_SIZE(root));
+
+	cl_assert_equal_sz(1, git_vector_length(&uc->root->dirs));
+	cl_git_pass(git_untracked_dir_child(&dir, uc->root, "subdir", 6, false));
+	cl_assert(dir != NULL);
+	assert_untracked(dir, subdir, ARRAY_SIZE(subdir));
+}
+
+/* fill the cache in, and check it is used the next time */
+static void fill_cache(git_buf *expected)
+{
+	git_buf actual = GIT_BUF_INIT;
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(expected);
+	cl_assert(untracked_cache() == NULL);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", true);
+	backdate_workdir(10);
+	status_to_buf(&actual);
+	cl_assert_equal_s(expected->ptr, actual.ptr);
+
+	assert_filled(untracked_cache());
+
+	status_to_buf(&actual);
+	cl_assert_equal_s(expected->ptr, actual.ptr);
+
+	git_buf_free(&actual);
+}
+
+void test_status_untracked_cache__is_written_with_the_index(void)
+{
+	git_buf expected = GIT_BUF_INIT;
+	git_index *index;
+
+	fill_cache(&expected);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	assert_filled(index->untracked);
+	git_index_free(index);
+
+	/* "keep" holds on to it */
+	cl_repo_set_string(g_repo, "core.untrackedcache", "keep");
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
+	status_to_buf(&expected);
+	assert_filled(untracked_cache());
+
+	git_buf_free(&expected);
+}
+
+void test_status_untracked_cache__is_dropped_when_disabled(void)
+{
+	git_buf expected = GIT_BUF_INIT;
+	git_index *index;
+
+	fill_cache(&expected);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(&expected);
+	cl_assert(untracked_cache() == NULL);
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->untracked == NULL);
+	git_index_free(index);
+
+	git_buf_free(&expected);
+}
+
+void test_status_untracked_cache__notices_new_files(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	fill_cache(&expected);
+
+	cl_git_mkfile("status/subdir/another_file", "hello\n");
+	backdate_workdir(5);
+
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " subdir/another_file\n") != NULL);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(&expected);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_status_untracked_cache__notices_files_leaving_the_index(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+	git_index *index;
+
+	fill_cache(&expected);
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_remove_bypath(index, "subdir/current_file"));
+	cl_git_pass(git_index_write(index));
+
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " subdir/current_file\n") != NULL);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(&expected);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_status_untracked_cache__notices_gitignore_changes(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	fill_cache(&expected);
+
+	/* neither changes the directories themselves */
+	cl_git_rewritefile("status/subdir/.gitignore", "new_file\n");
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " subdir/new_file\n") == NULL);
+	cl_assert(strstr(actual.ptr, " new_file\n") != NULL);
+
+	cl_git_append2file("status/.git/info/exclude", "\nnew_file\n");
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " new_file\n") == NULL);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(&expected);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_status_untracked_cache__is_bypassed_by_internal_rules(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	fill_cache(&expected);
+
+	cl_git_pass(git_ignore_add_rule(g_repo, "new_file\nanother_file\n"));
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " new_file\n") == NULL);
+
+	/* what is seen meanwhile must not be recorded with these rules */
+	cl_git_mkfile("status/subdir/another_file", "hello\n");
+	backdate_workdir(5);
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " subdir/another_file\n") == NULL);
+
+	cl_git_pass(git_ignore_clear_internal_rules(g_repo));
+	status_to_buf(&actual);
+	cl_assert(strstr(actual.ptr, " new_file\n") != NULL);
+	cl_assert(strstr(actual.ptr, " subdir/another_file\n") != NULL);
+
+	cl_repo_set_bool(g_repo, "core.untrackedcache", false);
+	status_to_buf(&expected);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_status_untracked_cache__corrupt_extension_is_ignored(void)
+{
+	git_untracked_cache *uc;
+	git_buf buf = GIT_BUF_INIT;
+	size_t i;
+
+	cl_git_pass(git_untracked_cache_new(&uc));
+	cl_git_pass(git_untracked_cache_validate(uc, g_repo));
+	cl_git_pass(git_untracked_cache_write(&buf, uc));
+	git_untracked_cache_free(uc);
+
+	/* every truncation is rejected rather than misread */
+	for (i = 0; i < buf.size; i++) {
+		cl_git_fail(git_untracked_cache_read(&uc, buf.ptr, i));
+		giterr_clear();
+	}
+
+	cl_git_pass(git_untracked_cache_read(&uc, buf.ptr, buf.size));
+	cl_assert(uc->root != NULL);
+	git_untracked_cache_free(uc);
+
+	git_buf_free(&buf);
+}
@@ -0,0 +1,74 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "delta.h"
+#include "cpu.h"
+
+#include <time.h>
+
+#define BUFFER_SIZE (4 * 1024 * 1024)
+#define ROUNDS 10
+
+static unsigned int features;
+static git_buf base = GIT_BUF_INIT, target = GIT_BUF_INIT;
+
+void test_stress_delta__initialize(void)
+{
+	unsigned int seed = 0;
+	size_t i;
+
+	features = git_cpu__features;
+
+	for (i = 0; i < BUFFER_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		git_buf_putc(&base, "abcdefgh \n"[(seed >> 16) % 10]);
+
+		seed = seed * 1103515245 + 12345;
+		git_buf_putc(&target,
+			((seed >> 16) % 1000) ? base.ptr[i] : 'X');
+	}
+
+	cl_assert(!git_buf_oom(&base) && !git_buf_oom(&target));
+}
+
+void test_stress_delta__cleanup(void)
+{
+	git_cpu__features = features;
+
+	git_buf_free(&base);
+	git_buf_free(&target);
+}
+
+static double time_delta(unsigned int cpu_features, unsigned long *delta_len)
+{
+	clock_t start;
+	void *delta;
+	int i;
+
+	git_cpu__features = cpu_features;
+	start = clock();
+
+	for (i = 0; i < ROUNDS; i++) {
+		cl_assert(delta = git_delta(base.ptr, base.size,
+			target.ptr, target.size, delta_len, 0));
+		git__free(delta);
+	}
+
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void test_stress_delta__kernels(void)
+{
+	unsigned long scalar_len, sse2_len, avx2_len;
+	double scalar, sse2, avx2;
+
+	scalar = time_delta(0, &scalar_len);
+	sse2 = time_delta(features & GIT_CPU_SSE2, &sse2_len);
+	avx2 = time_delta(features, &avx2_len);
+
+	cl_assert_equal_i(scalar_len, sse2_len);
+	cl_assert_equal_i(scalar_len, avx2_len);
+
+	fprintf(stderr, "\ndelta of %d bytes, %d rounds: "
+		"scalar %.3fs, sse2 %.3fs, avx2 %.3fs\n",
+		BUFFER_SIZE, ROUNDS, scalar, sse2, avx2);
+}
@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include <git2/sys/config.h>
+#include <git2/sys/fsmonitor.h>
 #include <git2/sys/odb_backend.h>
 #include <git2/sys/refdb_backend.h>
 
@@ -124,4 +125,9 @@ void test_structinit_structinit__compare(void)
 	CHECK_MACRO_FUNC_INIT_EQUAL( \
 		git_refdb_backend, GIT_REFDB_BACKEND_VERSION, \
 		GIT_REFDB_BACKEND_INIT, git_refdb_init_backend);
+
+	/* fsmonitor */
+	CHECK_MACRO_FUNC_INIT_EQUAL( \
+		git_fsmonitor, GIT_FSMONITOR_VERSION, \
+		GIT_FSMONITOR_INIT, git_fsmonitor_init_backend);
 }
@@ -0,0 +1,113 @@
+#include "clar_libgit2.h"
+#include "thread_helpers.h"
+#include "array.h"
+#include "cache.h"
+
+static git_repository *_repo;
+static git_array_t(git_oid) _oids;
+static ssize_t _initial_storage;
+
+#define LOOKUPS_PER_OBJECT 4
+
+static int collect_oid_cb(const git_oid *id, void *payload)
+{
+	git_oid *oid = git_array_alloc(_oids);
+	GITERR_CHECK_ALLOC(oid);
+
+	GIT_UNUSED(payload);
+
+	git_oid_cpy(oid, id);
+	return 0;
+}
+
+static void open_repo(void)
+{
+	git_odb *odb;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+
+	if (!git_array_size(_oids)) {
+		cl_git_pass(git_repository_odb(&odb, _repo));
+		cl_git_pass(git_odb_foreach(odb, collect_oid_cb, NULL));
+		git_odb_free(odb);
+	}
+}
+
+static void close_repo(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	/* Every object that was cached has been accounted for */
+	cl_assert_equal_i(_initial_storage, git_cache__current_storage.val);
+}
+
+void test_threads_cache__initialize(void)
+{
+	git_array_init(_oids);
+	_initial_storage = git_cache__current_storage.val;
+
+	git_libgit2_opts(
+		GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)32767);
+}
+
+void test_threads_cache__cleanup(void)
+{
+	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, (int)GIT_CACHE_EVICT_CLOCK);
+
+	git_array_clear(_oids);
+}
+
+static void *lookup_objects(void *arg)
+{
+	int id = *(int *)arg;
+	size_t i, n = git_array_size(_oids), round;
+	git_odb *odb;
+	git_odb_object *odb_obj;
+	git_object *obj;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+
+	/* each thread starts somewhere else and mixes raw and parsed reads */
+	for (round = 0; round < LOOKUPS_PER_OBJECT; ++round) {
+		for (i = 0; i < n; ++i) {
+			const git_oid *oid = git_array_get(_oids, (i + id * 7) % n);
+
+			if ((i + round + id) & 1) {
+				cl_git_pass(git_odb_read(&odb_obj, odb, oid));
+				cl_assert(git_oid_equal(oid, git_odb_object_id(odb_obj)));
+				git_odb_object_free(odb_obj);
+			} else {
+				cl_git_pass(git_object_lookup(&obj, _repo, oid, GIT_OBJ_ANY));
+				cl_assert(git_oid_equal(oid, git_object_id(obj)));
+				git_object_free(obj);
+			}
+		}
+	}
+
+	git_odb_free(odb);
+	return arg;
+}
+
+void test_threads_cache__lookups(void)
+{
+	run_in_parallel(2, 16, lookup_objects, open_repo, close_repo);
+}
+
+void test_threads_cache__lookups_while_evicting(void)
+{
+	/* every new object pushes others out */
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)4096);
+
+	run_in_parallel(2, 16, lookup_objects, open_repo, close_repo);
+}
+
+void test_threads_cache__lookups_while_evicting_randomly(void)
+{
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)4096);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_EVICTION, (int)GIT_CACHE_EVICT_RANDOM);
+
+	run_in_parallel(2, 16, lookup_objects, open_repo, close_repo);
+}